@@ -0,0 +1,1036 @@
+// Summarizes allocation traces: lifetimes, size classes, peak live bytes and call sites.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "objects.h"
+#include "sizeclass.h"
+#include "timing.h"
+#include "tracereader.h"
+#include "workpool.h"
+
+// Summarizes allocation traces (see trace.h):
+//
+//   ./build/analyze demo.trace
+//
+// prints how long allocations lived, how requests spread over the size
+// classes, the most live bytes there ever were and which call sites
+// allocate the most.
+//
+// The work is split over every core in three passes, each a batch of
+// tasks on a work-stealing pool:
+//
+//   1. One task per trace block. Decodes it, counts size classes and call
+//      sites, and files every event into a partition by its pointer.
+//   2. One task per partition. Every malloc and free of a given pointer is
+//      now in the same partition, whatever block or thread it came from,
+//      so sorting the partition by pointer and time pairs each free with
+//      its malloc. Each pair becomes a lifetime, plus a +size and a -size
+//      change in live bytes, which get filed into time buckets.
+//   3. One task per time bucket. Sorts its changes by time and works out
+//      its net change and the highest point it reaches, after which the
+//      peak over the whole trace is one quick pass over the buckets.
+//
+// -c also runs a plain single-threaded analysis and checks that both give
+// the same answers.
+
+#define LIFETIME_BUCKETS 64
+#define SIZE_CLASSES (SIZE_CLASS_COUNT + 1)
+#define DEFAULT_TOP_SITES 10
+
+// The top bit of an event's size marks it as a free.
+#define EVENT_FREE ((uint64_t) 1 << 63)
+
+// Events with the same timestamp go in the order they were recorded:
+// Sequence is the block number in the top half and the position in the
+// block in the bottom half.
+struct Event
+{
+    uint64_t Ptr;
+    uint64_t Timestamp;
+    uint64_t Sequence;
+    uint64_t Size;
+};
+
+// A change in live bytes.
+struct Delta
+{
+    uint64_t Timestamp;
+    uint64_t Sequence;
+    int64_t Bytes;
+};
+
+struct EventBuffer
+{
+    struct Event* Events;
+    size_t Count;
+    size_t Capacity;
+};
+
+struct SiteStats
+{
+    uint64_t CallSite;
+    uint64_t Count;
+    uint64_t Bytes;
+};
+
+// Call site -> stats, with linear probing. Call site 0 marks an empty
+// slot; a real call site is never 0.
+struct SiteMap
+{
+    struct SiteStats* Slots;
+    size_t Capacity;
+    size_t Count;
+};
+
+struct ClassStats
+{
+    uint64_t Count;
+    uint64_t Bytes;
+};
+
+// Everything the analysis comes up with, in a form both the parallel and
+// the single-threaded analysis fill in, so they can be compared.
+struct Analysis
+{
+    uint64_t Mallocs;
+    uint64_t Frees;
+    uint64_t Pairs;
+    uint64_t UnmatchedFrees;
+    uint64_t LiveAtEnd;
+    uint64_t LiveBytesAtEnd;
+    uint64_t PeakLiveBytes;
+    uint64_t PeakTimestamp;
+    uint64_t FirstTimestamp;
+    uint64_t LastTimestamp;
+    uint64_t Lifetimes[LIFETIME_BUCKETS];
+    struct ClassStats Classes[SIZE_CLASSES];
+    struct SiteMap Sites;
+};
+
+// Per-worker state for the first pass.
+struct WorkerState
+{
+    struct TraceRecord* Records;
+    struct EventBuffer* Partitions;
+    struct Analysis Totals;
+};
+
+// Per-partition results of the second pass.
+struct PartitionState
+{
+    struct Delta* Deltas;
+    size_t DeltaCount;
+    size_t* BucketCounts;
+    uint64_t Pairs;
+    uint64_t UnmatchedFrees;
+    uint64_t LiveAtEnd;
+    uint64_t LiveBytesAtEnd;
+    uint64_t Lifetimes[LIFETIME_BUCKETS];
+};
+
+// Per-bucket results of the third pass.
+struct BucketState
+{
+    int64_t Net;
+    int64_t HighPoint;
+    uint64_t HighTimestamp;
+};
+
+struct ParallelAnalysis
+{
+    struct TraceReader* Reader;
+    size_t Workers;
+    struct WorkerState* WorkerStates;
+
+    size_t PartitionCount;
+    struct PartitionState* PartitionStates;
+
+    // Deltas sorted into time buckets: bucket b's are at
+    // Deltas[BucketStarts[b]] up to Deltas[BucketStarts[b + 1]].
+    size_t BucketCount;
+    uint64_t FirstTimestamp;
+    uint64_t Span;
+    struct Delta* Deltas;
+    size_t* BucketStarts;
+    // Where each partition writes into each bucket, indexed
+    // [bucket * PartitionCount + partition].
+    size_t* BucketCursors;
+    struct BucketState* BucketStates;
+};
+
+static void* Allocate(size_t size)
+{
+    void* p = calloc(1, size > 0 ? size : 1);
+    if (p == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+    return p;
+}
+
+static void* Reallocate(void* p, size_t size)
+{
+    p = realloc(p, size > 0 ? size : 1);
+    if (p == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+    return p;
+}
+
+static void PushEvent(struct EventBuffer* buffer, const struct Event* event)
+{
+    if (buffer->Count == buffer->Capacity)
+    {
+        buffer->Capacity = buffer->Capacity > 0 ? buffer->Capacity * 2 : 256;
+        buffer->Events = (struct Event*) Reallocate(buffer->Events, buffer->Capacity * sizeof(struct Event));
+    }
+    buffer->Events[buffer->Count++] = *event;
+}
+
+static size_t Hash(uint64_t key)
+{
+    return (size_t) ((key * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+static void SiteMapInit(struct SiteMap* map)
+{
+    map->Capacity = 256;
+    map->Count = 0;
+    map->Slots = (struct SiteStats*) Allocate(map->Capacity * sizeof(struct SiteStats));
+}
+
+static void SiteMapAdd(struct SiteMap* map, uint64_t callSite, uint64_t count, uint64_t bytes)
+{
+    if ((map->Count + 1) * 2 > map->Capacity)
+    {
+        struct SiteMap old = *map;
+        map->Capacity *= 2;
+        map->Count = 0;
+        map->Slots = (struct SiteStats*) Allocate(map->Capacity * sizeof(struct SiteStats));
+        for (size_t i = 0; i < old.Capacity; i++)
+        {
+            if (old.Slots[i].CallSite != 0)
+            {
+                SiteMapAdd(map, old.Slots[i].CallSite, old.Slots[i].Count, old.Slots[i].Bytes);
+            }
+        }
+        free(old.Slots);
+    }
+
+    size_t i = Hash(callSite) & (map->Capacity - 1);
+    while (map->Slots[i].CallSite != 0 && map->Slots[i].CallSite != callSite)
+    {
+        i = (i + 1) & (map->Capacity - 1);
+    }
+
+    if (map->Slots[i].CallSite == 0)
+    {
+        map->Slots[i].CallSite = callSite;
+        map->Count++;
+    }
+    map->Slots[i].Count += count;
+    map->Slots[i].Bytes += bytes;
+}
+
+static void SiteMapMerge(struct SiteMap* into, const struct SiteMap* from)
+{
+    for (size_t i = 0; i < from->Capacity; i++)
+    {
+        if (from->Slots[i].CallSite != 0)
+        {
+            SiteMapAdd(into, from->Slots[i].CallSite, from->Slots[i].Count, from->Slots[i].Bytes);
+        }
+    }
+}
+
+static size_t LifetimeBucket(uint64_t lifetimeNs)
+{
+    return lifetimeNs == 0 ? 0 : (size_t) (64 - __builtin_clzll(lifetimeNs));
+}
+
+// What happens to a malloc, whichever way the analysis does it.
+static void CountMalloc(struct Analysis* analysis, const struct TraceRecord* record)
+{
+    analysis->Mallocs++;
+    struct ClassStats* sizeClass = &analysis->Classes[SizeClassIndex(record->Size)];
+    sizeClass->Count++;
+    sizeClass->Bytes += record->Size;
+    // Call site 0 would mean an empty slot in the map.
+    SiteMapAdd(&analysis->Sites, record->CallSite != 0 ? record->CallSite : 1, 1, record->Size);
+}
+
+static void UpdateTimeRange(struct Analysis* analysis, uint64_t timestamp)
+{
+    analysis->FirstTimestamp = timestamp < analysis->FirstTimestamp ? timestamp : analysis->FirstTimestamp;
+    analysis->LastTimestamp = timestamp > analysis->LastTimestamp ? timestamp : analysis->LastTimestamp;
+}
+
+static int CompareEvents(const void* a, const void* b)
+{
+    const struct Event* x = (const struct Event*) a;
+    const struct Event* y = (const struct Event*) b;
+    if (x->Ptr != y->Ptr)
+    {
+        return (x->Ptr > y->Ptr) - (x->Ptr < y->Ptr);
+    }
+    if (x->Timestamp != y->Timestamp)
+    {
+        return (x->Timestamp > y->Timestamp) - (x->Timestamp < y->Timestamp);
+    }
+    return (x->Sequence > y->Sequence) - (x->Sequence < y->Sequence);
+}
+
+static int CompareDeltas(const void* a, const void* b)
+{
+    const struct Delta* x = (const struct Delta*) a;
+    const struct Delta* y = (const struct Delta*) b;
+    if (x->Timestamp != y->Timestamp)
+    {
+        return (x->Timestamp > y->Timestamp) - (x->Timestamp < y->Timestamp);
+    }
+    return (x->Sequence > y->Sequence) - (x->Sequence < y->Sequence);
+}
+
+// Pass 1: one trace block.
+static void DecodeBlockTask(void* context, size_t index, size_t worker)
+{
+    struct ParallelAnalysis* parallel = (struct ParallelAnalysis*) context;
+    struct WorkerState* state = &parallel->WorkerStates[worker];
+
+    const size_t count = TraceReaderDecodeBlock(parallel->Reader, index, state->Records);
+    for (size_t i = 0; i < count; i++)
+    {
+        const struct TraceRecord* record = &state->Records[i];
+        UpdateTimeRange(&state->Totals, record->Timestamp);
+
+        struct Event event = {
+            .Ptr = record->Ptr,
+            .Timestamp = record->Timestamp,
+            .Sequence = ((uint64_t) index << 32) | i,
+            .Size = record->Size,
+        };
+        if (record->Op == TRACE_MALLOC)
+        {
+            CountMalloc(&state->Totals, record);
+        }
+        else
+        {
+            state->Totals.Frees++;
+            event.Size = EVENT_FREE;
+        }
+
+        // PartitionCount is a power of two.
+        const size_t partition = Hash(record->Ptr) & (parallel->PartitionCount - 1);
+        PushEvent(&state->Partitions[partition], &event);
+    }
+}
+
+static void PushDelta(struct PartitionState* state, size_t* capacity, const struct Event* event, int64_t bytes)
+{
+    if (state->DeltaCount == *capacity)
+    {
+        *capacity = *capacity > 0 ? *capacity * 2 : 256;
+        state->Deltas = (struct Delta*) Reallocate(state->Deltas, *capacity * sizeof(struct Delta));
+    }
+    state->Deltas[state->DeltaCount].Timestamp = event->Timestamp;
+    state->Deltas[state->DeltaCount].Sequence = event->Sequence;
+    state->Deltas[state->DeltaCount].Bytes = bytes;
+    state->DeltaCount++;
+}
+
+static size_t TimeBucket(const struct ParallelAnalysis* parallel, uint64_t timestamp)
+{
+    const unsigned __int128 offset = timestamp - parallel->FirstTimestamp;
+    return (size_t) (offset * parallel->BucketCount / ((unsigned __int128) parallel->Span + 1));
+}
+
+// Pass 2: pair up the mallocs and frees of one partition.
+static void PairPartitionTask(void* context, size_t index, size_t worker)
+{
+    (void) worker;
+    struct ParallelAnalysis* parallel = (struct ParallelAnalysis*) context;
+    struct PartitionState* state = &parallel->PartitionStates[index];
+
+    size_t total = 0;
+    for (size_t w = 0; w < parallel->Workers; w++)
+    {
+        total += parallel->WorkerStates[w].Partitions[index].Count;
+    }
+
+    struct Event* events = (struct Event*) Allocate(total * sizeof(struct Event));
+    size_t offset = 0;
+    for (size_t w = 0; w < parallel->Workers; w++)
+    {
+        struct EventBuffer* buffer = &parallel->WorkerStates[w].Partitions[index];
+        memcpy(events + offset, buffer->Events, buffer->Count * sizeof(struct Event));
+        offset += buffer->Count;
+        free(buffer->Events);
+        memset(buffer, 0, sizeof(*buffer));
+    }
+    qsort(events, total, sizeof(struct Event), CompareEvents);
+
+    size_t capacity = 0;
+    for (size_t i = 0; i < total;)
+    {
+        // Walk one pointer's history. A malloc with no free before the
+        // next malloc of the same pointer lost its free somehow; like one
+        // that's never freed, it counts as live to the end.
+        const uint64_t ptr = events[i].Ptr;
+        const struct Event* pending = NULL;
+        for (; i < total && events[i].Ptr == ptr; i++)
+        {
+            const struct Event* event = &events[i];
+            if (!(event->Size & EVENT_FREE))
+            {
+                if (pending != NULL)
+                {
+                    state->LiveAtEnd++;
+                    state->LiveBytesAtEnd += pending->Size;
+                    PushDelta(state, &capacity, pending, (int64_t) pending->Size);
+                }
+                pending = event;
+            }
+            else if (pending != NULL)
+            {
+                state->Pairs++;
+                state->Lifetimes[LifetimeBucket(event->Timestamp - pending->Timestamp)]++;
+                PushDelta(state, &capacity, pending, (int64_t) pending->Size);
+                PushDelta(state, &capacity, event, -(int64_t) pending->Size);
+                pending = NULL;
+            }
+            else
+            {
+                state->UnmatchedFrees++;
+            }
+        }
+
+        if (pending != NULL)
+        {
+            state->LiveAtEnd++;
+            state->LiveBytesAtEnd += pending->Size;
+            PushDelta(state, &capacity, pending, (int64_t) pending->Size);
+        }
+    }
+    free(events);
+
+    state->BucketCounts = (size_t*) Allocate(parallel->BucketCount * sizeof(size_t));
+    for (size_t i = 0; i < state->DeltaCount; i++)
+    {
+        state->BucketCounts[TimeBucket(parallel, state->Deltas[i].Timestamp)]++;
+    }
+}
+
+// Between passes 2 and 3: copy one partition's deltas into the buckets.
+static void ScatterDeltasTask(void* context, size_t index, size_t worker)
+{
+    (void) worker;
+    struct ParallelAnalysis* parallel = (struct ParallelAnalysis*) context;
+    struct PartitionState* state = &parallel->PartitionStates[index];
+
+    for (size_t i = 0; i < state->DeltaCount; i++)
+    {
+        const size_t bucket = TimeBucket(parallel, state->Deltas[i].Timestamp);
+        size_t* cursor = &parallel->BucketCursors[bucket * parallel->PartitionCount + index];
+        parallel->Deltas[(*cursor)++] = state->Deltas[i];
+    }
+
+    free(state->Deltas);
+    state->Deltas = NULL;
+}
+
+// Pass 3: the high point of live bytes within one time bucket.
+static void BucketPeakTask(void* context, size_t index, size_t worker)
+{
+    (void) worker;
+    struct ParallelAnalysis* parallel = (struct ParallelAnalysis*) context;
+    struct BucketState* state = &parallel->BucketStates[index];
+
+    struct Delta* deltas = parallel->Deltas + parallel->BucketStarts[index];
+    const size_t count = parallel->BucketStarts[index + 1] - parallel->BucketStarts[index];
+    qsort(deltas, count, sizeof(struct Delta), CompareDeltas);
+
+    int64_t live = 0;
+    state->HighPoint = 0;
+    state->HighTimestamp = count > 0 ? deltas[0].Timestamp : 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        live += deltas[i].Bytes;
+        if (live > state->HighPoint)
+        {
+            state->HighPoint = live;
+            state->HighTimestamp = deltas[i].Timestamp;
+        }
+    }
+    state->Net = live;
+}
+
+static void InitAnalysis(struct Analysis* analysis)
+{
+    memset(analysis, 0, sizeof(*analysis));
+    analysis->FirstTimestamp = UINT64_MAX;
+    SiteMapInit(&analysis->Sites);
+}
+
+static void AnalyzeParallel(struct TraceReader* reader, struct WorkPool* pool, struct Analysis* result)
+{
+    struct ParallelAnalysis parallel;
+    memset(&parallel, 0, sizeof(parallel));
+    parallel.Reader = reader;
+    parallel.Workers = WorkPoolWorkers(pool);
+
+    // Enough partitions and buckets that stealing has something to even
+    // out, but not so many that they're all tiny.
+    parallel.PartitionCount = 16;
+    while (parallel.PartitionCount < parallel.Workers * 8)
+    {
+        parallel.PartitionCount *= 2;
+    }
+
+    parallel.WorkerStates = (struct WorkerState*) Allocate(parallel.Workers * sizeof(struct WorkerState));
+    for (size_t w = 0; w < parallel.Workers; w++)
+    {
+        struct WorkerState* state = &parallel.WorkerStates[w];
+        state->Records = (struct TraceRecord*) Allocate(TRACE_BLOCK_EVENTS * sizeof(struct TraceRecord));
+        state->Partitions = (struct EventBuffer*) Allocate(parallel.PartitionCount * sizeof(struct EventBuffer));
+        InitAnalysis(&state->Totals);
+    }
+
+    WorkPoolRun(pool, reader->BlockCount, DecodeBlockTask, &parallel);
+
+    InitAnalysis(result);
+    for (size_t w = 0; w < parallel.Workers; w++)
+    {
+        const struct Analysis* totals = &parallel.WorkerStates[w].Totals;
+        result->Mallocs += totals->Mallocs;
+        result->Frees += totals->Frees;
+        result->FirstTimestamp = totals->FirstTimestamp < result->FirstTimestamp ? totals->FirstTimestamp
+                                                                                 : result->FirstTimestamp;
+        result->LastTimestamp = totals->LastTimestamp > result->LastTimestamp ? totals->LastTimestamp
+                                                                              : result->LastTimestamp;
+        for (size_t c = 0; c < SIZE_CLASSES; c++)
+        {
+            result->Classes[c].Count += totals->Classes[c].Count;
+            result->Classes[c].Bytes += totals->Classes[c].Bytes;
+        }
+        SiteMapMerge(&result->Sites, &totals->Sites);
+        free(totals->Sites.Slots);
+        free(parallel.WorkerStates[w].Records);
+    }
+
+    if (result->Mallocs + result->Frees == 0)
+    {
+        for (size_t w = 0; w < parallel.Workers; w++)
+        {
+            free(parallel.WorkerStates[w].Partitions);
+        }
+        free(parallel.WorkerStates);
+        result->FirstTimestamp = 0;
+        return;
+    }
+
+    parallel.FirstTimestamp = result->FirstTimestamp;
+    parallel.Span = result->LastTimestamp - result->FirstTimestamp;
+    parallel.BucketCount = parallel.PartitionCount * 4;
+    parallel.PartitionStates = (struct PartitionState*) Allocate(parallel.PartitionCount * sizeof(struct PartitionState));
+
+    WorkPoolRun(pool, parallel.PartitionCount, PairPartitionTask, &parallel);
+
+    // Lay the buckets out one after another, and within each bucket give
+    // every partition its own stretch, so the scatter needs no locking.
+    parallel.BucketStarts = (size_t*) Allocate((parallel.BucketCount + 1) * sizeof(size_t));
+    parallel.BucketCursors = (size_t*) Allocate(parallel.BucketCount * parallel.PartitionCount * sizeof(size_t));
+    size_t offset = 0;
+    for (size_t b = 0; b < parallel.BucketCount; b++)
+    {
+        parallel.BucketStarts[b] = offset;
+        for (size_t p = 0; p < parallel.PartitionCount; p++)
+        {
+            parallel.BucketCursors[b * parallel.PartitionCount + p] = offset;
+            offset += parallel.PartitionStates[p].BucketCounts[b];
+        }
+    }
+    parallel.BucketStarts[parallel.BucketCount] = offset;
+    parallel.Deltas = (struct Delta*) Allocate(offset * sizeof(struct Delta));
+
+    WorkPoolRun(pool, parallel.PartitionCount, ScatterDeltasTask, &parallel);
+
+    parallel.BucketStates = (struct BucketState*) Allocate(parallel.BucketCount * sizeof(struct BucketState));
+    WorkPoolRun(pool, parallel.BucketCount, BucketPeakTask, &parallel);
+
+    int64_t live = 0;
+    for (size_t b = 0; b < parallel.BucketCount; b++)
+    {
+        const struct BucketState* bucket = &parallel.BucketStates[b];
+        if (live + bucket->HighPoint > (int64_t) result->PeakLiveBytes)
+        {
+            result->PeakLiveBytes = (uint64_t) (live + bucket->HighPoint);
+            result->PeakTimestamp = bucket->HighTimestamp;
+        }
+        live += bucket->Net;
+    }
+
+    for (size_t p = 0; p < parallel.PartitionCount; p++)
+    {
+        const struct PartitionState* state = &parallel.PartitionStates[p];
+        result->Pairs += state->Pairs;
+        result->UnmatchedFrees += state->UnmatchedFrees;
+        result->LiveAtEnd += state->LiveAtEnd;
+        result->LiveBytesAtEnd += state->LiveBytesAtEnd;
+        for (size_t l = 0; l < LIFETIME_BUCKETS; l++)
+        {
+            result->Lifetimes[l] += state->Lifetimes[l];
+        }
+        free(state->BucketCounts);
+    }
+
+    for (size_t w = 0; w < parallel.Workers; w++)
+    {
+        free(parallel.WorkerStates[w].Partitions);
+    }
+    free(parallel.WorkerStates);
+    free(parallel.PartitionStates);
+    free(parallel.BucketStarts);
+    free(parallel.BucketCursors);
+    free(parallel.Deltas);
+    free(parallel.BucketStates);
+}
+
+// The single-threaded analysis -c checks against: put every record in
+// time order and walk through them once, the obvious way.
+struct TimedRecord
+{
+    uint64_t Timestamp;
+    size_t Index;
+};
+
+static int CompareTimedRecords(const void* a, const void* b)
+{
+    const struct TimedRecord* x = (const struct TimedRecord*) a;
+    const struct TimedRecord* y = (const struct TimedRecord*) b;
+    if (x->Timestamp != y->Timestamp)
+    {
+        return (x->Timestamp > y->Timestamp) - (x->Timestamp < y->Timestamp);
+    }
+    return (x->Index > y->Index) - (x->Index < y->Index);
+}
+
+struct LiveBlock
+{
+    uint64_t Ptr;
+    uint64_t Timestamp;
+    uint64_t Size;
+};
+
+static void AnalyzeSequential(struct TraceReader* reader, struct Analysis* result)
+{
+    InitAnalysis(result);
+
+    struct TraceRecord* records = (struct TraceRecord*) Allocate((reader->Count + 1) * sizeof(struct TraceRecord));
+    size_t count = 0;
+    for (size_t b = 0; b < reader->BlockCount; b++)
+    {
+        count += TraceReaderDecodeBlock(reader, b, records + count);
+    }
+
+    struct TimedRecord* order = (struct TimedRecord*) Allocate((count + 1) * sizeof(struct TimedRecord));
+    for (size_t i = 0; i < count; i++)
+    {
+        order[i].Timestamp = records[i].Timestamp;
+        order[i].Index = i;
+    }
+    qsort(order, count, sizeof(struct TimedRecord), CompareTimedRecords);
+
+    // Live blocks by pointer, with linear probing and backward-shift
+    // deletion. Pointer 0 marks an empty slot.
+    size_t capacity = 1024;
+    while (capacity < count)
+    {
+        capacity *= 2;
+    }
+    struct LiveBlock* live = (struct LiveBlock*) Allocate(capacity * sizeof(struct LiveBlock));
+    const size_t mask = capacity - 1;
+
+    uint64_t liveBytes = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const struct TraceRecord* record = &records[order[i].Index];
+        UpdateTimeRange(result, record->Timestamp);
+
+        size_t slot = Hash(record->Ptr) & mask;
+        while (live[slot].Ptr != 0 && live[slot].Ptr != record->Ptr)
+        {
+            slot = (slot + 1) & mask;
+        }
+
+        if (record->Op == TRACE_MALLOC)
+        {
+            CountMalloc(result, record);
+            if (live[slot].Ptr != 0)
+            {
+                // Lost its free; it stays live to the end, and its bytes
+                // are never taken back off liveBytes.
+                result->LiveAtEnd++;
+                result->LiveBytesAtEnd += live[slot].Size;
+            }
+            live[slot].Ptr = record->Ptr;
+            live[slot].Timestamp = record->Timestamp;
+            live[slot].Size = record->Size;
+
+            liveBytes += record->Size;
+            if (liveBytes > result->PeakLiveBytes)
+            {
+                result->PeakLiveBytes = liveBytes;
+                result->PeakTimestamp = record->Timestamp;
+            }
+            continue;
+        }
+
+        result->Frees++;
+        if (live[slot].Ptr == 0)
+        {
+            result->UnmatchedFrees++;
+            continue;
+        }
+
+        result->Pairs++;
+        result->Lifetimes[LifetimeBucket(record->Timestamp - live[slot].Timestamp)]++;
+        liveBytes -= live[slot].Size;
+
+        size_t hole = slot;
+        for (size_t j = (hole + 1) & mask; live[j].Ptr != 0; j = (j + 1) & mask)
+        {
+            const size_t home = Hash(live[j].Ptr) & mask;
+            if (((j - home) & mask) >= ((j - hole) & mask))
+            {
+                live[hole] = live[j];
+                hole = j;
+            }
+        }
+        live[hole].Ptr = 0;
+    }
+
+    for (size_t i = 0; i < capacity; i++)
+    {
+        if (live[i].Ptr != 0)
+        {
+            result->LiveAtEnd++;
+            result->LiveBytesAtEnd += live[i].Size;
+        }
+    }
+
+    if (count == 0)
+    {
+        result->FirstTimestamp = 0;
+    }
+
+    free(live);
+    free(order);
+    free(records);
+}
+
+static int CheckField(const char* name, uint64_t parallel, uint64_t sequential)
+{
+    if (parallel == sequential)
+    {
+        return 0;
+    }
+    printf("  mismatch in %s: %llu in parallel, %llu single-threaded\n", name,
+           (unsigned long long) parallel, (unsigned long long) sequential);
+    return 1;
+}
+
+static int CompareAnalyses(const struct Analysis* parallel, const struct Analysis* sequential)
+{
+    int mismatches = 0;
+    mismatches += CheckField("mallocs", parallel->Mallocs, sequential->Mallocs);
+    mismatches += CheckField("frees", parallel->Frees, sequential->Frees);
+    mismatches += CheckField("pairs", parallel->Pairs, sequential->Pairs);
+    mismatches += CheckField("unmatched frees", parallel->UnmatchedFrees, sequential->UnmatchedFrees);
+    mismatches += CheckField("live at end", parallel->LiveAtEnd, sequential->LiveAtEnd);
+    mismatches += CheckField("live bytes at end", parallel->LiveBytesAtEnd, sequential->LiveBytesAtEnd);
+    mismatches += CheckField("peak live bytes", parallel->PeakLiveBytes, sequential->PeakLiveBytes);
+    mismatches += CheckField("first timestamp", parallel->FirstTimestamp, sequential->FirstTimestamp);
+    mismatches += CheckField("last timestamp", parallel->LastTimestamp, sequential->LastTimestamp);
+
+    for (size_t l = 0; l < LIFETIME_BUCKETS; l++)
+    {
+        mismatches += CheckField("lifetime histogram", parallel->Lifetimes[l], sequential->Lifetimes[l]);
+    }
+    for (size_t c = 0; c < SIZE_CLASSES; c++)
+    {
+        mismatches += CheckField("size class counts", parallel->Classes[c].Count, sequential->Classes[c].Count);
+        mismatches += CheckField("size class bytes", parallel->Classes[c].Bytes, sequential->Classes[c].Bytes);
+    }
+
+    mismatches += CheckField("call sites", parallel->Sites.Count, sequential->Sites.Count);
+    for (size_t i = 0; i < parallel->Sites.Capacity; i++)
+    {
+        const struct SiteStats* site = &parallel->Sites.Slots[i];
+        if (site->CallSite == 0)
+        {
+            continue;
+        }
+
+        size_t j = Hash(site->CallSite) & (sequential->Sites.Capacity - 1);
+        while (sequential->Sites.Slots[j].CallSite != 0 && sequential->Sites.Slots[j].CallSite != site->CallSite)
+        {
+            j = (j + 1) & (sequential->Sites.Capacity - 1);
+        }
+        mismatches += CheckField("call site counts", site->Count, sequential->Sites.Slots[j].Count);
+        mismatches += CheckField("call site bytes", site->Bytes, sequential->Sites.Slots[j].Bytes);
+    }
+
+    return mismatches;
+}
+
+static void FormatDuration(char* buffer, size_t size, uint64_t ns)
+{
+    if (ns < 1000)
+    {
+        snprintf(buffer, size, "%llu ns", (unsigned long long) ns);
+    }
+    else if (ns < 1000000)
+    {
+        snprintf(buffer, size, "%.1f us", (double) ns / 1e3);
+    }
+    else if (ns < 1000000000)
+    {
+        snprintf(buffer, size, "%.1f ms", (double) ns / 1e6);
+    }
+    else
+    {
+        snprintf(buffer, size, "%.1f s", (double) ns / 1e9);
+    }
+}
+
+static int CompareSites(const void* a, const void* b)
+{
+    const struct SiteStats* x = (const struct SiteStats*) a;
+    const struct SiteStats* y = (const struct SiteStats*) b;
+    if (x->Bytes != y->Bytes)
+    {
+        return (x->Bytes < y->Bytes) - (x->Bytes > y->Bytes);
+    }
+    return (x->Count < y->Count) - (x->Count > y->Count);
+}
+
+static void PrintAnalysis(const struct Analysis* analysis, size_t topSites)
+{
+    char when[32];
+    FormatDuration(when, sizeof(when), analysis->LastTimestamp - analysis->FirstTimestamp);
+    printf("  %llu mallocs and %llu frees over %s\n", (unsigned long long) analysis->Mallocs,
+           (unsigned long long) analysis->Frees, when);
+
+    FormatDuration(when, sizeof(when), analysis->PeakTimestamp - analysis->FirstTimestamp);
+    printf("  peak live: %llu bytes (%.2f MiB), %s in\n", (unsigned long long) analysis->PeakLiveBytes,
+           (double) analysis->PeakLiveBytes / (1024.0 * 1024.0), when);
+    printf("  still live at the end: %llu blocks, %llu bytes\n", (unsigned long long) analysis->LiveAtEnd,
+           (unsigned long long) analysis->LiveBytesAtEnd);
+    if (analysis->UnmatchedFrees > 0)
+    {
+        printf("  frees of memory allocated before the trace started: %llu\n",
+               (unsigned long long) analysis->UnmatchedFrees);
+    }
+
+    printf("\n  Lifetimes of freed blocks:\n");
+    uint64_t mostPairs = 0;
+    for (size_t l = 0; l < LIFETIME_BUCKETS; l++)
+    {
+        mostPairs = analysis->Lifetimes[l] > mostPairs ? analysis->Lifetimes[l] : mostPairs;
+    }
+    for (size_t l = 0; l < LIFETIME_BUCKETS; l++)
+    {
+        if (analysis->Lifetimes[l] == 0)
+        {
+            continue;
+        }
+
+        // Bucket l holds lifetimes in [2^(l-1), 2^l).
+        char upTo[32];
+        FormatDuration(upTo, sizeof(upTo), l == 0 ? 1 : (l >= 63 ? UINT64_MAX : (uint64_t) 1 << l));
+        const int bar = (int) (40 * analysis->Lifetimes[l] / mostPairs);
+        printf("    < %-10s %12llu %6.2f%% %.*s\n", upTo, (unsigned long long) analysis->Lifetimes[l],
+               100.0 * (double) analysis->Lifetimes[l] / (double) analysis->Pairs, bar,
+               "########################################");
+    }
+
+    printf("\n  Size classes:\n");
+    printf("    %-8s %12s %8s %14s\n", "class", "mallocs", "", "bytes");
+    for (size_t c = 0; c < SIZE_CLASSES; c++)
+    {
+        const struct ClassStats* sizeClass = &analysis->Classes[c];
+        if (sizeClass->Count == 0)
+        {
+            continue;
+        }
+
+        char name[16];
+        if (c == SIZE_CLASS_LARGE)
+        {
+            snprintf(name, sizeof(name), ">%d", SIZE_CLASS_MAX);
+        }
+        else
+        {
+            snprintf(name, sizeof(name), "%zu", SizeClassSize(c));
+        }
+        printf("    %-8s %12llu %7.2f%% %14llu\n", name, (unsigned long long) sizeClass->Count,
+               100.0 * (double) sizeClass->Count / (double) analysis->Mallocs,
+               (unsigned long long) sizeClass->Bytes);
+    }
+
+    struct SiteStats* sites = (struct SiteStats*) Allocate(analysis->Sites.Count * sizeof(struct SiteStats));
+    size_t siteCount = 0;
+    for (size_t i = 0; i < analysis->Sites.Capacity; i++)
+    {
+        if (analysis->Sites.Slots[i].CallSite != 0)
+        {
+            sites[siteCount++] = analysis->Sites.Slots[i];
+        }
+    }
+    qsort(sites, siteCount, sizeof(struct SiteStats), CompareSites);
+
+    printf("\n  Top allocation sites by bytes (of %zu):\n", siteCount);
+    printf("    %-18s %12s %16s %12s\n", "call site", "mallocs", "bytes", "average");
+    for (size_t i = 0; i < siteCount && i < topSites; i++)
+    {
+        printf("    0x%016llx %12llu %16llu %12.1f\n", (unsigned long long) sites[i].CallSite,
+               (unsigned long long) sites[i].Count, (unsigned long long) sites[i].Bytes,
+               (double) sites[i].Bytes / (double) sites[i].Count);
+    }
+    free(sites);
+}
+
+static void PrintUsage(FILE* stream, const char* program)
+{
+    fprintf(stream, "Usage: %s [-j threads] [-s sites] [-c] trace...\n"
+                    "  -j threads  analyze on this many threads (default one per core)\n"
+                    "  -s sites    how many allocation sites to list (default %d)\n"
+                    "  -c          check the results against a single-threaded analysis\n",
+            program, DEFAULT_TOP_SITES);
+}
+
+int main(int argc, char** argv)
+{
+    size_t threads = 0;
+    size_t topSites = DEFAULT_TOP_SITES;
+    int check = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:s:c")) != -1)
+    {
+        switch (opt)
+        {
+            case 'j':
+                threads = strtoul(optarg, NULL, 10);
+                if (threads == 0)
+                {
+                    fprintf(stderr, "Threads must be a positive number.\n");
+                    return 1;
+                }
+                break;
+            case 's':
+                topSites = strtoul(optarg, NULL, 10);
+                break;
+            case 'c':
+                check = 1;
+                break;
+            default:
+                PrintUsage(stderr, argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind == argc)
+    {
+        PrintUsage(stderr, argv[0]);
+        return 1;
+    }
+
+    struct WorkPool* pool = WorkPoolCreate(threads);
+    if (pool == NULL)
+    {
+        fprintf(stderr, "Couldn't start the worker threads.\n");
+        return 1;
+    }
+
+    int status = 0;
+    for (int arg = optind; arg < argc; arg++)
+    {
+        struct TraceReader reader;
+        if (TraceReaderOpen(&reader, argv[arg]) != 0)
+        {
+            if (errno == EINVAL)
+            {
+                fprintf(stderr, "%s isn't an allocation trace.\n", argv[arg]);
+            }
+            else
+            {
+                fprintf(stderr, "Couldn't open %s: %s\n", argv[arg], strerror(errno));
+            }
+            status = 1;
+            continue;
+        }
+
+        struct Analysis analysis;
+        const uint64_t start = NowNs();
+        AnalyzeParallel(&reader, pool, &analysis);
+        const uint64_t elapsed = NowNs() - start;
+
+        printf("%s: %zu events in %zu blocks, analyzed in %.1f ms on %zu thread%s\n", argv[arg], reader.Count,
+               reader.BlockCount, (double) elapsed / 1e6, WorkPoolWorkers(pool),
+               WorkPoolWorkers(pool) == 1 ? "" : "s");
+        PrintAnalysis(&analysis, topSites);
+
+        if (check)
+        {
+            struct Analysis sequential;
+            const uint64_t sequentialStart = NowNs();
+            AnalyzeSequential(&reader, &sequential);
+            const uint64_t sequentialElapsed = NowNs() - sequentialStart;
+
+            printf("\n  Checking against a single-threaded analysis (%.1f ms):\n",
+                   (double) sequentialElapsed / 1e6);
+            if (CompareAnalyses(&analysis, &sequential) == 0)
+            {
+                printf("  everything matches\n");
+            }
+            else
+            {
+                status = 1;
+            }
+            free(sequential.Sites.Slots);
+        }
+
+        printf("\n");
+        free(analysis.Sites.Slots);
+        TraceReaderClose(&reader);
+    }
+
+    WorkPoolDestroy(pool);
+    return status;
+}
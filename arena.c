@@ -0,0 +1,113 @@
+// A bump-pointer arena (region) allocator.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "arena.h"
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Big enough that the demos and benchmarks never run out, and since the
+// mapping is MAP_NORESERVE we only pay for the pages we actually touch.
+#define ARENA_ENGINE_CAPACITY ((size_t) 1 << 30)
+
+int ArenaInit(struct Arena* arena, size_t capacity)
+{
+    const size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    capacity = (capacity + pageSize - 1) & ~(pageSize - 1);
+
+    void* base = mmap(NULL, capacity, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    arena->Base = (char*) base;
+    arena->Capacity = capacity;
+    arena->Offset = 0;
+    return 0;
+}
+
+void* ArenaAlloc(struct Arena* arena, size_t size)
+{
+    // Round up so the *next* allocation starts aligned. The base is page
+    // aligned, so keeping the offset aligned is all we need.
+    const size_t rounded = (size + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+
+    // Checking against what's left (rather than Offset + rounded) means
+    // a huge size can't wrap around and sneak past the check.
+    if (rounded < size || rounded > arena->Capacity - arena->Offset)
+    {
+        return NULL;
+    }
+
+    char* p = arena->Base + arena->Offset;
+    arena->Offset += rounded;
+    return p;
+}
+
+void ArenaReset(struct Arena* arena)
+{
+    arena->Offset = 0;
+}
+
+void ArenaDestroy(struct Arena* arena)
+{
+    if (arena->Base != NULL)
+    {
+        munmap(arena->Base, arena->Capacity);
+    }
+
+    arena->Base = NULL;
+    arena->Capacity = 0;
+    arena->Offset = 0;
+}
+
+static struct Arena engineArena;
+
+static void* ArenaEngineMalloc(size_t size)
+{
+    if (engineArena.Base == NULL && ArenaInit(&engineArena, ARENA_ENGINE_CAPACITY) != 0)
+    {
+        return NULL;
+    }
+
+    return ArenaAlloc(&engineArena, size);
+}
+
+static void ArenaEngineFree(void* ptr)
+{
+    // Individual frees are meaningless in an arena.
+    (void) ptr;
+}
+
+static void ArenaEngineReset(void)
+{
+    ArenaReset(&engineArena);
+}
+
+const struct AllocEngine ArenaEngine = {
+    .Name = "arena",
+    .Description = "bump-pointer region; free is a no-op, reset frees everything",
+    .Malloc = ArenaEngineMalloc,
+    .Free = ArenaEngineFree,
+    .Reset = ArenaEngineReset,
+    .ThreadSafe = 0,
+};
@@ -0,0 +1,57 @@
+// A bump-pointer arena (region) allocator.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#include "engine.h"
+
+// A region allocator: one mmap'd block of address space that we hand
+// out by bumping a pointer. There's no per-allocation header and no way
+// to free a single allocation; everything goes away at once on reset.
+struct Arena
+{
+    char* Base;
+    size_t Capacity;
+    size_t Offset;
+};
+
+// Every allocation is aligned to this many bytes, same as glibc on x86-64.
+#define ARENA_ALIGNMENT 16
+
+// Reserves capacity bytes (rounded up to a page) for the arena.
+// Returns 0 on success and -1 if the mapping failed.
+int ArenaInit(struct Arena* arena, size_t capacity);
+
+// Returns NULL once the arena is full.
+void* ArenaAlloc(struct Arena* arena, size_t size);
+
+// Frees everything allocated so far. The pages stay mapped so the next
+// round of allocations doesn't fault them in again.
+void ArenaReset(struct Arena* arena);
+
+void ArenaDestroy(struct Arena* arena);
+
+// The arena engine runs on a single process-wide arena that's created
+// the first time it's used. Its Free does nothing; call Reset instead.
+extern const struct AllocEngine ArenaEngine;
+
+#endif
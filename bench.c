@@ -0,0 +1,301 @@
+// Allocator benchmark driver.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "cachesize.h"
+#include "objects.h"
+#include "perfcounters.h"
+#include "timing.h"
+
+static const struct Benchmark benchmarks[] = {
+    { "arena", "bump-pointer arena versus glibc on ObjectMallocDemo allocations", BenchArena },
+    { "pool", "struct Object pool versus glibc: throughput and bytes per object", BenchPool },
+    { "sizeclass", "size-class fragmentation report next to glibc, plus throughput", BenchSizeClass },
+    { "tcache", "thread-cache engine versus glibc from 1 to 64 threads", BenchTCache },
+    { "lfstack", "lock-free free list versus a mutex-guarded one at 2 to 64 threads", BenchLockFreeStack },
+    { "remote", "one thread allocates GiantObjects, another frees them", BenchRemoteFree },
+    { "buddy", "buddy allocator fragmentation over a randomized Object/GiantObject trace", BenchBuddy },
+    { "tlsf", "malloc and free latency histograms, TLSF versus glibc", BenchTlsf },
+    { "preload", "libmallocdemo.so preloaded versus glibc: demo runs and a threaded workload", BenchPreload },
+    { "trace", "allocation tracer overhead on an ObjectMallocDemo loop", BenchTrace },
+    { "tracefile", "compact trace format: bytes per event and decoding speed", BenchTraceFile },
+    { "guard", "guard-page allocator cost versus glibc, recycled slots versus a mapping each", BenchGuard },
+    { "sampled", "sampled guard pages: overhead versus detection rate on the demos' overflows", BenchSampled },
+    { "redzone", "canary redzone checks on free: scan throughput per SIMD width and cost per GiB freed", BenchRedzone },
+    { "shadow", "shadow memory: checked versus unchecked field writes, and the cost of poisoning", BenchShadow },
+    { "suite", "every engine through fixed, random, FIFO and LIFO churn: ns, instructions, cache misses", BenchSuite },
+    { "latency", "per-call malloc and free latency: p50, p99, p99.9 and max per engine and size", BenchLatency },
+    { "columns", "GiantObject columns versus a GiantObject array: scans of 1, 4 and 20 fields, and fills", BenchColumns },
+    { "fill", "GiantObject array fills from a template: field by field versus AVX2 and AVX-512 stores", BenchFill },
+};
+
+#define BENCHMARK_COUNT (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+double BenchChurn(const struct AllocEngine* engine, size_t size, size_t batch, size_t rounds)
+{
+    void** ptrs = (void**) malloc(batch * sizeof(void*));
+    if (ptrs == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+
+    const uint64_t start = NowNs();
+
+    for (size_t round = 0; round < rounds; round++)
+    {
+        for (size_t i = 0; i < batch; i++)
+        {
+            char* p = (char*) engine->Malloc(size);
+            if (p == NULL)
+            {
+                fprintf(stderr, "Out of memory.\n");
+                exit(OOM_EXIT_CODE);
+            }
+
+            // Touch both ends so the allocation can't stay untouched
+            // address space.
+            p[0] = (char) i;
+            p[size - 1] = (char) round;
+            ptrs[i] = p;
+        }
+
+        if (engine->Reset != NULL)
+        {
+            engine->Reset();
+        }
+        else
+        {
+            for (size_t i = 0; i < batch; i++)
+            {
+                engine->Free(ptrs[i]);
+            }
+        }
+    }
+
+    const uint64_t elapsed = NowNs() - start;
+    free(ptrs);
+    return (double) elapsed / (double) (batch * rounds);
+}
+
+struct ChurnThread
+{
+    pthread_t Thread;
+    pthread_barrier_t* Start;
+    const struct AllocEngine* Engine;
+    size_t Size;
+    size_t Batch;
+    size_t Rounds;
+    uint64_t Begin;
+    uint64_t End;
+};
+
+static void* ChurnThreadMain(void* arg)
+{
+    struct ChurnThread* churn = (struct ChurnThread*) arg;
+    pthread_barrier_wait(churn->Start);
+    churn->Begin = NowNs();
+    BenchChurn(churn->Engine, churn->Size, churn->Batch, churn->Rounds);
+    churn->End = NowNs();
+    return NULL;
+}
+
+double BenchThreadedChurn(const struct AllocEngine* engine, size_t size, size_t threads,
+                          size_t batch, size_t rounds)
+{
+    struct ChurnThread* churns = (struct ChurnThread*) calloc(threads, sizeof(struct ChurnThread));
+    if (churns == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+
+    // Nobody starts until every thread has been created. Each thread
+    // times itself, and we measure from the first start to the last end,
+    // since the main thread may not even be running when the barrier opens.
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, (unsigned) threads);
+
+    for (size_t i = 0; i < threads; i++)
+    {
+        churns[i].Start = &start;
+        churns[i].Engine = engine;
+        churns[i].Size = size;
+        churns[i].Batch = batch;
+        churns[i].Rounds = rounds;
+        if (pthread_create(&churns[i].Thread, NULL, ChurnThreadMain, &churns[i]) != 0)
+        {
+            fprintf(stderr, "Couldn't create thread %zu.\n", i);
+            exit(1);
+        }
+    }
+
+    uint64_t begin = UINT64_MAX;
+    uint64_t end = 0;
+    for (size_t i = 0; i < threads; i++)
+    {
+        pthread_join(churns[i].Thread, NULL);
+        begin = churns[i].Begin < begin ? churns[i].Begin : begin;
+        end = churns[i].End > end ? churns[i].End : end;
+    }
+    const uint64_t elapsed = end - begin;
+
+    pthread_barrier_destroy(&start);
+    free(churns);
+    return (double) (threads * batch * rounds) * 1000.0 / (double) elapsed;
+}
+
+static int CompareSamples(const void* a, const void* b)
+{
+    const uint64_t x = *(const uint64_t*) a;
+    const uint64_t y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+uint64_t BenchPercentile(uint64_t* samples, size_t count, double percentile)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    qsort(samples, count, sizeof(uint64_t), CompareSamples);
+    size_t index = (size_t) (percentile / 100.0 * (double) count);
+    return samples[index < count ? index : count - 1];
+}
+
+void BenchFlushCaches(void)
+{
+    static char* scratch;
+    static size_t scratchBytes;
+    static unsigned char pass;
+    if (scratch == NULL)
+    {
+        scratchBytes = LastLevelCacheBytes();
+        scratchBytes = scratchBytes > BENCH_MAX_FLUSH_BYTES ? BENCH_MAX_FLUSH_BYTES : scratchBytes;
+        scratch = (char*) malloc(scratchBytes);
+        if (scratch == NULL)
+        {
+            fprintf(stderr, "Out of memory.\n");
+            exit(OOM_EXIT_CODE);
+        }
+    }
+    memset(scratch, ++pass, scratchBytes);
+}
+
+static void PrintUsage(FILE* stream, const char* program)
+{
+    fprintf(stream, "Usage: %s [-n iterations] [-l] [-w] [-u] [-t file] [benchmark...]\n"
+                    "  -n iterations  scale the amount of work (default 1)\n"
+                    "  -l             list the benchmarks and exit\n"
+                    "  -w             only run the preload benchmark's threaded workload\n"
+                    "  -u             only run one untraced loop of the trace benchmark\n"
+                    "  -t file        only run one loop of the trace benchmark, traced into file\n"
+                    "With no benchmark names, every benchmark runs.\n", program);
+}
+
+int main(int argc, char** argv)
+{
+    struct BenchOptions options = { .Iterations = 1 };
+    int workloadOnly = 0;
+    int traceLoopOnly = 0;
+    const char* tracePath = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:lwut:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                options.Iterations = strtoul(optarg, NULL, 10);
+                if (options.Iterations == 0)
+                {
+                    fprintf(stderr, "Iterations must be a positive number.\n");
+                    return 1;
+                }
+                break;
+            case 'l':
+                for (size_t i = 0; i < BENCHMARK_COUNT; i++)
+                {
+                    printf("  %-12s %s\n", benchmarks[i].Name, benchmarks[i].Description);
+                }
+                return 0;
+            case 'w':
+                workloadOnly = 1;
+                break;
+            case 'u':
+                traceLoopOnly = 1;
+                break;
+            case 't':
+                traceLoopOnly = 1;
+                tracePath = optarg;
+                break;
+            default:
+                PrintUsage(stderr, argv[0]);
+                return 1;
+        }
+    }
+
+    if (workloadOnly)
+    {
+        BenchPreloadWorkload(&options);
+        return 0;
+    }
+    if (traceLoopOnly)
+    {
+        BenchTraceLoop(&options, tracePath);
+        return 0;
+    }
+
+    // Every benchmark gets a line of counters for everything it did,
+    // including any threads and processes it started.
+    struct PerfCounters counters;
+    PerfCountersOpen(&counters, 1);
+    PerfCountersPrintMissing(stdout, &counters);
+
+    for (size_t i = 0; i < BENCHMARK_COUNT; i++)
+    {
+        int selected = optind == argc;
+        for (int arg = optind; arg < argc && !selected; arg++)
+        {
+            selected = strcmp(argv[arg], benchmarks[i].Name) == 0;
+        }
+
+        if (selected)
+        {
+            printf("== %s: %s\n", benchmarks[i].Name, benchmarks[i].Description);
+            struct PerfReading reading;
+            PerfCountersStart(&counters);
+            benchmarks[i].Run(&options);
+            PerfCountersStop(&counters, &reading);
+
+            PerfReadingPrint(stdout, "Counters", &reading);
+            printf("\n");
+        }
+    }
+
+    PerfCountersClose(&counters);
+    return 0;
+}
@@ -0,0 +1,96 @@
+// Allocator benchmark driver.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "engine.h"
+
+struct BenchOptions
+{
+    // Scales how much work every benchmark does. Each benchmark decides
+    // what one iteration means; the default keeps a full run short.
+    size_t Iterations;
+};
+
+struct Benchmark
+{
+    const char* Name;
+    const char* Description;
+    void (*Run)(const struct BenchOptions* options);
+};
+
+// Allocates batch objects of the given size on the engine, writes to each
+// one, then frees them all (or resets the engine if it has a bulk free).
+// Repeats that rounds times and returns the average nanoseconds per
+// allocate/free pair.
+double BenchChurn(const struct AllocEngine* engine, size_t size, size_t batch, size_t rounds);
+
+// BenchChurn on threads threads at once, each doing its own batches of
+// allocations and frees. Returns the combined millions of allocate/free
+// pairs per second across all threads.
+double BenchThreadedChurn(const struct AllocEngine* engine, size_t size, size_t threads,
+                          size_t batch, size_t rounds);
+
+// Sorts samples in place and returns the given percentile (0 to 100) of
+// them. 100 gives the maximum.
+uint64_t BenchPercentile(uint64_t* samples, size_t count, double percentile);
+
+#define BENCH_MAX_FLUSH_BYTES (512u << 20)
+
+// Writes over a buffer as big as the last-level cache (up to
+// BENCH_MAX_FLUSH_BYTES), so whatever a benchmark touched before is
+// mostly out of the caches when the next measurement starts.
+void BenchFlushCaches(void);
+
+// Benchmarks, one per allocator or experiment.
+void BenchArena(const struct BenchOptions* options);
+void BenchPool(const struct BenchOptions* options);
+void BenchSizeClass(const struct BenchOptions* options);
+void BenchTCache(const struct BenchOptions* options);
+void BenchLockFreeStack(const struct BenchOptions* options);
+void BenchRemoteFree(const struct BenchOptions* options);
+void BenchBuddy(const struct BenchOptions* options);
+void BenchTlsf(const struct BenchOptions* options);
+void BenchPreload(const struct BenchOptions* options);
+void BenchTrace(const struct BenchOptions* options);
+void BenchTraceFile(const struct BenchOptions* options);
+void BenchGuard(const struct BenchOptions* options);
+void BenchSampled(const struct BenchOptions* options);
+void BenchRedzone(const struct BenchOptions* options);
+void BenchShadow(const struct BenchOptions* options);
+void BenchSuite(const struct BenchOptions* options);
+void BenchLatency(const struct BenchOptions* options);
+void BenchColumns(const struct BenchOptions* options);
+void BenchFill(const struct BenchOptions* options);
+
+// The multi-threaded workload the preload benchmark runs in a child
+// process, with and without the interposer. Runs with bench -w.
+void BenchPreloadWorkload(const struct BenchOptions* options);
+
+// One run of the trace benchmark's loop, untraced or traced into
+// tracePath if that isn't NULL, which the trace benchmark runs in a fresh
+// process for each measurement. Prints its times on one line. Runs with
+// bench -u or bench -t file.
+void BenchTraceLoop(const struct BenchOptions* options, const char* tracePath);
+
+#endif
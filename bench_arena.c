@@ -0,0 +1,40 @@
+// Benchmark: arena allocator versus glibc malloc.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <stdio.h>
+
+#include "arena.h"
+#include "bench.h"
+#include "objects.h"
+
+void BenchArena(const struct BenchOptions* options)
+{
+    // A batch is roughly one scenario run's worth of objects, so a reset
+    // per batch matches how the batch jobs would use the arena.
+    const size_t batch = 4096;
+    const size_t rounds = 2000 * options->Iterations;
+
+    const double glibcNs = BenchChurn(&GlibcEngine, sizeof(struct Object), batch, rounds);
+    const double arenaNs = BenchChurn(&ArenaEngine, sizeof(struct Object), batch, rounds);
+
+    printf("%-8s %10s %12s\n", "engine", "ns/op", "Mops/s");
+    printf("%-8s %10.2f %12.2f\n", GlibcEngine.Name, glibcNs, 1000.0 / glibcNs);
+    printf("%-8s %10.2f %12.2f\n", ArenaEngine.Name, arenaNs, 1000.0 / arenaNs);
+    printf("arena speedup over glibc: %.2fx\n", glibcNs / arenaNs);
+}
@@ -0,0 +1,140 @@
+// Benchmark: buddy allocator fragmentation over time.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "buddy.h"
+#include "objects.h"
+
+struct LiveAllocation
+{
+    void* Ptr;
+    size_t Size;
+};
+
+// A randomized trace of Object and GiantObject allocations: most steps
+// allocate one or the other (or the 2 byte GiantObjectDemo request), the
+// rest free a random live allocation. The live set keeps growing until it
+// settles where allocations and frees balance out, which is where
+// fragmentation builds up.
+static size_t NextRequest(unsigned* seed)
+{
+    const int pick = rand_r(seed) % 8;
+    if (pick < 5)
+    {
+        return sizeof(struct Object);
+    }
+    if (pick < 7)
+    {
+        return sizeof(struct GiantObject);
+    }
+    return 2;
+}
+
+void BenchBuddy(const struct BenchOptions* options)
+{
+    const size_t steps = 2000000 * options->Iterations;
+    const size_t reportEvery = steps / 10;
+    const size_t maxLive = 100000;
+
+    struct Buddy buddy;
+    struct LiveAllocation* live = (struct LiveAllocation*) malloc(maxLive * sizeof(struct LiveAllocation));
+    void** glibcLive = (void**) malloc(maxLive * sizeof(void*));
+    if (live == NULL || glibcLive == NULL || BuddyInit(&buddy) != 0)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+
+    void* two = malloc(2);
+    printf("A 2 byte request costs a %zu byte block (plus two bitmap bits per tree node);\n"
+           "glibc gives it %zu usable bytes plus its chunk header.\n",
+           BuddyBlockSize(2), malloc_usable_size(two));
+    free(two);
+    printf("Fragmentation over time. internal = block bytes / requested bytes,\n"
+           "external = 1 - largest free block / free bytes (the region is %zu MiB).\n",
+           ((size_t) 1 << BUDDY_MAX_ORDER) >> 20);
+    printf("%9s %7s %12s %12s %9s %9s %12s\n", "step", "live", "requested", "buddy bytes",
+           "internal", "external", "glibc bytes");
+
+    const size_t glibcBefore = mallinfo2().uordblks;
+    const size_t regionSize = (size_t) 1 << BUDDY_MAX_ORDER;
+    unsigned seed = 392;
+    size_t liveCount = 0;
+    size_t requested = 0;
+
+    for (size_t step = 1; step <= steps; step++)
+    {
+        // Lean towards allocating while the live set is small.
+        const int allocate = liveCount == 0
+                             || (liveCount < maxLive && (size_t) (rand_r(&seed) % maxLive) >= liveCount / 2);
+        if (allocate)
+        {
+            const size_t size = NextRequest(&seed);
+            void* p = BuddyAlloc(&buddy, size);
+            void* q = malloc(size);
+            if (p == NULL || q == NULL)
+            {
+                fprintf(stderr, "Out of memory.\n");
+                exit(OOM_EXIT_CODE);
+            }
+
+            live[liveCount].Ptr = p;
+            live[liveCount].Size = size;
+            glibcLive[liveCount] = q;
+            liveCount++;
+            requested += size;
+        }
+        else
+        {
+            const size_t victim = (size_t) rand_r(&seed) % liveCount;
+            BuddyFree(&buddy, live[victim].Ptr);
+            free(glibcLive[victim]);
+            requested -= live[victim].Size;
+
+            liveCount--;
+            live[victim] = live[liveCount];
+            glibcLive[victim] = glibcLive[liveCount];
+        }
+
+        if (step % reportEvery == 0)
+        {
+            const size_t freeBytes = regionSize - buddy.AllocatedBytes;
+            printf("%9zu %7zu %12zu %12zu %8.2fx %8.1f%% %12zu\n", step, liveCount, requested,
+                   buddy.AllocatedBytes, (double) buddy.AllocatedBytes / (double) requested,
+                   100.0 * (1.0 - (double) BuddyLargestFree(&buddy) / (double) freeBytes),
+                   mallinfo2().uordblks - glibcBefore);
+        }
+    }
+
+    for (size_t i = 0; i < liveCount; i++)
+    {
+        BuddyFree(&buddy, live[i].Ptr);
+        free(glibcLive[i]);
+    }
+    printf("After freeing everything the largest free block is %zu MiB again.\n",
+           BuddyLargestFree(&buddy) >> 20);
+
+    BuddyDestroy(&buddy);
+    free(glibcLive);
+    free(live);
+}
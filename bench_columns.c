@@ -0,0 +1,272 @@
+// Benchmarks column scans over GiantObject columns versus a GiantObject array.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "giantcolumns.h"
+#include "objects.h"
+#include "perfcounters.h"
+#include "timing.h"
+
+// 80 MiB of GiantObjects either way. The caches are flushed before every
+// run, so each scan starts from memory.
+#define COLUMNS_OBJECTS (1u << 19)
+
+// Each measurement is the median of this many runs, after one warm-up run.
+#define COLUMNS_RUNS 5
+
+struct ColumnsData
+{
+    struct GiantObject* Objects;
+    struct GiantColumns Columns;
+    size_t Passes;
+};
+
+// Something to time on both layouts. Returns a sum the two layouts
+// should agree on, or 0 when there's nothing to compare.
+typedef int64_t (*ColumnsWork)(struct ColumnsData* data, size_t fields);
+
+#define ADD_FIELD(field) sum += o->field
+
+static int64_t ScanStructs1(const struct GiantObject* objects)
+{
+    int64_t sum = 0;
+    for (const struct GiantObject* o = objects; o < objects + COLUMNS_OBJECTS; o++)
+    {
+        ADD_FIELD(Field01);
+    }
+    return sum;
+}
+
+static int64_t ScanStructs4(const struct GiantObject* objects)
+{
+    int64_t sum = 0;
+    for (const struct GiantObject* o = objects; o < objects + COLUMNS_OBJECTS; o++)
+    {
+        ADD_FIELD(Field01); ADD_FIELD(Field02); ADD_FIELD(Field03); ADD_FIELD(Field04);
+    }
+    return sum;
+}
+
+static int64_t ScanStructs20(const struct GiantObject* objects)
+{
+    int64_t sum = 0;
+    for (const struct GiantObject* o = objects; o < objects + COLUMNS_OBJECTS; o++)
+    {
+        ADD_FIELD(Field01); ADD_FIELD(Field02); ADD_FIELD(Field03); ADD_FIELD(Field04); ADD_FIELD(Field05);
+        ADD_FIELD(Field06); ADD_FIELD(Field07); ADD_FIELD(Field08); ADD_FIELD(Field09); ADD_FIELD(Field10);
+        ADD_FIELD(Field11); ADD_FIELD(Field12); ADD_FIELD(Field13); ADD_FIELD(Field14); ADD_FIELD(Field15);
+        ADD_FIELD(Field16); ADD_FIELD(Field17); ADD_FIELD(Field18); ADD_FIELD(Field19); ADD_FIELD(Field20);
+    }
+    return sum;
+}
+
+// Sums the first fields fields of every object, an object at a time.
+static int64_t ScanStructs(struct ColumnsData* data, size_t fields)
+{
+    int64_t sum = 0;
+    for (size_t pass = 0; pass < data->Passes; pass++)
+    {
+        switch (fields)
+        {
+            case 1: sum += ScanStructs1(data->Objects); break;
+            case 4: sum += ScanStructs4(data->Objects); break;
+            default: sum += ScanStructs20(data->Objects); break;
+        }
+    }
+    return sum;
+}
+
+// The same sum, a column at a time.
+static int64_t ScanColumns(struct ColumnsData* data, size_t fields)
+{
+    int64_t sum = 0;
+    for (size_t pass = 0; pass < data->Passes; pass++)
+    {
+        for (size_t f = 0; f < fields; f++)
+        {
+            const int64_t* column = data->Columns.Columns[f];
+            for (size_t i = 0; i < COLUMNS_OBJECTS; i++)
+            {
+                sum += column[i];
+            }
+        }
+    }
+    return sum;
+}
+
+static const struct GiantObject fillValue = {
+    0x12345678, 0xDEADBEEF, 0xBADF00D, 0xC0FFEE, 0xBADC0FFEE, 0xDABBAD00, 0xDEADDEAD, 0xFACEFEED,
+    0x89ABCDEF, 0x89ABCDEF, 0x89ABCDEF, 0x89ABCDEF, 0x89ABCDEF, 0x89ABCDEF, 0x89ABCDEF, 0x89ABCDEF,
+    0x89ABCDEF, 0x89ABCDEF, 0x89ABCDEF, 0x89ABCDEF,
+};
+
+static int64_t FillStructs(struct ColumnsData* data, size_t fields)
+{
+    (void) fields;
+    for (size_t pass = 0; pass < data->Passes; pass++)
+    {
+        for (size_t i = 0; i < COLUMNS_OBJECTS; i++)
+        {
+            data->Objects[i] = fillValue;
+        }
+    }
+    return 0;
+}
+
+static int64_t FillColumns(struct ColumnsData* data, size_t fields)
+{
+    (void) fields;
+    for (size_t pass = 0; pass < data->Passes; pass++)
+    {
+        GiantColumnsFill(&data->Columns, &fillValue);
+    }
+    return 0;
+}
+
+struct ColumnsResult
+{
+    uint64_t Ns;
+    int64_t Sum;
+    struct PerfReading Counters;
+};
+
+static int CompareResults(const void* a, const void* b)
+{
+    const uint64_t x = ((const struct ColumnsResult*) a)->Ns;
+    const uint64_t y = ((const struct ColumnsResult*) b)->Ns;
+    return (x > y) - (x < y);
+}
+
+// Runs work COLUMNS_RUNS times and returns the median run.
+static struct ColumnsResult Measure(ColumnsWork work, struct ColumnsData* data, size_t fields,
+                                    struct PerfCounters* counters)
+{
+    struct ColumnsResult results[COLUMNS_RUNS];
+    work(data, fields);
+    for (size_t run = 0; run < COLUMNS_RUNS; run++)
+    {
+        BenchFlushCaches();
+        const uint64_t start = NowNs();
+        PerfCountersStart(counters);
+        results[run].Sum = work(data, fields);
+        PerfCountersStop(counters, &results[run].Counters);
+        results[run].Ns = NowNs() - start;
+    }
+
+    qsort(results, COLUMNS_RUNS, sizeof(results[0]), CompareResults);
+    return results[COLUMNS_RUNS / 2];
+}
+
+static void PrintPerObject(const struct PerfReading* reading, enum PerfEvent event, size_t objects)
+{
+    if (reading->Valid & (1u << event))
+    {
+        printf(" %14.3f", (double) reading->Values[event] / (double) objects);
+    }
+    else
+    {
+        printf(" %14s", "-");
+    }
+}
+
+// One row: ns per object, GB/s of the fields the work asked for, and
+// cache misses per object.
+static void PrintRow(const char* label, const char* layout, const struct ColumnsResult* result, size_t fields,
+                     size_t passes)
+{
+    const size_t objects = (size_t) COLUMNS_OBJECTS * passes;
+    printf("%-10s %-8s %10.2f %8.2f", label, layout, (double) result->Ns / (double) objects,
+           (double) (objects * fields * sizeof(int64_t)) / (double) result->Ns);
+    PrintPerObject(&result->Counters, PERF_EVENT_L1D_MISSES, objects);
+    PrintPerObject(&result->Counters, PERF_EVENT_LLC_MISSES, objects);
+    printf("\n");
+}
+
+void BenchColumns(const struct BenchOptions* options)
+{
+    struct PerfCounters counters;
+    PerfCountersOpen(&counters, 0);
+    PerfCountersPrintMissing(stdout, &counters);
+
+    struct ColumnsData data = { .Passes = options->Iterations };
+    data.Objects = (struct GiantObject*) malloc(COLUMNS_OBJECTS * sizeof(struct GiantObject));
+    if (data.Objects == NULL || GiantColumnsInit(&data.Columns, COLUMNS_OBJECTS) != 0)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+
+    // Every field of every object different, so a scan that read the wrong
+    // column would come out with the wrong sum.
+    for (size_t i = 0; i < COLUMNS_OBJECTS; i++)
+    {
+        int64_t* fields = (int64_t*) &data.Objects[i];
+        for (size_t f = 0; f < GIANT_FIELD_COUNT; f++)
+        {
+            fields[f] = (int64_t) (i * GIANT_FIELD_COUNT + f);
+        }
+    }
+    GiantColumnsStore(&data.Columns, 0, data.Objects, COLUMNS_OBJECTS);
+
+    printf("%u GiantObjects as an array of structs (GiantObject[]) and as one column per field, %zu MiB\n",
+           COLUMNS_OBJECTS, COLUMNS_OBJECTS * sizeof(struct GiantObject) >> 20);
+    printf("each. GB/s counts only the fields asked for. Each number is from the median of %d runs, with\n",
+           COLUMNS_RUNS);
+    printf("the caches flushed before each one.\n\n");
+    printf("%-10s %-8s %10s %8s %14s %14s\n", "scan", "layout", "ns/object", "GB/s", "L1D miss/obj",
+           "LLC miss/obj");
+
+    const size_t scans[] = { 1, 4, GIANT_FIELD_COUNT };
+    for (size_t s = 0; s < sizeof(scans) / sizeof(scans[0]); s++)
+    {
+        const size_t fields = scans[s];
+        char label[32];
+        snprintf(label, sizeof(label), "%zu field%s", fields, fields == 1 ? "" : "s");
+
+        const struct ColumnsResult structs = Measure(ScanStructs, &data, fields, &counters);
+        const struct ColumnsResult columns = Measure(ScanColumns, &data, fields, &counters);
+        PrintRow(label, "structs", &structs, fields, data.Passes);
+        PrintRow(label, "columns", &columns, fields, data.Passes);
+        if (structs.Sum != columns.Sum)
+        {
+            printf("The layouts disagree: %lld from the structs, %lld from the columns.\n",
+                   (long long) structs.Sum, (long long) columns.Sum);
+        }
+    }
+
+    // Bulk initialization writes every field of every object either way.
+    const struct ColumnsResult structs = Measure(FillStructs, &data, GIANT_FIELD_COUNT, &counters);
+    const struct ColumnsResult columns = Measure(FillColumns, &data, GIANT_FIELD_COUNT, &counters);
+    PrintRow("fill", "structs", &structs, GIANT_FIELD_COUNT, data.Passes);
+    PrintRow("fill", "columns", &columns, GIANT_FIELD_COUNT, data.Passes);
+
+    struct GiantObject check;
+    GiantColumnsLoad(&data.Columns, COLUMNS_OBJECTS - 1, &check);
+    if (check.Field01 != fillValue.Field01 || check.Field20 != fillValue.Field20)
+    {
+        printf("The column fill didn't fill the last object.\n");
+    }
+
+    GiantColumnsDestroy(&data.Columns);
+    free(data.Objects);
+    PerfCountersClose(&counters);
+}
@@ -0,0 +1,140 @@
+// Benchmarks filling GiantObject arrays field by field versus with vector stores.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "cachesize.h"
+#include "giantfill.h"
+#include "objects.h"
+#include "timing.h"
+
+// Each measurement is the median of this many runs, after one warm-up run.
+#define FILL_RUNS 5
+
+static const struct GiantObject fillValue = {
+    0x12345678, 0xDEADBEEF, 0xBADF00D, 0xC0FFEE, 0xBADC0FFEE, 0xDABBAD00, 0xDEADDEAD, 0xFACEFEED,
+    0x89ABCDEF, 0x89ABCDEF, 0x89ABCDEF, 0x89ABCDEF, 0x89ABCDEF, 0x89ABCDEF, 0x89ABCDEF, 0x89ABCDEF,
+    0x89ABCDEF, 0x89ABCDEF, 0x89ABCDEF, 0x89ABCDEF,
+};
+
+static int CompareNs(const void* a, const void* b)
+{
+    const uint64_t x = *(const uint64_t*) a;
+    const uint64_t y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+// Returns GB/s from the median run, or a negative number if the fill got
+// an object wrong.
+static double TimeFill(GiantFillFunction fill, struct GiantObject* objects, size_t count, size_t passes)
+{
+    uint64_t ns[FILL_RUNS];
+    memset(objects, 0, count * sizeof(struct GiantObject));
+    fill(objects, count, &fillValue);
+    for (size_t run = 0; run < FILL_RUNS; run++)
+    {
+        const uint64_t start = NowNs();
+        for (size_t pass = 0; pass < passes; pass++)
+        {
+            fill(objects, count, &fillValue);
+        }
+        ns[run] = NowNs() - start;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (memcmp(&objects[i], &fillValue, sizeof(fillValue)) != 0)
+        {
+            return -1.0;
+        }
+    }
+
+    qsort(ns, FILL_RUNS, sizeof(ns[0]), CompareNs);
+    return (double) (count * passes * sizeof(struct GiantObject)) / (double) ns[FILL_RUNS / 2];
+}
+
+static void PrintRate(double rate)
+{
+    if (rate < 0)
+    {
+        printf(" %10s", "wrong");
+    }
+    else
+    {
+        printf(" %10.2f", rate);
+    }
+}
+
+void BenchFill(const struct BenchOptions* options)
+{
+    const size_t cacheBytes = LastLevelCacheBytes();
+    size_t bigBytes = 2 * cacheBytes;
+    bigBytes = bigBytes > 2 * BENCH_MAX_FLUSH_BYTES ? 2 * BENCH_MAX_FLUSH_BYTES : bigBytes;
+    const size_t sizes[] = { 256u << 10, 8u << 20, bigBytes };
+    const size_t sizeCount = sizeof(sizes) / sizeof(sizes[0]);
+
+    // The biggest array, at malloc's 16-byte alignment, so the vector
+    // fillers have to line themselves up.
+    struct GiantObject* objects = (struct GiantObject*) malloc(bigBytes);
+    if (objects == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+
+    size_t fillerCount;
+    const struct GiantFiller* fillers = GiantFillers(&fillerCount);
+
+    printf("GB/s filling an array of GiantObjects from one template, median of %d runs. \"fields\" stores a\n",
+           FILL_RUNS);
+    printf("field at a time; GiantObjectsFill picks the widest vectors, streaming past the cache above the\n");
+    printf("%zu MiB last-level cache.\n\n", cacheBytes >> 20);
+
+    printf("%-18s", "filler");
+    for (size_t s = 0; s < sizeCount; s++)
+    {
+        char label[32];
+        snprintf(label, sizeof(label), "%zu %s", sizes[s] >= (1u << 20) ? sizes[s] >> 20 : sizes[s] >> 10,
+                 sizes[s] >= (1u << 20) ? "MiB" : "KiB");
+        printf(" %10s", label);
+    }
+    printf("\n");
+
+    for (size_t f = 0; f <= fillerCount; f++)
+    {
+        const GiantFillFunction fill = f < fillerCount ? fillers[f].Fill : GiantObjectsFill;
+        printf("%-18s", f < fillerCount ? fillers[f].Name : "GiantObjectsFill");
+        for (size_t s = 0; s < sizeCount; s++)
+        {
+            const size_t count = sizes[s] / sizeof(struct GiantObject);
+
+            // Small arrays are filled over and over, so every measurement
+            // runs long enough to time.
+            const size_t passes = options->Iterations * (bigBytes / sizes[s] < 64 ? bigBytes / sizes[s] : 64);
+            PrintRate(TimeFill(fill, objects, count, passes));
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+
+    free(objects);
+}
@@ -0,0 +1,158 @@
+// Benchmarks the guard-page allocator against glibc and a mapping per block.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "guard.h"
+#include "objects.h"
+#include "timing.h"
+
+// What the guard engine would cost without its slot pool: a fresh mapping
+// and an mprotect for every malloc, and an munmap for every free.
+static void* MapMalloc(size_t size)
+{
+    const size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    const size_t length = ((size + pageSize - 1) & ~(pageSize - 1)) + 2 * pageSize;
+    char* base = (char*) mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+    {
+        return NULL;
+    }
+    mprotect(base + length - pageSize, pageSize, PROT_NONE);
+
+    char* p = base + length - pageSize - size;
+    ((size_t*) p)[-1] = length;
+    ((char**) p)[-2] = base;
+    return p;
+}
+
+static void MapFree(void* ptr)
+{
+    munmap(((char**) ptr)[-2], ((size_t*) ptr)[-1]);
+}
+
+static const struct AllocEngine mapEngine = {
+    .Name = "mmap",
+    .Description = "",
+    .Malloc = MapMalloc,
+    .Free = MapFree,
+    .Reset = NULL,
+    .ThreadSafe = 1,
+};
+
+// Times batch mallocs of size bytes from a brand-new guard allocator, so
+// every slot has to be carved, and then the same again once they've all
+// been freed and can be recycled.
+static void TimeGuard(size_t size, size_t batch, size_t rounds, double* coldNs, double* warmNs,
+                      double* coldCalls, double* warmCalls)
+{
+    void** ptrs = (void**) malloc(batch * sizeof(void*));
+    if (ptrs == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+
+    struct Guard guard;
+    uint64_t cold = 0;
+    uint64_t coldSystemCalls = 0;
+    for (size_t round = 0; round < rounds; round++)
+    {
+        GuardInit(&guard);
+        const uint64_t start = NowNs();
+        for (size_t i = 0; i < batch; i++)
+        {
+            char* p = (char*) GuardMalloc(&guard, size);
+            if (p == NULL)
+            {
+                fprintf(stderr, "Out of memory.\n");
+                exit(OOM_EXIT_CODE);
+            }
+            p[0] = (char) i;
+            p[size - 1] = (char) round;
+            ptrs[i] = p;
+        }
+        cold += NowNs() - start;
+        coldSystemCalls += guard.SystemCalls;
+
+        if (round + 1 < rounds)
+        {
+            GuardDestroy(&guard);
+        }
+    }
+
+    // The last round's allocator is already warm.
+    for (size_t i = 0; i < batch; i++)
+    {
+        GuardFree(&guard, ptrs[i]);
+    }
+    const uint64_t warmSystemCalls = guard.SystemCalls;
+    const uint64_t start = NowNs();
+    for (size_t round = 0; round < rounds; round++)
+    {
+        for (size_t i = 0; i < batch; i++)
+        {
+            char* p = (char*) GuardMalloc(&guard, size);
+            p[0] = (char) i;
+            p[size - 1] = (char) round;
+            ptrs[i] = p;
+        }
+        for (size_t i = 0; i < batch; i++)
+        {
+            GuardFree(&guard, ptrs[i]);
+        }
+    }
+    const uint64_t warm = NowNs() - start;
+
+    *coldNs = (double) cold / (double) (batch * rounds);
+    *warmNs = (double) warm / (double) (batch * rounds);
+    *coldCalls = (double) coldSystemCalls / (double) (batch * rounds);
+    *warmCalls = (double) (guard.SystemCalls - warmSystemCalls) / (double) (batch * rounds);
+
+    GuardDestroy(&guard);
+    free(ptrs);
+}
+
+void BenchGuard(const struct BenchOptions* options)
+{
+    const size_t sizes[] = { 2, sizeof(struct Object), sizeof(struct GiantObject), 4096, 16384 };
+    const size_t batch = 1000;
+    const size_t rounds = 20 * options->Iterations;
+
+    printf("Guarded malloc + free, ns per pair; cold is a brand-new allocator carving every slot\n");
+    printf("(malloc only), warm is recycling them. Syscalls are per malloc.\n\n");
+    printf("%8s %10s %10s %10s %10s %12s %12s\n", "size", "glibc", "warm", "cold", "mmap", "cold calls",
+           "warm calls");
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        const double glibc = BenchChurn(&GlibcEngine, sizes[i], batch, rounds);
+        const double map = BenchChurn(&mapEngine, sizes[i], batch, rounds);
+
+        double cold, warm, coldCalls, warmCalls;
+        TimeGuard(sizes[i], batch, rounds, &cold, &warm, &coldCalls, &warmCalls);
+
+        printf("%8zu %10.1f %10.1f %10.1f %10.1f %12.3f %12.3f\n", sizes[i], glibc, warm, cold, map, coldCalls,
+               warmCalls);
+    }
+}
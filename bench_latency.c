@@ -0,0 +1,182 @@
+// Benchmarks per-call malloc and free latency percentiles on every engine and size.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "histogram.h"
+#include "objects.h"
+#include "timing.h"
+
+#define LATENCY_THREADS 4
+#define LATENCY_BATCH 1000
+
+struct LatencyRun
+{
+    const struct AllocEngine* Engine;
+    size_t Size;
+    size_t Rounds;
+    struct HistogramSet* Mallocs;
+    struct HistogramSet* Frees;
+};
+
+struct LatencyThread
+{
+    pthread_t Thread;
+    const struct LatencyRun* Run;
+    int Refused;
+};
+
+// Mallocs a batch, then frees it, timing every call on its own into this
+// thread's histograms.
+static void* LatencyThreadMain(void* arg)
+{
+    struct LatencyThread* thread = (struct LatencyThread*) arg;
+    const struct LatencyRun* run = thread->Run;
+    struct Histogram* mallocs = HistogramSetAdd(run->Mallocs);
+    struct Histogram* frees = HistogramSetAdd(run->Frees);
+    void** ptrs = (void**) malloc(LATENCY_BATCH * sizeof(void*));
+    if (mallocs == NULL || frees == NULL || ptrs == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+
+    for (size_t round = 0; round < run->Rounds && !thread->Refused; round++)
+    {
+        size_t count = 0;
+        for (; count < LATENCY_BATCH; count++)
+        {
+            const uint64_t start = NowTicks();
+            char* p = (char*) run->Engine->Malloc(run->Size);
+            HistogramRecord(mallocs, NowTicks() - start);
+            if (p == NULL)
+            {
+                thread->Refused = 1;
+                break;
+            }
+            p[0] = (char) count;
+            ptrs[count] = p;
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            const uint64_t start = NowTicks();
+            run->Engine->Free(ptrs[i]);
+            HistogramRecord(frees, NowTicks() - start);
+        }
+        if (run->Engine->Reset != NULL)
+        {
+            run->Engine->Reset();
+        }
+    }
+
+    free(ptrs);
+    return NULL;
+}
+
+// Runs the engine at one size on as many threads as it can take. Returns
+// 0, or -1 if the engine refused the size.
+static int TimeCalls(const struct AllocEngine* engine, size_t size, size_t rounds, struct Histogram* mallocs,
+                     struct Histogram* frees)
+{
+    struct HistogramSet mallocSet, freeSet;
+    HistogramSetInit(&mallocSet);
+    HistogramSetInit(&freeSet);
+    const struct LatencyRun run = { engine, size, rounds, &mallocSet, &freeSet };
+
+    const size_t threads = engine->ThreadSafe ? LATENCY_THREADS : 1;
+    struct LatencyThread workers[LATENCY_THREADS] = { 0 };
+    for (size_t i = 0; i < threads; i++)
+    {
+        workers[i].Run = &run;
+        if (pthread_create(&workers[i].Thread, NULL, LatencyThreadMain, &workers[i]) != 0)
+        {
+            fprintf(stderr, "Couldn't create thread %zu.\n", i);
+            exit(1);
+        }
+    }
+
+    int refused = 0;
+    for (size_t i = 0; i < threads; i++)
+    {
+        pthread_join(workers[i].Thread, NULL);
+        refused |= workers[i].Refused;
+    }
+
+    HistogramSetMerge(&mallocSet, mallocs);
+    HistogramSetMerge(&freeSet, frees);
+    HistogramSetDestroy(&mallocSet);
+    HistogramSetDestroy(&freeSet);
+    return refused ? -1 : 0;
+}
+
+void BenchLatency(const struct BenchOptions* options)
+{
+    const size_t sizes[] = { sizeof(struct Object), 16, 64, sizeof(struct GiantObject), 1024, 4096 };
+    const size_t rounds = 50 * options->Iterations;
+    const double tickNs = HistogramTickNs();
+
+    struct Histogram* mallocs = (struct Histogram*) malloc(sizeof(struct Histogram));
+    struct Histogram* frees = (struct Histogram*) malloc(sizeof(struct Histogram));
+    if (mallocs == NULL || frees == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+
+    printf("Every malloc and free timed on its own with the %s, in ns (one tick is %.3f ns),\n",
+#if defined(__x86_64__) || defined(__i386__)
+           "time-stamp counter",
+#else
+           "monotonic clock",
+#endif
+           tickNs);
+    printf("on %d threads for thread-safe engines and one otherwise. Batches of %d blocks are\n",
+           LATENCY_THREADS, LATENCY_BATCH);
+    printf("allocated and then freed.\n");
+
+    size_t engineCount;
+    const struct AllocEngine* const* engines = EngineList(&engineCount);
+    for (size_t e = 0; e < engineCount; e++)
+    {
+        printf("\n%s:\n", engines[e]->Name);
+        HistogramPrintHeader(stdout, "size / call");
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        {
+            char label[32];
+            if (TimeCalls(engines[e], sizes[i], rounds, mallocs, frees) != 0)
+            {
+                snprintf(label, sizeof(label), "%zu", sizes[i]);
+                printf("%-16s %10s\n", label, "refused");
+                continue;
+            }
+
+            snprintf(label, sizeof(label), "%zu malloc", sizes[i]);
+            HistogramPrintRow(stdout, label, mallocs, tickNs);
+            snprintf(label, sizeof(label), "%zu free", sizes[i]);
+            HistogramPrintRow(stdout, label, frees, tickNs);
+        }
+    }
+
+    free(mallocs);
+    free(frees);
+}
@@ -0,0 +1,195 @@
+// Benchmark: lock-free free list versus a mutex-guarded one.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "lfstack.h"
+#include "objects.h"
+#include "timing.h"
+
+// The baseline: the same free list behind a mutex.
+struct LockedStack
+{
+    pthread_mutex_t Lock;
+    struct LockFreeNode* Head;
+};
+
+static void LockedStackPush(struct LockedStack* stack, struct LockFreeNode* node)
+{
+    pthread_mutex_lock(&stack->Lock);
+    node->Next = stack->Head;
+    stack->Head = node;
+    pthread_mutex_unlock(&stack->Lock);
+}
+
+static struct LockFreeNode* LockedStackPop(struct LockedStack* stack)
+{
+    pthread_mutex_lock(&stack->Lock);
+    struct LockFreeNode* node = stack->Head;
+    if (node != NULL)
+    {
+        stack->Head = node->Next;
+    }
+    pthread_mutex_unlock(&stack->Lock);
+    return node;
+}
+
+#define NODES_PER_THREAD 8
+
+struct StackThread
+{
+    pthread_t Thread;
+    pthread_barrier_t* Start;
+    struct LockFreeStack* LockFree;
+    struct LockedStack* Locked;
+    size_t Rounds;
+    uint64_t Begin;
+    uint64_t End;
+};
+
+// Every round pops a few blocks and pushes them back, like a thread
+// allocating and then freeing a handful of objects.
+static void* StackThreadMain(void* arg)
+{
+    struct StackThread* thread = (struct StackThread*) arg;
+    struct LockFreeNode* held[NODES_PER_THREAD];
+
+    pthread_barrier_wait(thread->Start);
+    thread->Begin = NowNs();
+
+    for (size_t round = 0; round < thread->Rounds; round++)
+    {
+        size_t count = 0;
+        for (size_t i = 0; i < NODES_PER_THREAD; i++)
+        {
+            struct LockFreeNode* node = thread->LockFree != NULL
+                                        ? LockFreeStackPop(thread->LockFree)
+                                        : LockedStackPop(thread->Locked);
+            if (node != NULL)
+            {
+                held[count++] = node;
+            }
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            if (thread->LockFree != NULL)
+            {
+                LockFreeStackPush(thread->LockFree, held[i]);
+            }
+            else
+            {
+                LockedStackPush(thread->Locked, held[i]);
+            }
+        }
+    }
+
+    thread->End = NowNs();
+    return NULL;
+}
+
+// Returns millions of push/pop pairs per second across all threads.
+static double RunStack(struct LockFreeStack* lockFree, struct LockedStack* locked,
+                       size_t threads, size_t rounds)
+{
+    struct StackThread* workers = (struct StackThread*) calloc(threads, sizeof(struct StackThread));
+    if (workers == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, (unsigned) threads);
+
+    for (size_t i = 0; i < threads; i++)
+    {
+        workers[i].Start = &start;
+        workers[i].LockFree = lockFree;
+        workers[i].Locked = locked;
+        workers[i].Rounds = rounds;
+        if (pthread_create(&workers[i].Thread, NULL, StackThreadMain, &workers[i]) != 0)
+        {
+            fprintf(stderr, "Couldn't create thread %zu.\n", i);
+            exit(1);
+        }
+    }
+
+    uint64_t begin = UINT64_MAX;
+    uint64_t end = 0;
+    for (size_t i = 0; i < threads; i++)
+    {
+        pthread_join(workers[i].Thread, NULL);
+        begin = workers[i].Begin < begin ? workers[i].Begin : begin;
+        end = workers[i].End > end ? workers[i].End : end;
+    }
+
+    pthread_barrier_destroy(&start);
+    free(workers);
+    return (double) (threads * rounds * NODES_PER_THREAD) * 1000.0 / (double) (end - begin);
+}
+
+void BenchLockFreeStack(const struct BenchOptions* options)
+{
+    const size_t threadCounts[] = { 2, 8, 32, 64 };
+    const size_t rounds = 20000 * options->Iterations;
+
+    printf("Combined Mops/s (pop/push pairs) on one shared free list.\n");
+    printf("%8s %10s %10s %8s\n", "threads", "mutex", "lockfree", "ratio");
+
+    for (size_t t = 0; t < sizeof(threadCounts) / sizeof(threadCounts[0]); t++)
+    {
+        const size_t threads = threadCounts[t];
+
+        // Exactly enough blocks for every thread to hold its share, so the
+        // list is hammered without anyone ever finding it empty for long.
+        const size_t nodeCount = threads * NODES_PER_THREAD;
+        struct LockFreeNode* nodes = (struct LockFreeNode*) calloc(nodeCount, sizeof(struct GiantObject));
+        if (nodes == NULL)
+        {
+            fprintf(stderr, "Out of memory.\n");
+            exit(OOM_EXIT_CODE);
+        }
+
+        struct LockFreeStack lockFree;
+        struct LockedStack locked = { .Lock = PTHREAD_MUTEX_INITIALIZER, .Head = NULL };
+        LockFreeStackInit(&lockFree);
+
+        // Space the blocks out like GiantObjects so neighbouring blocks
+        // don't share a cache line.
+        const size_t stride = sizeof(struct GiantObject) / sizeof(struct LockFreeNode);
+        for (size_t i = 0; i < nodeCount; i++)
+        {
+            LockFreeStackPush(&lockFree, &nodes[i * stride]);
+        }
+        const double lockFreeMops = RunStack(&lockFree, NULL, threads, rounds);
+
+        for (size_t i = 0; i < nodeCount; i++)
+        {
+            LockedStackPush(&locked, &nodes[i * stride]);
+        }
+        const double lockedMops = RunStack(NULL, &locked, threads, rounds);
+
+        printf("%8zu %10.2f %10.2f %7.2fx\n", threads, lockedMops, lockFreeMops, lockFreeMops / lockedMops);
+        free(nodes);
+    }
+}
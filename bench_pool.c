@@ -0,0 +1,134 @@
+// Benchmark: struct Object pool versus glibc malloc.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "objects.h"
+#include "pool.h"
+#include "timing.h"
+
+static void* ExitIfNull(void* p)
+{
+    if (p == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+
+    return p;
+}
+
+// Both loops call the allocators directly rather than through an engine
+// so the pool gets credit for being inlinable into a tight loop.
+static double MallocChurnNs(struct Object** objects, size_t batch, size_t rounds)
+{
+    const uint64_t start = NowNs();
+    for (size_t round = 0; round < rounds; round++)
+    {
+        for (size_t i = 0; i < batch; i++)
+        {
+            objects[i] = (struct Object*) ExitIfNull(malloc(sizeof(struct Object)));
+            objects[i]->Field1 = (uint32_t) i;
+        }
+        for (size_t i = 0; i < batch; i++)
+        {
+            free(objects[i]);
+        }
+    }
+    return (double) (NowNs() - start) / (double) (batch * rounds);
+}
+
+static double PoolChurnNs(struct Object** objects, size_t batch, size_t rounds)
+{
+    struct ObjectPool* pool = (struct ObjectPool*) ExitIfNull(ObjectPoolCreate(64 * 1024));
+
+    const uint64_t start = NowNs();
+    for (size_t round = 0; round < rounds; round++)
+    {
+        for (size_t i = 0; i < batch; i++)
+        {
+            objects[i] = (struct Object*) ExitIfNull(ObjectPoolAlloc(pool));
+            objects[i]->Field1 = (uint32_t) i;
+        }
+        for (size_t i = 0; i < batch; i++)
+        {
+            ObjectPoolFree(pool, objects[i]);
+        }
+    }
+    const uint64_t elapsed = NowNs() - start;
+
+    ObjectPoolDestroy(pool);
+    return (double) elapsed / (double) (batch * rounds);
+}
+
+// Keeps count objects live at once and reports how many bytes each one
+// really costs, headers and rounding included.
+static double MallocBytesPerObject(struct Object** objects, size_t count)
+{
+    const size_t before = mallinfo2().uordblks;
+    for (size_t i = 0; i < count; i++)
+    {
+        objects[i] = (struct Object*) ExitIfNull(malloc(sizeof(struct Object)));
+    }
+    const size_t after = mallinfo2().uordblks;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        free(objects[i]);
+    }
+    return (double) (after - before) / (double) count;
+}
+
+static double PoolBytesPerObject(struct Object** objects, size_t count)
+{
+    struct ObjectPool* pool = (struct ObjectPool*) ExitIfNull(ObjectPoolCreate(64 * 1024));
+    for (size_t i = 0; i < count; i++)
+    {
+        objects[i] = (struct Object*) ExitIfNull(ObjectPoolAlloc(pool));
+    }
+    const double perObject = (double) ObjectPoolFootprint(pool) / (double) count;
+
+    ObjectPoolDestroy(pool);
+    return perObject;
+}
+
+void BenchPool(const struct BenchOptions* options)
+{
+    const size_t batch = 4096;
+    const size_t rounds = 2000 * options->Iterations;
+    const size_t liveCount = 1000000;
+
+    struct Object** objects = (struct Object**) ExitIfNull(malloc(liveCount * sizeof(struct Object*)));
+
+    const double mallocNs = MallocChurnNs(objects, batch, rounds);
+    const double poolNs = PoolChurnNs(objects, batch, rounds);
+    const double mallocBytes = MallocBytesPerObject(objects, liveCount);
+    const double poolBytes = PoolBytesPerObject(objects, liveCount);
+
+    printf("%-8s %10s %12s %14s\n", "engine", "ns/op", "Mops/s", "bytes/object");
+    printf("%-8s %10.2f %12.2f %14.2f\n", "glibc", mallocNs, 1000.0 / mallocNs, mallocBytes);
+    printf("%-8s %10.2f %12.2f %14.2f\n", "pool", poolNs, 1000.0 / poolNs, poolBytes);
+    printf("sizeof(struct Object) = %zu; pool speedup over glibc: %.2fx\n",
+           sizeof(struct Object), mallocNs / poolNs);
+
+    free(objects);
+}
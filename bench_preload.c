@@ -0,0 +1,184 @@
+// Benchmark: the LD_PRELOAD interposer versus glibc malloc.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <fcntl.h>
+#include <limits.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "objects.h"
+#include "timing.h"
+
+extern char** environ;
+
+// Set when we're running with libmallocdemo.so preloaded.
+extern int MallocDemoInterposed(void) __attribute__((weak));
+
+// The interposer and the demo binary are built next to this benchmark.
+static int SiblingPath(char* out, size_t outSize, const char* name)
+{
+    char self[PATH_MAX];
+    const ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (length < 0)
+    {
+        return -1;
+    }
+    self[length] = '\0';
+
+    char* slash = strrchr(self, '/');
+    if (slash != NULL)
+    {
+        *slash = '\0';
+    }
+
+    snprintf(out, outSize, "%s/%s", self, name);
+    return access(out, F_OK);
+}
+
+// Our environment without LD_PRELOAD, plus preload if it isn't NULL.
+static char** ChildEnvironment(const char* preload)
+{
+    size_t count = 0;
+    while (environ[count] != NULL)
+    {
+        count++;
+    }
+
+    char** env = (char**) calloc(count + 2, sizeof(char*));
+    if (env == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (strncmp(environ[i], "LD_PRELOAD=", 11) != 0)
+        {
+            env[n++] = environ[i];
+        }
+    }
+    if (preload != NULL)
+    {
+        env[n++] = (char*) preload;
+    }
+    return env;
+}
+
+// Runs the program runs times in a row and returns the total wall time
+// in seconds.
+static double TimeRuns(char* const argv[], char** env, size_t runs, int quiet)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (quiet)
+    {
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    }
+
+    const uint64_t start = NowNs();
+    for (size_t i = 0; i < runs; i++)
+    {
+        pid_t pid;
+        int status;
+        if (posix_spawn(&pid, argv[0], &actions, NULL, argv, env) != 0
+            || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            fprintf(stderr, "Running %s failed.\n", argv[0]);
+            exit(1);
+        }
+    }
+    const uint64_t elapsed = NowNs() - start;
+
+    posix_spawn_file_actions_destroy(&actions);
+    return (double) elapsed / 1e9;
+}
+
+void BenchPreloadWorkload(const struct BenchOptions* options)
+{
+    const size_t sizes[] = { sizeof(struct Object), sizeof(struct GiantObject), 1000 };
+    const size_t threads = 8;
+    const size_t rounds = 5000 * options->Iterations;
+
+    printf("  malloc is %s\n", MallocDemoInterposed != NULL ? "libmallocdemo.so" : "glibc");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        printf("  %zu threads, %4zu bytes: %8.2f Mops/s\n", threads, sizes[i],
+               BenchThreadedChurn(&GlibcEngine, sizes[i], threads, 64, rounds));
+    }
+}
+
+void BenchPreload(const struct BenchOptions* options)
+{
+    char library[PATH_MAX];
+    char demo[PATH_MAX];
+    char self[PATH_MAX];
+    char preload[PATH_MAX + 16];
+
+    if (SiblingPath(library, sizeof(library), "libmallocdemo.so") != 0)
+    {
+        printf("libmallocdemo.so isn't built next to the benchmark; skipping.\n");
+        return;
+    }
+    if (SiblingPath(demo, sizeof(demo), "main") != 0 && SiblingPath(demo, sizeof(demo), "AllocDemo") != 0)
+    {
+        printf("The demo binary isn't built next to the benchmark; skipping.\n");
+        return;
+    }
+    const ssize_t selfLength = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (selfLength < 0)
+    {
+        return;
+    }
+    self[selfLength] = '\0';
+    snprintf(preload, sizeof(preload), "LD_PRELOAD=%s", library);
+
+    char** glibcEnv = ChildEnvironment(NULL);
+    char** preloadEnv = ChildEnvironment(preload);
+
+    // Runs are short enough that process startup dominates, so do plenty.
+    const size_t runs = 200 * options->Iterations;
+    char* demoArgv[] = { demo, "-g", NULL };
+    const double glibcDemo = TimeRuns(demoArgv, glibcEnv, runs, 1);
+    const double preloadDemo = TimeRuns(demoArgv, preloadEnv, runs, 1);
+    printf("%zu runs of %s -g: glibc %.3fs, preloaded %.3fs (%.2fx)\n",
+           runs, demo, glibcDemo, preloadDemo, glibcDemo / preloadDemo);
+
+    char iterations[32];
+    snprintf(iterations, sizeof(iterations), "%zu", options->Iterations);
+    char* workloadArgv[] = { self, "-w", "-n", iterations, NULL };
+
+    printf("\nSynthetic multi-threaded workload on glibc:\n");
+    fflush(stdout);
+    const double glibcWorkload = TimeRuns(workloadArgv, glibcEnv, 1, 0);
+    printf("Same workload preloaded:\n");
+    fflush(stdout);
+    const double preloadWorkload = TimeRuns(workloadArgv, preloadEnv, 1, 0);
+    printf("Workload wall time: glibc %.3fs, preloaded %.3fs (%.2fx)\n",
+           glibcWorkload, preloadWorkload, glibcWorkload / preloadWorkload);
+
+    free(glibcEnv);
+    free(preloadEnv);
+}
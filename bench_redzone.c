@@ -0,0 +1,148 @@
+// Benchmarks redzone verification: scan throughput and cost per GiB freed.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "objects.h"
+#include "redzone.h"
+#include "timing.h"
+
+#define GIB (1024.0 * 1024.0 * 1024.0)
+
+// Times each scanner over a run of clean canary bytes, the common case.
+// The run fits in L2, like the zones of a block that's just been used.
+static void TimeScanners(const struct RedzoneScanner* scanners, size_t count, size_t iterations)
+{
+    const size_t length = 64 * 1024;
+    unsigned char* zone = (unsigned char*) malloc(length);
+    if (zone == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+    memset(zone, REDZONE_CANARY, length);
+
+    printf("Scanning %zu KiB of clean canary bytes over and over:\n", length / 1024);
+    printf("%10s %10s %14s\n", "scanner", "GiB/s", "ns per 32 B");
+    for (size_t s = 0; s < count; s++)
+    {
+        const size_t passes = 1024 * iterations;
+        size_t first, last;
+        int found = 0;
+        const uint64_t start = NowNs();
+        for (size_t pass = 0; pass < passes; pass++)
+        {
+            found |= scanners[s].Scan(zone, length, &first, &last);
+        }
+        const uint64_t elapsed = NowNs() - start;
+        if (found)
+        {
+            fprintf(stderr, "The %s scanner found a corrupted byte in a clean zone.\n", scanners[s].Name);
+        }
+
+        const double bytes = (double) length * (double) passes;
+        printf("%10s %10.2f %14.3f\n", scanners[s].Name, bytes / GIB / ((double) elapsed / 1e9),
+               (double) elapsed * 32.0 / bytes);
+    }
+    printf("\n");
+
+    free(zone);
+}
+
+// Returns the average ns it takes scan to check the zones of each of the
+// batch blocks.
+static double TimeChecks(void** blocks, size_t batch, RedzoneScanFunction scan, size_t rounds)
+{
+    int found = 0;
+    const uint64_t start = NowNs();
+    for (size_t round = 0; round < rounds; round++)
+    {
+        for (size_t i = 0; i < batch; i++)
+        {
+            found |= RedzoneCheck(blocks[i], scan);
+        }
+    }
+    const uint64_t elapsed = NowNs() - start;
+    if (found)
+    {
+        fprintf(stderr, "Found a corrupted redzone in a clean block.\n");
+    }
+    return (double) elapsed / (double) (batch * rounds);
+}
+
+void BenchRedzone(const struct BenchOptions* options)
+{
+    const size_t sizes[] = { sizeof(struct Object), 64, sizeof(struct GiantObject), 1024, 4096, 65536 };
+    const size_t batch = 1000;
+    const size_t rounds = 100 * options->Iterations;
+
+    size_t count;
+    const struct RedzoneScanner* scanners = RedzoneScanners(&count);
+    TimeScanners(scanners, count, options->Iterations);
+
+    void** blocks = (void**) malloc(batch * sizeof(void*));
+    if (blocks == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+
+    // A free only checks the two zones, so the cost per GiB freed falls
+    // as the blocks grow.
+    printf("Malloc + free in ns per pair, and checking a block's zones on free in ns per block and\n");
+    printf("ms per GiB freed. The redzone engine uses %s.\n\n", scanners[count - 1].Name);
+    printf("%8s %10s %10s", "size", "glibc", "redzone");
+    for (size_t s = 0; s < count; s++)
+    {
+        printf(" %10s %10s", scanners[s].Name, "ms/GiB");
+    }
+    printf("\n");
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        const double glibc = BenchChurn(&GlibcEngine, sizes[i], batch, rounds / 10 + 1);
+        const double redzone = BenchChurn(&RedzoneEngine, sizes[i], batch, rounds / 10 + 1);
+        printf("%8zu %10.1f %10.1f", sizes[i], glibc, redzone);
+
+        for (size_t b = 0; b < batch; b++)
+        {
+            blocks[b] = RedzoneMalloc(sizes[i]);
+            if (blocks[b] == NULL)
+            {
+                fprintf(stderr, "Out of memory.\n");
+                exit(OOM_EXIT_CODE);
+            }
+        }
+        for (size_t s = 0; s < count; s++)
+        {
+            const double ns = TimeChecks(blocks, batch, scanners[s].Scan, rounds);
+            printf(" %10.1f %10.2f", ns, ns * (GIB / (double) sizes[i]) / 1e6);
+        }
+        printf("\n");
+        for (size_t b = 0; b < batch; b++)
+        {
+            RedzoneFree(blocks[b]);
+        }
+    }
+
+    free(blocks);
+}
@@ -0,0 +1,142 @@
+// Benchmark: cross-thread frees on remote-free lists versus glibc.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "objects.h"
+#include "remote.h"
+#include "timing.h"
+
+// A single-producer, single-consumer ring that carries freshly allocated
+// objects from the allocating thread to the freeing thread.
+#define RING_SIZE 1024
+
+struct Handoff
+{
+    const struct AllocEngine* Engine;
+    size_t Count;
+
+    _Alignas(64) _Atomic size_t Head;
+    _Alignas(64) _Atomic size_t Tail;
+    _Alignas(64) struct GiantObject* Ring[RING_SIZE];
+
+    // One entry per free, filled in by the consumer.
+    uint64_t* FreeNs;
+};
+
+static void* Producer(void* arg)
+{
+    struct Handoff* handoff = (struct Handoff*) arg;
+    size_t head = 0;
+
+    for (size_t i = 0; i < handoff->Count; i++)
+    {
+        struct GiantObject* p = (struct GiantObject*) handoff->Engine->Malloc(sizeof(struct GiantObject));
+        if (p == NULL)
+        {
+            fprintf(stderr, "Out of memory.\n");
+            exit(OOM_EXIT_CODE);
+        }
+        p->Field01 = (int64_t) i;
+        p->Field20 = (int64_t) i;
+
+        while (head - atomic_load_explicit(&handoff->Tail, memory_order_acquire) == RING_SIZE)
+        {
+            sched_yield();
+        }
+        handoff->Ring[head % RING_SIZE] = p;
+        atomic_store_explicit(&handoff->Head, ++head, memory_order_release);
+    }
+
+    return NULL;
+}
+
+static void* Consumer(void* arg)
+{
+    struct Handoff* handoff = (struct Handoff*) arg;
+    size_t tail = 0;
+
+    for (size_t i = 0; i < handoff->Count; i++)
+    {
+        while (atomic_load_explicit(&handoff->Head, memory_order_acquire) == tail)
+        {
+            sched_yield();
+        }
+        struct GiantObject* p = handoff->Ring[tail % RING_SIZE];
+        atomic_store_explicit(&handoff->Tail, ++tail, memory_order_release);
+
+        const uint64_t start = NowNs();
+        handoff->Engine->Free(p);
+        handoff->FreeNs[i] = NowNs() - start;
+    }
+
+    return NULL;
+}
+
+static void RunHandoff(const struct AllocEngine* engine, size_t count)
+{
+    // calloc only promises 16-byte alignment, and Head, Tail and Ring have
+    // to be on cache lines of their own.
+    struct Handoff* handoff = (struct Handoff*) aligned_alloc(_Alignof(struct Handoff), sizeof(struct Handoff));
+    uint64_t* freeNs = (uint64_t*) malloc(count * sizeof(uint64_t));
+    if (handoff == NULL || freeNs == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+    memset(handoff, 0, sizeof(struct Handoff));
+
+    handoff->Engine = engine;
+    handoff->Count = count;
+    handoff->FreeNs = freeNs;
+
+    pthread_t producer;
+    pthread_t consumer;
+    const uint64_t start = NowNs();
+    pthread_create(&producer, NULL, Producer, handoff);
+    pthread_create(&consumer, NULL, Consumer, handoff);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+    const uint64_t elapsed = NowNs() - start;
+
+    printf("%-8s %12.2f %10llu %10llu %10llu\n", engine->Name,
+           (double) count * 1000.0 / (double) elapsed,
+           (unsigned long long) BenchPercentile(freeNs, count, 50.0),
+           (unsigned long long) BenchPercentile(freeNs, count, 99.0),
+           (unsigned long long) BenchPercentile(freeNs, count, 100.0));
+
+    free(freeNs);
+    free(handoff);
+}
+
+void BenchRemoteFree(const struct BenchOptions* options)
+{
+    const size_t count = 1000000 * options->Iterations;
+
+    printf("Thread A allocates %zu GiantObjects, thread B frees them.\n", count);
+    printf("%-8s %12s %10s %10s %10s\n", "engine", "Mobjects/s", "p50 ns", "p99 ns", "max ns");
+    RunHandoff(&GlibcEngine, count);
+    RunHandoff(&RemoteEngine, count);
+}
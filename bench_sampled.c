@@ -0,0 +1,172 @@
+// Benchmarks the sampling guard-page engine: overhead against detection rate.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "objects.h"
+#include "recover.h"
+#include "sampled.h"
+#include "tcache.h"
+
+// The overflow one of the demos makes, as a list of writes: Count writes
+// of Width bytes, starting Start bytes into a Size byte block and Width
+// bytes apart.
+struct OverflowScenario
+{
+    const char* Name;
+    size_t Size;
+    size_t Start;
+    size_t Width;
+    size_t Count;
+};
+
+static const struct OverflowScenario scenarios[] = {
+    // p2 = p1 + 4 and then p2->Field1 and p2->Field2 in an 8 byte block.
+    { "ObjectMallocDemo", sizeof(struct Object), sizeof(struct Object) / 2, sizeof(uint32_t), 2 },
+    // Every field of a GiantObject in a 2 byte block.
+    { "GiantObjectDemo", 2, 0, sizeof(int64_t), sizeof(struct GiantObject) / sizeof(int64_t) },
+};
+
+#define SCENARIO_COUNT (sizeof(scenarios) / sizeof(scenarios[0]))
+
+struct OverflowTrial
+{
+    const struct OverflowScenario* Scenario;
+    char* Block;
+    volatile size_t Done;
+    volatile uint64_t Saved[sizeof(struct GiantObject) / sizeof(int64_t)];
+};
+
+static void Overflow(void* context)
+{
+    struct OverflowTrial* trial = (struct OverflowTrial*) context;
+    const struct OverflowScenario* scenario = trial->Scenario;
+    for (trial->Done = 0; trial->Done < scenario->Count; trial->Done++)
+    {
+        volatile char* at = trial->Block + scenario->Start + trial->Done * scenario->Width;
+        if (scenario->Width == sizeof(uint32_t))
+        {
+            trial->Saved[trial->Done] = *(volatile uint32_t*) at;
+            *(volatile uint32_t*) at = 0xDEADBEEF;
+        }
+        else
+        {
+            trial->Saved[trial->Done] = *(volatile uint64_t*) at;
+            *(volatile uint64_t*) at = 0x89ABCDEF;
+        }
+    }
+}
+
+// Runs the scenario trials times and returns how many faulted. Whatever
+// didn't fault is put back the way it was, so the heap under an unsampled
+// block isn't left corrupted.
+static size_t CountDetections(const struct AllocEngine* engine, const struct OverflowScenario* scenario,
+                              size_t trials)
+{
+    size_t detected = 0;
+    struct OverflowTrial trial;
+    trial.Scenario = scenario;
+
+    for (size_t i = 0; i < trials; i++)
+    {
+        trial.Block = (char*) engine->Malloc(scenario->Size);
+        if (trial.Block == NULL)
+        {
+            fprintf(stderr, "Out of memory.\n");
+            exit(OOM_EXIT_CODE);
+        }
+
+        struct RecoverFault fault;
+        detected += (size_t) RecoverRun(Overflow, &trial, &fault);
+
+        for (size_t done = trial.Done; done-- > 0;)
+        {
+            volatile char* at = trial.Block + scenario->Start + done * scenario->Width;
+            if (scenario->Width == sizeof(uint32_t))
+            {
+                *(volatile uint32_t*) at = (uint32_t) trial.Saved[done];
+            }
+            else
+            {
+                *(volatile uint64_t*) at = trial.Saved[done];
+            }
+        }
+        engine->Free(trial.Block);
+    }
+
+    return detected;
+}
+
+void BenchSampled(const struct BenchOptions* options)
+{
+    const unsigned rates[] = { 1, 10, 100, 1000, 10000 };
+    const size_t trials = 100000 * options->Iterations;
+    const size_t batch = 64;
+    const size_t rounds = 5000 * options->Iterations;
+
+    // Set the pool up (and with it, its fault handler) first, so the
+    // handler that recovers from the faults gets them before it does and
+    // the benchmark isn't drowned in fault reports.
+    SampledRate();
+    if (RecoverInstall() != 0)
+    {
+        perror("Couldn't catch faults");
+        return;
+    }
+
+    printf("Overhead is ns per malloc + free of an ObjectMallocDemo-sized block; detected is the\n");
+    printf("share of %zu overflows caught, repeating each demo's overflow on a fresh block.\n\n", trials);
+    printf("%10s %12s %10s", "rate", "ns/op", "sampled");
+    for (size_t s = 0; s < SCENARIO_COUNT; s++)
+    {
+        printf(" %18s", scenarios[s].Name);
+    }
+    printf("\n");
+
+    printf("%10s %12.1f %10s", "tcache", BenchChurn(&TCacheEngine, sizeof(struct Object), batch, rounds), "-");
+    for (size_t s = 0; s < SCENARIO_COUNT; s++)
+    {
+        const size_t detected = CountDetections(&TCacheEngine, &scenarios[s], trials);
+        printf(" %17.2f%%", 100.0 * (double) detected / (double) trials);
+    }
+    printf("\n");
+
+    for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++)
+    {
+        SampledSetRate(rates[r]);
+        const size_t sampledBefore = SampledCount();
+        const double ns = BenchChurn(&SampledEngine, sizeof(struct Object), batch, rounds);
+        const size_t sampled = SampledCount() - sampledBefore;
+
+        char rate[16];
+        snprintf(rate, sizeof(rate), "1/%u", rates[r]);
+        printf("%10s %12.1f %9.3f%%", rate, ns, 100.0 * (double) sampled / (double) (batch * rounds));
+        for (size_t s = 0; s < SCENARIO_COUNT; s++)
+        {
+            const size_t detected = CountDetections(&SampledEngine, &scenarios[s], trials);
+            printf(" %17.2f%%", 100.0 * (double) detected / (double) trials);
+        }
+        printf("\n");
+    }
+
+    SampledSetRate(SAMPLED_DEFAULT_RATE);
+}
@@ -0,0 +1,118 @@
+// Benchmarks checked field writes against unchecked ones.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "objects.h"
+#include "shadow.h"
+#include "timing.h"
+#include "tlsf.h"
+
+#define UNCHECKED(field, value) p->field = (value)
+
+#define CHECKED(field, value) \
+    { \
+        if (!ShadowIsAddressable(shadow, (const void*) &p->field, sizeof(p->field))) \
+        { \
+            return -1; \
+        } \
+        p->field = (value); \
+    }
+
+// Every field of the demo's GiantObject, written the way WRITE(field,
+// value) says.
+#define WRITE_EVERY_FIELD(WRITE, i) \
+    WRITE(Field01, i); WRITE(Field02, i); WRITE(Field03, i); WRITE(Field04, i); WRITE(Field05, i); \
+    WRITE(Field06, i); WRITE(Field07, i); WRITE(Field08, i); WRITE(Field09, i); WRITE(Field10, i); \
+    WRITE(Field11, i); WRITE(Field12, i); WRITE(Field13, i); WRITE(Field14, i); WRITE(Field15, i); \
+    WRITE(Field16, i); WRITE(Field17, i); WRITE(Field18, i); WRITE(Field19, i); WRITE(Field20, i)
+
+#define FIELD_COUNT (sizeof(struct GiantObject) / sizeof(int64_t))
+
+// The volatile keeps every store, so both loops do the same writes.
+static int WriteUnchecked(volatile struct GiantObject* p, size_t rounds)
+{
+    for (size_t i = 0; i < rounds; i++)
+    {
+        WRITE_EVERY_FIELD(UNCHECKED, (int64_t) i);
+    }
+    return 0;
+}
+
+static int WriteChecked(volatile struct GiantObject* p, const struct Shadow* shadow, size_t rounds)
+{
+    for (size_t i = 0; i < rounds; i++)
+    {
+        WRITE_EVERY_FIELD(CHECKED, (int64_t) i);
+    }
+    return 0;
+}
+
+// Returns ns per field write, or a negative number if a check failed.
+static double TimeWrites(struct GiantObject* p, const struct Shadow* shadow, size_t rounds)
+{
+    const uint64_t start = NowNs();
+    const int result = shadow == NULL ? WriteUnchecked(p, rounds) : WriteChecked(p, shadow, rounds);
+    const uint64_t elapsed = NowNs() - start;
+    return result != 0 ? -1.0 : (double) elapsed / (double) (rounds * FIELD_COUNT);
+}
+
+void BenchShadow(const struct BenchOptions* options)
+{
+    const size_t rounds = 2000000 * options->Iterations;
+    const struct Shadow* shadow = ShadowEngineState();
+
+    struct GiantObject* onShadow = (struct GiantObject*) ShadowMalloc(sizeof(struct GiantObject));
+    struct GiantObject* onGlibc = (struct GiantObject*) malloc(sizeof(struct GiantObject));
+    if (onShadow == NULL || onGlibc == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+
+    // A block off the shadow heap is checked too, but it's outside the
+    // region so the check gives up after the range test.
+    const double unchecked = TimeWrites(onShadow, NULL, rounds);
+    const double checked = TimeWrites(onShadow, shadow, rounds);
+    const double outside = TimeWrites(onGlibc, shadow, rounds);
+
+    printf("Writing every field of a whole GiantObject, ns per field write:\n\n");
+    printf("%-36s %10.3f\n", "unchecked", unchecked);
+    printf("%-36s %10.3f %+9.1f%%\n", "checked, shadow engine block", checked,
+           100.0 * (checked - unchecked) / unchecked);
+    printf("%-36s %10.3f %+9.1f%%\n", "checked, block outside the shadow", outside,
+           100.0 * (outside - unchecked) / unchecked);
+
+    ShadowFree(onShadow);
+    free(onGlibc);
+
+    // The shadow engine also pays for poisoning on every malloc and free.
+    const size_t sizes[] = { 2, sizeof(struct Object), sizeof(struct GiantObject), 1024 };
+    printf("\nMalloc + free, ns per pair:\n\n");
+    printf("%8s %10s %10s %10s\n", "size", "glibc", "tlsf", "shadow");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        const size_t churnRounds = 200 * options->Iterations;
+        printf("%8zu %10.1f %10.1f %10.1f\n", sizes[i], BenchChurn(&GlibcEngine, sizes[i], 1000, churnRounds),
+               BenchChurn(&TlsfEngine, sizes[i], 1000, churnRounds),
+               BenchChurn(&ShadowEngine, sizes[i], 1000, churnRounds));
+    }
+}
@@ -0,0 +1,124 @@
+// Benchmark: size-class allocator fragmentation and throughput.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "objects.h"
+#include "sizeclass.h"
+
+// How much of the usable block the request leaves empty, on both
+// allocators, for one request size.
+static void Waste(size_t request, size_t* ours, size_t* glibc)
+{
+    void* p = malloc(request);
+    if (p == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+
+    *glibc = malloc_usable_size(p) - request;
+    free(p);
+
+    *ours = SizeClassSize(SizeClassIndex(request)) - request;
+}
+
+static void PrintClassReport(void)
+{
+    printf("Internal fragmentation per class, averaged over every request size the class serves.\n"
+           "glibc is malloc_usable_size for the same requests.\n");
+    printf("%5s %6s %12s %16s %16s\n", "class", "size", "requests", "ours avg waste", "glibc avg waste");
+
+    size_t first = 1;
+    for (size_t index = 0; index < SIZE_CLASS_COUNT; index++)
+    {
+        const size_t last = SizeClassSize(index);
+        size_t oursTotal = 0;
+        size_t glibcTotal = 0;
+        double oursPercent = 0;
+        double glibcPercent = 0;
+
+        for (size_t request = first; request <= last; request++)
+        {
+            size_t ours;
+            size_t glibc;
+            Waste(request, &ours, &glibc);
+            oursTotal += ours;
+            glibcTotal += glibc;
+            oursPercent += 100.0 * (double) ours / (double) (request + ours);
+            glibcPercent += 100.0 * (double) glibc / (double) (request + glibc);
+        }
+
+        const double n = (double) (last - first + 1);
+        printf("%5zu %6zu %5zu..%-5zu %7.1fB %5.1f%% %7.1fB %5.1f%%\n",
+               index, last, first, last,
+               (double) oursTotal / n, oursPercent / n,
+               (double) glibcTotal / n, glibcPercent / n);
+        first = last + 1;
+    }
+}
+
+static void PrintDemoReport(void)
+{
+    // The request sizes main.c actually makes.
+    const struct
+    {
+        const char* Demo;
+        size_t Request;
+    } requests[] = {
+        { "IntMallocDemo", 1 },
+        { "GiantObjectDemo", 2 },
+        { "ObjectMallocDemo", sizeof(struct Object) },
+        { "sizeof(GiantObject)", sizeof(struct GiantObject) },
+    };
+
+    printf("\nThe demo requests:\n");
+    printf("%-20s %8s %6s %11s %12s %11s\n", "demo", "request", "class", "class size", "glibc usable", "ours waste");
+    for (size_t i = 0; i < sizeof(requests) / sizeof(requests[0]); i++)
+    {
+        size_t ours;
+        size_t glibc;
+        Waste(requests[i].Request, &ours, &glibc);
+        printf("%-20s %8zu %6zu %11zu %12zu %10zuB\n", requests[i].Demo, requests[i].Request,
+               SizeClassIndex(requests[i].Request), requests[i].Request + ours,
+               requests[i].Request + glibc, ours);
+    }
+}
+
+void BenchSizeClass(const struct BenchOptions* options)
+{
+    PrintClassReport();
+    PrintDemoReport();
+
+    const size_t batch = 4096;
+    const size_t rounds = 1000 * options->Iterations;
+    const size_t sizes[] = { sizeof(struct Object), sizeof(struct GiantObject) };
+
+    printf("\n%-8s %8s %10s\n", "engine", "size", "ns/op");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        printf("%-8s %8zu %10.2f\n", GlibcEngine.Name, sizes[i],
+               BenchChurn(&GlibcEngine, sizes[i], batch, rounds));
+        printf("%-8s %8zu %10.2f\n", "segreg.", sizes[i],
+               BenchChurn(&SizeClassEngine, sizes[i], batch, rounds));
+    }
+}
@@ -0,0 +1,271 @@
+// A suite of allocator microbenchmarks run on every engine, with hardware counters.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "objects.h"
+#include "perfcounters.h"
+#include "timing.h"
+
+// Each measurement is the median of this many runs, after one warm-up run.
+#define SUITE_RUNS 5
+
+#define SUITE_WINDOW 1024
+#define SUITE_MAX_RANDOM_SIZE 1024
+#define SUITE_BATCH 4000
+
+// A workload the suite runs on every engine. Run does about ops mallocs,
+// each with its matching free, and returns how many it did, or 0 if the
+// engine refused one of them.
+struct SuiteScenario
+{
+    const char* Name;
+    const char* Description;
+    size_t (*Run)(const struct AllocEngine* engine, void** ptrs, size_t ops);
+    size_t Ops;
+};
+
+// Frees the first count blocks in ptrs, in order or in reverse.
+static void FreeAll(const struct AllocEngine* engine, void** ptrs, size_t count, int reverse)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        engine->Free(ptrs[reverse ? count - 1 - i : i]);
+    }
+}
+
+static size_t Churn(const struct AllocEngine* engine, size_t size, size_t ops)
+{
+    for (size_t i = 0; i < ops; i++)
+    {
+        char* p = (char*) engine->Malloc(size);
+        if (p == NULL)
+        {
+            return 0;
+        }
+        p[0] = (char) i;
+        engine->Free(p);
+    }
+    return ops;
+}
+
+static size_t ObjectChurn(const struct AllocEngine* engine, void** ptrs, size_t ops)
+{
+    (void) ptrs;
+    return Churn(engine, sizeof(struct Object), ops);
+}
+
+static size_t GiantChurn(const struct AllocEngine* engine, void** ptrs, size_t ops)
+{
+    (void) ptrs;
+    return Churn(engine, sizeof(struct GiantObject), ops);
+}
+
+static uint32_t NextRandom(uint32_t* state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// Keeps a window of live blocks and replaces a random one each op with a
+// block of a random size. The seed is fixed, so every engine sees the same
+// sizes in the same order.
+static size_t RandomChurn(const struct AllocEngine* engine, void** ptrs, size_t ops)
+{
+    uint32_t rng = 0x2545F491;
+    size_t live = 0;
+    size_t done = 0;
+    for (; live < SUITE_WINDOW; live++)
+    {
+        ptrs[live] = engine->Malloc(1 + NextRandom(&rng) % SUITE_MAX_RANDOM_SIZE);
+        if (ptrs[live] == NULL)
+        {
+            break;
+        }
+    }
+
+    if (live == SUITE_WINDOW)
+    {
+        for (done = SUITE_WINDOW; done < ops; done++)
+        {
+            const size_t slot = NextRandom(&rng) % SUITE_WINDOW;
+            engine->Free(ptrs[slot]);
+            ptrs[slot] = engine->Malloc(1 + NextRandom(&rng) % SUITE_MAX_RANDOM_SIZE);
+            if (ptrs[slot] == NULL)
+            {
+                ptrs[slot] = ptrs[--live];
+                break;
+            }
+        }
+    }
+
+    FreeAll(engine, ptrs, live, 0);
+    return done >= ops ? ops : 0;
+}
+
+// Allocates a batch of Objects, then frees every one of them in
+// allocation order (FIFO) or the reverse (LIFO), over and over.
+static size_t AllThenFree(const struct AllocEngine* engine, void** ptrs, size_t ops, int reverse)
+{
+    size_t done = 0;
+    while (done < ops)
+    {
+        for (size_t i = 0; i < SUITE_BATCH; i++)
+        {
+            ptrs[i] = engine->Malloc(sizeof(struct Object));
+            if (ptrs[i] == NULL)
+            {
+                FreeAll(engine, ptrs, i, reverse);
+                return 0;
+            }
+            ((char*) ptrs[i])[0] = (char) i;
+        }
+        FreeAll(engine, ptrs, SUITE_BATCH, reverse);
+        done += SUITE_BATCH;
+    }
+    return done;
+}
+
+static size_t AllThenFreeFifo(const struct AllocEngine* engine, void** ptrs, size_t ops)
+{
+    return AllThenFree(engine, ptrs, ops, 0);
+}
+
+static size_t AllThenFreeLifo(const struct AllocEngine* engine, void** ptrs, size_t ops)
+{
+    return AllThenFree(engine, ptrs, ops, 1);
+}
+
+static const struct SuiteScenario scenarios[] = {
+    { "object churn", "malloc and free one Object-sized block at a time", ObjectChurn, 200000 },
+    { "giant churn", "malloc and free one GiantObject-sized block at a time", GiantChurn, 200000 },
+    { "random churn", "replace a random one of 1024 live blocks with one of 1 to 1024 bytes", RandomChurn, 200000 },
+    { "all then fifo", "malloc 4000 Objects, then free them oldest first", AllThenFreeFifo, 100000 },
+    { "all then lifo", "malloc 4000 Objects, then free them newest first", AllThenFreeLifo, 100000 },
+};
+
+struct SuiteResult
+{
+    uint64_t Ns;
+    struct PerfReading Counters;
+};
+
+static int CompareResults(const void* a, const void* b)
+{
+    const uint64_t x = ((const struct SuiteResult*) a)->Ns;
+    const uint64_t y = ((const struct SuiteResult*) b)->Ns;
+    return (x > y) - (x < y);
+}
+
+// Runs the scenario SUITE_RUNS times on the engine and puts the median
+// run in median. Returns the ops in a run, or 0 if the engine refused.
+static size_t Measure(const struct SuiteScenario* scenario, const struct AllocEngine* engine, void** ptrs,
+                      size_t ops, struct PerfCounters* counters, struct SuiteResult* median)
+{
+    struct SuiteResult results[SUITE_RUNS];
+    size_t done = scenario->Run(engine, ptrs, ops);
+    for (size_t run = 0; run < SUITE_RUNS && done > 0; run++)
+    {
+        if (engine->Reset != NULL)
+        {
+            engine->Reset();
+        }
+
+        const uint64_t start = NowNs();
+        PerfCountersStart(counters);
+        done = scenario->Run(engine, ptrs, ops);
+        PerfCountersStop(counters, &results[run].Counters);
+        results[run].Ns = NowNs() - start;
+    }
+
+    if (engine->Reset != NULL)
+    {
+        engine->Reset();
+    }
+    if (done == 0)
+    {
+        return 0;
+    }
+
+    qsort(results, SUITE_RUNS, sizeof(results[0]), CompareResults);
+    *median = results[SUITE_RUNS / 2];
+    return done;
+}
+
+static void PrintPerOp(const struct PerfReading* reading, enum PerfEvent event, size_t ops)
+{
+    if (reading->Valid & (1u << event))
+    {
+        printf(" %14.2f", (double) reading->Values[event] / (double) ops);
+    }
+    else
+    {
+        printf(" %14s", "-");
+    }
+}
+
+void BenchSuite(const struct BenchOptions* options)
+{
+    struct PerfCounters counters;
+    PerfCountersOpen(&counters, 0);
+    PerfCountersPrintMissing(stdout, &counters);
+
+    void** ptrs = (void**) malloc(SUITE_BATCH * sizeof(void*));
+    if (ptrs == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+
+    size_t engineCount;
+    const struct AllocEngine* const* engines = EngineList(&engineCount);
+
+    printf("An op is one malloc and its free. Each number is from the median of %d runs.\n", SUITE_RUNS);
+    for (size_t s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++)
+    {
+        const struct SuiteScenario* scenario = &scenarios[s];
+        printf("\n%s: %s\n", scenario->Name, scenario->Description);
+        printf("%12s %10s %14s %14s\n", "engine", "ns/op", "instr/op", "LLC miss/op");
+
+        for (size_t e = 0; e < engineCount; e++)
+        {
+            struct SuiteResult result;
+            const size_t ops = Measure(scenario, engines[e], ptrs, scenario->Ops * options->Iterations,
+                                       &counters, &result);
+            if (ops == 0)
+            {
+                printf("%12s %10s\n", engines[e]->Name, "refused");
+                continue;
+            }
+
+            printf("%12s %10.1f", engines[e]->Name, (double) result.Ns / (double) ops);
+            PrintPerOp(&result.Counters, PERF_EVENT_INSTRUCTIONS, ops);
+            PrintPerOp(&result.Counters, PERF_EVENT_LLC_MISSES, ops);
+            printf("\n");
+        }
+    }
+
+    free(ptrs);
+    PerfCountersClose(&counters);
+}
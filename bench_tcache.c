@@ -0,0 +1,167 @@
+// Benchmark: thread-cache engine scaling versus glibc.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "objects.h"
+#include "tcache.h"
+#include "timing.h"
+
+// Big enough that every round overflows the freeing thread's cache and
+// drains the allocating one's, so it's the central heap that's measured.
+#define CROSS_BATCH 256
+
+struct CrossShared
+{
+    pthread_barrier_t Round;
+    const struct AllocEngine* Engine;
+    size_t Size;
+    size_t Threads;
+    size_t Rounds;
+
+    // Threads * CROSS_BATCH blocks; thread i allocates into the i-th run
+    // of them and frees the run of thread i + 1.
+    void** Blocks;
+};
+
+struct CrossThread
+{
+    pthread_t Thread;
+    struct CrossShared* Shared;
+    size_t Index;
+    uint64_t Begin;
+    uint64_t End;
+};
+
+static void* CrossThreadMain(void* arg)
+{
+    struct CrossThread* thread = (struct CrossThread*) arg;
+    struct CrossShared* shared = thread->Shared;
+    void** mine = shared->Blocks + thread->Index * CROSS_BATCH;
+    void** theirs = shared->Blocks + (thread->Index + 1) % shared->Threads * CROSS_BATCH;
+
+    pthread_barrier_wait(&shared->Round);
+    thread->Begin = NowNs();
+    for (size_t round = 0; round < shared->Rounds; round++)
+    {
+        for (size_t i = 0; i < CROSS_BATCH; i++)
+        {
+            char* p = (char*) shared->Engine->Malloc(shared->Size);
+            if (p == NULL)
+            {
+                fprintf(stderr, "Out of memory.\n");
+                exit(OOM_EXIT_CODE);
+            }
+            p[0] = (char) i;
+            mine[i] = p;
+        }
+
+        pthread_barrier_wait(&shared->Round);
+        for (size_t i = 0; i < CROSS_BATCH; i++)
+        {
+            shared->Engine->Free(theirs[i]);
+        }
+        pthread_barrier_wait(&shared->Round);
+    }
+    thread->End = NowNs();
+    return NULL;
+}
+
+// Every thread frees what its neighbour allocated. Returns the combined
+// millions of allocate/free pairs per second.
+static double CrossThreadChurn(const struct AllocEngine* engine, size_t size, size_t threads, size_t rounds)
+{
+    struct CrossShared shared = { .Engine = engine, .Size = size, .Threads = threads, .Rounds = rounds };
+    struct CrossThread* workers = (struct CrossThread*) calloc(threads, sizeof(struct CrossThread));
+    shared.Blocks = (void**) malloc(threads * CROSS_BATCH * sizeof(void*));
+    if (workers == NULL || shared.Blocks == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+
+    pthread_barrier_init(&shared.Round, NULL, (unsigned) threads);
+    for (size_t i = 0; i < threads; i++)
+    {
+        workers[i].Shared = &shared;
+        workers[i].Index = i;
+        if (pthread_create(&workers[i].Thread, NULL, CrossThreadMain, &workers[i]) != 0)
+        {
+            fprintf(stderr, "Couldn't create thread %zu.\n", i);
+            exit(1);
+        }
+    }
+
+    uint64_t begin = UINT64_MAX;
+    uint64_t end = 0;
+    for (size_t i = 0; i < threads; i++)
+    {
+        pthread_join(workers[i].Thread, NULL);
+        begin = workers[i].Begin < begin ? workers[i].Begin : begin;
+        end = workers[i].End > end ? workers[i].End : end;
+    }
+
+    pthread_barrier_destroy(&shared.Round);
+    free(shared.Blocks);
+    free(workers);
+    return (double) (threads * CROSS_BATCH * rounds) * 1000.0 / (double) (end - begin);
+}
+
+void BenchTCache(const struct BenchOptions* options)
+{
+    // Small batches so a thread's working set stays inside its cache,
+    // which is the case thread caches are built for.
+    const size_t batch = 16;
+    const size_t rounds = 20000 * options->Iterations;
+    const size_t threadCounts[] = { 1, 2, 4, 8, 16, 32, 64 };
+    const size_t sizes[] = { sizeof(struct Object), sizeof(struct GiantObject) };
+
+    printf("Combined Mops/s (allocate/free pairs) across all threads.\n");
+    printf("%8s %6s %10s %10s %8s\n", "threads", "size", "glibc", "tcache", "ratio");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        for (size_t t = 0; t < sizeof(threadCounts) / sizeof(threadCounts[0]); t++)
+        {
+            const double glibc = BenchThreadedChurn(&GlibcEngine, sizes[s], threadCounts[t], batch, rounds);
+            const double tcache = BenchThreadedChurn(&TCacheEngine, sizes[s], threadCounts[t], batch, rounds);
+            printf("%8zu %6zu %10.2f %10.2f %7.2fx\n", threadCounts[t], sizes[s], glibc, tcache, tcache / glibc);
+        }
+    }
+
+    // Here every free lands on a thread that didn't allocate the block, in
+    // batches bigger than a thread cache holds, so blocks keep moving
+    // through the central free lists.
+    const size_t crossRounds = 2000 * options->Iterations;
+    const size_t crossThreads[] = { 2, 4, 8, 16 };
+    printf("\nEach thread frees its neighbour's %d blocks every round, Mops/s:\n", CROSS_BATCH);
+    printf("%8s %6s %10s %10s %8s\n", "threads", "size", "glibc", "tcache", "ratio");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        for (size_t t = 0; t < sizeof(crossThreads) / sizeof(crossThreads[0]); t++)
+        {
+            const double glibc = CrossThreadChurn(&GlibcEngine, sizes[s], crossThreads[t], crossRounds);
+            const double tcache = CrossThreadChurn(&TCacheEngine, sizes[s], crossThreads[t], crossRounds);
+            printf("%8zu %6zu %10.2f %10.2f %7.2fx\n", crossThreads[t], sizes[s], glibc, tcache, tcache / glibc);
+        }
+    }
+}
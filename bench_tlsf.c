@@ -0,0 +1,258 @@
+// Benchmark: TLSF versus glibc malloc/free latency.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "objects.h"
+#include "timing.h"
+#include "tlsf.h"
+
+// Mostly the demos' request sizes, with the occasional bigger buffer so
+// glibc has to do some of its slower work (consolidating, trimming and
+// mmap'ing) now and then.
+static size_t NextRequest(unsigned* seed)
+{
+    const int pick = rand_r(seed) % 100;
+    if (pick < 40)
+    {
+        return sizeof(struct Object);
+    }
+    if (pick < 70)
+    {
+        return sizeof(struct GiantObject);
+    }
+    if (pick < 80)
+    {
+        return 2;
+    }
+    if (pick < 99)
+    {
+        return 16 + (size_t) rand_r(seed) % 4096;
+    }
+    return 64 * 1024 + (size_t) rand_r(seed) % (256 * 1024);
+}
+
+// Times every single malloc and free of a random trace that keeps up to
+// maxLive allocations around.
+static void TimeTrace(const struct AllocEngine* engine, size_t steps, size_t maxLive, uint64_t* firstNs,
+                      uint64_t* mallocNs, uint64_t* freeNs, size_t* mallocCount, size_t* freeCount)
+{
+    void** live = (void**) malloc(maxLive * sizeof(void*));
+    if (live == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+
+    // The engines set themselves up on their first malloc. That's timed on
+    // its own, and kept out of the rest of the numbers.
+    const uint64_t firstStart = NowNs();
+    void* first = engine->Malloc(1);
+    *firstNs = NowNs() - firstStart;
+    engine->Free(first);
+
+    unsigned seed = 392;
+    size_t liveCount = 0;
+    *mallocCount = 0;
+    *freeCount = 0;
+
+    for (size_t step = 0; step < steps; step++)
+    {
+        if (liveCount < maxLive && (liveCount == 0 || rand_r(&seed) % 2 == 0))
+        {
+            const size_t size = NextRequest(&seed);
+            const uint64_t start = NowNs();
+            char* p = (char*) engine->Malloc(size);
+            mallocNs[(*mallocCount)++] = NowNs() - start;
+
+            if (p == NULL)
+            {
+                fprintf(stderr, "Out of memory.\n");
+                exit(OOM_EXIT_CODE);
+            }
+            p[0] = 1;
+            live[liveCount++] = p;
+        }
+        else
+        {
+            const size_t victim = (size_t) rand_r(&seed) % liveCount;
+            void* p = live[victim];
+            live[victim] = live[--liveCount];
+
+            const uint64_t start = NowNs();
+            engine->Free(p);
+            freeNs[(*freeCount)++] = NowNs() - start;
+        }
+    }
+
+    for (size_t i = 0; i < liveCount; i++)
+    {
+        engine->Free(live[i]);
+    }
+    free(live);
+}
+
+// Counts samples into power-of-two buckets: bucket b holds [2^b, 2^(b+1)) ns.
+#define HISTOGRAM_BUCKETS 24
+
+static void Histogram(const uint64_t* samples, size_t count, size_t* buckets)
+{
+    for (size_t b = 0; b < HISTOGRAM_BUCKETS; b++)
+    {
+        buckets[b] = 0;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t b = samples[i] == 0 ? 0 : (size_t) (63 - __builtin_clzll(samples[i]));
+        buckets[b < HISTOGRAM_BUCKETS ? b : HISTOGRAM_BUCKETS - 1]++;
+    }
+}
+
+// One column of the comparison: an engine, and what timing it recorded.
+struct LatencyColumn
+{
+    const char* Name;
+    const struct AllocEngine* Engine;
+    uint64_t FirstNs;
+    uint64_t* MallocNs;
+    uint64_t* FreeNs;
+    size_t Mallocs;
+    size_t Frees;
+};
+
+#define LATENCY_COLUMNS 3
+
+static void PrintLatency(const char* operation, const struct LatencyColumn* columns, int freeTimes)
+{
+    size_t buckets[LATENCY_COLUMNS][HISTOGRAM_BUCKETS];
+    printf("%s latency histogram (ns, includes the clock read):\n%20s", operation, "bucket");
+    for (size_t c = 0; c < LATENCY_COLUMNS; c++)
+    {
+        Histogram(freeTimes ? columns[c].FreeNs : columns[c].MallocNs,
+                  freeTimes ? columns[c].Frees : columns[c].Mallocs, buckets[c]);
+        printf(" %14s", columns[c].Name);
+    }
+    printf("\n");
+
+    for (size_t b = 0; b < HISTOGRAM_BUCKETS; b++)
+    {
+        if (buckets[0][b] == 0 && buckets[1][b] == 0 && buckets[2][b] == 0)
+        {
+            continue;
+        }
+        printf("  [%7llu, %7llu)", 1ull << b, 1ull << (b + 1));
+        for (size_t c = 0; c < LATENCY_COLUMNS; c++)
+        {
+            printf(" %14zu", buckets[c][b]);
+        }
+        printf("\n");
+    }
+
+    const double percentiles[] = { 50.0, 99.0, 99.9, 99.99, 100.0 };
+    const char* names[] = { "p50", "p99", "p99.9", "p99.99", "max" };
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+    {
+        printf("%20s", names[i]);
+        for (size_t c = 0; c < LATENCY_COLUMNS; c++)
+        {
+            printf(" %14llu", (unsigned long long) (freeTimes
+                ? BenchPercentile(columns[c].FreeNs, columns[c].Frees, percentiles[i])
+                : BenchPercentile(columns[c].MallocNs, columns[c].Mallocs, percentiles[i])));
+        }
+        printf("\n");
+    }
+}
+
+// A TLSF heap of the engine's size that's been faulted in ahead of time
+// with TlsfPopulate(), so its calls never take a page fault.
+static struct Tlsf populatedTlsf;
+
+static void* PopulatedMalloc(size_t size)
+{
+    if (populatedTlsf.Memory == NULL)
+    {
+        if (TlsfInit(&populatedTlsf, (size_t) 64 * 1024 * 1024) != 0)
+        {
+            return NULL;
+        }
+        TlsfPopulate(&populatedTlsf);
+    }
+    return TlsfMalloc(&populatedTlsf, size);
+}
+
+static void PopulatedFree(void* ptr)
+{
+    TlsfFree(&populatedTlsf, ptr);
+}
+
+static const struct AllocEngine populatedEngine = {
+    .Name = "tlsf populated",
+    .Malloc = PopulatedMalloc,
+    .Free = PopulatedFree,
+};
+
+void BenchTlsf(const struct BenchOptions* options)
+{
+    const size_t steps = 2000000 * options->Iterations;
+    const size_t maxLive = 20000;
+
+    uint64_t* samples = (uint64_t*) malloc(2 * LATENCY_COLUMNS * steps * sizeof(uint64_t));
+    if (samples == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+
+    // The tlsf engine's pages fault in as it uses them; the populated heap
+    // pays for all of them in its first malloc instead.
+    struct LatencyColumn columns[LATENCY_COLUMNS] = {
+        { .Name = "glibc", .Engine = &GlibcEngine },
+        { .Name = "tlsf", .Engine = &TlsfEngine },
+        { .Name = "tlsf populated", .Engine = &populatedEngine },
+    };
+    for (size_t c = 0; c < LATENCY_COLUMNS; c++)
+    {
+        columns[c].MallocNs = samples + 2 * c * steps;
+        columns[c].FreeNs = samples + (2 * c + 1) * steps;
+        TimeTrace(columns[c].Engine, steps, maxLive, &columns[c].FirstNs, columns[c].MallocNs, columns[c].FreeNs,
+                  &columns[c].Mallocs, &columns[c].Frees);
+    }
+
+    printf("%20s", "");
+    for (size_t c = 0; c < LATENCY_COLUMNS; c++)
+    {
+        printf(" %14s", columns[c].Name);
+    }
+    printf("\n%20s", "first malloc (ns)");
+    for (size_t c = 0; c < LATENCY_COLUMNS; c++)
+    {
+        printf(" %14llu", (unsigned long long) columns[c].FirstNs);
+    }
+    printf("\n\n");
+
+    PrintLatency("malloc", columns, 0);
+    printf("\n");
+    PrintLatency("free", columns, 1);
+
+    TlsfDestroy(&populatedTlsf);
+    free(samples);
+}
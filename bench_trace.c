@@ -0,0 +1,238 @@
+// Benchmark: allocation tracer overhead.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#include <limits.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "objects.h"
+#include "timing.h"
+#include "trace.h"
+
+extern char** environ;
+
+struct LoopTime
+{
+    // Wall clock and the allocating thread's own CPU time, per object.
+    double WallNs;
+    double CpuNs;
+};
+
+static uint64_t ThreadCpuNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+// ObjectMallocDemo's allocation blown up to millions of objects: allocate
+// a struct Object's worth of memory, poke the two overlapping halves the
+// way the demo does, and free it, a batch at a time.
+static void ObjectLoop(size_t objects)
+{
+    const size_t batch = 1024;
+    char* memory[1024];
+    uint32_t sink = 0;
+
+    for (size_t done = 0; done < objects; done += batch)
+    {
+        for (size_t i = 0; i < batch; i++)
+        {
+            memory[i] = (char*) EngineMalloc(sizeof(struct Object));
+            if (memory[i] == NULL)
+            {
+                fprintf(stderr, "Out of memory.\n");
+                exit(OOM_EXIT_CODE);
+            }
+
+            struct Object* p1 = (struct Object*) memory[i];
+            struct Object* p2 = (struct Object*) (memory[i] + sizeof(struct Object) / 2);
+            p1->Field1 = 0x12341234;
+            p1->Field2 = 0x56785678;
+            p2->Field1 = 0xDEADBEEF;
+            sink += p1->Field2;
+        }
+
+        for (size_t i = 0; i < batch; i++)
+        {
+            EngineFree(memory[i]);
+        }
+    }
+
+    // Keep the pokes from being optimized away.
+    if (sink == 1)
+    {
+        printf("\n");
+    }
+}
+
+static size_t LoopObjects(const struct BenchOptions* options)
+{
+    return 5000000 * options->Iterations;
+}
+
+void BenchTraceLoop(const struct BenchOptions* options, const char* tracePath)
+{
+    const size_t objects = LoopObjects(options);
+
+    // Starting and stopping the trace are part of what tracing costs, so
+    // they're on the clock too.
+    const uint64_t start = NowNs();
+    const uint64_t startCpu = ThreadCpuNs();
+    if (tracePath != NULL && TraceStart(tracePath) != 0)
+    {
+        perror("Couldn't start tracing");
+        exit(1);
+    }
+    ObjectLoop(objects);
+    if (tracePath != NULL && TraceStop() != 0)
+    {
+        perror("Couldn't finish the trace");
+        exit(1);
+    }
+    const uint64_t cpu = ThreadCpuNs() - startCpu;
+    const uint64_t elapsed = NowNs() - start;
+
+    printf("%.4f %.4f %llu\n", (double) elapsed / (double) objects, (double) cpu / (double) objects,
+           (unsigned long long) TraceEventCount());
+}
+
+// Runs BenchTraceLoop in a fresh process of this program, so each run
+// starts cold: nothing faulted in yet, and glibc's malloc still on its
+// single-threaded paths until something starts a thread.
+static int RunLoop(const struct BenchOptions* options, const char* tracePath, struct LoopTime* time,
+                   unsigned long long* events)
+{
+    char self[PATH_MAX];
+    const ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (length < 0)
+    {
+        return -1;
+    }
+    self[length] = '\0';
+
+    char iterations[32];
+    snprintf(iterations, sizeof(iterations), "%zu", options->Iterations);
+    char* argv[] = { self, "-n", iterations, tracePath != NULL ? "-t" : "-u", (char*) tracePath, NULL };
+
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        return -1;
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, fds[0]);
+
+    pid_t pid;
+    const int spawned = posix_spawn(&pid, self, &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+    if (spawned != 0)
+    {
+        close(fds[0]);
+        return -1;
+    }
+
+    FILE* output = fdopen(fds[0], "r");
+    const int parsed = output != NULL && fscanf(output, "%lf %lf %llu", &time->WallNs, &time->CpuNs, events) == 3;
+    if (output != NULL)
+    {
+        fclose(output);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || !parsed)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+static void KeepBest(struct LoopTime* best, struct LoopTime time)
+{
+    best->WallNs = time.WallNs < best->WallNs ? time.WallNs : best->WallNs;
+    best->CpuNs = time.CpuNs < best->CpuNs ? time.CpuNs : best->CpuNs;
+}
+
+void BenchTrace(const struct BenchOptions* options)
+{
+    const int repeats = 5;
+
+    char path[] = "/tmp/alloc-trace-XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd < 0)
+    {
+        perror("Couldn't create a trace file");
+        return;
+    }
+    close(fd);
+
+    // Alternate untraced and traced runs and keep the best of each, so a
+    // noisy moment doesn't land on just one side.
+    struct LoopTime untraced = { 1e300, 1e300 };
+    struct LoopTime traced = { 1e300, 1e300 };
+    unsigned long long events = 0;
+    off_t traceBytes = 0;
+    for (int r = 0; r < repeats; r++)
+    {
+        struct LoopTime time;
+        if (RunLoop(options, NULL, &time, &events) != 0)
+        {
+            fprintf(stderr, "The untraced run failed.\n");
+            unlink(path);
+            return;
+        }
+        KeepBest(&untraced, time);
+
+        if (RunLoop(options, path, &time, &events) != 0)
+        {
+            fprintf(stderr, "The traced run failed.\n");
+            unlink(path);
+            return;
+        }
+        KeepBest(&traced, time);
+
+        struct stat st;
+        traceBytes = stat(path, &st) == 0 ? st.st_size : 0;
+    }
+
+    printf("%zu objects through EngineMalloc/EngineFree on %s, each run in a fresh process, best of %d:\n",
+           LoopObjects(options), EngineCurrent()->Name, repeats);
+    printf("  wall clock:             untraced %.2f ns/object, traced %.2f ns/object, overhead %.1f%%\n",
+           untraced.WallNs, traced.WallNs, 100.0 * (traced.WallNs - untraced.WallNs) / untraced.WallNs);
+    printf("  allocating thread's CPU: untraced %.2f ns/object, traced %.2f ns/object, overhead %.1f%%\n",
+           untraced.CpuNs, traced.CpuNs, 100.0 * (traced.CpuNs - untraced.CpuNs) / untraced.CpuNs);
+    printf("  %llu events, %.1f MiB of trace\n", events, (double) traceBytes / (1024.0 * 1024.0));
+
+    // The wall clock only shows what recording costs once the drain
+    // process has a core of its own to encode on.
+    if (sysconf(_SC_NPROCESSORS_ONLN) < 2)
+    {
+        printf("  This machine has one CPU, so the drain process's encoding is in the traced wall clock too.\n");
+    }
+
+    unlink(path);
+}
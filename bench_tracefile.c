@@ -0,0 +1,161 @@
+// Benchmark: size of the compact trace format and how fast it decodes.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "objects.h"
+#include "timing.h"
+#include "trace.h"
+#include "tracereader.h"
+
+// How fast the decoder is meant to feed a replay, on one core.
+#define TRACE_DECODE_TARGET_MEVENTS 100
+
+// Records a trace of the demos' allocations mixed with assorted small
+// buffers, freed in a shuffled order so pointers jump around the way they
+// do in a real program.
+static void RecordWorkload(size_t events)
+{
+    const size_t live = 4096;
+    void** blocks = (void**) calloc(live, sizeof(void*));
+    if (blocks == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+
+    uint64_t state = 0x2545F4914F6CDD1Dull;
+    for (size_t done = 0; done < events; done += 2)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        const size_t slot = (size_t) (state % live);
+        EngineFree(blocks[slot]);
+
+        size_t size;
+        switch ((state >> 32) % 4)
+        {
+            case 0:
+                size = 2;
+                break;
+            case 1:
+                size = sizeof(struct Object);
+                break;
+            case 2:
+                size = sizeof(struct GiantObject);
+                break;
+            default:
+                size = 1 + (size_t) ((state >> 40) % 512);
+                break;
+        }
+
+        blocks[slot] = EngineMalloc(size);
+        if (blocks[slot] == NULL)
+        {
+            fprintf(stderr, "Out of memory.\n");
+            exit(OOM_EXIT_CODE);
+        }
+    }
+
+    for (size_t i = 0; i < live; i++)
+    {
+        EngineFree(blocks[i]);
+    }
+    free(blocks);
+}
+
+void BenchTraceFile(const struct BenchOptions* options)
+{
+    const size_t events = 10000000 * options->Iterations;
+    const int repeats = 5;
+
+    char path[] = "/tmp/alloc-trace-XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd < 0)
+    {
+        perror("Couldn't create a trace file");
+        return;
+    }
+    close(fd);
+
+    if (TraceStart(path) != 0)
+    {
+        perror("Couldn't start tracing");
+        unlink(path);
+        return;
+    }
+    RecordWorkload(events);
+    TraceStop();
+
+    struct TraceReader reader;
+    if (TraceReaderOpen(&reader, path) != 0)
+    {
+        perror("Couldn't read the trace back");
+        unlink(path);
+        return;
+    }
+
+    const double rawBytes = (double) reader.Count * sizeof(struct TraceRecord);
+    printf("%zu events in %zu blocks: %.1f MiB, %.2f bytes/event (%.1fx smaller than raw records)\n",
+           reader.Count, reader.BlockCount, (double) reader.MapSize / (1024.0 * 1024.0),
+           (double) reader.MapSize / (double) reader.Count, rawBytes / (double) reader.MapSize);
+
+    struct TraceRecord* records = (struct TraceRecord*) malloc(TRACE_BLOCK_EVENTS * sizeof(struct TraceRecord));
+    if (records == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+
+    // The first pass also pages the file in, so it's a fair comparison
+    // with the later ones.
+    uint64_t best = UINT64_MAX;
+    uint64_t sink = 0;
+    for (int r = 0; r < repeats + 1; r++)
+    {
+        reader.NextBlock = 0;
+        const uint64_t start = NowNs();
+        size_t decoded;
+        while ((decoded = TraceReaderNext(&reader, records)) > 0)
+        {
+            sink += records[decoded - 1].Ptr;
+        }
+        const uint64_t elapsed = NowNs() - start;
+        best = r > 0 && elapsed < best ? elapsed : best;
+    }
+
+    printf("  decoding, best of %d: %.1f M events/s (%.2f ns/event), target %d M events/s\n", repeats,
+           (double) reader.Count * 1000.0 / (double) best, (double) best / (double) reader.Count,
+           TRACE_DECODE_TARGET_MEVENTS);
+
+    if (sink == 1)
+    {
+        printf("\n");
+    }
+
+    free(records);
+    TraceReaderClose(&reader);
+    unlink(path);
+}
@@ -0,0 +1,277 @@
+// A binary buddy allocator with bitmap state.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "buddy.h"
+
+#include <sys/mman.h>
+
+#define REGION_SIZE ((size_t) 1 << BUDDY_MAX_ORDER)
+#define NODE_COUNT (((size_t) 1 << BUDDY_LEVELS) - 1)
+
+// Free blocks double as list nodes so we can pull a buddy out of the
+// middle of its list when we merge.
+struct BuddyBlock
+{
+    struct BuddyBlock* Next;
+    struct BuddyBlock* Prev;
+};
+
+// Nodes are numbered like a binary heap: the root is 0 and the children
+// of node n are 2n + 1 and 2n + 2. The tree level of a node is how many
+// times the region was halved to get it, so level 0 has order
+// BUDDY_MAX_ORDER.
+
+static int TestBit(const uint64_t* bitmap, size_t node)
+{
+    return (int) ((bitmap[node / 64] >> (node % 64)) & 1);
+}
+
+static void SetBit(uint64_t* bitmap, size_t node)
+{
+    bitmap[node / 64] |= (uint64_t) 1 << (node % 64);
+}
+
+static void ClearBit(uint64_t* bitmap, size_t node)
+{
+    bitmap[node / 64] &= ~((uint64_t) 1 << (node % 64));
+}
+
+static size_t LevelOrder(size_t level)
+{
+    return BUDDY_MAX_ORDER - level;
+}
+
+static size_t FirstNodeOfLevel(size_t level)
+{
+    return ((size_t) 1 << level) - 1;
+}
+
+static char* NodeAddress(const struct Buddy* buddy, size_t node, size_t level)
+{
+    return buddy->Base + ((node - FirstNodeOfLevel(level)) << LevelOrder(level));
+}
+
+static size_t NodeAt(const struct Buddy* buddy, const void* ptr, size_t level)
+{
+    return FirstNodeOfLevel(level) + ((size_t) ((const char*) ptr - buddy->Base) >> LevelOrder(level));
+}
+
+static void PushFree(struct Buddy* buddy, size_t node, size_t level)
+{
+    struct BuddyBlock* block = (struct BuddyBlock*) NodeAddress(buddy, node, level);
+    block->Prev = NULL;
+    block->Next = buddy->FreeLists[level];
+    if (block->Next != NULL)
+    {
+        block->Next->Prev = block;
+    }
+    buddy->FreeLists[level] = block;
+    SetBit(buddy->Free, node);
+}
+
+static void RemoveFree(struct Buddy* buddy, size_t node, size_t level)
+{
+    struct BuddyBlock* block = (struct BuddyBlock*) NodeAddress(buddy, node, level);
+    if (block->Prev != NULL)
+    {
+        block->Prev->Next = block->Next;
+    }
+    else
+    {
+        buddy->FreeLists[level] = block->Next;
+    }
+    if (block->Next != NULL)
+    {
+        block->Next->Prev = block->Prev;
+    }
+    ClearBit(buddy->Free, node);
+}
+
+int BuddyInit(struct Buddy* buddy)
+{
+    // The bitmaps are sized for the whole tree but mapped lazily, so only
+    // the parts of the tree we actually split down into cost memory.
+    const size_t bitmapBytes = (NODE_COUNT + 63) / 64 * sizeof(uint64_t);
+
+    void* base = mmap(NULL, REGION_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    void* bitmaps = mmap(NULL, 2 * bitmapBytes, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED || bitmaps == MAP_FAILED)
+    {
+        if (base != MAP_FAILED)
+        {
+            munmap(base, REGION_SIZE);
+        }
+        if (bitmaps != MAP_FAILED)
+        {
+            munmap(bitmaps, 2 * bitmapBytes);
+        }
+        return -1;
+    }
+
+    buddy->Base = (char*) base;
+    buddy->Split = (uint64_t*) bitmaps;
+    buddy->Free = buddy->Split + bitmapBytes / sizeof(uint64_t);
+    buddy->BitmapBytes = bitmapBytes;
+    for (size_t level = 0; level < BUDDY_LEVELS; level++)
+    {
+        buddy->FreeLists[level] = NULL;
+    }
+    buddy->AllocatedBytes = 0;
+
+    PushFree(buddy, 0, 0);
+    return 0;
+}
+
+size_t BuddyBlockSize(size_t size)
+{
+    if (size > REGION_SIZE)
+    {
+        return 0;
+    }
+
+    size_t order = BUDDY_MIN_ORDER;
+    while (((size_t) 1 << order) < size)
+    {
+        order++;
+    }
+    return (size_t) 1 << order;
+}
+
+void* BuddyAlloc(struct Buddy* buddy, size_t size)
+{
+    const size_t blockSize = BuddyBlockSize(size);
+    if (blockSize == 0)
+    {
+        return NULL;
+    }
+
+    const size_t wantLevel = BUDDY_MAX_ORDER - (size_t) __builtin_ctzll(blockSize);
+
+    // Find the smallest free block that's big enough...
+    size_t level = wantLevel;
+    while (buddy->FreeLists[level] == NULL)
+    {
+        if (level == 0)
+        {
+            return NULL;
+        }
+        level--;
+    }
+
+    struct BuddyBlock* block = buddy->FreeLists[level];
+    size_t node = NodeAt(buddy, block, level);
+    RemoveFree(buddy, node, level);
+
+    // ...and split it until it's the right size, freeing the upper half
+    // each time.
+    while (level < wantLevel)
+    {
+        SetBit(buddy->Split, node);
+        node = 2 * node + 1;
+        level++;
+        PushFree(buddy, node + 1, level);
+    }
+
+    buddy->AllocatedBytes += blockSize;
+    return block;
+}
+
+void BuddyFree(struct Buddy* buddy, void* ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    // The block is the first node on the path down to ptr that isn't split.
+    size_t level = 0;
+    size_t node = 0;
+    while (TestBit(buddy->Split, node))
+    {
+        level++;
+        node = NodeAt(buddy, ptr, level);
+    }
+
+    buddy->AllocatedBytes -= (size_t) 1 << LevelOrder(level);
+
+    // Merge with the buddy for as long as it's free too.
+    while (level > 0)
+    {
+        const size_t buddyNode = (node & 1) ? node + 1 : node - 1;
+        if (!TestBit(buddy->Free, buddyNode))
+        {
+            break;
+        }
+
+        RemoveFree(buddy, buddyNode, level);
+        node = (node - 1) / 2;
+        level--;
+        ClearBit(buddy->Split, node);
+    }
+
+    PushFree(buddy, node, level);
+}
+
+void BuddyDestroy(struct Buddy* buddy)
+{
+    munmap(buddy->Base, REGION_SIZE);
+    munmap(buddy->Split, 2 * buddy->BitmapBytes);
+    buddy->Base = NULL;
+}
+
+size_t BuddyLargestFree(const struct Buddy* buddy)
+{
+    for (size_t level = 0; level < BUDDY_LEVELS; level++)
+    {
+        if (buddy->FreeLists[level] != NULL)
+        {
+            return (size_t) 1 << LevelOrder(level);
+        }
+    }
+
+    return 0;
+}
+
+static struct Buddy engineBuddy;
+
+static void* BuddyEngineMalloc(size_t size)
+{
+    if (engineBuddy.Base == NULL && BuddyInit(&engineBuddy) != 0)
+    {
+        return NULL;
+    }
+
+    return BuddyAlloc(&engineBuddy, size);
+}
+
+static void BuddyEngineFree(void* ptr)
+{
+    BuddyFree(&engineBuddy, ptr);
+}
+
+const struct AllocEngine BuddyEngine = {
+    .Name = "buddy",
+    .Description = "binary buddy allocator over a 32 MiB region, bitmap state, no headers",
+    .Malloc = BuddyEngineMalloc,
+    .Free = BuddyEngineFree,
+    .Reset = NULL,
+    .ThreadSafe = 0,
+};
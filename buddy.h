@@ -0,0 +1,77 @@
+// A binary buddy allocator with bitmap state.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef BUDDY_H
+#define BUDDY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "engine.h"
+
+// A binary buddy allocator. The region is one power-of-two block that we
+// split in half as often as needed to fit a request, and whenever both
+// halves of a split are free again they merge back. Every block is a node
+// in a complete binary tree over the region.
+//
+// All the bookkeeping lives in two bitmaps with one bit per tree node
+// (whether the node is split, and whether it's free) plus a free list per
+// order threaded through the free blocks themselves. Allocated blocks have
+// no header, so a request only ever costs its rounded-up block plus two
+// bits per node.
+
+#define BUDDY_MIN_ORDER 4   // 16 byte blocks, enough for the free list links
+#define BUDDY_MAX_ORDER 25  // a 32 MiB region
+#define BUDDY_LEVELS (BUDDY_MAX_ORDER - BUDDY_MIN_ORDER + 1)
+
+struct BuddyBlock;
+
+struct Buddy
+{
+    char* Base;
+    uint64_t* Split;
+    uint64_t* Free;
+    size_t BitmapBytes;
+    struct BuddyBlock* FreeLists[BUDDY_LEVELS];
+
+    // Bytes in allocated blocks, after rounding up to a power of two.
+    size_t AllocatedBytes;
+};
+
+// Returns 0 on success and -1 if the region or bitmaps couldn't be mapped.
+int BuddyInit(struct Buddy* buddy);
+
+// Returns NULL if no block big enough is free.
+void* BuddyAlloc(struct Buddy* buddy, size_t size);
+
+// Finds the block's size by walking the split bitmap down from the root,
+// so it takes O(log n) and doesn't need the size.
+void BuddyFree(struct Buddy* buddy, void* ptr);
+
+void BuddyDestroy(struct Buddy* buddy);
+
+// The block size a request is rounded up to, or 0 if it's too big.
+size_t BuddyBlockSize(size_t size);
+
+// The biggest block that could be handed out right now.
+size_t BuddyLargestFree(const struct Buddy* buddy);
+
+extern const struct AllocEngine BuddyEngine;
+
+#endif
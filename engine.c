@@ -0,0 +1,167 @@
+// Allocator engines the demos can switch between.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "engine.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "buddy.h"
+#include "guard.h"
+#include "histogram.h"
+#include "pool.h"
+#include "redzone.h"
+#include "sizeclass.h"
+#include "remote.h"
+#include "sampled.h"
+#include "shadow.h"
+#include "tcache.h"
+#include "timing.h"
+#include "tlsf.h"
+#include "trace.h"
+
+static void* GlibcMalloc(size_t size)
+{
+    return malloc(size);
+}
+
+static void GlibcFree(void* ptr)
+{
+    free(ptr);
+}
+
+const struct AllocEngine GlibcEngine = {
+    .Name = "glibc",
+    .Description = "the C library's malloc and free (default)",
+    .Malloc = GlibcMalloc,
+    .Free = GlibcFree,
+    .Reset = NULL,
+    .ThreadSafe = 1,
+};
+
+static const struct AllocEngine* const engines[] = {
+    &GlibcEngine,
+    &ArenaEngine,
+    &PoolEngine,
+    &SizeClassEngine,
+    &TCacheEngine,
+    &RemoteEngine,
+    &BuddyEngine,
+    &TlsfEngine,
+    &GuardEngine,
+    &SampledEngine,
+    &RedzoneEngine,
+    &ShadowEngine,
+};
+
+#define ENGINE_COUNT (sizeof(engines) / sizeof(engines[0]))
+
+static const struct AllocEngine* currentEngine = &GlibcEngine;
+
+const struct AllocEngine* EngineFind(const char* name)
+{
+    for (size_t i = 0; i < ENGINE_COUNT; i++)
+    {
+        if (strcmp(engines[i]->Name, name) == 0)
+        {
+            return engines[i];
+        }
+    }
+
+    return NULL;
+}
+
+void EnginePrintAll(FILE* stream)
+{
+    for (size_t i = 0; i < ENGINE_COUNT; i++)
+    {
+        fprintf(stream, "  %-12s %s\n", engines[i]->Name, engines[i]->Description);
+    }
+}
+
+const struct AllocEngine* const* EngineList(size_t* count)
+{
+    *count = ENGINE_COUNT;
+    return engines;
+}
+
+void EngineSelect(const struct AllocEngine* engine)
+{
+    currentEngine = engine;
+}
+
+const struct AllocEngine* EngineCurrent(void)
+{
+    return currentEngine;
+}
+
+static struct HistogramSet* mallocTimes;
+static struct HistogramSet* freeTimes;
+static __thread struct Histogram* threadMallocTimes;
+static __thread struct Histogram* threadFreeTimes;
+
+void EngineTimeCalls(struct HistogramSet* mallocs, struct HistogramSet* frees)
+{
+    mallocTimes = mallocs;
+    freeTimes = frees;
+}
+
+// Records into the calling thread's histogram from set, adding it to the
+// set the first time.
+static void RecordCall(struct Histogram** local, struct HistogramSet* set, uint64_t ticks)
+{
+    if (*local == NULL && (*local = HistogramSetAdd(set)) == NULL)
+    {
+        return;
+    }
+    HistogramRecord(*local, ticks);
+}
+
+void* EngineMalloc(size_t size)
+{
+    void* p;
+    if (mallocTimes == NULL)
+    {
+        p = currentEngine->Malloc(size);
+    }
+    else
+    {
+        const uint64_t start = NowTicks();
+        p = currentEngine->Malloc(size);
+        RecordCall(&threadMallocTimes, mallocTimes, NowTicks() - start);
+    }
+    TraceMalloc(p, size, __builtin_return_address(0));
+    return p;
+}
+
+void EngineFree(void* ptr)
+{
+    TraceFree(ptr, __builtin_return_address(0));
+    if (freeTimes == NULL)
+    {
+        currentEngine->Free(ptr);
+    }
+    else
+    {
+        const uint64_t start = NowTicks();
+        currentEngine->Free(ptr);
+        RecordCall(&threadFreeTimes, freeTimes, NowTicks() - start);
+    }
+}
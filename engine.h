@@ -0,0 +1,74 @@
+// Allocator engines the demos can switch between.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// An allocator engine is a malloc/free pair the demos can run on.
+// The demos never call malloc directly; they go through EngineMalloc
+// and EngineFree so the same scenario can be replayed on top of a
+// different allocator just by selecting another engine.
+struct AllocEngine
+{
+    const char* Name;
+    const char* Description;
+
+    // Same contract as malloc: returns NULL when out of memory.
+    void* (*Malloc)(size_t size);
+
+    // Same contract as free: NULL is a no-op.
+    void (*Free)(void* ptr);
+
+    // Releases every allocation at once. NULL when the engine has no
+    // bulk free, in which case callers have to free individually.
+    void (*Reset)(void);
+
+    // Set when Malloc and Free may be called from several threads at
+    // once. Anything else has to be serialized by the caller.
+    int ThreadSafe;
+};
+
+extern const struct AllocEngine GlibcEngine;
+
+// Looks up an engine by name. Returns NULL if there isn't one.
+const struct AllocEngine* EngineFind(const char* name);
+
+// Prints the name and description of every engine, one per line.
+void EnginePrintAll(FILE* stream);
+
+// Every engine, in the order EnginePrintAll lists them.
+const struct AllocEngine* const* EngineList(size_t* count);
+
+void EngineSelect(const struct AllocEngine* engine);
+const struct AllocEngine* EngineCurrent(void);
+
+void* EngineMalloc(size_t size);
+void EngineFree(void* ptr);
+
+struct HistogramSet;
+
+// Times every EngineMalloc and EngineFree call after this one, each into
+// the calling thread's own histogram in mallocs or frees, in NowTicks()
+// ticks. Call it once, before the demos start any threads.
+void EngineTimeCalls(struct HistogramSet* mallocs, struct HistogramSet* frees);
+
+#endif
@@ -0,0 +1,177 @@
+// Runs crash-prone trials in children forked from a warm parent.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "forkserver.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "timing.h"
+
+// What a child writes down the pipe once its trial has returned. A child
+// that dies first never writes it, which is how the parent tells "exited
+// with status 0 after the trial" from "the trial called exit(0)".
+struct TrialReport
+{
+    uint32_t Trial;
+};
+
+static void RunChild(int reportFd, int nullFd, uint32_t trial, void (*trialFunction)(void*), void* context)
+{
+    // A core dump per crash would cost far more than the trial itself.
+    const struct rlimit noCore = { 0, 0 };
+    setrlimit(RLIMIT_CORE, &noCore);
+
+    if (nullFd >= 0)
+    {
+        dup2(nullFd, STDOUT_FILENO);
+    }
+
+    trialFunction(context);
+
+    // stdout is /dev/null, so there's nothing worth flushing; _exit also
+    // skips the parent's atexit handlers, which aren't ours to run.
+    const struct TrialReport report = { trial };
+    if (write(reportFd, &report, sizeof(report)) != (ssize_t) sizeof(report))
+    {
+        _exit(127);
+    }
+    _exit(0);
+}
+
+int ForkServerRun(size_t trials, void (*trial)(void* context), void* context,
+                  struct ForkServerResults* results)
+{
+    memset(results, 0, sizeof(*results));
+
+    int reportPipe[2];
+    if (pipe(reportPipe) != 0)
+    {
+        return -1;
+    }
+    // The parent only reads after the child is gone, by which point the
+    // report is either there or never coming.
+    fcntl(reportPipe[0], F_SETFL, O_NONBLOCK);
+    const int nullFd = open("/dev/null", O_WRONLY);
+
+    // Anything still buffered would be printed again by every child.
+    fflush(stdout);
+    fflush(stderr);
+
+    int status = 0;
+    const uint64_t start = NowNs();
+    for (size_t i = 0; i < trials; i++)
+    {
+        const pid_t pid = fork();
+        if (pid < 0)
+        {
+            status = -1;
+            break;
+        }
+        if (pid == 0)
+        {
+            close(reportPipe[0]);
+            RunChild(reportPipe[1], nullFd, (uint32_t) i, trial, context);
+        }
+
+        int childStatus;
+        while (waitpid(pid, &childStatus, 0) < 0)
+        {
+            if (errno != EINTR)
+            {
+                status = -1;
+                break;
+            }
+        }
+        if (status != 0)
+        {
+            break;
+        }
+
+        results->Trials++;
+        struct TrialReport report;
+        const int reported = read(reportPipe[0], &report, sizeof(report)) == (ssize_t) sizeof(report)
+                             && report.Trial == (uint32_t) i;
+
+        if (WIFSIGNALED(childStatus))
+        {
+            results->Signaled[WTERMSIG(childStatus)]++;
+        }
+        else if (reported && WEXITSTATUS(childStatus) == 0)
+        {
+            results->Completed++;
+        }
+        else
+        {
+            results->Exited[WEXITSTATUS(childStatus)]++;
+        }
+    }
+    results->ElapsedNs = NowNs() - start;
+
+    const int savedErrno = errno;
+    close(reportPipe[0]);
+    close(reportPipe[1]);
+    if (nullFd >= 0)
+    {
+        close(nullFd);
+    }
+    errno = savedErrno;
+    return status;
+}
+
+static void PrintOutcome(FILE* stream, const char* name, uint64_t count, uint64_t trials)
+{
+    fprintf(stream, "  %-40s %10llu %7.2f%%\n", name, (unsigned long long) count,
+            100.0 * (double) count / (double) trials);
+}
+
+void ForkServerPrint(FILE* stream, const struct ForkServerResults* results)
+{
+    const double seconds = (double) results->ElapsedNs / 1e9;
+    fprintf(stream, "%llu trials in %.2f s (%.0f trials/s):\n", (unsigned long long) results->Trials, seconds,
+            seconds > 0 ? (double) results->Trials / seconds : 0.0);
+    if (results->Trials == 0)
+    {
+        return;
+    }
+
+    PrintOutcome(stream, "completed", results->Completed, results->Trials);
+
+    char name[64];
+    for (int i = 0; i < 256; i++)
+    {
+        if (results->Exited[i] > 0)
+        {
+            snprintf(name, sizeof(name), "exited with status %d", i);
+            PrintOutcome(stream, name, results->Exited[i], results->Trials);
+        }
+    }
+    for (int i = 1; i < NSIG; i++)
+    {
+        if (results->Signaled[i] > 0)
+        {
+            snprintf(name, sizeof(name), "killed by signal %d (%s)", i, strsignal(i));
+            PrintOutcome(stream, name, results->Signaled[i], results->Trials);
+        }
+    }
+}
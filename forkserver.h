@@ -0,0 +1,53 @@
+// Runs crash-prone trials in children forked from a warm parent.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef FORKSERVER_H
+#define FORKSERVER_H
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Runs something that might crash over and over, each time in a child
+// forked from the already set-up parent instead of a fresh exec. Whatever
+// the parent has warmed up (the allocator engine, stdio, page tables) the
+// child starts with for free, so a trial costs little more than a fork.
+struct ForkServerResults
+{
+    uint64_t Trials;
+    // The trial function returned.
+    uint64_t Completed;
+    // The trial called exit() itself, by exit status.
+    uint64_t Exited[256];
+    // The trial was killed, by signal number.
+    uint64_t Signaled[NSIG];
+    uint64_t ElapsedNs;
+};
+
+// Runs trial(context) in trials children, one after another, and counts
+// how each one ended. The children's stdout goes to /dev/null and they
+// don't dump core. Returns 0 on success and -1 (with errno set) if a
+// child couldn't be started; results then cover the trials run so far.
+int ForkServerRun(size_t trials, void (*trial)(void* context), void* context,
+                  struct ForkServerResults* results);
+
+void ForkServerPrint(FILE* stream, const struct ForkServerResults* results);
+
+#endif
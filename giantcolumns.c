@@ -0,0 +1,101 @@
+// GiantObjects stored one column per field.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "giantcolumns.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_LINE 64
+
+// GiantObject's fields as an array, in declaration order.
+static void FieldsOf(const struct GiantObject* object, int64_t fields[GIANT_FIELD_COUNT])
+{
+    memcpy(fields, object, sizeof(*object));
+}
+
+int GiantColumnsInit(struct GiantColumns* columns, size_t count)
+{
+    if (count > SIZE_MAX / sizeof(int64_t) / GIANT_FIELD_COUNT - CACHE_LINE)
+    {
+        return -1;
+    }
+
+    // Rounded up so the next column starts on a new cache line. The extra
+    // line keeps the size nonzero when count is 0.
+    const size_t stride = (count * sizeof(int64_t) + CACHE_LINE - 1) & ~(size_t) (CACHE_LINE - 1);
+    char* memory = (char*) aligned_alloc(CACHE_LINE, stride * GIANT_FIELD_COUNT + CACHE_LINE);
+    if (memory == NULL)
+    {
+        return -1;
+    }
+
+    for (size_t f = 0; f < GIANT_FIELD_COUNT; f++)
+    {
+        columns->Columns[f] = (int64_t*) (memory + f * stride);
+    }
+    columns->Count = count;
+    columns->Memory = memory;
+    return 0;
+}
+
+void GiantColumnsDestroy(struct GiantColumns* columns)
+{
+    free(columns->Memory);
+    memset(columns, 0, sizeof(*columns));
+}
+
+void GiantColumnsFill(struct GiantColumns* columns, const struct GiantObject* value)
+{
+    int64_t fields[GIANT_FIELD_COUNT];
+    FieldsOf(value, fields);
+    for (size_t f = 0; f < GIANT_FIELD_COUNT; f++)
+    {
+        int64_t* column = columns->Columns[f];
+        const int64_t v = fields[f];
+        for (size_t i = 0; i < columns->Count; i++)
+        {
+            column[i] = v;
+        }
+    }
+}
+
+void GiantColumnsStore(struct GiantColumns* columns, size_t first, const struct GiantObject* objects,
+                       size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        int64_t fields[GIANT_FIELD_COUNT];
+        FieldsOf(&objects[i], fields);
+        for (size_t f = 0; f < GIANT_FIELD_COUNT; f++)
+        {
+            columns->Columns[f][first + i] = fields[f];
+        }
+    }
+}
+
+void GiantColumnsLoad(const struct GiantColumns* columns, size_t index, struct GiantObject* object)
+{
+    int64_t fields[GIANT_FIELD_COUNT];
+    for (size_t f = 0; f < GIANT_FIELD_COUNT; f++)
+    {
+        fields[f] = columns->Columns[f][index];
+    }
+    memcpy(object, fields, sizeof(*object));
+}
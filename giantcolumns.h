@@ -0,0 +1,63 @@
+// A struct-of-arrays container for GiantObject: one contiguous column per field.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef GIANTCOLUMNS_H
+#define GIANTCOLUMNS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "objects.h"
+
+// GiantObjects stored as a struct of arrays: one contiguous column per
+// field instead of one 160-byte struct per object. A loop that only reads
+// Field01 then pulls in nothing but Field01s, eight to a cache line,
+// where the same loop over a GiantObject[] drags in a whole line to use 8
+// bytes of it. The price is that touching every field of one object
+// touches GIANT_FIELD_COUNT lines instead of three.
+//
+// Columns[f][i] is field f + 1 of object i (GIANT_COLUMN(Field07) is 6).
+// Every column starts on its own cache line, and they're all carved out
+// of one allocation.
+struct GiantColumns
+{
+    int64_t* Columns[GIANT_FIELD_COUNT];
+    size_t Count;
+    void* Memory;
+};
+
+#define GIANT_COLUMN(field) (offsetof(struct GiantObject, field) / sizeof(int64_t))
+
+// Makes room for count objects, with unspecified contents. Returns 0, or
+// -1 if the memory couldn't be allocated.
+int GiantColumnsInit(struct GiantColumns* columns, size_t count);
+void GiantColumnsDestroy(struct GiantColumns* columns);
+
+// Sets every object to value, one column at a time.
+void GiantColumnsFill(struct GiantColumns* columns, const struct GiantObject* value);
+
+// Copies count GiantObjects from objects into the columns, starting at
+// object first.
+void GiantColumnsStore(struct GiantColumns* columns, size_t first, const struct GiantObject* objects,
+                       size_t count);
+
+// Gathers object index back into one GiantObject.
+void GiantColumnsLoad(const struct GiantColumns* columns, size_t index, struct GiantObject* object);
+
+#endif
@@ -0,0 +1,236 @@
+// Scalar, AVX2 and AVX-512 GiantObject fills, picked at run time.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "giantfill.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cachesize.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GIANT_FILL_X86 1
+#endif
+
+#define FILL_FIELD(field) o->field = value->field
+
+static void FillFields(struct GiantObject* objects, size_t count, const struct GiantObject* value)
+{
+    for (struct GiantObject* o = objects; o < objects + count; o++)
+    {
+        FILL_FIELD(Field01); FILL_FIELD(Field02); FILL_FIELD(Field03); FILL_FIELD(Field04); FILL_FIELD(Field05);
+        FILL_FIELD(Field06); FILL_FIELD(Field07); FILL_FIELD(Field08); FILL_FIELD(Field09); FILL_FIELD(Field10);
+        FILL_FIELD(Field11); FILL_FIELD(Field12); FILL_FIELD(Field13); FILL_FIELD(Field14); FILL_FIELD(Field15);
+        FILL_FIELD(Field16); FILL_FIELD(Field17); FILL_FIELD(Field18); FILL_FIELD(Field19); FILL_FIELD(Field20);
+    }
+}
+
+#ifdef GIANT_FILL_X86
+
+// The vector loops see the array as one long run of bytes that repeats
+// every sizeof(struct GiantObject). Five vectors of either width cover a
+// whole number of objects (one with AVX2, two with AVX-512), so after
+// lining the first store up with the vector width, the loop just stores
+// the same five vectors over and over. The pattern holds the template
+// three times over: enough to load five vectors starting at any phase,
+// and to copy any leftover bytes at the ends from.
+#define PATTERN_OBJECTS 3
+#define PATTERN_BYTES (PATTERN_OBJECTS * sizeof(struct GiantObject))
+
+static void MakePattern(unsigned char* pattern, const struct GiantObject* value)
+{
+    for (size_t i = 0; i < PATTERN_OBJECTS; i++)
+    {
+        memcpy(pattern + i * sizeof(struct GiantObject), value, sizeof(struct GiantObject));
+    }
+}
+
+// Writes bytes from to from + length of the array from the pattern.
+static void CopyPattern(unsigned char* bytes, size_t from, size_t length, const unsigned char* pattern)
+{
+    memcpy(bytes + from, pattern + from % sizeof(struct GiantObject), length);
+}
+
+// Bytes to write before bytes + head is width-aligned, no more than total.
+static size_t HeadLength(const unsigned char* bytes, size_t width, size_t total)
+{
+    const size_t head = (size_t) -(uintptr_t) bytes & (width - 1);
+    return head < total ? head : total;
+}
+
+__attribute__((target("avx2")))
+static void FillAvx2(struct GiantObject* objects, size_t count, const struct GiantObject* value, int stream)
+{
+    unsigned char pattern[PATTERN_BYTES];
+    MakePattern(pattern, value);
+    unsigned char* bytes = (unsigned char*) objects;
+    const size_t total = count * sizeof(struct GiantObject);
+    const size_t head = HeadLength(bytes, 32, total);
+    CopyPattern(bytes, 0, head, pattern);
+
+    const unsigned char* phase = pattern + head % sizeof(struct GiantObject);
+    const __m256i v0 = _mm256_loadu_si256((const __m256i*) (phase + 0));
+    const __m256i v1 = _mm256_loadu_si256((const __m256i*) (phase + 32));
+    const __m256i v2 = _mm256_loadu_si256((const __m256i*) (phase + 64));
+    const __m256i v3 = _mm256_loadu_si256((const __m256i*) (phase + 96));
+    const __m256i v4 = _mm256_loadu_si256((const __m256i*) (phase + 128));
+
+    size_t at = head;
+    if (stream)
+    {
+        for (; at + 160 <= total; at += 160)
+        {
+            __m256i* p = (__m256i*) (bytes + at);
+            _mm256_stream_si256(p + 0, v0);
+            _mm256_stream_si256(p + 1, v1);
+            _mm256_stream_si256(p + 2, v2);
+            _mm256_stream_si256(p + 3, v3);
+            _mm256_stream_si256(p + 4, v4);
+        }
+
+        // Streaming stores aren't ordered with the ones after them.
+        _mm_sfence();
+    }
+    else
+    {
+        for (; at + 160 <= total; at += 160)
+        {
+            __m256i* p = (__m256i*) (bytes + at);
+            _mm256_store_si256(p + 0, v0);
+            _mm256_store_si256(p + 1, v1);
+            _mm256_store_si256(p + 2, v2);
+            _mm256_store_si256(p + 3, v3);
+            _mm256_store_si256(p + 4, v4);
+        }
+    }
+    CopyPattern(bytes, at, total - at, pattern);
+}
+
+__attribute__((target("avx512f")))
+static void FillAvx512(struct GiantObject* objects, size_t count, const struct GiantObject* value, int stream)
+{
+    unsigned char pattern[PATTERN_BYTES];
+    MakePattern(pattern, value);
+    unsigned char* bytes = (unsigned char*) objects;
+    const size_t total = count * sizeof(struct GiantObject);
+    const size_t head = HeadLength(bytes, 64, total);
+    CopyPattern(bytes, 0, head, pattern);
+
+    const unsigned char* phase = pattern + head % sizeof(struct GiantObject);
+    const __m512i v0 = _mm512_loadu_si512((const void*) (phase + 0));
+    const __m512i v1 = _mm512_loadu_si512((const void*) (phase + 64));
+    const __m512i v2 = _mm512_loadu_si512((const void*) (phase + 128));
+    const __m512i v3 = _mm512_loadu_si512((const void*) (phase + 192));
+    const __m512i v4 = _mm512_loadu_si512((const void*) (phase + 256));
+
+    size_t at = head;
+    if (stream)
+    {
+        for (; at + 320 <= total; at += 320)
+        {
+            __m512i* p = (__m512i*) (bytes + at);
+            _mm512_stream_si512(p + 0, v0);
+            _mm512_stream_si512(p + 1, v1);
+            _mm512_stream_si512(p + 2, v2);
+            _mm512_stream_si512(p + 3, v3);
+            _mm512_stream_si512(p + 4, v4);
+        }
+        _mm_sfence();
+    }
+    else
+    {
+        for (; at + 320 <= total; at += 320)
+        {
+            __m512i* p = (__m512i*) (bytes + at);
+            _mm512_store_si512(p + 0, v0);
+            _mm512_store_si512(p + 1, v1);
+            _mm512_store_si512(p + 2, v2);
+            _mm512_store_si512(p + 3, v3);
+            _mm512_store_si512(p + 4, v4);
+        }
+    }
+    CopyPattern(bytes, at, total - at, pattern);
+}
+
+static void FillAvx2Cached(struct GiantObject* objects, size_t count, const struct GiantObject* value)
+{
+    FillAvx2(objects, count, value, 0);
+}
+
+static void FillAvx2Stream(struct GiantObject* objects, size_t count, const struct GiantObject* value)
+{
+    FillAvx2(objects, count, value, 1);
+}
+
+static void FillAvx512Cached(struct GiantObject* objects, size_t count, const struct GiantObject* value)
+{
+    FillAvx512(objects, count, value, 0);
+}
+
+static void FillAvx512Stream(struct GiantObject* objects, size_t count, const struct GiantObject* value)
+{
+    FillAvx512(objects, count, value, 1);
+}
+
+#endif
+
+static struct GiantFiller fillers[5];
+static size_t fillerCount;
+static size_t streamBytes;
+static GiantFillFunction cachedFill;
+static GiantFillFunction streamFill;
+static pthread_once_t fillersOnce = PTHREAD_ONCE_INIT;
+
+static void InitFillers(void)
+{
+    fillers[fillerCount++] = (struct GiantFiller) { "fields", FillFields, 0 };
+#ifdef GIANT_FILL_X86
+    if (__builtin_cpu_supports("avx2"))
+    {
+        fillers[fillerCount++] = (struct GiantFiller) { "avx2", FillAvx2Cached, 0 };
+        fillers[fillerCount++] = (struct GiantFiller) { "avx2 stream", FillAvx2Stream, 1 };
+    }
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        fillers[fillerCount++] = (struct GiantFiller) { "avx512", FillAvx512Cached, 0 };
+        fillers[fillerCount++] = (struct GiantFiller) { "avx512 stream", FillAvx512Stream, 1 };
+    }
+#endif
+
+    // The last two are the widest, unless there's only the scalar one.
+    cachedFill = fillers[fillerCount == 1 ? 0 : fillerCount - 2].Fill;
+    streamFill = fillers[fillerCount - 1].Fill;
+    streamBytes = LastLevelCacheBytes();
+}
+
+const struct GiantFiller* GiantFillers(size_t* count)
+{
+    pthread_once(&fillersOnce, InitFillers);
+    *count = fillerCount;
+    return fillers;
+}
+
+void GiantObjectsFill(struct GiantObject* objects, size_t count, const struct GiantObject* value)
+{
+    pthread_once(&fillersOnce, InitFillers);
+    const GiantFillFunction fill = count * sizeof(struct GiantObject) > streamBytes ? streamFill : cachedFill;
+    fill(objects, count, value);
+}
@@ -0,0 +1,53 @@
+// Fills GiantObject arrays from a template with vector and streaming stores.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef GIANTFILL_H
+#define GIANTFILL_H
+
+#include <stddef.h>
+
+#include "objects.h"
+
+// Fills count GiantObjects at objects with copies of value.
+typedef void (*GiantFillFunction)(struct GiantObject* objects, size_t count, const struct GiantObject* value);
+
+struct GiantFiller
+{
+    const char* Name;
+    GiantFillFunction Fill;
+
+    // Set when the filler writes around the caches with non-temporal
+    // stores.
+    int Streams;
+};
+
+// The fillers this CPU can run, slowest first. The first is the scalar
+// one that stores a field at a time, the way the demos do; the rest store
+// the template a vector at a time, with AVX2 and then AVX-512, each with
+// and without streaming stores.
+const struct GiantFiller* GiantFillers(size_t* count);
+
+// Fills with the widest vectors the CPU has. Arrays bigger than the
+// last-level cache are written with streaming stores, which skip reading
+// each line in before overwriting it and leave the cache to whatever was
+// already there; smaller ones are stored normally so they're still in the
+// cache when they're read.
+void GiantObjectsFill(struct GiantObject* objects, size_t count, const struct GiantObject* value);
+
+#endif
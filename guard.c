@@ -0,0 +1,245 @@
+// A guard-page allocator that catches overflows on the first bad write.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "guard.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Sits just below a big block, which always has its header page to
+// spare for it.
+struct GuardLargeHeader
+{
+    char* Base;
+    size_t Length;
+};
+
+int GuardInit(struct Guard* guard)
+{
+    memset(guard, 0, sizeof(*guard));
+    guard->PageSize = (size_t) sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < GUARD_MAX_CLASS_PAGES; i++)
+    {
+        // Each slot is its pages plus the guard page after them.
+        guard->Classes[i].SlotSize = (i + 2) * guard->PageSize;
+    }
+    return pthread_mutex_init(&guard->Lock, NULL) == 0 ? 0 : -1;
+}
+
+// Makes the next batch of slots usable and puts them on the free list.
+// Returns 0 on success and -1 if the class is out of slots.
+static int CarveSlots(struct Guard* guard, struct GuardClass* guardClass)
+{
+    if (guardClass->Base == NULL)
+    {
+        // Reserve the whole class at once. None of it is accessible, so
+        // it costs address space and nothing else until it's carved.
+        void* base = mmap(NULL, guardClass->SlotSize * GUARD_CLASS_SLOTS, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        guard->SystemCalls++;
+        if (base == MAP_FAILED)
+        {
+            return -1;
+        }
+        guardClass->Base = (char*) base;
+    }
+
+    const size_t dataSize = guardClass->SlotSize - guard->PageSize;
+    size_t carved = 0;
+    while (carved < GUARD_BATCH_SLOTS && guardClass->Carved < GUARD_CLASS_SLOTS)
+    {
+        // Only the slot's own pages become accessible; the guard page
+        // after them stays the way it was reserved.
+        char* slot = guardClass->Base + guardClass->Carved * guardClass->SlotSize;
+        guard->SystemCalls++;
+        if (mprotect(slot, dataSize, PROT_READ | PROT_WRITE) != 0)
+        {
+            // Most likely the process's limit on mappings; every slot is
+            // two of them.
+            break;
+        }
+        guardClass->Carved++;
+        carved++;
+    }
+
+    // Push them in reverse so they're handed out in address order.
+    for (size_t i = 0; i < carved; i++)
+    {
+        char* slot = guardClass->Base + (guardClass->Carved - 1 - i) * guardClass->SlotSize;
+        *(void**) slot = guardClass->FreeList;
+        guardClass->FreeList = slot;
+    }
+
+    return carved > 0 ? 0 : -1;
+}
+
+// Where a block of size bytes goes when its pages end at end: flush
+// against the guard page, then back to the alignment it's owed. Blocks
+// are never moved back by more than the alignment, which is at most a
+// page, so they stay inside their own pages.
+static char* PlaceBlock(const struct Guard* guard, char* end, size_t size)
+{
+    size_t alignment = guard->Alignment;
+    if (alignment == 0)
+    {
+        alignment = size >= GUARD_MIN_ALIGNMENT ? GUARD_MIN_ALIGNMENT : 1;
+    }
+    return (char*) ((uintptr_t) (end - size) & ~(uintptr_t) (alignment - 1));
+}
+
+static void* LargeMalloc(struct Guard* guard, size_t size)
+{
+    const size_t dataSize = (size + guard->PageSize - 1) & ~(guard->PageSize - 1);
+    const size_t length = dataSize + 2 * guard->PageSize;
+    if (dataSize < size || length < dataSize)
+    {
+        return NULL;
+    }
+
+    char* base = (char*) mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+    {
+        return NULL;
+    }
+    char* guardPage = base + length - guard->PageSize;
+    if (mprotect(guardPage, guard->PageSize, PROT_NONE) != 0)
+    {
+        munmap(base, length);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&guard->Lock);
+    guard->SystemCalls += 2;
+    pthread_mutex_unlock(&guard->Lock);
+
+    char* p = PlaceBlock(guard, guardPage, size);
+    struct GuardLargeHeader* header = (struct GuardLargeHeader*) p - 1;
+    header->Base = base;
+    header->Length = length;
+    return p;
+}
+
+void* GuardMalloc(struct Guard* guard, size_t size)
+{
+    const size_t pages = size > 0 ? (size + guard->PageSize - 1) / guard->PageSize : 1;
+    if (pages > GUARD_MAX_CLASS_PAGES)
+    {
+        return LargeMalloc(guard, size);
+    }
+
+    struct GuardClass* guardClass = &guard->Classes[pages - 1];
+    pthread_mutex_lock(&guard->Lock);
+    if (guardClass->FreeList == NULL && CarveSlots(guard, guardClass) != 0)
+    {
+        pthread_mutex_unlock(&guard->Lock);
+        return NULL;
+    }
+    char* slot = (char*) guardClass->FreeList;
+    guardClass->FreeList = *(void**) slot;
+    pthread_mutex_unlock(&guard->Lock);
+
+    return PlaceBlock(guard, slot + pages * guard->PageSize, size);
+}
+
+void GuardFree(struct Guard* guard, void* ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    char* p = (char*) ptr;
+    pthread_mutex_lock(&guard->Lock);
+    for (size_t i = 0; i < GUARD_MAX_CLASS_PAGES; i++)
+    {
+        struct GuardClass* guardClass = &guard->Classes[i];
+        if (guardClass->Base != NULL && p >= guardClass->Base
+            && p < guardClass->Base + guardClass->Carved * guardClass->SlotSize)
+        {
+            // A zero-byte block points at its own guard page, which is
+            // still inside its slot.
+            char* slot = guardClass->Base + (size_t) (p - guardClass->Base) / guardClass->SlotSize
+                                                * guardClass->SlotSize;
+            *(void**) slot = guardClass->FreeList;
+            guardClass->FreeList = slot;
+            pthread_mutex_unlock(&guard->Lock);
+            return;
+        }
+    }
+    guard->SystemCalls++;
+    pthread_mutex_unlock(&guard->Lock);
+
+    const struct GuardLargeHeader* header = (const struct GuardLargeHeader*) p - 1;
+    munmap(header->Base, header->Length);
+}
+
+void GuardDestroy(struct Guard* guard)
+{
+    for (size_t i = 0; i < GUARD_MAX_CLASS_PAGES; i++)
+    {
+        if (guard->Classes[i].Base != NULL)
+        {
+            munmap(guard->Classes[i].Base, guard->Classes[i].SlotSize * GUARD_CLASS_SLOTS);
+        }
+    }
+    pthread_mutex_destroy(&guard->Lock);
+    memset(guard, 0, sizeof(*guard));
+}
+
+static struct Guard engineGuard;
+static pthread_once_t engineGuardOnce = PTHREAD_ONCE_INIT;
+
+static void InitEngineGuard(void)
+{
+    GuardInit(&engineGuard);
+
+    const char* alignment = getenv("MALLOCDEMO_GUARD_ALIGNMENT");
+    const unsigned long parsed = alignment != NULL ? strtoul(alignment, NULL, 10) : 0;
+    if (parsed > 0 && (parsed & (parsed - 1)) == 0 && parsed <= engineGuard.PageSize)
+    {
+        engineGuard.Alignment = (size_t) parsed;
+    }
+}
+
+struct Guard* GuardEngineState(void)
+{
+    pthread_once(&engineGuardOnce, InitEngineGuard);
+    return &engineGuard;
+}
+
+static void* GuardEngineMalloc(size_t size)
+{
+    return GuardMalloc(GuardEngineState(), size);
+}
+
+static void GuardEngineFree(void* ptr)
+{
+    GuardFree(GuardEngineState(), ptr);
+}
+
+const struct AllocEngine GuardEngine = {
+    .Name = "guard",
+    .Description = "every block flush against a guard page; the first overflowing write faults",
+    .Malloc = GuardEngineMalloc,
+    .Free = GuardEngineFree,
+    .Reset = NULL,
+    .ThreadSafe = 1,
+};
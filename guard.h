@@ -0,0 +1,103 @@
+// A guard-page allocator that catches overflows on the first bad write.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef GUARD_H
+#define GUARD_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "engine.h"
+
+// An Electric Fence style allocator: every allocation gets its own pages,
+// with an inaccessible guard page right after them, and sits flush against
+// the guard page. The first byte written past the end of an allocation
+// faults, every time, on the very write that does it.
+//
+// A block is placed so that it ends exactly where the guard page starts,
+// which leaves it aligned to the largest power of two that divides its
+// size (up to the page size). That's all the alignment an object of that
+// size can need, since an object's alignment always divides its size, but
+// code that assumes malloc's usual 16 bytes would trip over a 24 byte
+// block on an 8 byte boundary. So blocks of GUARD_MIN_ALIGNMENT bytes or
+// more start on a multiple of it, moving back from the guard page by up
+// to 15 bytes when their size isn't a multiple of 16. Overflows into that
+// gap go unnoticed. Setting a Guard's Alignment asks for more: every
+// block starts on a multiple of it, at the cost of a gap of up to
+// Alignment - 1 bytes.
+//
+// Slots are grouped by how many pages they need, up to
+// GUARD_MAX_CLASS_PAGES, and each group reserves its own stretch of
+// address space. Slots are carved out of it GUARD_BATCH_SLOTS at a time,
+// which is the only time their pages get mprotect'd; freed slots go on a
+// free list with their guard page still in place, so after warm-up a
+// malloc or free makes no system calls at all. Bigger requests get a
+// mapping of their own.
+//
+// Only overflows are caught. Writing before the start of a block, or to a
+// block after it's been freed, goes unnoticed.
+
+#define GUARD_MAX_CLASS_PAGES 16
+#define GUARD_MIN_ALIGNMENT 16
+#define GUARD_CLASS_SLOTS 4096
+#define GUARD_BATCH_SLOTS 64
+
+struct GuardClass
+{
+    char* Base;
+    size_t SlotSize;
+    size_t Carved;
+    void* FreeList;
+};
+
+struct Guard
+{
+    pthread_mutex_t Lock;
+    size_t PageSize;
+    struct GuardClass Classes[GUARD_MAX_CLASS_PAGES];
+
+    // 0 for the default placement above, or a power of two no bigger than
+    // the page size that every block starts on a multiple of.
+    size_t Alignment;
+
+    // How many mmap, mprotect and munmap calls it has made, to show what
+    // the recycling saves.
+    uint64_t SystemCalls;
+};
+
+// Returns 0 on success and -1 if the address space couldn't be reserved.
+int GuardInit(struct Guard* guard);
+
+// Returns NULL if the slots of that size have run out.
+void* GuardMalloc(struct Guard* guard, size_t size);
+
+void GuardFree(struct Guard* guard, void* ptr);
+
+void GuardDestroy(struct Guard* guard);
+
+// The guard engine's process-wide allocator, created on first use. It's
+// locked, so the engine is thread safe. Its Alignment comes from the
+// MALLOCDEMO_GUARD_ALIGNMENT environment variable, if that's set to a
+// power of two no bigger than a page.
+struct Guard* GuardEngineState(void);
+
+extern const struct AllocEngine GuardEngine;
+
+#endif
@@ -0,0 +1,160 @@
+// Log-linear latency histograms with lock-free per-thread recording.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "histogram.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timing.h"
+
+void HistogramInit(struct Histogram* histogram)
+{
+    memset(histogram, 0, sizeof(*histogram));
+}
+
+// The largest value that lands in the bucket at index.
+static uint64_t BucketHighest(size_t index)
+{
+    if (index < HISTOGRAM_SUB_COUNT)
+    {
+        return index;
+    }
+
+    const unsigned shift = (unsigned) (index / HISTOGRAM_SUB_COUNT) - 1;
+    const uint64_t lowest = (uint64_t) (index % HISTOGRAM_SUB_COUNT + HISTOGRAM_SUB_COUNT) << shift;
+    return lowest + ((uint64_t) 1 << shift) - 1;
+}
+
+void HistogramMerge(struct Histogram* into, const struct Histogram* from)
+{
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        into->Counts[i] += from->Counts[i];
+    }
+    into->Total += from->Total;
+    into->Max = from->Max > into->Max ? from->Max : into->Max;
+}
+
+uint64_t HistogramPercentile(const struct Histogram* histogram, double percentile)
+{
+    if (histogram->Total == 0)
+    {
+        return 0;
+    }
+    if (percentile >= 100.0)
+    {
+        return histogram->Max;
+    }
+
+    uint64_t target = (uint64_t) (percentile / 100.0 * (double) histogram->Total + 0.5);
+    target = target == 0 ? 1 : target;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += histogram->Counts[i];
+        if (seen >= target)
+        {
+            const uint64_t highest = BucketHighest(i);
+            return highest < histogram->Max ? highest : histogram->Max;
+        }
+    }
+    return histogram->Max;
+}
+
+void HistogramSetInit(struct HistogramSet* set)
+{
+    atomic_init(&set->Head, NULL);
+}
+
+struct Histogram* HistogramSetAdd(struct HistogramSet* set)
+{
+    struct Histogram* histogram = (struct Histogram*) malloc(sizeof(struct Histogram));
+    if (histogram == NULL)
+    {
+        return NULL;
+    }
+    HistogramInit(histogram);
+
+    struct Histogram* head = atomic_load_explicit(&set->Head, memory_order_relaxed);
+    do
+    {
+        histogram->Next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&set->Head, &head, histogram, memory_order_release,
+                                                    memory_order_relaxed));
+    return histogram;
+}
+
+void HistogramSetMerge(struct HistogramSet* set, struct Histogram* merged)
+{
+    HistogramInit(merged);
+    for (struct Histogram* h = atomic_load_explicit(&set->Head, memory_order_acquire); h != NULL; h = h->Next)
+    {
+        HistogramMerge(merged, h);
+    }
+}
+
+void HistogramSetDestroy(struct HistogramSet* set)
+{
+    struct Histogram* h = atomic_exchange(&set->Head, NULL);
+    while (h != NULL)
+    {
+        struct Histogram* next = h->Next;
+        free(h);
+        h = next;
+    }
+}
+
+static double tickNs;
+static pthread_once_t tickNsOnce = PTHREAD_ONCE_INIT;
+
+static void MeasureTickNs(void)
+{
+    // Long enough that the two clock reads at either end don't matter.
+    const uint64_t startNs = NowNs();
+    const uint64_t startTicks = NowTicks();
+    while (NowNs() - startNs < 20000000)
+    {
+    }
+    const uint64_t ns = NowNs() - startNs;
+    const uint64_t ticks = NowTicks() - startTicks;
+    tickNs = ticks > 0 ? (double) ns / (double) ticks : 1.0;
+}
+
+double HistogramTickNs(void)
+{
+    pthread_once(&tickNsOnce, MeasureTickNs);
+    return tickNs;
+}
+
+void HistogramPrintHeader(FILE* stream, const char* label)
+{
+    fprintf(stream, "%-16s %10s %10s %10s %10s %12s\n", label, "count", "p50", "p99", "p99.9", "max");
+}
+
+void HistogramPrintRow(FILE* stream, const char* label, const struct Histogram* histogram, double scale)
+{
+    fprintf(stream, "%-16s %10llu %10.0f %10.0f %10.0f %12.0f\n", label, (unsigned long long) histogram->Total,
+            (double) HistogramPercentile(histogram, 50.0) * scale,
+            (double) HistogramPercentile(histogram, 99.0) * scale,
+            (double) HistogramPercentile(histogram, 99.9) * scale,
+            (double) HistogramPercentile(histogram, 100.0) * scale);
+}
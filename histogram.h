@@ -0,0 +1,115 @@
+// HDR-style log-linear latency histograms.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// A log-linear latency histogram, the same idea as HdrHistogram. Each
+// power of two is split into HISTOGRAM_SUB_COUNT equal buckets, so any
+// value from 0 to 2^64 - 1 is recorded to within 1/64 (about 1.6%) of
+// itself, in a fixed 30 KiB of counts and with no allocation at all on
+// the recording path. Values below HISTOGRAM_SUB_COUNT are exact.
+//
+// A histogram has one writer. Threads that want to record at the same
+// time each take their own from a HistogramSet, and the set merges them
+// once they're done.
+
+#define HISTOGRAM_SUB_BITS 6
+#define HISTOGRAM_SUB_COUNT (1u << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((65 - HISTOGRAM_SUB_BITS) * HISTOGRAM_SUB_COUNT)
+
+struct Histogram
+{
+    uint64_t Counts[HISTOGRAM_BUCKETS];
+    uint64_t Total;
+    uint64_t Max;
+
+    // The next histogram in a set.
+    struct Histogram* Next;
+};
+
+void HistogramInit(struct Histogram* histogram);
+
+static inline size_t HistogramIndex(uint64_t value)
+{
+    if (value < HISTOGRAM_SUB_COUNT)
+    {
+        return (size_t) value;
+    }
+
+    // The top HISTOGRAM_SUB_BITS + 1 bits of the value pick the bucket,
+    // and how far down they sit picks the power of two.
+    const unsigned shift = (unsigned) (63 - __builtin_clzll(value)) - HISTOGRAM_SUB_BITS;
+    return (size_t) (shift + 1) * HISTOGRAM_SUB_COUNT + (size_t) (value >> shift) - HISTOGRAM_SUB_COUNT;
+}
+
+static inline void HistogramRecord(struct Histogram* histogram, uint64_t value)
+{
+    histogram->Counts[HistogramIndex(value)]++;
+    histogram->Total++;
+    if (value > histogram->Max)
+    {
+        histogram->Max = value;
+    }
+}
+
+// Adds every value recorded in from to into.
+void HistogramMerge(struct Histogram* into, const struct Histogram* from);
+
+// The value that percentile (0 to 100) percent of the recorded values are
+// at or below, to the histogram's precision. 100 gives the exact maximum.
+uint64_t HistogramPercentile(const struct Histogram* histogram, double percentile);
+
+// Histograms for any number of threads to record into at once. Adding
+// one is a lock-free push, and recording touches only the caller's own.
+struct HistogramSet
+{
+    _Atomic(struct Histogram*) Head;
+};
+
+void HistogramSetInit(struct HistogramSet* set);
+
+// A new, empty histogram in the set for the calling thread to record
+// into. Returns NULL if it couldn't be allocated.
+struct Histogram* HistogramSetAdd(struct HistogramSet* set);
+
+// Merges every histogram in the set into merged. Only call it once the
+// threads recording into the set are done.
+void HistogramSetMerge(struct HistogramSet* set, struct Histogram* merged);
+
+// Frees every histogram in the set.
+void HistogramSetDestroy(struct HistogramSet* set);
+
+// Nanoseconds per NowTicks() tick, measured against the monotonic clock
+// the first time it's asked for.
+double HistogramTickNs(void);
+
+// Prints the column headings for HistogramPrintRow.
+void HistogramPrintHeader(FILE* stream, const char* label);
+
+// Prints one line: label, how many values and their p50, p99, p99.9 and
+// maximum, each multiplied by scale (HistogramTickNs() for ticks).
+void HistogramPrintRow(FILE* stream, const char* label, const struct Histogram* histogram, double scale);
+
+#endif
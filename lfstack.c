@@ -0,0 +1,85 @@
+// A lock-free (Treiber stack) free list with ABA tags.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "lfstack.h"
+
+#include <stddef.h>
+
+#define POINTER_BITS 48
+#define POINTER_MASK (((uint64_t) 1 << POINTER_BITS) - 1)
+#define TAG_ONE ((uint64_t) 1 << POINTER_BITS)
+
+static struct LockFreeNode* PointerOf(uint64_t head)
+{
+    return (struct LockFreeNode*) (uintptr_t) (head & POINTER_MASK);
+}
+
+// Keeps the tag and swaps in a new pointer. Pushes don't need a new tag:
+// ABA needs a pop to observe a stale next pointer, and every pop bumps it.
+static uint64_t WithPointer(uint64_t head, const struct LockFreeNode* node)
+{
+    return (head & ~POINTER_MASK) | ((uint64_t) (uintptr_t) node & POINTER_MASK);
+}
+
+void LockFreeStackInit(struct LockFreeStack* stack)
+{
+    atomic_init(&stack->Head, 0);
+}
+
+void LockFreeStackPush(struct LockFreeStack* stack, struct LockFreeNode* node)
+{
+    LockFreeStackPushChain(stack, node, node);
+}
+
+void LockFreeStackPushChain(struct LockFreeStack* stack, struct LockFreeNode* first,
+                            struct LockFreeNode* last)
+{
+    uint64_t head = atomic_load_explicit(&stack->Head, memory_order_relaxed);
+    do
+    {
+        last->Next = PointerOf(head);
+    }
+    while (!atomic_compare_exchange_weak_explicit(&stack->Head, &head, WithPointer(head, first),
+                                                  memory_order_release, memory_order_relaxed));
+}
+
+struct LockFreeNode* LockFreeStackPop(struct LockFreeStack* stack)
+{
+    uint64_t head = atomic_load_explicit(&stack->Head, memory_order_acquire);
+    for (;;)
+    {
+        struct LockFreeNode* node = PointerOf(head);
+        if (node == NULL)
+        {
+            return NULL;
+        }
+
+        // Another thread might pop node and write to it while we read
+        // this. That's the case the tag catches: our CAS below will fail
+        // and we'll try again with the new head.
+        struct LockFreeNode* next = __atomic_load_n(&node->Next, __ATOMIC_RELAXED);
+        const uint64_t newHead = WithPointer(head + TAG_ONE, next);
+
+        if (atomic_compare_exchange_weak_explicit(&stack->Head, &head, newHead,
+                                                  memory_order_acquire, memory_order_acquire))
+        {
+            return node;
+        }
+    }
+}
@@ -0,0 +1,63 @@
+// A lock-free (Treiber stack) free list with ABA tags.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef LFSTACK_H
+#define LFSTACK_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// A lock-free free list (a Treiber stack). Threads push and pop blocks
+// with a single compare-and-swap on the head, so freeing from another
+// thread never has to wait for a mutex.
+//
+// The classic problem with this is ABA: thread 1 reads head A and A's
+// next B, stalls, thread 2 pops A and B and pushes A back, and thread 1's
+// CAS from A to B succeeds even though B isn't on the list anymore. We
+// avoid that by packing a counter into the top 16 bits of the head next
+// to the 48 bit pointer and bumping it on every pop, so the stale CAS
+// sees a different tag and fails.
+//
+// Blocks must stay mapped for as long as the stack is in use, because a
+// pop may still read the next pointer of a block another thread just
+// took. Allocator free lists never give their memory back, so that's fine.
+
+struct LockFreeNode
+{
+    struct LockFreeNode* Next;
+};
+
+struct LockFreeStack
+{
+    _Atomic uint64_t Head;
+};
+
+void LockFreeStackInit(struct LockFreeStack* stack);
+
+void LockFreeStackPush(struct LockFreeStack* stack, struct LockFreeNode* node);
+
+// Pushes an already linked chain from first to last with one CAS, for
+// returning a batch of blocks at once.
+void LockFreeStackPushChain(struct LockFreeStack* stack, struct LockFreeNode* first,
+                            struct LockFreeNode* last);
+
+// Returns NULL when the stack is empty.
+struct LockFreeNode* LockFreeStackPop(struct LockFreeStack* stack);
+
+#endif
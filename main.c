@@ -21,10 +21,90 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
+
+#include "engine.h"
+#include "forkserver.h"
+#include "histogram.h"
+#include "objects.h"
+#include "perfcounters.h"
+#include "shadow.h"
+#include "sweep.h"
+#include "trace.h"
 
-#define OOM_EXIT_CODE 93
 #define NAMEOF(x) #x
 
+// Set by -c: the giant object demo checks every field write against the
+// shadow engine's shadow memory before making it.
+static int checkedWrites = 0;
+
+// Set by -p: every demo, and the whole of a -f, -s or -a run, is counted
+// with the performance counters, and the counts are printed after it.
+static int countEvents = 0;
+static struct PerfCounters counters;
+
+static void CountersBegin(void)
+{
+    if (countEvents)
+    {
+        PerfCountersStart(&counters);
+    }
+}
+
+static void CountersEnd(const char* scenario)
+{
+    if (countEvents)
+    {
+        struct PerfReading reading;
+        PerfCountersStop(&counters, &reading);
+        printf("\n");
+        PerfReadingPrint(stdout, scenario, &reading);
+    }
+}
+
+// Set by -m: every malloc and free is timed, and the percentiles are
+// printed at the end.
+static int timeCalls = 0;
+static struct HistogramSet mallocTimes;
+static struct HistogramSet freeTimes;
+
+static void PrintCallTimes(void)
+{
+    if (!timeCalls)
+    {
+        return;
+    }
+
+    struct Histogram merged;
+    const double tickNs = HistogramTickNs();
+    printf("\nEvery malloc and free on the %s engine, in ns:\n", EngineCurrent()->Name);
+    HistogramPrintHeader(stdout, "call");
+    HistogramSetMerge(&mallocTimes, &merged);
+    HistogramPrintRow(stdout, "malloc", &merged, tickNs);
+    HistogramSetMerge(&freeTimes, &merged);
+    HistogramPrintRow(stdout, "free", &merged, tickNs);
+}
+
+// Returns 1 if the size bytes of field, a field of p, are all inside the
+// allocation. Otherwise says which byte isn't and returns 0.
+static int CheckFieldWrite(const void* p, const void* field, size_t size, const char* name)
+{
+    const struct Shadow* shadow = ShadowEngineState();
+    if (ShadowIsAddressable(shadow, field, size))
+    {
+        return 1;
+    }
+
+    const size_t offset = (size_t) ((const char*) field - (const char*) p);
+    const size_t bad = ShadowFirstPoisoned(shadow, field, size);
+    const uint8_t mark = ShadowMarkAt(shadow, (const char*) field + bad);
+    printf("Stop! %s is bytes %zu to %zu of the object, and byte %zu is %s.\n", name, offset, offset + size - 1,
+           offset + bad, mark == SHADOW_MARK_FREED ? "in freed memory"
+                         : mark == SHADOW_MARK_UNALLOCATED ? "outside any allocation"
+                         : "past the end of the allocation");
+    return 0;
+}
+
 void IntMallocDemo()
 {
     printf("Let's try to allocate just one byte for integers.\n");
@@ -35,7 +115,7 @@ void IntMallocDemo()
     // It's more than possible. We'd have to be pretty lucky to get
     // these next to each other in memory though. So we'll force that
     // by simulating it in another test.
-    int* p1 = (int*) malloc(1);
+    int* p1 = (int*) EngineMalloc(1);
 
     // Make sure we could allocate that one byte
     if (p1 == NULL)
@@ -44,7 +124,7 @@ void IntMallocDemo()
         exit(OOM_EXIT_CODE);
     }
 
-    int* p2 = (int*) malloc(1);
+    int* p2 = (int*) EngineMalloc(1);
 
     // And check one more time
     if (p2 == NULL)
@@ -68,21 +148,13 @@ void IntMallocDemo()
         printf(NAMEOF(p1) " and " NAMEOF(p2) " are not immediately next to each other.\n");
     }
 
-    free(p1);
+    EngineFree(p1);
     p1 = NULL;
 
-    free(p2);
+    EngineFree(p2);
     p2 = NULL;
 }
 
-struct Object
-{
-    // We'll use unsigned integers so we can spell fun words with
-    // hex literals without signed/unsigned conversion.
-    uint32_t Field1;
-    uint32_t Field2;
-};
-
 void ObjectMallocDemo()
 {
     printf("Let's try allocating the wrong size when using\n"
@@ -96,7 +168,7 @@ void ObjectMallocDemo()
            "for the entire struct.\n");
 
     printf("We'll allocate %lu bytes for the array.\n", sizeof(struct Object));
-    char* memForObject = (char*) malloc(sizeof(struct Object));
+    char* memForObject = (char*) EngineMalloc(sizeof(struct Object));
 
     // Make sure we were able to allocate.
     if (memForObject == NULL)
@@ -182,36 +254,12 @@ void ObjectMallocDemo()
     // the actual memory we allocated with malloc. We have
     // to free the pointer given to us by malloc to be as
     // safe as possible.
-    free(memForObject);
+    EngineFree(memForObject);
     memForObject = NULL;
     p1 = NULL;
     p2 = NULL;
 }
 
-struct GiantObject
-{
-    int64_t Field01;
-    int64_t Field02;
-    int64_t Field03;
-    int64_t Field04;
-    int64_t Field05;
-    int64_t Field06;
-    int64_t Field07;
-    int64_t Field08;
-    int64_t Field09;
-    int64_t Field10;
-    int64_t Field11;
-    int64_t Field12;
-    int64_t Field13;
-    int64_t Field14;
-    int64_t Field15;
-    int64_t Field16;
-    int64_t Field17;
-    int64_t Field18;
-    int64_t Field19;
-    int64_t Field20;
-};
-
 void GiantObjectDemo()
 {
     const size_t bytesToAllocate = 2;
@@ -219,7 +267,7 @@ void GiantObjectDemo()
     printf("We'll only allocate %lu bytes for a %lu byte object.\n",
            bytesToAllocate, sizeof(struct GiantObject));
 
-    struct GiantObject* p = (struct GiantObject*) malloc(bytesToAllocate);
+    struct GiantObject* p = (struct GiantObject*) EngineMalloc(bytesToAllocate);
 
     // Make sure we get usable memory back.
     if (p == NULL)
@@ -233,6 +281,11 @@ void GiantObjectDemo()
 
 #define WRITE_TO_FIELD(field, value) { \
     printf("Write data to " NAMEOF(p->field) "...\n"); \
+    if (checkedWrites && !CheckFieldWrite(p, &p->field, sizeof(p->field), NAMEOF(p->field))) \
+    { \
+        EngineFree(p); \
+        return; \
+    } \
     p->field = value; }
 
     WRITE_TO_FIELD(Field01, 0x12345678);
@@ -260,12 +313,215 @@ void GiantObjectDemo()
 
     printf("Congratulations! It didn't segfault!\n");
 
-    free(p);
+    EngineFree(p);
     p = NULL;
 }
 
+static void GiantObjectTrial(void* context)
+{
+    (void) context;
+    GiantObjectDemo();
+}
+
+static void PrintUsage(FILE* stream, const char* program)
+{
+    fprintf(stream, "Usage: %s [-g] [-c] [-p] [-m] [-e engine] [-l] [-r rounds] [-t file] [-f trials] [-s rounds]\n"
+                    "          [-a iterations [-j threads]]\n"
+                    "  -g         also run the giant object demo (likely to segfault)\n"
+                    "  -c         check the giant object demo's writes against the shadow engine's\n"
+                    "             shadow memory, and stop at the first one outside the object\n"
+                    "  -p         count cycles, instructions, cache and TLB misses and page faults\n"
+                    "             for each demo (or the whole -f, -s or -a run) and print them\n"
+                    "  -m         time every malloc and free and print p50, p99, p99.9 and max\n"
+                    "  -e engine  run the demos on the given allocator engine\n"
+                    "  -l         list the allocator engines and exit\n"
+                    "  -r rounds  run the demos this many times over (default 1)\n"
+                    "  -t file    record every malloc and free the demos make into file\n"
+                    "  -f trials  run just the giant object demo this many times, each in its own\n"
+                    "             forked child, and count how often it crashes\n"
+                    "  -s rounds  write the giant object into every smaller allocation size this many\n"
+                    "             times over, catching the faults, and show where they happened\n"
+                    "  -a iterations  make the int demo's two allocations this many times for every size\n"
+                    "             up to %d bytes and show how far apart they land\n"
+                    "  -j threads spread -a over this many threads (default one per core)\n",
+            program, INT_SWEEP_MAX_SIZE);
+}
+
 int main(int argc, char** argv)
 {
+    int giantObjectDemo = 0;
+    const char* tracePath = NULL;
+    unsigned long rounds = 1;
+    unsigned long trials = 0;
+    unsigned long sweepRounds = 0;
+    unsigned long adjacencyIterations = 0;
+    size_t threads = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "gcpme:lr:t:f:s:a:j:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'g':
+                giantObjectDemo = 1;
+                break;
+            case 'c':
+                checkedWrites = 1;
+                break;
+            case 'p':
+                countEvents = 1;
+                break;
+            case 'm':
+                timeCalls = 1;
+                break;
+            case 'e':
+            {
+                const struct AllocEngine* engine = EngineFind(optarg);
+                if (engine == NULL)
+                {
+                    fprintf(stderr, "Unknown engine '%s'. Available engines:\n", optarg);
+                    EnginePrintAll(stderr);
+                    return 1;
+                }
+                EngineSelect(engine);
+                break;
+            }
+            case 'l':
+                EnginePrintAll(stdout);
+                return 0;
+            case 'r':
+                rounds = strtoul(optarg, NULL, 10);
+                if (rounds == 0)
+                {
+                    fprintf(stderr, "Rounds must be a positive number.\n");
+                    return 1;
+                }
+                break;
+            case 't':
+                tracePath = optarg;
+                break;
+            case 'f':
+                trials = strtoul(optarg, NULL, 10);
+                if (trials == 0)
+                {
+                    fprintf(stderr, "Trials must be a positive number.\n");
+                    return 1;
+                }
+                break;
+            case 'a':
+                adjacencyIterations = strtoul(optarg, NULL, 10);
+                if (adjacencyIterations == 0)
+                {
+                    fprintf(stderr, "Iterations must be a positive number.\n");
+                    return 1;
+                }
+                break;
+            case 'j':
+                threads = strtoul(optarg, NULL, 10);
+                if (threads == 0)
+                {
+                    fprintf(stderr, "Threads must be a positive number.\n");
+                    return 1;
+                }
+                break;
+            case 's':
+                sweepRounds = strtoul(optarg, NULL, 10);
+                if (sweepRounds == 0)
+                {
+                    fprintf(stderr, "Rounds must be a positive number.\n");
+                    return 1;
+                }
+                break;
+            default:
+                PrintUsage(stderr, argv[0]);
+                return 1;
+        }
+    }
+
+    if (checkedWrites && EngineCurrent() != &ShadowEngine)
+    {
+        fprintf(stderr, "-c needs the shadow engine (-e shadow).\n");
+        return 1;
+    }
+
+    if (timeCalls)
+    {
+        HistogramSetInit(&mallocTimes);
+        HistogramSetInit(&freeTimes);
+        EngineTimeCalls(&mallocTimes, &freeTimes);
+    }
+
+    // Opened before any thread or child exists, so they're counted too.
+    if (countEvents)
+    {
+        PerfCountersOpen(&counters, 1);
+        PerfCountersPrintMissing(stdout, &counters);
+    }
+
+    if (trials > 0)
+    {
+        // A child would record into the same shared rings as the parent
+        // thread it was forked from, and each ring has only one writer.
+        if (tracePath != NULL)
+        {
+            fprintf(stderr, "-f can't be combined with -t.\n");
+            return 1;
+        }
+
+        // Neither can the timings, which would stay in the children.
+        if (timeCalls)
+        {
+            fprintf(stderr, "-f can't be combined with -m.\n");
+            return 1;
+        }
+
+        // Set the engine up once here so no child has to.
+        EngineFree(EngineMalloc(1));
+
+        printf("Running the giant object demo on the %s engine in forked children.\n", EngineCurrent()->Name);
+        struct ForkServerResults results;
+        CountersBegin();
+        if (ForkServerRun(trials, GiantObjectTrial, NULL, &results) != 0)
+        {
+            perror("Couldn't run every trial");
+        }
+        ForkServerPrint(stdout, &results);
+        CountersEnd("Trials");
+        return 0;
+    }
+
+    if (adjacencyIterations > 0)
+    {
+        CountersBegin();
+        if (IntMallocSweep(stdout, adjacencyIterations, threads) != 0)
+        {
+            fprintf(stderr, "Couldn't start the worker threads.\n");
+            return 1;
+        }
+        CountersEnd("IntMallocSweep");
+        PrintCallTimes();
+        return 0;
+    }
+
+    if (sweepRounds > 0)
+    {
+        CountersBegin();
+        if (GiantObjectSweep(stdout, sweepRounds) != 0)
+        {
+            perror("Couldn't catch faults");
+            return 1;
+        }
+        CountersEnd("GiantObjectSweep");
+        PrintCallTimes();
+        return 0;
+    }
+
+    if (tracePath != NULL && TraceStart(tracePath) != 0)
+    {
+        perror("Couldn't start tracing");
+        return 1;
+    }
+
     // This demo with integers could work, but it's quite unreliable.
     // It trusts that they land right next to each other in order to
     // have a visible effect. But it does have the obvious issue of
@@ -275,15 +531,46 @@ int main(int argc, char** argv)
     // IntMallocDemo();
     // printf("\n====================================================\n\n");
 
-    ObjectMallocDemo();
+    for (unsigned long round = 0; round < rounds; round++)
+    {
+        if (round > 0)
+        {
+            printf("\n====================================================\n\n");
+        }
+
+        CountersBegin();
+        ObjectMallocDemo();
+        CountersEnd("ObjectMallocDemo");
+
+        // We'll conditionally enable the "giant object" demo since it's very
+        // likely to segfault.
+        if (giantObjectDemo)
+        {
+            printf("\n====================================================\n\n");
+            CountersBegin();
+            GiantObjectDemo();
+            CountersEnd("GiantObjectDemo");
+        }
+
+        // Engines without a real free (like the arena) hand everything back here.
+        if (EngineCurrent()->Reset != NULL)
+        {
+            EngineCurrent()->Reset();
+        }
+    }
 
-    // We'll conditionally enable the "giant object" demo since it's very
-    // likely to segfault.
-    if (argc > 1 && strcmp(argv[1], "-g") == 0)
+    if (tracePath != NULL)
     {
-        printf("\n====================================================\n\n");
-        GiantObjectDemo();
+        // If the giant object demo crashed before we get here, the drain
+        // process still finishes the trace, up to the crash.
+        if (TraceStop() != 0)
+        {
+            perror("The trace is incomplete");
+            return 1;
+        }
+        fprintf(stderr, "Traced %llu events into %s.\n", (unsigned long long) TraceEventCount(), tracePath);
     }
 
+    PrintCallTimes();
     return 0;
 }
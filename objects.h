@@ -0,0 +1,61 @@
+// The objects the demos allocate.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef OBJECTS_H
+#define OBJECTS_H
+
+#include <stdint.h>
+
+#define OOM_EXIT_CODE 93
+
+struct Object
+{
+    // We'll use unsigned integers so we can spell fun words with
+    // hex literals without signed/unsigned conversion.
+    uint32_t Field1;
+    uint32_t Field2;
+};
+
+struct GiantObject
+{
+    int64_t Field01;
+    int64_t Field02;
+    int64_t Field03;
+    int64_t Field04;
+    int64_t Field05;
+    int64_t Field06;
+    int64_t Field07;
+    int64_t Field08;
+    int64_t Field09;
+    int64_t Field10;
+    int64_t Field11;
+    int64_t Field12;
+    int64_t Field13;
+    int64_t Field14;
+    int64_t Field15;
+    int64_t Field16;
+    int64_t Field17;
+    int64_t Field18;
+    int64_t Field19;
+    int64_t Field20;
+};
+
+#define GIANT_FIELD_COUNT 20
+
+#endif
@@ -0,0 +1,196 @@
+// Reads hardware performance counters for the calling thread with perf_event_open.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "perfcounters.h"
+
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct PerfEventInfo
+{
+    const char* Name;
+    uint32_t Type;
+    uint64_t Config;
+    enum PerfGroup Group;
+};
+
+#define CACHE_READ_MISSES(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct PerfEventInfo events[PERF_EVENT_COUNT] = {
+    [PERF_EVENT_CYCLES] = { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, PERF_GROUP_HARDWARE },
+    [PERF_EVENT_INSTRUCTIONS] = { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,
+                                  PERF_GROUP_HARDWARE },
+    [PERF_EVENT_L1D_MISSES] = { "L1D-misses", PERF_TYPE_HW_CACHE, CACHE_READ_MISSES(PERF_COUNT_HW_CACHE_L1D),
+                                PERF_GROUP_HARDWARE },
+    [PERF_EVENT_LLC_MISSES] = { "LLC-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,
+                                PERF_GROUP_HARDWARE },
+    [PERF_EVENT_DTLB_MISSES] = { "dTLB-misses", PERF_TYPE_HW_CACHE, CACHE_READ_MISSES(PERF_COUNT_HW_CACHE_DTLB),
+                                 PERF_GROUP_HARDWARE },
+    [PERF_EVENT_PAGE_FAULTS] = { "page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS,
+                                 PERF_GROUP_SOFTWARE },
+};
+
+static int OpenEvent(const struct PerfEventInfo* event, int groupFd, int inherit)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = event->Type;
+    attr.config = event->Config;
+    attr.disabled = groupFd == -1;
+    attr.inherit = inherit != 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    // Each counter is read on its own rather than with one group read,
+    // since inherited counters can't be read as a group.
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+
+int PerfCountersOpen(struct PerfCounters* counters, int inherit)
+{
+    for (int g = 0; g < PERF_GROUP_COUNT; g++)
+    {
+        counters->Leaders[g] = -1;
+    }
+    counters->Opened = 0;
+
+    for (int e = 0; e < PERF_EVENT_COUNT; e++)
+    {
+        int* leader = &counters->Leaders[events[e].Group];
+        counters->Fds[e] = OpenEvent(&events[e], *leader, inherit);
+        if (counters->Fds[e] < 0)
+        {
+            counters->Fds[e] = -1;
+            continue;
+        }
+        if (*leader == -1)
+        {
+            *leader = counters->Fds[e];
+        }
+        counters->Opened++;
+    }
+    return counters->Opened;
+}
+
+void PerfCountersClose(struct PerfCounters* counters)
+{
+    for (int e = 0; e < PERF_EVENT_COUNT; e++)
+    {
+        if (counters->Fds[e] != -1)
+        {
+            close(counters->Fds[e]);
+            counters->Fds[e] = -1;
+        }
+    }
+    for (int g = 0; g < PERF_GROUP_COUNT; g++)
+    {
+        counters->Leaders[g] = -1;
+    }
+    counters->Opened = 0;
+}
+
+void PerfCountersStart(struct PerfCounters* counters)
+{
+    for (int g = 0; g < PERF_GROUP_COUNT; g++)
+    {
+        if (counters->Leaders[g] != -1)
+        {
+            ioctl(counters->Leaders[g], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(counters->Leaders[g], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+}
+
+void PerfCountersStop(struct PerfCounters* counters, struct PerfReading* reading)
+{
+    for (int g = 0; g < PERF_GROUP_COUNT; g++)
+    {
+        if (counters->Leaders[g] != -1)
+        {
+            ioctl(counters->Leaders[g], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+
+    memset(reading, 0, sizeof(*reading));
+    for (int e = 0; e < PERF_EVENT_COUNT; e++)
+    {
+        // The count, how long the counter was enabled and how long it was
+        // actually on the PMU. A group the PMU could never fit counts
+        // nothing at all.
+        uint64_t data[3];
+        if (counters->Fds[e] == -1 || read(counters->Fds[e], data, sizeof(data)) != (ssize_t) sizeof(data)
+            || data[2] == 0)
+        {
+            continue;
+        }
+
+        // If the group had to share the PMU with someone else, scale up to
+        // what it would have counted all along.
+        const double scale = data[2] < data[1] ? (double) data[1] / (double) data[2] : 1.0;
+        reading->Values[e] = (uint64_t) ((double) data[0] * scale);
+        reading->Valid |= 1u << e;
+    }
+}
+
+const char* PerfEventName(enum PerfEvent event)
+{
+    return events[event].Name;
+}
+
+void PerfReadingPrint(FILE* stream, const char* label, const struct PerfReading* reading)
+{
+    fprintf(stream, "%s:", label);
+    for (int e = 0; e < PERF_EVENT_COUNT; e++)
+    {
+        if (reading->Valid & (1u << e))
+        {
+            fprintf(stream, " %s %llu", events[e].Name, (unsigned long long) reading->Values[e]);
+        }
+        else
+        {
+            fprintf(stream, " %s -", events[e].Name);
+        }
+        fprintf(stream, e + 1 < PERF_EVENT_COUNT ? "," : "\n");
+    }
+}
+
+void PerfCountersPrintMissing(FILE* stream, const struct PerfCounters* counters)
+{
+    if (counters->Opened == PERF_EVENT_COUNT)
+    {
+        return;
+    }
+
+    fprintf(stream, "Not counted here:");
+    for (int e = 0, first = 1; e < PERF_EVENT_COUNT; e++)
+    {
+        if (counters->Fds[e] == -1)
+        {
+            fprintf(stream, "%s %s", first ? "" : ",", events[e].Name);
+            first = 0;
+        }
+    }
+    fprintf(stream, " (no PMU, as in most VMs, or perf_event_paranoid doesn't allow them).\n");
+}
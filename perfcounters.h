@@ -0,0 +1,96 @@
+// Hardware performance counters through perf_event_open.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Performance counters through perf_event_open: the CPU's hardware
+// events plus the kernel's page fault count. The hardware counters are
+// opened as one group, so they're all on the PMU for exactly the same
+// stretch of code, and the software ones as another. Only user-space work
+// is counted.
+//
+// Counters the kernel won't give us (no PMU inside a VM, a strict
+// perf_event_paranoid, a group too big for the hardware) are simply left
+// out, and readings say which ones are missing, so callers can print a
+// dash instead of failing.
+
+enum PerfEvent
+{
+    PERF_EVENT_CYCLES,
+    PERF_EVENT_INSTRUCTIONS,
+    PERF_EVENT_L1D_MISSES,
+    PERF_EVENT_LLC_MISSES,
+    PERF_EVENT_DTLB_MISSES,
+    PERF_EVENT_PAGE_FAULTS,
+    PERF_EVENT_COUNT
+};
+
+enum PerfGroup
+{
+    PERF_GROUP_HARDWARE,
+    PERF_GROUP_SOFTWARE,
+    PERF_GROUP_COUNT
+};
+
+struct PerfCounters
+{
+    // -1 for events that couldn't be opened. In each group the first one
+    // that could is the leader.
+    int Fds[PERF_EVENT_COUNT];
+    int Leaders[PERF_GROUP_COUNT];
+    int Opened;
+};
+
+struct PerfReading
+{
+    uint64_t Values[PERF_EVENT_COUNT];
+
+    // Bit e is set when Values[e] was counted.
+    unsigned Valid;
+};
+
+// Opens as many of the counters as it can, all stopped. With inherit set
+// they also count every thread and child process started after they're
+// opened; otherwise just the calling thread. Returns how many opened;
+// with 0, readings just come back empty.
+int PerfCountersOpen(struct PerfCounters* counters, int inherit);
+void PerfCountersClose(struct PerfCounters* counters);
+
+// Zeroes the counters and starts them.
+void PerfCountersStart(struct PerfCounters* counters);
+
+// Stops the counters and reads them.
+void PerfCountersStop(struct PerfCounters* counters, struct PerfReading* reading);
+
+// A short name for the event, for column headers.
+const char* PerfEventName(enum PerfEvent event);
+
+// Prints "label: " and every event's count on one line, with - for the
+// ones that weren't counted.
+void PerfReadingPrint(FILE* stream, const char* label, const struct PerfReading* reading);
+
+// Prints which events couldn't be opened, if any, and why that usually
+// is. Prints nothing when they all were.
+void PerfCountersPrintMissing(FILE* stream, const struct PerfCounters* counters);
+
+#endif
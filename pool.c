@@ -0,0 +1,150 @@
+// A fixed-size pool allocator for struct Object.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "pool.h"
+
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define POOL_ENGINE_SLAB_BYTES ((size_t) 64 * 1024)
+
+struct ObjectPool* ObjectPoolCreate(size_t slabBytes)
+{
+    struct ObjectPool* pool = (struct ObjectPool*) malloc(sizeof(struct ObjectPool));
+    if (pool == NULL)
+    {
+        return NULL;
+    }
+
+    const size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    slabBytes = (slabBytes + pageSize - 1) & ~(pageSize - 1);
+
+    pool->FreeList = NULL;
+    pool->Unused = NULL;
+    pool->UnusedEnd = NULL;
+    pool->Slabs = NULL;
+    pool->SlabBytes = slabBytes;
+    pool->SlabCount = 0;
+    return pool;
+}
+
+static int ObjectPoolGrow(struct ObjectPool* pool)
+{
+    void* mem = mmap(NULL, pool->SlabBytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    // The first slot of each slab links it into the slab list so we can
+    // unmap it later. The rest are up for grabs.
+    union PoolSlot* slab = (union PoolSlot*) mem;
+    slab->Next = pool->Slabs;
+    pool->Slabs = slab;
+    pool->SlabCount++;
+
+    pool->Unused = slab + 1;
+    pool->UnusedEnd = slab + pool->SlabBytes / sizeof(union PoolSlot);
+    return 0;
+}
+
+struct Object* ObjectPoolAlloc(struct ObjectPool* pool)
+{
+    union PoolSlot* slot = pool->FreeList;
+    if (slot != NULL)
+    {
+        pool->FreeList = slot->Next;
+        return &slot->Object;
+    }
+
+    if (pool->Unused == pool->UnusedEnd && ObjectPoolGrow(pool) != 0)
+    {
+        return NULL;
+    }
+
+    return &(pool->Unused++)->Object;
+}
+
+void ObjectPoolFree(struct ObjectPool* pool, struct Object* object)
+{
+    if (object == NULL)
+    {
+        return;
+    }
+
+    union PoolSlot* slot = (union PoolSlot*) object;
+    slot->Next = pool->FreeList;
+    pool->FreeList = slot;
+}
+
+void ObjectPoolDestroy(struct ObjectPool* pool)
+{
+    if (pool == NULL)
+    {
+        return;
+    }
+
+    union PoolSlot* slab = pool->Slabs;
+    while (slab != NULL)
+    {
+        union PoolSlot* next = slab->Next;
+        munmap(slab, pool->SlabBytes);
+        slab = next;
+    }
+
+    free(pool);
+}
+
+size_t ObjectPoolFootprint(const struct ObjectPool* pool)
+{
+    return pool->SlabCount * pool->SlabBytes;
+}
+
+static struct ObjectPool* enginePool;
+
+static void* PoolEngineMalloc(size_t size)
+{
+    if (size > sizeof(struct Object))
+    {
+        return NULL;
+    }
+
+    if (enginePool == NULL && (enginePool = ObjectPoolCreate(POOL_ENGINE_SLAB_BYTES)) == NULL)
+    {
+        return NULL;
+    }
+
+    return ObjectPoolAlloc(enginePool);
+}
+
+static void PoolEngineFree(void* ptr)
+{
+    ObjectPoolFree(enginePool, (struct Object*) ptr);
+}
+
+const struct AllocEngine PoolEngine = {
+    .Name = "pool",
+    .Description = "fixed-size struct Object pool; bigger requests fail",
+    .Malloc = PoolEngineMalloc,
+    .Free = PoolEngineFree,
+    .Reset = NULL,
+    .ThreadSafe = 0,
+};
@@ -0,0 +1,75 @@
+// A fixed-size pool allocator for struct Object.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+#include "engine.h"
+#include "objects.h"
+
+// A fixed-size pool for struct Object. Every slot is exactly one
+// struct Object with no header in front of it; a free slot stores the
+// pointer to the next free slot in its own bytes (an intrusive free
+// list), which works because a struct Object is as big as a pointer.
+union PoolSlot
+{
+    struct Object Object;
+    union PoolSlot* Next;
+};
+
+struct ObjectPool
+{
+    // Slots that have been freed and can be handed out again.
+    union PoolSlot* FreeList;
+
+    // Slots in the newest slab that have never been handed out. We carve
+    // these off lazily instead of threading a whole slab onto the free
+    // list up front.
+    union PoolSlot* Unused;
+    union PoolSlot* UnusedEnd;
+
+    // Every slab we've mapped, linked through their first slot.
+    union PoolSlot* Slabs;
+    size_t SlabBytes;
+    size_t SlabCount;
+};
+
+// Creates a pool that grows slabBytes (rounded up to a page) at a time.
+// Returns NULL if we couldn't allocate the pool itself.
+struct ObjectPool* ObjectPoolCreate(size_t slabBytes);
+
+// Returns NULL once a new slab can't be mapped.
+struct Object* ObjectPoolAlloc(struct ObjectPool* pool);
+
+void ObjectPoolFree(struct ObjectPool* pool, struct Object* object);
+
+// Unmaps every slab. Any objects still out are gone too.
+void ObjectPoolDestroy(struct ObjectPool* pool);
+
+// Bytes of memory the pool has taken from the OS.
+size_t ObjectPoolFootprint(const struct ObjectPool* pool);
+
+// The pool engine serves every request from one shared pool, so it only
+// handles requests up to sizeof(struct Object). Anything bigger comes
+// back NULL. That's enough for every allocation the demos make.
+extern const struct AllocEngine PoolEngine;
+
+#endif
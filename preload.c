@@ -0,0 +1,260 @@
+// An LD_PRELOAD malloc replacement built on the thread-cache allocator.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sizeclass.h"
+#include "tcache.h"
+#include "trace.h"
+
+// This file is built into libmallocdemo.so, which replaces the C
+// library's malloc family with the thread-cache allocator for any program
+// it's preloaded into:
+//
+//   LD_PRELOAD=./build/libmallocdemo.so ./build/main
+//
+// Interposers usually find the real malloc with dlsym, which can itself
+// call malloc (or calloc) before libc is ready. We never need the real
+// malloc: everything below gets its memory straight from mmap, and the
+// locks and thread-local state it uses are statically initialized. So
+// there's nothing to bootstrap and the very first malloc, however early,
+// just works.
+//
+// Set MALLOCDEMO_TRACE=path to record every call into an allocation trace
+// (see trace.h) while the program runs. The trace goes to path.<pid>, since
+// any programs it starts inherit the variable and would otherwise all
+// truncate and write over the same file.
+
+// Lets a program check whether it's running on this allocator.
+int MallocDemoInterposed(void)
+{
+    return 1;
+}
+
+static void* Allocate(size_t size, const void* callSite)
+{
+    void* p = TCacheMalloc(size);
+    if (p == NULL)
+    {
+        errno = ENOMEM;
+    }
+    TraceMalloc(p, size, callSite);
+    return p;
+}
+
+static void* AllocateAligned(size_t alignment, size_t size, const void* callSite)
+{
+    void* p = TCacheMallocAligned(alignment, size);
+    if (p == NULL)
+    {
+        errno = ENOMEM;
+    }
+    TraceMalloc(p, size, callSite);
+    return p;
+}
+
+static void Release(void* ptr, const void* callSite)
+{
+    TraceFree(ptr, callSite);
+    TCacheFree(ptr);
+}
+
+// Every entry point records its own caller as the call site, which is why
+// they call the helpers above rather than each other.
+
+void* malloc(size_t size)
+{
+    return Allocate(size, __builtin_return_address(0));
+}
+
+void free(void* ptr)
+{
+    Release(ptr, __builtin_return_address(0));
+}
+
+void* calloc(size_t count, size_t size)
+{
+    size_t total;
+    if (__builtin_mul_overflow(count, size, &total))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    void* p = Allocate(total, __builtin_return_address(0));
+    if (p != NULL)
+    {
+        memset(p, 0, total);
+    }
+    return p;
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    const void* callSite = __builtin_return_address(0);
+    if (ptr == NULL)
+    {
+        return Allocate(size, callSite);
+    }
+    if (size == 0)
+    {
+        Release(ptr, callSite);
+        return NULL;
+    }
+
+    // Stay put if the block is already big enough and we wouldn't land in
+    // a smaller class anyway. The trace still sees a free and a malloc,
+    // since the allocation's size changed.
+    const size_t usable = SizeClassUsableSize(ptr);
+    if (size <= usable && SizeClassIndex(size) == SizeClassIndex(usable))
+    {
+        TraceFree(ptr, callSite);
+        TraceMalloc(ptr, size, callSite);
+        return ptr;
+    }
+
+    void* p = Allocate(size, callSite);
+    if (p != NULL)
+    {
+        memcpy(p, ptr, size < usable ? size : usable);
+        Release(ptr, callSite);
+    }
+    return p;
+}
+
+static int IsPowerOfTwo(size_t x)
+{
+    return x != 0 && (x & (x - 1)) == 0;
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+    if (!IsPowerOfTwo(alignment))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return AllocateAligned(alignment, size, __builtin_return_address(0));
+}
+
+int posix_memalign(void** out, size_t alignment, size_t size)
+{
+    if (!IsPowerOfTwo(alignment) || alignment % sizeof(void*) != 0)
+    {
+        return EINVAL;
+    }
+
+    // It reports failure through its return value and leaves errno alone.
+    const int savedErrno = errno;
+    void* p = AllocateAligned(alignment, size, __builtin_return_address(0));
+    if (p == NULL)
+    {
+        errno = savedErrno;
+        return ENOMEM;
+    }
+
+    *out = p;
+    return 0;
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    if (!IsPowerOfTwo(alignment))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return AllocateAligned(alignment, size, __builtin_return_address(0));
+}
+
+void* valloc(size_t size)
+{
+    return AllocateAligned((size_t) sysconf(_SC_PAGESIZE), size, __builtin_return_address(0));
+}
+
+void* pvalloc(size_t size)
+{
+    const size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    if (size > SIZE_MAX - (pageSize - 1))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return AllocateAligned(pageSize, (size + pageSize - 1) & ~(pageSize - 1), __builtin_return_address(0));
+}
+
+size_t malloc_usable_size(void* ptr)
+{
+    return SizeClassUsableSize(ptr);
+}
+
+// A fork while another thread holds the central lock would leave the
+// child with a lock nobody will ever release. Holding it ourselves across
+// the fork means it's always in a known state on both sides.
+static void LockBeforeFork(void)
+{
+    TCacheLockCentral();
+}
+
+static void UnlockAfterFork(void)
+{
+    TCacheUnlockCentral();
+}
+
+// Registering can allocate, so it happens in a constructor (when malloc
+// is already usable) rather than from inside malloc. This is also where
+// we start tracing if MALLOCDEMO_TRACE names a file to trace into.
+__attribute__((constructor)) static void Initialize(void)
+{
+    pthread_atfork(LockBeforeFork, UnlockAfterFork, UnlockAfterFork);
+
+    const char* tracePath = getenv("MALLOCDEMO_TRACE");
+    if (tracePath == NULL || *tracePath == '\0')
+    {
+        return;
+    }
+
+    static char path[4096];
+    const int length = snprintf(path, sizeof(path), "%s.%d", tracePath, (int) getpid());
+    if (length < 0 || (size_t) length >= sizeof(path) || TraceStart(path) != 0)
+    {
+        static const char message[] = "libmallocdemo.so: couldn't start tracing\n";
+        ssize_t ignored = write(STDERR_FILENO, message, sizeof(message) - 1);
+        (void) ignored;
+    }
+}
+
+__attribute__((destructor)) static void Finish(void)
+{
+    if (TraceStop() != 0)
+    {
+        static const char message[] = "libmallocdemo.so: the trace is incomplete\n";
+        ssize_t ignored = write(STDERR_FILENO, message, sizeof(message) - 1);
+        (void) ignored;
+    }
+}
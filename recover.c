@@ -0,0 +1,93 @@
+// Catches bad memory accesses and jumps back out of them.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "recover.h"
+
+#include <setjmp.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Only ever touched by the thread's own code and its own signal handler.
+static _Thread_local sigjmp_buf recoverPoint;
+static _Thread_local volatile sig_atomic_t recovering;
+static _Thread_local struct RecoverFault lastFault;
+
+static void FaultHandler(int signal, siginfo_t* info, void* ucontext)
+{
+    (void) ucontext;
+
+    if (!recovering)
+    {
+        // Not ours. Put the default action back and return; the access
+        // happens again and takes the process down as usual.
+        struct sigaction defaultAction;
+        memset(&defaultAction, 0, sizeof(defaultAction));
+        defaultAction.sa_handler = SIG_DFL;
+        sigaction(signal, &defaultAction, NULL);
+        return;
+    }
+
+    recovering = 0;
+    lastFault.Signal = signal;
+    lastFault.Address = info->si_addr;
+    siglongjmp(recoverPoint, 1);
+}
+
+int RecoverInstall(void)
+{
+    // The handler runs on its own stack, and jumping out of it is all the
+    // cleanup it needs.
+    stack_t stack;
+    memset(&stack, 0, sizeof(stack));
+    stack.ss_size = SIGSTKSZ > 65536 ? SIGSTKSZ : 65536;
+    stack.ss_sp = malloc(stack.ss_size);
+    if (stack.ss_sp == NULL || sigaltstack(&stack, NULL) != 0)
+    {
+        free(stack.ss_sp);
+        return -1;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = FaultHandler;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGSEGV, &action, NULL) != 0 || sigaction(SIGBUS, &action, NULL) != 0)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+int RecoverRun(void (*body)(void* context), void* context, struct RecoverFault* fault)
+{
+    // Saving the signal mask lets the jump unblock the signal it came from.
+    if (sigsetjmp(recoverPoint, 1) != 0)
+    {
+        *fault = lastFault;
+        return 1;
+    }
+
+    recovering = 1;
+    body(context);
+    recovering = 0;
+    return 0;
+}
@@ -0,0 +1,44 @@
+// Catches bad memory accesses and jumps back out of them.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef RECOVER_H
+#define RECOVER_H
+
+// Lets a bad memory access end a piece of code instead of the process.
+// A SIGSEGV or SIGBUS handler on its own signal stack (so a smashed or
+// overflowed stack doesn't matter) jumps back out to RecoverRun, which
+// reports the fault. Nothing the code was in the middle of gets undone,
+// so it has to be something that's safe to abandon at any point: plain
+// loads and stores, not a malloc or a printf.
+struct RecoverFault
+{
+    int Signal;
+    void* Address;
+};
+
+// Sets up the signal stack and handlers for the calling thread. Returns
+// 0 on success and -1 (with errno set) on failure.
+int RecoverInstall(void);
+
+// Runs body(context). Returns 0 if it finished, or 1 if it faulted, in
+// which case fault says how. A fault anywhere outside RecoverRun still
+// kills the process like it normally would.
+int RecoverRun(void (*body)(void* context), void* context, struct RecoverFault* fault);
+
+#endif
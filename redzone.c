@@ -0,0 +1,285 @@
+// Redzone canaries around every block, checked with SIMD compares on free.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "redzone.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define REDZONE_X86 1
+#endif
+
+// Sits in front of the zone before a block. Check is the size scrambled,
+// so an underflow that ran through the whole zone and into the header
+// can't be mistaken for a different size.
+struct RedzoneHeader
+{
+    size_t Size;
+    size_t Check;
+};
+
+#define REDZONE_HEADER_CHECK ((size_t) 0x5A5A5A5A5A5A5A5Aull)
+
+// Header plus leading zone, which keeps blocks 16-byte aligned like
+// glibc's.
+#define REDZONE_LEAD (sizeof(struct RedzoneHeader) + REDZONE_SIZE)
+
+// At most this many of the overwritten bytes are printed.
+#define REDZONE_REPORT_BYTES 32
+
+static atomic_size_t corruptions;
+
+static size_t TrailLength(size_t size)
+{
+    return REDZONE_SIZE + (-size & 15);
+}
+
+static int ScanScalar(const unsigned char* zone, size_t length, size_t* first, size_t* last)
+{
+    int found = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (zone[i] != REDZONE_CANARY)
+        {
+            if (!found)
+            {
+                *first = i;
+                found = 1;
+            }
+            *last = i;
+        }
+    }
+    return found;
+}
+
+#ifdef REDZONE_X86
+
+// Folds one vector's mask of bad bytes (bit i set for byte i) into the
+// running first and last.
+static inline void NoteMismatches(uint32_t bad, size_t at, int* found, size_t* first, size_t* last)
+{
+    if (!*found)
+    {
+        *first = at + (size_t) __builtin_ctz(bad);
+        *found = 1;
+    }
+    *last = at + 31 - (size_t) __builtin_clz(bad);
+}
+
+__attribute__((target("sse2")))
+static int ScanSse2(const unsigned char* zone, size_t length, size_t* first, size_t* last)
+{
+    const __m128i canary = _mm_set1_epi8((char) REDZONE_CANARY);
+    int found = 0;
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16)
+    {
+        const __m128i bytes = _mm_loadu_si128((const __m128i*) (zone + i));
+        const uint32_t bad = ~(uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, canary)) & 0xFFFF;
+        if (bad != 0)
+        {
+            NoteMismatches(bad, i, &found, first, last);
+        }
+    }
+
+    size_t tailFirst = 0, tailLast = 0;
+    if (ScanScalar(zone + i, length - i, &tailFirst, &tailLast))
+    {
+        if (!found)
+        {
+            *first = i + tailFirst;
+            found = 1;
+        }
+        *last = i + tailLast;
+    }
+    return found;
+}
+
+__attribute__((target("avx2")))
+static int ScanAvx2(const unsigned char* zone, size_t length, size_t* first, size_t* last)
+{
+    const __m256i canary = _mm256_set1_epi8((char) REDZONE_CANARY);
+    int found = 0;
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32)
+    {
+        const __m256i bytes = _mm256_loadu_si256((const __m256i*) (zone + i));
+        const uint32_t bad = ~(uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, canary));
+        if (bad != 0)
+        {
+            NoteMismatches(bad, i, &found, first, last);
+        }
+    }
+
+    // A trailing zone is 32 to 47 bytes, so there can be half a vector
+    // left.
+    size_t tailFirst = 0, tailLast = 0;
+    if (ScanSse2(zone + i, length - i, &tailFirst, &tailLast))
+    {
+        if (!found)
+        {
+            *first = i + tailFirst;
+            found = 1;
+        }
+        *last = i + tailLast;
+    }
+    return found;
+}
+
+#endif
+
+static struct RedzoneScanner scanners[3];
+static size_t scannerCount;
+static pthread_once_t scannersOnce = PTHREAD_ONCE_INIT;
+
+static void InitScanners(void)
+{
+    scanners[scannerCount++] = (struct RedzoneScanner) { "scalar", ScanScalar };
+#ifdef REDZONE_X86
+    if (__builtin_cpu_supports("sse2"))
+    {
+        scanners[scannerCount++] = (struct RedzoneScanner) { "sse2", ScanSse2 };
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        scanners[scannerCount++] = (struct RedzoneScanner) { "avx2", ScanAvx2 };
+    }
+#endif
+}
+
+const struct RedzoneScanner* RedzoneScanners(size_t* count)
+{
+    pthread_once(&scannersOnce, InitScanners);
+    *count = scannerCount;
+    return scanners;
+}
+
+void* RedzoneMalloc(size_t size)
+{
+    const size_t trail = TrailLength(size);
+    if (size > SIZE_MAX - REDZONE_LEAD - trail)
+    {
+        return NULL;
+    }
+
+    char* base = (char*) malloc(REDZONE_LEAD + size + trail);
+    if (base == NULL)
+    {
+        return NULL;
+    }
+
+    struct RedzoneHeader* header = (struct RedzoneHeader*) base;
+    header->Size = size;
+    header->Check = size ^ REDZONE_HEADER_CHECK;
+
+    char* p = base + REDZONE_LEAD;
+    memset(p - REDZONE_SIZE, REDZONE_CANARY, REDZONE_SIZE);
+    memset(p + size, REDZONE_CANARY, trail);
+    return p;
+}
+
+// Prints which bytes of the block at p, from first to last (negative is
+// before the block), were overwritten and what they hold now.
+static void Report(const char* what, const unsigned char* p, size_t size, ptrdiff_t first, ptrdiff_t last)
+{
+    char text[256 + 3 * REDZONE_REPORT_BYTES];
+    int length = snprintf(text, sizeof(text),
+                          "Heap buffer %s found freeing the %zu byte block at %p: bytes %td to %td were overwritten.\n"
+                          "  They now hold:",
+                          what, size, (const void*) p, first, last);
+
+    for (ptrdiff_t i = first; i <= last && i - first < REDZONE_REPORT_BYTES; i++)
+    {
+        length += snprintf(text + length, sizeof(text) - (size_t) length, " %02x", p[i]);
+    }
+    snprintf(text + length, sizeof(text) - (size_t) length, "%s\n",
+             last - first >= REDZONE_REPORT_BYTES ? " ..." : "");
+
+    fputs(text, stderr);
+}
+
+void RedzoneFree(void* ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    size_t count;
+    const RedzoneScanFunction scan = RedzoneScanners(&count)[count - 1].Scan;
+
+    const unsigned char* p = (const unsigned char*) ptr;
+    char* base = (char*) ptr - REDZONE_LEAD;
+    const struct RedzoneHeader* header = (const struct RedzoneHeader*) base;
+    size_t first, last;
+
+    if ((header->Size ^ REDZONE_HEADER_CHECK) != header->Check)
+    {
+        // The zones can't be found without the size, but the block itself
+        // still can be freed.
+        fprintf(stderr, "Heap buffer underflow found freeing the block at %p: its header was overwritten.\n", ptr);
+        atomic_fetch_add(&corruptions, 1);
+        free(base);
+        return;
+    }
+
+    const size_t size = header->Size;
+    if (scan(p - REDZONE_SIZE, REDZONE_SIZE, &first, &last))
+    {
+        atomic_fetch_add(&corruptions, 1);
+        Report("underflow", p, size, (ptrdiff_t) first - REDZONE_SIZE, (ptrdiff_t) last - REDZONE_SIZE);
+    }
+    if (scan(p + size, TrailLength(size), &first, &last))
+    {
+        atomic_fetch_add(&corruptions, 1);
+        Report("overflow", p, size, (ptrdiff_t) (size + first), (ptrdiff_t) (size + last));
+    }
+
+    free(base);
+}
+
+int RedzoneCheck(const void* ptr, RedzoneScanFunction scan)
+{
+    const unsigned char* p = (const unsigned char*) ptr;
+    const struct RedzoneHeader* header = (const struct RedzoneHeader*) (p - REDZONE_LEAD);
+    size_t first, last;
+    return (header->Size ^ REDZONE_HEADER_CHECK) != header->Check
+           || scan(p - REDZONE_SIZE, REDZONE_SIZE, &first, &last)
+           || scan(p + header->Size, TrailLength(header->Size), &first, &last);
+}
+
+size_t RedzoneCorruptions(void)
+{
+    return atomic_load(&corruptions);
+}
+
+const struct AllocEngine RedzoneEngine = {
+    .Name = "redzone",
+    .Description = "glibc with canary bytes around every block, checked with SIMD compares on free",
+    .Malloc = RedzoneMalloc,
+    .Free = RedzoneFree,
+    .Reset = NULL,
+    .ThreadSafe = 1,
+};
@@ -0,0 +1,71 @@
+// Canary redzones around heap blocks.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef REDZONE_H
+#define REDZONE_H
+
+#include <stddef.h>
+
+#include "engine.h"
+
+// Canary redzones around every block, checked when the block is freed.
+// Each block gets its own glibc allocation with a run of canary bytes on
+// either side of it. Nothing stops a bad write, but free scans both runs,
+// and if any byte changed it reports which bytes, relative to the block,
+// were overwritten and what they hold now. The block is still freed, so
+// the demos carry on.
+//
+// The scan compares a vector of bytes against the canary at a time and
+// turns the result into a bitmask (SSE2, or AVX2 where the CPU has it),
+// so a clean redzone costs a load, a compare and a branch per 16 or 32
+// bytes.
+
+// Bytes of canary on each side of a block. The zone after a block also
+// takes up the padding to the next 16 bytes.
+#define REDZONE_SIZE 32
+#define REDZONE_CANARY 0xCB
+
+// Looks for bytes other than REDZONE_CANARY in the length bytes at zone.
+// Returns 0 if there are none, otherwise 1 with the offsets of the first
+// and last of them in first and last.
+typedef int (*RedzoneScanFunction)(const unsigned char* zone, size_t length, size_t* first, size_t* last);
+
+struct RedzoneScanner
+{
+    const char* Name;
+    RedzoneScanFunction Scan;
+};
+
+// The scanners this CPU can run, slowest first. The last one is what
+// RedzoneFree uses.
+const struct RedzoneScanner* RedzoneScanners(size_t* count);
+
+void* RedzoneMalloc(size_t size);
+void RedzoneFree(void* ptr);
+
+// Checks both zones around a block from RedzoneMalloc with scan, without
+// reporting or freeing anything. Returns 1 if either was overwritten.
+int RedzoneCheck(const void* ptr, RedzoneScanFunction scan);
+
+// How many frees have found a corrupted redzone so far.
+size_t RedzoneCorruptions(void);
+
+extern const struct AllocEngine RedzoneEngine;
+
+#endif
@@ -0,0 +1,229 @@
+// Per-thread page heaps with lock-free remote-free lists.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "remote.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "sizeclass.h"
+
+struct RemoteBlock
+{
+    struct RemoteBlock* Next;
+};
+
+// Sits at the start of every page. Pages are aligned to their size, so
+// masking a block's address finds its page.
+struct RemotePage
+{
+    // The Id of the heap that owns it.
+    uint64_t Owner;
+    struct RemotePage* NextInClass;
+    size_t ClassIndex;
+    size_t BlockSize;
+
+    // Only touched by the owner.
+    struct RemoteBlock* LocalFree;
+    char* Unused;
+    char* UnusedEnd;
+
+    // Pushed to by every other thread, emptied by the owner. It gets its
+    // own cache line so remote frees don't keep stealing the line with
+    // the owner's local state.
+    _Alignas(64) _Atomic(struct RemoteBlock*) RemoteFree;
+};
+
+struct ThreadHeap
+{
+    // Unique to each thread, and given out when it makes its first page.
+    // The address of the heap won't do to tell owners apart: a new thread
+    // can get a dead thread's TLS block, and with it the dead thread's
+    // orphaned pages.
+    uint64_t Id;
+
+    // The page each class allocates from, and every page of each class.
+    struct RemotePage* Current[SIZE_CLASS_COUNT];
+    struct RemotePage* Pages[SIZE_CLASS_COUNT];
+};
+
+static __thread struct ThreadHeap heap;
+
+static _Atomic uint64_t nextHeapId = 1;
+
+static struct RemotePage* PageOf(const void* ptr)
+{
+    return (struct RemotePage*) ((uintptr_t) ptr & ~(uintptr_t) (REMOTE_PAGE_SIZE - 1));
+}
+
+// mmap only promises page alignment, so map twice as much as we need and
+// trim the ends until what's left is aligned to REMOTE_PAGE_SIZE.
+static struct RemotePage* NewPage(size_t index)
+{
+    char* mem = (char*) mmap(NULL, 2 * REMOTE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    char* aligned = (char*) (((uintptr_t) mem + REMOTE_PAGE_SIZE - 1) & ~(uintptr_t) (REMOTE_PAGE_SIZE - 1));
+    if (aligned != mem)
+    {
+        munmap(mem, (size_t) (aligned - mem));
+    }
+    munmap(aligned + REMOTE_PAGE_SIZE, (size_t) (mem + 2 * REMOTE_PAGE_SIZE - (aligned + REMOTE_PAGE_SIZE)));
+
+    if (heap.Id == 0)
+    {
+        heap.Id = atomic_fetch_add_explicit(&nextHeapId, 1, memory_order_relaxed);
+    }
+
+    struct RemotePage* page = (struct RemotePage*) aligned;
+    page->Owner = heap.Id;
+    page->ClassIndex = index;
+    page->BlockSize = SizeClassSize(index);
+    page->LocalFree = NULL;
+    page->Unused = aligned + ((sizeof(struct RemotePage) + 15) & ~(size_t) 15);
+    page->UnusedEnd = aligned + REMOTE_PAGE_SIZE;
+    atomic_init(&page->RemoteFree, NULL);
+
+    page->NextInClass = heap.Pages[index];
+    heap.Pages[index] = page;
+    return page;
+}
+
+// Moves everything other threads have freed to this page onto its local
+// list. Returns whether there's anything to allocate from now.
+static int CollectRemoteFrees(struct RemotePage* page)
+{
+    if (atomic_load_explicit(&page->RemoteFree, memory_order_relaxed) == NULL)
+    {
+        return page->LocalFree != NULL;
+    }
+
+    struct RemoteBlock* remote = atomic_exchange_explicit(&page->RemoteFree, NULL, memory_order_acquire);
+    if (page->LocalFree == NULL)
+    {
+        page->LocalFree = remote;
+    }
+    else
+    {
+        struct RemoteBlock* tail = remote;
+        while (tail->Next != NULL)
+        {
+            tail = tail->Next;
+        }
+        tail->Next = page->LocalFree;
+        page->LocalFree = remote;
+    }
+
+    return 1;
+}
+
+static int HasRoom(struct RemotePage* page)
+{
+    return page->LocalFree != NULL
+           || (size_t) (page->UnusedEnd - page->Unused) >= page->BlockSize
+           || CollectRemoteFrees(page);
+}
+
+// Finds a page of this class with a block to spare, draining remote frees
+// as we go, or makes a new one.
+static struct RemotePage* FindPage(size_t index)
+{
+    for (struct RemotePage* page = heap.Pages[index]; page != NULL; page = page->NextInClass)
+    {
+        if (HasRoom(page))
+        {
+            return page;
+        }
+    }
+
+    return NewPage(index);
+}
+
+void* RemoteMalloc(size_t size)
+{
+    const size_t index = SizeClassIndex(size);
+    if (index == SIZE_CLASS_LARGE)
+    {
+        return NULL;
+    }
+
+    struct RemotePage* page = heap.Current[index];
+    if (page == NULL || !HasRoom(page))
+    {
+        page = FindPage(index);
+        if (page == NULL)
+        {
+            return NULL;
+        }
+        heap.Current[index] = page;
+    }
+
+    struct RemoteBlock* block = page->LocalFree;
+    if (block != NULL)
+    {
+        page->LocalFree = block->Next;
+        return block;
+    }
+
+    void* p = page->Unused;
+    page->Unused += page->BlockSize;
+    return p;
+}
+
+void RemoteFree(void* ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    struct RemotePage* page = PageOf(ptr);
+    struct RemoteBlock* block = (struct RemoteBlock*) ptr;
+
+    if (page->Owner == heap.Id)
+    {
+        block->Next = page->LocalFree;
+        page->LocalFree = block;
+        return;
+    }
+
+    // Nobody ever pops single blocks off the remote list (the owner takes
+    // the whole thing at once), so a plain CAS push has no ABA problem.
+    struct RemoteBlock* head = atomic_load_explicit(&page->RemoteFree, memory_order_relaxed);
+    do
+    {
+        block->Next = head;
+    }
+    while (!atomic_compare_exchange_weak_explicit(&page->RemoteFree, &head, block,
+                                                  memory_order_release, memory_order_relaxed));
+}
+
+const struct AllocEngine RemoteEngine = {
+    .Name = "remote",
+    .Description = "per-thread page heaps with lock-free remote-free lists (up to 1024 bytes)",
+    .Malloc = RemoteMalloc,
+    .Free = RemoteFree,
+    .Reset = NULL,
+    .ThreadSafe = 1,
+};
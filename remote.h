@@ -0,0 +1,45 @@
+// Per-thread page heaps with lock-free remote-free lists.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef REMOTE_H
+#define REMOTE_H
+
+#include <stddef.h>
+
+#include "engine.h"
+
+// A heap per thread, where every page belongs to the thread that created
+// it. Frees from the owning thread go straight onto the page's local free
+// list with no atomics at all. Frees from any other thread go onto the
+// page's remote free list with a single CAS, and the owner picks those up
+// in one atomic exchange the next time it runs out of local blocks. So
+// cross-thread frees never take a lock, and the owner only pays for
+// synchronization once per batch of remote frees.
+//
+// Blocks use the same size classes as the segregated allocator; bigger
+// requests fail. Pages of a thread that has exited are never reused.
+
+#define REMOTE_PAGE_SIZE ((size_t) 64 * 1024)
+
+void* RemoteMalloc(size_t size);
+void RemoteFree(void* ptr);
+
+extern const struct AllocEngine RemoteEngine;
+
+#endif
@@ -0,0 +1,885 @@
+// Replays recorded allocation traces on every allocator engine.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "engine.h"
+#include "objects.h"
+#include "timing.h"
+#include "tracereader.h"
+
+// Replays allocation traces (see trace.h) on each allocator engine, so
+// engines can be compared on what a real program did rather than on the
+// demos alone:
+//
+//   ./build/main -t demo.trace
+//   ./build/replay demo.trace
+//
+// Every thread in the trace gets a thread in the replay that makes the
+// same calls in the same order. A free on one thread of a block that
+// another thread allocated waits until that malloc has been replayed, so
+// the replay never frees something that doesn't exist yet.
+//
+// Each engine runs in a child process of its own. That way every engine
+// starts from a clean heap, a crash only takes out that engine's run,
+// and the peak RSS we report belongs to that engine alone.
+
+// One malloc or free, already resolved to the allocation it's about.
+struct ReplayOp
+{
+    uint64_t Size;
+    uint32_t Slot;
+    uint8_t Op;
+};
+
+struct ReplayThread
+{
+    uint32_t ThreadId;
+    struct ReplayOp* Ops;
+    size_t Count;
+
+    // Only used while replaying.
+    pthread_t Thread;
+    uint64_t Begin;
+    uint64_t End;
+    uint64_t Failed;
+};
+
+struct Replay
+{
+    struct ReplayThread* Threads;
+    size_t ThreadCount;
+
+    // Every malloc in the trace gets its own slot, which the replay
+    // fills in with the pointer the engine returned.
+    size_t SlotCount;
+
+    size_t OpCount;
+    uint64_t PeakLiveBytes;
+};
+
+// What a child process sends back to us about its engine.
+struct ReplayResult
+{
+    uint64_t ElapsedNs;
+    uint64_t PeakRssBytes;
+    uint64_t Failed;
+};
+
+// A map from 64-bit keys (pointers or thread ids) to 32-bit values, with
+// linear probing and backward-shift deletion so lookups never have to
+// step over tombstones.
+struct IdMap
+{
+    uint64_t* Keys;
+    uint32_t* Values;
+    size_t Capacity;
+    size_t Count;
+};
+
+// Key 0 marks an empty bucket, which is fine since neither NULL nor
+// thread id 0 ever shows up in a trace.
+#define ID_MAP_INITIAL_CAPACITY 1024
+
+static void* Allocate(size_t size)
+{
+    void* p = calloc(1, size);
+    if (p == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+    return p;
+}
+
+static size_t IdMapBucket(const struct IdMap* map, uint64_t key)
+{
+    // Fibonacci hashing: pointers are aligned, so their low bits are
+    // useless on their own.
+    return (size_t) ((key * 0x9E3779B97F4A7C15ull) >> 32) & (map->Capacity - 1);
+}
+
+static void IdMapInit(struct IdMap* map)
+{
+    map->Capacity = ID_MAP_INITIAL_CAPACITY;
+    map->Count = 0;
+    map->Keys = (uint64_t*) Allocate(map->Capacity * sizeof(uint64_t));
+    map->Values = (uint32_t*) Allocate(map->Capacity * sizeof(uint32_t));
+}
+
+static void IdMapDestroy(struct IdMap* map)
+{
+    free(map->Keys);
+    free(map->Values);
+    memset(map, 0, sizeof(*map));
+}
+
+static void IdMapPut(struct IdMap* map, uint64_t key, uint32_t value);
+
+static void IdMapGrow(struct IdMap* map)
+{
+    struct IdMap old = *map;
+    map->Capacity *= 2;
+    map->Count = 0;
+    map->Keys = (uint64_t*) Allocate(map->Capacity * sizeof(uint64_t));
+    map->Values = (uint32_t*) Allocate(map->Capacity * sizeof(uint32_t));
+
+    for (size_t i = 0; i < old.Capacity; i++)
+    {
+        if (old.Keys[i] != 0)
+        {
+            IdMapPut(map, old.Keys[i], old.Values[i]);
+        }
+    }
+    IdMapDestroy(&old);
+}
+
+// Returns the bucket holding key, or the empty bucket where it would go.
+static size_t IdMapFind(const struct IdMap* map, uint64_t key)
+{
+    size_t i = IdMapBucket(map, key);
+    while (map->Keys[i] != 0 && map->Keys[i] != key)
+    {
+        i = (i + 1) & (map->Capacity - 1);
+    }
+    return i;
+}
+
+static void IdMapPut(struct IdMap* map, uint64_t key, uint32_t value)
+{
+    // Stay at most half full so probe sequences stay short.
+    if ((map->Count + 1) * 2 > map->Capacity)
+    {
+        IdMapGrow(map);
+    }
+
+    const size_t i = IdMapFind(map, key);
+    if (map->Keys[i] == 0)
+    {
+        map->Keys[i] = key;
+        map->Count++;
+    }
+    map->Values[i] = value;
+}
+
+static int IdMapGet(const struct IdMap* map, uint64_t key, uint32_t* value)
+{
+    const size_t i = IdMapFind(map, key);
+    if (map->Keys[i] == 0)
+    {
+        return 0;
+    }
+    *value = map->Values[i];
+    return 1;
+}
+
+static void IdMapRemove(struct IdMap* map, uint64_t key)
+{
+    size_t hole = IdMapFind(map, key);
+    if (map->Keys[hole] == 0)
+    {
+        return;
+    }
+
+    // Pull later entries of the same probe run back into the hole, as
+    // long as that doesn't move them in front of their home bucket.
+    const size_t mask = map->Capacity - 1;
+    for (size_t i = (hole + 1) & mask; map->Keys[i] != 0; i = (i + 1) & mask)
+    {
+        const size_t home = IdMapBucket(map, map->Keys[i]);
+        if (((i - home) & mask) >= ((i - hole) & mask))
+        {
+            map->Keys[hole] = map->Keys[i];
+            map->Values[hole] = map->Values[i];
+            hole = i;
+        }
+    }
+
+    map->Keys[hole] = 0;
+    map->Count--;
+}
+
+// Records from one thread are in the file in the order they happened;
+// records from different threads are only roughly in order. So each
+// thread's records stay in file order, and timestamps only decide which
+// thread goes next. This is one thread's place in that merge.
+struct MergeCursor
+{
+    size_t Next;
+    size_t End;
+};
+
+// Whether thread a's next record comes before thread b's: the earlier
+// timestamp, or on a tie, the one earlier in the file.
+static int MergeBefore(const struct TraceRecord* records, const size_t* byThread, const struct MergeCursor* cursors,
+                       uint32_t a, uint32_t b)
+{
+    const size_t x = byThread[cursors[a].Next];
+    const size_t y = byThread[cursors[b].Next];
+    if (records[x].Timestamp != records[y].Timestamp)
+    {
+        return records[x].Timestamp < records[y].Timestamp;
+    }
+    return x < y;
+}
+
+// Moves heap[i] down to its place in a min-heap of threads ordered by
+// MergeBefore.
+static void MergeSiftDown(const struct TraceRecord* records, const size_t* byThread, const struct MergeCursor* cursors,
+                          uint32_t* heap, size_t count, size_t i)
+{
+    for (;;)
+    {
+        size_t first = i;
+        const size_t left = 2 * i + 1;
+        const size_t right = left + 1;
+        if (left < count && MergeBefore(records, byThread, cursors, heap[left], heap[first]))
+        {
+            first = left;
+        }
+        if (right < count && MergeBefore(records, byThread, cursors, heap[right], heap[first]))
+        {
+            first = right;
+        }
+        if (first == i)
+        {
+            return;
+        }
+
+        const uint32_t swap = heap[i];
+        heap[i] = heap[first];
+        heap[first] = swap;
+        i = first;
+    }
+}
+
+// Turns the raw records into a list of ops per thread. Frees of pointers
+// the trace never saw allocated (the program allocated them before the
+// trace started) are dropped.
+static void BuildReplay(struct TraceReader* reader, struct Replay* replay)
+{
+    memset(replay, 0, sizeof(*replay));
+
+    struct TraceRecord* records = (struct TraceRecord*) Allocate((reader->Count + 1) * sizeof(struct TraceRecord));
+    size_t count = 0;
+    size_t decoded;
+    while ((decoded = TraceReaderNext(reader, records + count)) > 0)
+    {
+        count += decoded;
+    }
+
+    // First pass: find the threads and count their records, so each one's
+    // ops can go in a single array.
+    struct IdMap threadIndex;
+    IdMapInit(&threadIndex);
+    size_t threadCapacity = 16;
+    replay->Threads = (struct ReplayThread*) Allocate(threadCapacity * sizeof(struct ReplayThread));
+
+    for (size_t i = 0; i < count; i++)
+    {
+        // Thread ids are never 0, but the map needs a nonzero key anyway.
+        const uint64_t key = (uint64_t) records[i].ThreadId + 1;
+        uint32_t thread;
+        if (!IdMapGet(&threadIndex, key, &thread))
+        {
+            if (replay->ThreadCount == threadCapacity)
+            {
+                threadCapacity *= 2;
+                replay->Threads = (struct ReplayThread*) realloc(replay->Threads,
+                                                                 threadCapacity * sizeof(struct ReplayThread));
+                if (replay->Threads == NULL)
+                {
+                    fprintf(stderr, "Out of memory.\n");
+                    exit(OOM_EXIT_CODE);
+                }
+            }
+
+            thread = (uint32_t) replay->ThreadCount++;
+            memset(&replay->Threads[thread], 0, sizeof(struct ReplayThread));
+            replay->Threads[thread].ThreadId = records[i].ThreadId;
+            IdMapPut(&threadIndex, key, thread);
+        }
+        replay->Threads[thread].Count++;
+    }
+
+    // Group the records by thread, keeping file order within each one.
+    struct MergeCursor* cursors = (struct MergeCursor*) Allocate(replay->ThreadCount * sizeof(struct MergeCursor));
+    size_t* byThread = (size_t*) Allocate((count + 1) * sizeof(size_t));
+    size_t start = 0;
+    for (size_t t = 0; t < replay->ThreadCount; t++)
+    {
+        cursors[t].Next = start;
+        cursors[t].End = start;
+        start += replay->Threads[t].Count;
+
+        replay->Threads[t].Ops = (struct ReplayOp*) Allocate(replay->Threads[t].Count * sizeof(struct ReplayOp));
+        replay->Threads[t].Count = 0;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t thread = 0;
+        IdMapGet(&threadIndex, (uint64_t) records[i].ThreadId + 1, &thread);
+        byThread[cursors[thread].End++] = i;
+    }
+
+    uint32_t* heap = (uint32_t*) Allocate((replay->ThreadCount + 1) * sizeof(uint32_t));
+    size_t heapCount = 0;
+    for (uint32_t t = 0; t < replay->ThreadCount; t++)
+    {
+        if (cursors[t].Next < cursors[t].End)
+        {
+            heap[heapCount++] = t;
+        }
+    }
+    for (size_t i = heapCount / 2; i-- > 0;)
+    {
+        MergeSiftDown(records, byThread, cursors, heap, heapCount, i);
+    }
+
+    // Second pass, over the merged order: give every malloc a slot and
+    // point every free at the slot of the most recent malloc of its
+    // pointer.
+    struct IdMap liveSlots;
+    IdMapInit(&liveSlots);
+    size_t sizeCapacity = 1024;
+    uint64_t* slotSizes = (uint64_t*) Allocate(sizeCapacity * sizeof(uint64_t));
+    uint64_t liveBytes = 0;
+
+    while (heapCount > 0)
+    {
+        const uint32_t thread = heap[0];
+        const struct TraceRecord* record = &records[byThread[cursors[thread].Next++]];
+        if (cursors[thread].Next == cursors[thread].End)
+        {
+            heap[0] = heap[--heapCount];
+        }
+        MergeSiftDown(records, byThread, cursors, heap, heapCount, 0);
+
+        struct ReplayOp op = { .Size = record->Size, .Op = record->Op };
+        if (record->Op == TRACE_MALLOC)
+        {
+            if (replay->SlotCount == sizeCapacity)
+            {
+                sizeCapacity *= 2;
+                slotSizes = (uint64_t*) realloc(slotSizes, sizeCapacity * sizeof(uint64_t));
+                if (slotSizes == NULL)
+                {
+                    fprintf(stderr, "Out of memory.\n");
+                    exit(OOM_EXIT_CODE);
+                }
+            }
+
+            // A pointer that's still live here lost its free somewhere;
+            // that allocation just never gets freed.
+            op.Slot = (uint32_t) replay->SlotCount++;
+            slotSizes[op.Slot] = record->Size;
+            IdMapPut(&liveSlots, record->Ptr, op.Slot);
+
+            liveBytes += record->Size;
+            replay->PeakLiveBytes = liveBytes > replay->PeakLiveBytes ? liveBytes : replay->PeakLiveBytes;
+        }
+        else if (record->Op == TRACE_FREE)
+        {
+            if (!IdMapGet(&liveSlots, record->Ptr, &op.Slot))
+            {
+                continue;
+            }
+            IdMapRemove(&liveSlots, record->Ptr);
+            liveBytes -= slotSizes[op.Slot];
+        }
+        else
+        {
+            continue;
+        }
+
+        struct ReplayThread* replayThread = &replay->Threads[thread];
+        replayThread->Ops[replayThread->Count++] = op;
+        replay->OpCount++;
+    }
+
+    free(slotSizes);
+    IdMapDestroy(&liveSlots);
+    IdMapDestroy(&threadIndex);
+    free(heap);
+    free(byThread);
+    free(cursors);
+    free(records);
+}
+
+static void DestroyReplay(struct Replay* replay)
+{
+    for (size_t t = 0; t < replay->ThreadCount; t++)
+    {
+        free(replay->Threads[t].Ops);
+    }
+    free(replay->Threads);
+    memset(replay, 0, sizeof(*replay));
+}
+
+// State shared by the replay threads in one child.
+static const struct AllocEngine* replayEngine;
+static void* _Atomic* slots;
+static pthread_barrier_t readyBarrier;
+static pthread_barrier_t startBarrier;
+
+// Engines that aren't thread safe get every call made under this lock
+// when the trace has more than one thread.
+static pthread_mutex_t engineLock = PTHREAD_MUTEX_INITIALIZER;
+static int serialize;
+
+// Stands in for the pointer of a malloc that failed, so a free waiting on
+// it knows there's nothing to free.
+static char failedMarker;
+
+static void* ReplayMalloc(size_t size)
+{
+    if (!serialize)
+    {
+        return replayEngine->Malloc(size);
+    }
+
+    pthread_mutex_lock(&engineLock);
+    void* p = replayEngine->Malloc(size);
+    pthread_mutex_unlock(&engineLock);
+    return p;
+}
+
+static void ReplayFree(void* ptr)
+{
+    if (!serialize)
+    {
+        replayEngine->Free(ptr);
+        return;
+    }
+
+    pthread_mutex_lock(&engineLock);
+    replayEngine->Free(ptr);
+    pthread_mutex_unlock(&engineLock);
+}
+
+static void* ReplayThreadMain(void* arg)
+{
+    struct ReplayThread* thread = (struct ReplayThread*) arg;
+    const size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+
+    pthread_barrier_wait(&readyBarrier);
+    pthread_barrier_wait(&startBarrier);
+    thread->Begin = NowNs();
+
+    for (size_t i = 0; i < thread->Count; i++)
+    {
+        const struct ReplayOp* op = &thread->Ops[i];
+        if (op->Op == TRACE_MALLOC)
+        {
+            char* p = (char*) ReplayMalloc(op->Size);
+            if (p == NULL)
+            {
+                thread->Failed++;
+                atomic_store_explicit(&slots[op->Slot], &failedMarker, memory_order_release);
+                continue;
+            }
+
+            // The program that was traced wrote to its memory, so we do
+            // too: one byte per page is enough for it to count in the RSS.
+            for (size_t offset = 0; offset < op->Size; offset += pageSize)
+            {
+                p[offset] = 1;
+            }
+            atomic_store_explicit(&slots[op->Slot], p, memory_order_release);
+        }
+        else
+        {
+            void* p;
+            while ((p = atomic_load_explicit(&slots[op->Slot], memory_order_acquire)) == NULL)
+            {
+                // Another thread hasn't made this allocation yet.
+                sched_yield();
+            }
+
+            if (p != &failedMarker)
+            {
+                ReplayFree(p);
+            }
+        }
+    }
+
+    thread->End = NowNs();
+    return NULL;
+}
+
+static uint64_t CurrentRssBytes(void)
+{
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL)
+    {
+        return 0;
+    }
+
+    unsigned long long size = 0;
+    unsigned long long resident = 0;
+    if (fscanf(statm, "%llu %llu", &size, &resident) != 2)
+    {
+        resident = 0;
+    }
+    fclose(statm);
+    return (uint64_t) resident * (uint64_t) sysconf(_SC_PAGESIZE);
+}
+
+// Resets the kernel's high-water mark for our RSS to what we're using
+// now. A forked child starts out with its parent's, which would include
+// everything we went through building the replay.
+static int ResetPeakRss(void)
+{
+    FILE* clearRefs = fopen("/proc/self/clear_refs", "w");
+    if (clearRefs == NULL)
+    {
+        return -1;
+    }
+
+    const int ok = fputs("5", clearRefs) >= 0;
+    return fclose(clearRefs) == 0 && ok ? 0 : -1;
+}
+
+static uint64_t PeakRssBytes(void)
+{
+    FILE* status = fopen("/proc/self/status", "r");
+    if (status != NULL)
+    {
+        char line[256];
+        unsigned long long kib;
+        while (fgets(line, sizeof(line), status) != NULL)
+        {
+            if (sscanf(line, "VmHWM: %llu kB", &kib) == 1)
+            {
+                fclose(status);
+                return (uint64_t) kib * 1024;
+            }
+        }
+        fclose(status);
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (uint64_t) usage.ru_maxrss * 1024;
+}
+
+// Runs in the child process.
+static void RunReplay(struct Replay* replay, const struct AllocEngine* engine, struct ReplayResult* result)
+{
+    replayEngine = engine;
+    serialize = !engine->ThreadSafe && replay->ThreadCount > 1;
+
+    // Get the engine's one-time setup (TLSF's pool, the shadow map) out of
+    // the way before the baseline, so it isn't billed to the trace.
+    void* first = engine->Malloc(1);
+    if (first != NULL)
+    {
+        engine->Free(first);
+    }
+
+    // calloc may hand back untouched zero pages, so clear the slots by
+    // hand; otherwise they'd show up as the engine's memory.
+    slots = (void* _Atomic*) Allocate((replay->SlotCount + 1) * sizeof(void*));
+    memset((void*) slots, 0, replay->SlotCount * sizeof(void*));
+
+    // We wait at the barriers too. Once every thread is at the first one
+    // it's up and running, so the baseline can include the replay
+    // threads' own stacks without any of the replay having started.
+    pthread_barrier_init(&readyBarrier, NULL, (unsigned) replay->ThreadCount + 1);
+    pthread_barrier_init(&startBarrier, NULL, (unsigned) replay->ThreadCount + 1);
+
+    for (size_t t = 0; t < replay->ThreadCount; t++)
+    {
+        if (pthread_create(&replay->Threads[t].Thread, NULL, ReplayThreadMain, &replay->Threads[t]) != 0)
+        {
+            fprintf(stderr, "Couldn't create replay thread %zu.\n", t);
+            exit(1);
+        }
+    }
+
+    // Without a way to reset the peak (kernels before 4.0) it's only
+    // accurate when the replay uses more than the parent did.
+    pthread_barrier_wait(&readyBarrier);
+    ResetPeakRss();
+    const uint64_t baseline = CurrentRssBytes();
+    pthread_barrier_wait(&startBarrier);
+
+    uint64_t begin = UINT64_MAX;
+    uint64_t end = 0;
+    memset(result, 0, sizeof(*result));
+    for (size_t t = 0; t < replay->ThreadCount; t++)
+    {
+        pthread_join(replay->Threads[t].Thread, NULL);
+        begin = replay->Threads[t].Begin < begin ? replay->Threads[t].Begin : begin;
+        end = replay->Threads[t].End > end ? replay->Threads[t].End : end;
+        result->Failed += replay->Threads[t].Failed;
+    }
+    pthread_barrier_destroy(&readyBarrier);
+    pthread_barrier_destroy(&startBarrier);
+
+    const uint64_t peak = PeakRssBytes();
+
+    result->ElapsedNs = end - begin;
+    result->PeakRssBytes = peak > baseline ? peak - baseline : 0;
+}
+
+// Replays the trace on engine in a child process. Returns 0 with the
+// child's result, or -1 with its wait status if it didn't send one.
+static int ReplayInChild(struct Replay* replay, const struct AllocEngine* engine, struct ReplayResult* result,
+                         int* status)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        perror("pipe");
+        exit(1);
+    }
+
+    fflush(stdout);
+    const pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        exit(1);
+    }
+
+    if (pid == 0)
+    {
+        close(fds[0]);
+        RunReplay(replay, engine, result);
+        const int ok = write(fds[1], result, sizeof(*result)) == (ssize_t) sizeof(*result);
+        _exit(ok ? 0 : 1);
+    }
+
+    close(fds[1]);
+    const ssize_t got = read(fds[0], result, sizeof(*result));
+    close(fds[0]);
+    waitpid(pid, status, 0);
+    return got == (ssize_t) sizeof(*result) ? 0 : -1;
+}
+
+// Prints why a child didn't send back a result.
+static void PrintChildFailure(int status)
+{
+    if (WIFSIGNALED(status))
+    {
+        printf(" crashed (%s)\n", strsignal(WTERMSIG(status)));
+    }
+    else
+    {
+        printf(" failed (exit status %d)\n", WEXITSTATUS(status));
+    }
+}
+
+// Replays the trace on engine and prints a row of the results table.
+static void ReplayOnEngine(struct Replay* replay, const struct AllocEngine* engine)
+{
+    struct ReplayResult result;
+    int status;
+    const int ok = ReplayInChild(replay, engine, &result, &status) == 0;
+
+    printf("  %-12s", engine->Name);
+    if (!ok)
+    {
+        PrintChildFailure(status);
+        return;
+    }
+
+    // How much of the memory the engine used wasn't live data at the
+    // worst point: headers, rounding, free blocks it couldn't hand back.
+    const double peakRss = (double) result.PeakRssBytes;
+    double fragmentation = 0.0;
+    if (peakRss > (double) replay->PeakLiveBytes)
+    {
+        fragmentation = 100.0 * (1.0 - (double) replay->PeakLiveBytes / peakRss);
+    }
+
+    printf(" %10.2f %10.2f %12.2f %7.1f%% %10llu%s\n",
+           (double) result.ElapsedNs / 1e6,
+           (double) replay->OpCount * 1000.0 / (double) result.ElapsedNs,
+           peakRss / (1024.0 * 1024.0),
+           fragmentation,
+           (unsigned long long) result.Failed,
+           !engine->ThreadSafe && replay->ThreadCount > 1 ? "  (serialized)" : "");
+}
+
+// A trace of one small malloc and its free has to come out at (about)
+// no memory on every engine, or the peak RSS column is billing the trace
+// for something else, like the engine's one-time setup.
+#define TINY_REPLAY_MAX_RSS (1u << 20)
+
+// Replays that trace on every engine. Returns how many went over
+// TINY_REPLAY_MAX_RSS or failed.
+static int CheckTinyReplay(const struct AllocEngine** engines, size_t count)
+{
+    struct ReplayOp ops[2] = {
+        { .Size = sizeof(struct Object), .Slot = 0, .Op = TRACE_MALLOC },
+        { .Size = sizeof(struct Object), .Slot = 0, .Op = TRACE_FREE },
+    };
+    struct ReplayThread thread = { .Ops = ops, .Count = 2 };
+    struct Replay replay = { .Threads = &thread, .ThreadCount = 1, .SlotCount = 1, .OpCount = 2,
+                             .PeakLiveBytes = sizeof(struct Object) };
+    int failures = 0;
+
+    printf("One malloc and free should use under %u KiB on every engine:\n", TINY_REPLAY_MAX_RSS >> 10);
+    for (size_t i = 0; i < count; i++)
+    {
+        struct ReplayResult result;
+        int status;
+        printf("  %-12s", engines[i]->Name);
+        if (ReplayInChild(&replay, engines[i], &result, &status) != 0)
+        {
+            PrintChildFailure(status);
+            failures++;
+            continue;
+        }
+
+        const int ok = result.PeakRssBytes <= TINY_REPLAY_MAX_RSS && result.Failed == 0;
+        printf(" %8.1f KiB  %s\n", (double) result.PeakRssBytes / 1024.0, ok ? "ok" : "too much");
+        failures += !ok;
+    }
+    return failures;
+}
+
+static void PrintUsage(FILE* stream, const char* program)
+{
+    fprintf(stream, "Usage: %s [-e engine]... [-l] trace...\n"
+                    "       %s [-e engine]... -c\n"
+                    "  -e engine  replay on the given engine (repeatable; default every engine)\n"
+                    "  -l         list the allocator engines and exit\n"
+                    "  -c         check that one malloc and free uses no memory on each engine, and exit\n"
+                    "Traces come from main -t or from MALLOCDEMO_TRACE with libmallocdemo.so.\n", program, program);
+}
+
+int main(int argc, char** argv)
+{
+    size_t engineCount;
+    const struct AllocEngine* const* allEngines = EngineList(&engineCount);
+
+    const struct AllocEngine** selected = (const struct AllocEngine**) Allocate(engineCount * sizeof(void*));
+    size_t selectedCount = 0;
+    int opt;
+
+    int check = 0;
+    while ((opt = getopt(argc, argv, "ce:l")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                check = 1;
+                break;
+            case 'e':
+            {
+                const struct AllocEngine* engine = EngineFind(optarg);
+                if (engine == NULL)
+                {
+                    fprintf(stderr, "Unknown engine '%s'. Available engines:\n", optarg);
+                    EnginePrintAll(stderr);
+                    return 1;
+                }
+                if (selectedCount < engineCount)
+                {
+                    selected[selectedCount++] = engine;
+                }
+                break;
+            }
+            case 'l':
+                EnginePrintAll(stdout);
+                return 0;
+            default:
+                PrintUsage(stderr, argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind == argc && !check)
+    {
+        PrintUsage(stderr, argv[0]);
+        return 1;
+    }
+
+    if (selectedCount == 0)
+    {
+        memcpy(selected, allEngines, engineCount * sizeof(void*));
+        selectedCount = engineCount;
+    }
+
+    if (check)
+    {
+        const int failures = CheckTinyReplay(selected, selectedCount);
+        free(selected);
+        return failures == 0 ? 0 : 1;
+    }
+
+    int status = 0;
+    for (int arg = optind; arg < argc; arg++)
+    {
+        struct TraceReader reader;
+        if (TraceReaderOpen(&reader, argv[arg]) != 0)
+        {
+            if (errno == EINVAL)
+            {
+                fprintf(stderr, "%s isn't an allocation trace.\n", argv[arg]);
+            }
+            else
+            {
+                fprintf(stderr, "Couldn't open %s: %s\n", argv[arg], strerror(errno));
+            }
+            status = 1;
+            continue;
+        }
+
+        struct Replay replay;
+        BuildReplay(&reader, &replay);
+        TraceReaderClose(&reader);
+
+        printf("%s: %zu mallocs and frees on %zu thread%s, at most %.2f MiB live\n",
+               argv[arg], replay.OpCount, replay.ThreadCount, replay.ThreadCount == 1 ? "" : "s",
+               (double) replay.PeakLiveBytes / (1024.0 * 1024.0));
+        if (replay.OpCount == 0)
+        {
+            printf("\n");
+            DestroyReplay(&replay);
+            continue;
+        }
+
+        printf("  %-12s %10s %10s %12s %8s %10s\n", "engine", "time (ms)", "Mops/s", "peak RSS MiB", "frag", "failed");
+
+        for (size_t i = 0; i < selectedCount; i++)
+        {
+            ReplayOnEngine(&replay, selected[i]);
+        }
+        printf("\n");
+
+        DestroyReplay(&replay);
+    }
+
+    free(selected);
+    return status;
+}
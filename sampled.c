@@ -0,0 +1,421 @@
+// Guard pages for a random sample of allocations.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "sampled.h"
+
+#include <execinfo.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "tcache.h"
+#include "timing.h"
+
+enum SlotState
+{
+    SLOT_UNUSED,
+    SLOT_LIVE,
+    SLOT_FREED,
+};
+
+// What we know about the block in a slot, for the fault report. Each slot
+// is a page for the block followed by its guard page.
+struct SampledSlot
+{
+    enum SlotState State;
+    char* Ptr;
+    size_t Size;
+    int AllocFrames;
+    int FreeFrames;
+    void* AllocStack[SAMPLED_STACK_DEPTH];
+    void* FreeStack[SAMPLED_STACK_DEPTH];
+};
+
+static pthread_once_t poolOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Set once, and read without the lock by every free.
+static _Atomic(char*) poolBase;
+static size_t pageSize;
+static struct SampledSlot slots[SAMPLED_SLOTS];
+
+// Free slots, oldest first. Reusing the slot that's been free the longest
+// gives a use after free the best chance of landing on a protected page.
+static unsigned freeSlots[SAMPLED_SLOTS];
+static size_t freeHead;
+static size_t freeCount;
+
+static _Atomic unsigned sampleRate;
+static _Atomic size_t sampledCount;
+
+static struct sigaction previousSegv;
+static struct sigaction previousBus;
+
+// Allocations left until the next sampled one. It starts at zero, so each
+// thread's first allocation takes the slow path, which seeds rng and
+// starts the countdown.
+static __thread int32_t countdown;
+static __thread uint32_t rng;
+
+static void ReportFault(int signal, siginfo_t* info, void* ucontext);
+
+// The signal handler can't use stdio, so reports are put together by hand.
+struct Report
+{
+    char Text[256];
+    size_t Length;
+};
+
+static void Append(struct Report* report, const char* text)
+{
+    while (*text != '\0' && report->Length < sizeof(report->Text))
+    {
+        report->Text[report->Length++] = *text++;
+    }
+}
+
+static void AppendNumber(struct Report* report, size_t value)
+{
+    char digits[24];
+    size_t count = 0;
+    do
+    {
+        digits[count++] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+
+    while (count > 0 && report->Length < sizeof(report->Text))
+    {
+        report->Text[report->Length++] = digits[--count];
+    }
+}
+
+static void Flush(struct Report* report)
+{
+    if (write(STDERR_FILENO, report->Text, report->Length) < 0)
+    {
+        // Nowhere left to say anything.
+    }
+    report->Length = 0;
+}
+
+static void PrintStacks(struct Report* report, const struct SampledSlot* slot)
+{
+    Append(report, "The block was allocated at:\n");
+    Flush(report);
+    backtrace_symbols_fd(slot->AllocStack, slot->AllocFrames, STDERR_FILENO);
+
+    if (slot->FreeFrames > 0)
+    {
+        Append(report, "and freed at:\n");
+        Flush(report);
+        backtrace_symbols_fd(slot->FreeStack, slot->FreeFrames, STDERR_FILENO);
+    }
+}
+
+static void ResetPoolLock(void)
+{
+    pthread_mutex_init(&poolLock, NULL);
+    // A child shouldn't pick the same allocations to sample as its parent.
+    rng = 0;
+    countdown = 0;
+}
+
+static void LockPool(void)
+{
+    pthread_mutex_lock(&poolLock);
+}
+
+static void UnlockPool(void)
+{
+    pthread_mutex_unlock(&poolLock);
+}
+
+static void InitPool(void)
+{
+    if (atomic_load(&sampleRate) == 0)
+    {
+        const char* rate = getenv("MALLOCDEMO_SAMPLE_RATE");
+        const unsigned long parsed = rate != NULL ? strtoul(rate, NULL, 10) : 0;
+        atomic_store(&sampleRate, parsed > 0 ? (unsigned) parsed : SAMPLED_DEFAULT_RATE);
+    }
+
+    pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    void* base = mmap(NULL, SAMPLED_SLOTS * 2 * pageSize, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+    {
+        // Without a pool, nothing is sampled.
+        return;
+    }
+
+    for (unsigned i = 0; i < SAMPLED_SLOTS; i++)
+    {
+        freeSlots[i] = i;
+    }
+    freeHead = 0;
+    freeCount = SAMPLED_SLOTS;
+
+    // The first backtrace loads the unwinder, which allocates. Better here
+    // than in the middle of a sampled allocation.
+    void* frame;
+    backtrace(&frame, 1);
+
+    pthread_atfork(LockPool, UnlockPool, ResetPoolLock);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = ReportFault;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &previousSegv);
+    sigaction(SIGBUS, &action, &previousBus);
+
+    atomic_store(&poolBase, (char*) base);
+}
+
+void SampledSetRate(unsigned rate)
+{
+    atomic_store(&sampleRate, rate > 0 ? rate : 1);
+    countdown = 0;
+    rng = 0;
+}
+
+unsigned SampledRate(void)
+{
+    pthread_once(&poolOnce, InitPool);
+    return atomic_load(&sampleRate);
+}
+
+size_t SampledCount(void)
+{
+    return atomic_load(&sampledCount);
+}
+
+static int32_t NextCountdown(void)
+{
+    if (rng == 0)
+    {
+        rng = (uint32_t) (NowNs() ^ (uintptr_t) &countdown ^ ((uint64_t) getpid() << 16)) | 1;
+    }
+
+    // xorshift32
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+
+    // Uniform over [1, 2 * rate - 1], which averages out to rate.
+    const unsigned rate = atomic_load(&sampleRate);
+    return rate <= 1 ? 1 : (int32_t) (1 + rng % (2 * rate - 1));
+}
+
+static void* GuardedMalloc(size_t size)
+{
+    char* base = atomic_load(&poolBase);
+    if (base == NULL || size > pageSize)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&poolLock);
+    if (freeCount == 0)
+    {
+        pthread_mutex_unlock(&poolLock);
+        return NULL;
+    }
+    const unsigned index = freeSlots[freeHead];
+    freeHead = (freeHead + 1) % SAMPLED_SLOTS;
+    freeCount--;
+    pthread_mutex_unlock(&poolLock);
+
+    struct SampledSlot* slot = &slots[index];
+    char* page = base + (size_t) index * 2 * pageSize;
+    if (mprotect(page, pageSize, PROT_READ | PROT_WRITE) != 0)
+    {
+        pthread_mutex_lock(&poolLock);
+        freeSlots[(freeHead + freeCount) % SAMPLED_SLOTS] = index;
+        freeCount++;
+        pthread_mutex_unlock(&poolLock);
+        return NULL;
+    }
+
+    // Flush against the guard page, then back to malloc's usual 16 bytes
+    // for blocks that big, as in the guard engine.
+    char* p = page + pageSize - size;
+    if (size >= SAMPLED_MIN_ALIGNMENT)
+    {
+        p = (char*) ((uintptr_t) p & ~(uintptr_t) (SAMPLED_MIN_ALIGNMENT - 1));
+    }
+    slot->Ptr = p;
+    slot->Size = size;
+    slot->AllocFrames = backtrace(slot->AllocStack, SAMPLED_STACK_DEPTH);
+    slot->FreeFrames = 0;
+    slot->State = SLOT_LIVE;
+    atomic_fetch_add(&sampledCount, 1);
+    return slot->Ptr;
+}
+
+static __attribute__((noinline)) void* SampleSlow(size_t size)
+{
+    pthread_once(&poolOnce, InitPool);
+
+    if (rng == 0)
+    {
+        // A thread that's only just started (or been forked) should be as
+        // likely to sample its next allocation as one that's been running
+        // a while. Partway through a countdown, what's left of it is
+        // distributed about like the smaller of two fresh ones.
+        const int32_t first = NextCountdown();
+        const int32_t second = NextCountdown();
+        countdown = first < second ? first : second;
+        if (--countdown > 0)
+        {
+            return TCacheMalloc(size);
+        }
+    }
+
+    countdown = NextCountdown();
+    void* p = GuardedMalloc(size);
+    return p != NULL ? p : TCacheMalloc(size);
+}
+
+void* SampledMalloc(size_t size)
+{
+    if (__builtin_expect(--countdown > 0, 1))
+    {
+        return TCacheMalloc(size);
+    }
+
+    return SampleSlow(size);
+}
+
+static __attribute__((noinline)) void GuardedFree(char* base, char* p)
+{
+    const size_t index = (size_t) (p - base) / (2 * pageSize);
+    struct SampledSlot* slot = &slots[index];
+
+    if (slot->State != SLOT_LIVE || slot->Ptr != p)
+    {
+        struct Report report = { .Length = 0 };
+        Append(&report, slot->State == SLOT_FREED && slot->Ptr == p ? "Double free of a sampled "
+                                                                    : "Bad free inside a sampled ");
+        AppendNumber(&report, slot->Size);
+        Append(&report, " byte block.\n");
+        PrintStacks(&report, slot);
+        abort();
+    }
+
+    slot->FreeFrames = backtrace(slot->FreeStack, SAMPLED_STACK_DEPTH);
+    slot->State = SLOT_FREED;
+    mprotect(base + index * 2 * pageSize, pageSize, PROT_NONE);
+
+    pthread_mutex_lock(&poolLock);
+    freeSlots[(freeHead + freeCount) % SAMPLED_SLOTS] = (unsigned) index;
+    freeCount++;
+    pthread_mutex_unlock(&poolLock);
+}
+
+void SampledFree(void* ptr)
+{
+    char* base = atomic_load_explicit(&poolBase, memory_order_relaxed);
+    char* p = (char*) ptr;
+    if (base != NULL && p >= base && p < base + SAMPLED_SLOTS * 2 * pageSize)
+    {
+        GuardedFree(base, p);
+        return;
+    }
+
+    TCacheFree(ptr);
+}
+
+static void PassOn(int signal, siginfo_t* info, void* ucontext)
+{
+    const struct sigaction* previous = signal == SIGSEGV ? &previousSegv : &previousBus;
+    if ((previous->sa_flags & SA_SIGINFO) && previous->sa_sigaction != NULL)
+    {
+        previous->sa_sigaction(signal, info, ucontext);
+        return;
+    }
+    if (previous->sa_handler != SIG_DFL && previous->sa_handler != SIG_IGN)
+    {
+        previous->sa_handler(signal);
+        return;
+    }
+
+    // Put the default action back and return; the access happens again
+    // and takes the process down as usual.
+    struct sigaction defaultAction;
+    memset(&defaultAction, 0, sizeof(defaultAction));
+    defaultAction.sa_handler = SIG_DFL;
+    sigaction(signal, &defaultAction, NULL);
+}
+
+static void ReportFault(int signal, siginfo_t* info, void* ucontext)
+{
+    char* base = atomic_load(&poolBase);
+    char* address = (char*) info->si_addr;
+    if (base == NULL || address < base || address >= base + SAMPLED_SLOTS * 2 * pageSize)
+    {
+        PassOn(signal, info, ucontext);
+        return;
+    }
+
+    const size_t index = (size_t) (address - base) / (2 * pageSize);
+    const size_t offset = (size_t) (address - base) % (2 * pageSize);
+    const struct SampledSlot* slot = &slots[index];
+
+    struct Report report = { .Length = 0 };
+    if (offset >= pageSize && slot->State == SLOT_LIVE)
+    {
+        Append(&report, "Heap buffer overflow: accessed byte ");
+        AppendNumber(&report, (size_t) (address - slot->Ptr));
+        Append(&report, " of a ");
+        AppendNumber(&report, slot->Size);
+        Append(&report, " byte block.\n");
+    }
+    else if (offset < pageSize && slot->State == SLOT_FREED)
+    {
+        Append(&report, "Use after free: accessed byte ");
+        AppendNumber(&report, (size_t) (address - slot->Ptr));
+        Append(&report, " of a freed ");
+        AppendNumber(&report, slot->Size);
+        Append(&report, " byte block.\n");
+    }
+    else
+    {
+        Append(&report, "Bad access to the sampled allocation pool.\n");
+    }
+    PrintStacks(&report, slot);
+
+    PassOn(signal, info, ucontext);
+}
+
+const struct AllocEngine SampledEngine = {
+    .Name = "sampled",
+    .Description = "tcache, with guard pages on a random sample of allocations",
+    .Malloc = SampledMalloc,
+    .Free = SampledFree,
+    .Reset = NULL,
+    .ThreadSafe = 1,
+};
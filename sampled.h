@@ -0,0 +1,73 @@
+// Guard pages for a random sample of allocations.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SAMPLED_H
+#define SAMPLED_H
+
+#include <stddef.h>
+
+#include "engine.h"
+
+// Guard pages for a sample of allocations, cheap enough to leave on in
+// production (the same idea as GWP-ASan). Most allocations go straight to
+// the thread-cache allocator. Roughly one in every SampledRate() instead
+// gets a slot in a small pool of guarded pages: it sits flush against a
+// guard page, like in the guard engine, and once it's freed its page is
+// made inaccessible until the slot is reused.
+//
+// As in the guard engine, blocks of SAMPLED_MIN_ALIGNMENT bytes or more
+// start on a multiple of it, since code written against the real malloc
+// counts on that. When their size isn't a multiple of 16 that moves them
+// back from the guard page by up to 15 bytes, and an overflow that stays
+// inside that gap goes unnoticed.
+//
+// Whether an allocation is sampled is a thread-local countdown, so the
+// fast path is a decrement and a branch. Each time it runs out it's reset
+// to a random number between 1 and twice the rate, so no allocation site
+// is always or never picked.
+//
+// If a sampled block is overflowed or used after it's freed, the fault
+// handler prints what happened and the stack the block was allocated
+// from (and freed from, if it was) to stderr before the process dies as
+// it normally would.
+//
+// Only requests up to a page are sampled, and when every slot is in use
+// allocations just take the fast path.
+
+// The rate comes from the MALLOCDEMO_SAMPLE_RATE environment variable the
+// first time it's needed, or this if that isn't set.
+#define SAMPLED_DEFAULT_RATE 1000
+#define SAMPLED_MIN_ALIGNMENT 16
+#define SAMPLED_SLOTS 256
+#define SAMPLED_STACK_DEPTH 16
+
+// Changes how often allocations are sampled: about one in every rate.
+// 1 samples every allocation that fits in a slot.
+void SampledSetRate(unsigned rate);
+unsigned SampledRate(void);
+
+// How many allocations have been sampled so far.
+size_t SampledCount(void);
+
+void* SampledMalloc(size_t size);
+void SampledFree(void* ptr);
+
+extern const struct AllocEngine SampledEngine;
+
+#endif
@@ -0,0 +1,205 @@
+// Shadow memory for byte-precise out-of-bounds checks, and an engine that keeps it.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "shadow.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "tlsf.h"
+
+#define SHADOW_ENGINE_SIZE ((size_t) 16 * 1024 * 1024)
+
+int ShadowInit(struct Shadow* shadow, const void* start, size_t size)
+{
+    const size_t mapSize = (size + SHADOW_GRANULE - 1) / SHADOW_GRANULE;
+    void* map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+    {
+        return -1;
+    }
+    memset(map, SHADOW_MARK_UNALLOCATED, mapSize);
+
+    shadow->Start = (const char*) start;
+    shadow->Size = size;
+    shadow->Map = (uint8_t*) map;
+    return 0;
+}
+
+void ShadowDestroy(struct Shadow* shadow)
+{
+    munmap(shadow->Map, (shadow->Size + SHADOW_GRANULE - 1) / SHADOW_GRANULE);
+    memset(shadow, 0, sizeof(*shadow));
+}
+
+void ShadowUnpoison(struct Shadow* shadow, const void* p, size_t size)
+{
+    uint8_t* mark = shadow->Map + (size_t) ((const char*) p - shadow->Start) / SHADOW_GRANULE;
+    memset(mark, 0, size / SHADOW_GRANULE);
+    if (size % SHADOW_GRANULE != 0)
+    {
+        mark[size / SHADOW_GRANULE] = (uint8_t) (size % SHADOW_GRANULE);
+    }
+}
+
+void ShadowPoison(struct Shadow* shadow, const void* p, size_t size, uint8_t mark)
+{
+    const size_t first = (size_t) ((const char*) p - shadow->Start) / SHADOW_GRANULE;
+    memset(shadow->Map + first, mark, (size + SHADOW_GRANULE - 1) / SHADOW_GRANULE);
+}
+
+size_t ShadowFirstPoisoned(const struct Shadow* shadow, const void* p, size_t size)
+{
+    const char* bytes = (const char*) p;
+    size_t i = 0;
+    while (i < size)
+    {
+        const uintptr_t offset = (uintptr_t) (bytes + i) - (uintptr_t) shadow->Start;
+        if (offset >= shadow->Size)
+        {
+            i++;
+            continue;
+        }
+
+        // Every byte of a granule with a 0 mark is fine, so skip to the
+        // next one.
+        const uint8_t mark = shadow->Map[offset / SHADOW_GRANULE];
+        const size_t inGranule = offset % SHADOW_GRANULE;
+        if (mark == 0)
+        {
+            i += SHADOW_GRANULE - inGranule;
+        }
+        else if (mark < SHADOW_GRANULE && inGranule < mark)
+        {
+            i++;
+        }
+        else
+        {
+            return i;
+        }
+    }
+    return size;
+}
+
+uint8_t ShadowMarkAt(const struct Shadow* shadow, const void* p)
+{
+    const uintptr_t offset = (uintptr_t) p - (uintptr_t) shadow->Start;
+    return offset < shadow->Size ? shadow->Map[offset / SHADOW_GRANULE] : 0;
+}
+
+static struct Tlsf engineTlsf;
+static struct Shadow engineShadow;
+
+void* ShadowMalloc(size_t size)
+{
+    if (engineTlsf.Memory == NULL)
+    {
+        if (TlsfInit(&engineTlsf, SHADOW_ENGINE_SIZE) != 0)
+        {
+            return NULL;
+        }
+        if (ShadowInit(&engineShadow, engineTlsf.Memory, engineTlsf.MemorySize) != 0)
+        {
+            TlsfDestroy(&engineTlsf);
+            return NULL;
+        }
+    }
+
+    if (size > SIZE_MAX - SHADOW_REDZONE)
+    {
+        return NULL;
+    }
+    char* p = (char*) TlsfMalloc(&engineTlsf, size + SHADOW_REDZONE);
+    if (p == NULL)
+    {
+        return NULL;
+    }
+
+    // The redzone starts mid-granule when size isn't a multiple of 8;
+    // that granule's mark already says where the block ends.
+    ShadowUnpoison(&engineShadow, p, size);
+    const size_t blockGranules = (size + SHADOW_GRANULE - 1) / SHADOW_GRANULE;
+    ShadowPoison(&engineShadow, p + blockGranules * SHADOW_GRANULE,
+                 size + SHADOW_REDZONE - blockGranules * SHADOW_GRANULE, SHADOW_MARK_REDZONE);
+    return p;
+}
+
+// Whether p is where a live block starts: its first granule is usable (or
+// is the redzone, for an empty block) and the one before it, TLSF's block
+// header, never is.
+static int IsBlockStart(const char* p)
+{
+    if (p < engineShadow.Start || p >= engineShadow.Start + engineShadow.Size
+        || (size_t) (p - engineShadow.Start) % SHADOW_GRANULE != 0)
+    {
+        return 0;
+    }
+
+    const uint8_t mark = ShadowMarkAt(&engineShadow, p);
+    const uint8_t before = p == engineShadow.Start ? SHADOW_MARK_UNALLOCATED
+                                                   : ShadowMarkAt(&engineShadow, p - SHADOW_GRANULE);
+    return (mark < SHADOW_GRANULE || mark == SHADOW_MARK_REDZONE) && before >= SHADOW_GRANULE;
+}
+
+void ShadowFree(void* ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    if (!IsBlockStart((const char*) ptr))
+    {
+        fprintf(stderr, "%s of %p, which isn't a live block on the shadow heap.\n",
+                ShadowMarkAt(&engineShadow, ptr) == SHADOW_MARK_FREED ? "Double free" : "Invalid free", ptr);
+        abort();
+    }
+
+    // A live block reads as a run of 0 marks, maybe a partial granule and
+    // then its redzone, so the shadow knows how big it is.
+    const uint8_t* mark = engineShadow.Map + (size_t) ((const char*) ptr - engineShadow.Start) / SHADOW_GRANULE;
+    size_t size = 0;
+    while (mark[size / SHADOW_GRANULE] == 0)
+    {
+        size += SHADOW_GRANULE;
+    }
+    if (mark[size / SHADOW_GRANULE] < SHADOW_GRANULE)
+    {
+        size += mark[size / SHADOW_GRANULE];
+    }
+
+    ShadowPoison(&engineShadow, ptr, size + SHADOW_REDZONE, SHADOW_MARK_FREED);
+    TlsfFree(&engineTlsf, ptr);
+}
+
+const struct Shadow* ShadowEngineState(void)
+{
+    return &engineShadow;
+}
+
+const struct AllocEngine ShadowEngine = {
+    .Name = "shadow",
+    .Description = "TLSF with a shadow byte per 8 bytes, poisoned on free, for checked field writes (-c)",
+    .Malloc = ShadowMalloc,
+    .Free = ShadowFree,
+    .Reset = NULL,
+    .ThreadSafe = 0,
+};
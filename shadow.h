@@ -0,0 +1,105 @@
+// Shadow memory: a byte per 8 heap bytes saying how many can be used.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "engine.h"
+
+// Shadow memory for a heap region, the way AddressSanitizer does it: one
+// shadow byte for every 8 byte granule of the region, saying how much of
+// the granule is part of a live block.
+//
+//   0        all 8 bytes can be used
+//   1 to 7   only that many bytes, from the start of the granule
+//   anything else (the marks below) none of it, and why not
+//
+// The shadow engine keeps it up to date. Blocks come out of a TLSF heap,
+// 8 byte aligned so every block starts a granule. Malloc unpoisons the
+// block and marks SHADOW_REDZONE bytes after it as a redzone, and free
+// poisons the whole thing again as freed. A checked write then costs a
+// subtraction, a shadow byte load and a compare.
+
+#define SHADOW_GRANULE 8
+#define SHADOW_REDZONE 32
+
+#define SHADOW_MARK_UNALLOCATED 0xFE
+#define SHADOW_MARK_REDZONE 0xFA
+#define SHADOW_MARK_FREED 0xFD
+
+struct Shadow
+{
+    // The region being shadowed. Start is granule aligned.
+    const char* Start;
+    size_t Size;
+    uint8_t* Map;
+};
+
+// Maps the shadow for size bytes from start, all of it marked
+// unallocated. Returns 0 on success and -1 if the mapping failed.
+int ShadowInit(struct Shadow* shadow, const void* start, size_t size);
+void ShadowDestroy(struct Shadow* shadow);
+
+// Makes the size bytes at p usable. p has to start a granule.
+void ShadowUnpoison(struct Shadow* shadow, const void* p, size_t size);
+
+// Marks the granules covering the size bytes at p with mark. p has to
+// start a granule.
+void ShadowPoison(struct Shadow* shadow, const void* p, size_t size, uint8_t mark);
+
+// Returns the offset of the first byte of the size at p that can't be
+// used, or size if they all can. Memory outside the region is never
+// poisoned.
+size_t ShadowFirstPoisoned(const struct Shadow* shadow, const void* p, size_t size);
+
+// The shadow byte for the granule holding p, or 0 outside the region.
+uint8_t ShadowMarkAt(const struct Shadow* shadow, const void* p);
+
+// Whether every one of the size bytes at p can be used. Anything that
+// fits in one granule is decided inline.
+static inline int ShadowIsAddressable(const struct Shadow* shadow, const void* p, size_t size)
+{
+    const uintptr_t offset = (uintptr_t) p - (uintptr_t) shadow->Start;
+    if (offset >= shadow->Size)
+    {
+        return 1;
+    }
+
+    const uintptr_t inGranule = offset % SHADOW_GRANULE;
+    if (inGranule + size <= SHADOW_GRANULE)
+    {
+        const uint8_t mark = shadow->Map[offset / SHADOW_GRANULE];
+        return mark == 0 || (mark < SHADOW_GRANULE && inGranule + size <= mark);
+    }
+    return ShadowFirstPoisoned(shadow, p, size) == size;
+}
+
+void* ShadowMalloc(size_t size);
+void ShadowFree(void* ptr);
+
+// The shadow of the shadow engine's heap. Its region is empty until the
+// engine's first malloc.
+const struct Shadow* ShadowEngineState(void);
+
+extern const struct AllocEngine ShadowEngine;
+
+#endif
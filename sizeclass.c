@@ -0,0 +1,312 @@
+// A size-class segregated-fit allocator.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "sizeclass.h"
+
+#include <string.h>
+#include <sys/mman.h>
+
+// Spans are carved out of chunks this big so we aren't making an mmap
+// call per page.
+#define SPAN_CHUNK_SIZE ((size_t) 1024 * 1024)
+
+#define SPAN_MAGIC 0x5350414eu   // "SPAN"
+#define LARGE_MAGIC 0x4c524745u  // "LRGE"
+
+// Sits at the start of every span and in the page a large allocation
+// starts in. It's padded to 32 bytes so whatever comes after it stays 16
+// byte aligned.
+struct SpanHeader
+{
+    _Alignas(16) uint32_t Magic;
+    uint32_t ClassIndex;
+
+    // Only used by large allocations. An aligned allocation may not start
+    // in the first page of its mapping, so we keep where the mapping is.
+    char* MapBase;
+    size_t MapSize;
+};
+
+struct FreeBlock
+{
+    struct FreeBlock* Next;
+};
+
+struct SizeClass
+{
+    struct FreeBlock* FreeList;
+
+    // The part of the newest span that hasn't been handed out yet.
+    char* Unused;
+    char* UnusedEnd;
+};
+
+static struct SizeClass classes[SIZE_CLASS_COUNT];
+
+// Spans not yet given to any class.
+static char* spanChunk;
+static char* spanChunkEnd;
+
+static struct SizeClassStats stats;
+
+size_t SizeClassIndex(size_t size)
+{
+    if (size <= 8)
+    {
+        return 0;
+    }
+
+    if (size <= 64)
+    {
+        return (size + 15) / 16;
+    }
+
+    if (size > SIZE_CLASS_MAX)
+    {
+        return SIZE_CLASS_LARGE;
+    }
+
+    // size is in (2^k, 2^(k + 1)]. Split that range into quarters and
+    // figure out which quarter it falls in.
+    const size_t k = (size_t) (63 - __builtin_clzll((unsigned long long) (size - 1)));
+    const size_t quarter = (size_t) 1 << (k - 2);
+    const size_t step = (size - ((size_t) 1 << k) + quarter - 1) / quarter;
+    return 4 + (k - 6) * 4 + step;
+}
+
+size_t SizeClassSize(size_t index)
+{
+    if (index == 0)
+    {
+        return 8;
+    }
+
+    if (index <= 4)
+    {
+        return index * 16;
+    }
+
+    const size_t k = 6 + (index - 5) / 4;
+    const size_t step = (index - 5) % 4 + 1;
+    return ((size_t) 1 << k) + step * ((size_t) 1 << (k - 2));
+}
+
+// Every block in a span and every large allocation starts past the
+// header, so the byte just before a pointer always lies in the same page
+// as the header that owns it. Rounding down from there (rather than from
+// the pointer itself) keeps working for page aligned large allocations.
+static struct SpanHeader* SpanOf(const void* ptr)
+{
+    return (struct SpanHeader*) (((uintptr_t) ptr - 1) & ~(uintptr_t) (SPAN_SIZE - 1));
+}
+
+static char* NewSpan(size_t index)
+{
+    if (spanChunk == spanChunkEnd)
+    {
+        void* chunk = mmap(NULL, SPAN_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (chunk == MAP_FAILED)
+        {
+            return NULL;
+        }
+
+        spanChunk = (char*) chunk;
+        spanChunkEnd = spanChunk + SPAN_CHUNK_SIZE;
+        stats.SpanBytes += SPAN_CHUNK_SIZE;
+    }
+
+    char* span = spanChunk;
+    spanChunk += SPAN_SIZE;
+
+    struct SpanHeader* header = (struct SpanHeader*) span;
+    header->Magic = SPAN_MAGIC;
+    header->ClassIndex = (uint32_t) index;
+    header->MapBase = NULL;
+    header->MapSize = 0;
+    return span;
+}
+
+static void* LargeMalloc(size_t alignment, size_t size)
+{
+    if (size > SIZE_MAX - alignment - 2 * SPAN_SIZE)
+    {
+        return NULL;
+    }
+
+    const size_t mapSize = (size + alignment + sizeof(struct SpanHeader) + SPAN_SIZE - 1)
+                           & ~(size_t) (SPAN_SIZE - 1);
+    char* mem = (char*) mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    // Below a page of alignment this lands in the first page, right after
+    // the header. Otherwise it's page aligned and the header goes in the
+    // page just before it. Either way SpanOf finds the header.
+    char* p = (char*) (((uintptr_t) mem + sizeof(struct SpanHeader) + alignment - 1) & ~(uintptr_t) (alignment - 1));
+
+    struct SpanHeader* header = SpanOf(p);
+    header->Magic = LARGE_MAGIC;
+    header->ClassIndex = SIZE_CLASS_LARGE;
+    header->MapBase = mem;
+    header->MapSize = mapSize;
+    stats.LargeBytes += mapSize;
+    return p;
+}
+
+void* SizeClassMalloc(size_t size)
+{
+    const size_t index = SizeClassIndex(size);
+    if (index == SIZE_CLASS_LARGE)
+    {
+        return LargeMalloc(16, size);
+    }
+
+    struct SizeClass* sizeClass = &classes[index];
+    struct FreeBlock* block = sizeClass->FreeList;
+    if (block != NULL)
+    {
+        sizeClass->FreeList = block->Next;
+        stats.LiveBlocks[index]++;
+        return block;
+    }
+
+    const size_t blockSize = SizeClassSize(index);
+    if ((size_t) (sizeClass->UnusedEnd - sizeClass->Unused) < blockSize)
+    {
+        char* span = NewSpan(index);
+        if (span == NULL)
+        {
+            return NULL;
+        }
+
+        sizeClass->Unused = span + sizeof(struct SpanHeader);
+        sizeClass->UnusedEnd = span + SPAN_SIZE;
+    }
+
+    void* p = sizeClass->Unused;
+    sizeClass->Unused += blockSize;
+    stats.LiveBlocks[index]++;
+    return p;
+}
+
+void* SizeClassMallocAligned(size_t alignment, size_t size)
+{
+    // Blocks of 16 bytes and up are always 16 byte aligned; the 8 byte
+    // class is only 8 byte aligned.
+    if (alignment <= 8)
+    {
+        return SizeClassMalloc(size);
+    }
+    if (alignment == 16)
+    {
+        return SizeClassMalloc(size < 16 ? 16 : size);
+    }
+
+    return LargeMalloc(alignment, size);
+}
+
+size_t SizeClassAllocBatch(size_t index, void** blocks, size_t count)
+{
+    const size_t size = SizeClassSize(index);
+    for (size_t i = 0; i < count; i++)
+    {
+        blocks[i] = SizeClassMalloc(size);
+        if (blocks[i] == NULL)
+        {
+            return i;
+        }
+    }
+
+    return count;
+}
+
+void SizeClassFreeBatch(size_t index, void* const* blocks, size_t count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    // Link the batch together first, then splice the whole thing onto
+    // the class's free list in one go.
+    for (size_t i = 0; i + 1 < count; i++)
+    {
+        ((struct FreeBlock*) blocks[i])->Next = (struct FreeBlock*) blocks[i + 1];
+    }
+
+    struct SizeClass* sizeClass = &classes[index];
+    ((struct FreeBlock*) blocks[count - 1])->Next = sizeClass->FreeList;
+    sizeClass->FreeList = (struct FreeBlock*) blocks[0];
+    stats.LiveBlocks[index] -= count;
+}
+
+void SizeClassFree(void* ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    struct SpanHeader* header = SpanOf(ptr);
+    if (header->Magic == LARGE_MAGIC)
+    {
+        stats.LargeBytes -= header->MapSize;
+        munmap(header->MapBase, header->MapSize);
+        return;
+    }
+
+    struct SizeClass* sizeClass = &classes[header->ClassIndex];
+    struct FreeBlock* block = (struct FreeBlock*) ptr;
+    block->Next = sizeClass->FreeList;
+    sizeClass->FreeList = block;
+    stats.LiveBlocks[header->ClassIndex]--;
+}
+
+size_t SizeClassUsableSize(const void* ptr)
+{
+    if (ptr == NULL)
+    {
+        return 0;
+    }
+
+    const struct SpanHeader* header = SpanOf(ptr);
+    if (header->Magic == LARGE_MAGIC)
+    {
+        return (size_t) (header->MapBase + header->MapSize - (const char*) ptr);
+    }
+
+    return SizeClassSize(header->ClassIndex);
+}
+
+void SizeClassGetStats(struct SizeClassStats* out)
+{
+    memcpy(out, &stats, sizeof(stats));
+}
+
+const struct AllocEngine SizeClassEngine = {
+    .Name = "segregated",
+    .Description = "size-class segregated fit with per-class free lists and page spans",
+    .Malloc = SizeClassMalloc,
+    .Free = SizeClassFree,
+    .Reset = NULL,
+    .ThreadSafe = 0,
+};
@@ -0,0 +1,90 @@
+// A size-class segregated-fit allocator.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SIZECLASS_H
+#define SIZECLASS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "engine.h"
+
+// A segregated-fit allocator. Small requests are rounded up to one of a
+// fixed set of size classes and every class keeps its own free list, so
+// allocating and freeing are a couple of pointer moves. Blocks are carved
+// out of page-sized spans that only ever hold one class, which means the
+// span header tells us a block's size without a per-block header.
+//
+// The classes go up in quarter steps between powers of two (80, 96, 112,
+// 128, 160, ...), which caps internal fragmentation at 20% or so. Below
+// 64 bytes they go up in 16 byte steps instead so every class above 8
+// bytes stays 16 byte aligned.
+//
+// None of this is thread safe on its own. The thread cache engine puts a
+// lock in front of it.
+
+#define SIZE_CLASS_COUNT 21
+#define SIZE_CLASS_MAX 1024
+#define SPAN_SIZE 4096
+
+// Requests bigger than SIZE_CLASS_MAX get their own mapping; this is the
+// class index we report for them.
+#define SIZE_CLASS_LARGE SIZE_CLASS_COUNT
+
+// Returns the class a request of size bytes is served from, or
+// SIZE_CLASS_LARGE if it's too big for any of them.
+size_t SizeClassIndex(size_t size);
+
+// The block size of a class.
+size_t SizeClassSize(size_t index);
+
+void* SizeClassMalloc(size_t size);
+void SizeClassFree(void* ptr);
+
+// Like SizeClassMalloc, but the block is aligned to alignment, which must
+// be a power of two. Anything that needs more than 16 byte alignment gets
+// a mapping of its own.
+void* SizeClassMallocAligned(size_t alignment, size_t size);
+
+// Hands out up to count blocks of one class at once, for callers that
+// cache blocks of their own. Returns how many it managed to allocate.
+size_t SizeClassAllocBatch(size_t index, void** blocks, size_t count);
+
+// Gives count blocks of one class back at once.
+void SizeClassFreeBatch(size_t index, void* const* blocks, size_t count);
+
+// How many bytes the caller can actually use at ptr, like glibc's
+// malloc_usable_size.
+size_t SizeClassUsableSize(const void* ptr);
+
+struct SizeClassStats
+{
+    // Bytes mapped for spans and for large allocations.
+    size_t SpanBytes;
+    size_t LargeBytes;
+
+    // Blocks currently handed out, per class.
+    size_t LiveBlocks[SIZE_CLASS_COUNT];
+};
+
+void SizeClassGetStats(struct SizeClassStats* stats);
+
+extern const struct AllocEngine SizeClassEngine;
+
+#endif
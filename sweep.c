@@ -0,0 +1,470 @@
+// Batch experiments built from the demos.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "sweep.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+#include "objects.h"
+#include "recover.h"
+#include "timing.h"
+#include "workpool.h"
+
+#define GIANT_SWEEP_SIZES (sizeof(struct GiantObject) - 1)
+
+static const size_t giantFieldOffsets[GIANT_FIELD_COUNT] = {
+    offsetof(struct GiantObject, Field01), offsetof(struct GiantObject, Field02),
+    offsetof(struct GiantObject, Field03), offsetof(struct GiantObject, Field04),
+    offsetof(struct GiantObject, Field05), offsetof(struct GiantObject, Field06),
+    offsetof(struct GiantObject, Field07), offsetof(struct GiantObject, Field08),
+    offsetof(struct GiantObject, Field09), offsetof(struct GiantObject, Field10),
+    offsetof(struct GiantObject, Field11), offsetof(struct GiantObject, Field12),
+    offsetof(struct GiantObject, Field13), offsetof(struct GiantObject, Field14),
+    offsetof(struct GiantObject, Field15), offsetof(struct GiantObject, Field16),
+    offsetof(struct GiantObject, Field17), offsetof(struct GiantObject, Field18),
+    offsetof(struct GiantObject, Field19), offsetof(struct GiantObject, Field20),
+};
+
+// One trial. Field and Saved are volatile because they're read back
+// after a fault has jumped out of the middle of the loop.
+struct GiantTrial
+{
+    char* Object;
+    volatile size_t Field;
+    volatile int64_t Saved[GIANT_FIELD_COUNT];
+};
+
+// How the trials of one size went. FirstFaults[GIANT_FIELD_COUNT] counts
+// the trials that never faulted. A fault whose address isn't in the field
+// being written (it shouldn't happen) counts as Stray instead, and sizes
+// the engine won't allocate count as Refused.
+struct GiantSizeStats
+{
+    uint64_t FirstFaults[GIANT_FIELD_COUNT + 1];
+    uint64_t Stray;
+    uint64_t Refused;
+};
+
+static void WriteFields(void* context)
+{
+    struct GiantTrial* trial = (struct GiantTrial*) context;
+    for (trial->Field = 0; trial->Field < GIANT_FIELD_COUNT; trial->Field++)
+    {
+        volatile int64_t* field = (volatile int64_t*) (trial->Object + giantFieldOffsets[trial->Field]);
+        trial->Saved[trial->Field] = *field;
+        *field = 0x89ABCDEF;
+    }
+}
+
+static void PrintSizes(FILE* stream, size_t first, size_t last, const struct GiantSizeStats* stats,
+                       unsigned long rounds)
+{
+    char sizes[32];
+    if (first == last)
+    {
+        snprintf(sizes, sizeof(sizes), "%zu", first);
+    }
+    else
+    {
+        snprintf(sizes, sizeof(sizes), "%zu-%zu", first, last);
+    }
+
+    if (stats->Refused == rounds)
+    {
+        fprintf(stream, "  %-10s  refused by the engine\n", sizes);
+        return;
+    }
+
+    const uint64_t trials = rounds - stats->Refused;
+    const uint64_t faults = trials - stats->FirstFaults[GIANT_FIELD_COUNT];
+    fprintf(stream, "  %-10s %7.2f%%", sizes, 100.0 * (double) faults / (double) trials);
+    for (size_t i = 0; i < GIANT_FIELD_COUNT; i++)
+    {
+        if (stats->FirstFaults[i] > 0)
+        {
+            fprintf(stream, "  %zu: %.1f%%", giantFieldOffsets[i],
+                    100.0 * (double) stats->FirstFaults[i] / (double) faults);
+        }
+    }
+    if (stats->Stray > 0)
+    {
+        fprintf(stream, "  elsewhere: %.1f%%", 100.0 * (double) stats->Stray / (double) faults);
+    }
+    fprintf(stream, "\n");
+}
+
+int GiantObjectSweep(FILE* stream, unsigned long rounds)
+{
+    if (RecoverInstall() != 0)
+    {
+        return -1;
+    }
+
+    struct GiantSizeStats* stats = (struct GiantSizeStats*) calloc(GIANT_SWEEP_SIZES + 1, sizeof(*stats));
+    if (stats == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+
+    const uint64_t start = NowNs();
+    struct GiantTrial trial;
+    for (unsigned long round = 0; round < rounds; round++)
+    {
+        for (size_t size = 1; size <= GIANT_SWEEP_SIZES; size++)
+        {
+            trial.Object = (char*) EngineMalloc(size);
+            if (trial.Object == NULL)
+            {
+                // Some engines only take small requests.
+                stats[size].Refused++;
+                continue;
+            }
+
+            struct RecoverFault fault;
+            if (RecoverRun(WriteFields, &trial, &fault) == 0)
+            {
+                stats[size].FirstFaults[GIANT_FIELD_COUNT]++;
+            }
+            else
+            {
+                const char* field = trial.Object + giantFieldOffsets[trial.Field];
+                const char* address = (const char*) fault.Address;
+                if (address >= field && address < field + sizeof(int64_t))
+                {
+                    stats[size].FirstFaults[trial.Field]++;
+                }
+                else
+                {
+                    stats[size].Stray++;
+                }
+            }
+
+            // Undo the overflow, newest write first, before the engine
+            // looks at anything we may have scribbled over.
+            for (size_t i = trial.Field; i-- > 0;)
+            {
+                *(volatile int64_t*) (trial.Object + giantFieldOffsets[i]) = trial.Saved[i];
+            }
+            EngineFree(trial.Object);
+        }
+    }
+    const uint64_t elapsed = NowNs() - start;
+
+    const uint64_t trials = (uint64_t) rounds * GIANT_SWEEP_SIZES;
+    fprintf(stream, "Wrote all %d fields of a %zu byte object into every smaller allocation on the %s engine:\n",
+            GIANT_FIELD_COUNT, sizeof(struct GiantObject), EngineCurrent()->Name);
+    fprintf(stream, "%llu trials in %.2f s (%.0f trials/s)\n\n", (unsigned long long) trials,
+            (double) elapsed / 1e9, (double) trials / ((double) elapsed / 1e9));
+    fprintf(stream, "  %-10s %8s  %s\n", "size", "faulted", "offset of the first faulting field: share of faults");
+
+    // Runs of sizes that came out the same share a line.
+    size_t first = 1;
+    for (size_t size = 2; size <= GIANT_SWEEP_SIZES + 1; size++)
+    {
+        if (size > GIANT_SWEEP_SIZES || memcmp(&stats[size], &stats[first], sizeof(*stats)) != 0)
+        {
+            PrintSizes(stream, first, size - 1, &stats[first], rounds);
+            first = size;
+        }
+    }
+
+    free(stats);
+    return 0;
+}
+
+enum IntSweepMode
+{
+    INT_SWEEP_BACK_TO_BACK,
+    INT_SWEEP_FREE_BETWEEN,
+    INT_SWEEP_MODES
+};
+
+// Where p2 lands, by the gap between the end of p1's request and p2.
+enum IntSweepGap
+{
+    INT_GAP_BEFORE,     // p2 is below p1
+    INT_GAP_ADJACENT,   // p2 starts right where p1's request ends
+    INT_GAP_UNDER_16,
+    INT_GAP_UNDER_64,
+    INT_GAP_UNDER_256,
+    INT_GAP_UNDER_4096,
+    INT_GAP_FAR,
+    INT_GAP_BUCKETS
+};
+
+static const char* const intGapNames[INT_GAP_BUCKETS] = {
+    "p2 below p1", "right after p1", "1-15 bytes after", "16-63 bytes after",
+    "64-255 bytes after", "256-4095 bytes after", "4096+ bytes after",
+};
+
+// Every pair a size makes stays allocated until that size is done, so
+// each pair comes out of heap that hasn't been handed out before, the
+// way the demo's do. Freeing each pair before the next would measure the
+// order the engine recycles freed blocks in instead. A size stops early
+// once its blocks take up this much, or the engine runs out of room.
+#define INT_SWEEP_MAX_LIVE_BYTES (64u << 20)
+
+// Refused is set if the engine wouldn't allocate this size. Samples is
+// how many pairs it made before it was done or had to stop.
+struct IntSizeStats
+{
+    int Refused;
+    uint64_t Samples;
+    uint64_t Gaps[INT_GAP_BUCKETS];
+    int64_t CommonDelta;
+    uint64_t CommonCount;
+    uint64_t DistinctDeltas;
+};
+
+struct IntSweep
+{
+    unsigned long Iterations;
+    // One scratch array of deltas, and one of the blocks still live, per
+    // worker.
+    int64_t** Deltas;
+    void*** Live;
+    // Indexed [mode * INT_SWEEP_MAX_SIZE + size - 1].
+    struct IntSizeStats* Stats;
+};
+
+static int CompareDeltas(const void* a, const void* b)
+{
+    const int64_t x = *(const int64_t*) a;
+    const int64_t y = *(const int64_t*) b;
+    return (x > y) - (x < y);
+}
+
+static void IntSweepTask(void* context, size_t index, size_t worker)
+{
+    struct IntSweep* sweep = (struct IntSweep*) context;
+    struct IntSizeStats* stats = &sweep->Stats[index];
+    const enum IntSweepMode mode = (enum IntSweepMode) (index / INT_SWEEP_MAX_SIZE);
+    const size_t size = index % INT_SWEEP_MAX_SIZE + 1;
+    int64_t* deltas = sweep->Deltas[worker];
+    void** live = sweep->Live[worker];
+    size_t liveCount = 0;
+    unsigned long samples = 0;
+
+    while (samples < sweep->Iterations && (liveCount + 3) * size <= INT_SWEEP_MAX_LIVE_BYTES)
+    {
+        char* p1;
+        char* p2;
+        if (mode == INT_SWEEP_BACK_TO_BACK)
+        {
+            p1 = (char*) EngineMalloc(size);
+            p2 = (char*) EngineMalloc(size);
+        }
+        else
+        {
+            char* before = (char*) EngineMalloc(size);
+            p1 = (char*) EngineMalloc(size);
+            EngineFree(before);
+            p2 = before == NULL ? NULL : (char*) EngineMalloc(size);
+        }
+
+        if (p1 == NULL || p2 == NULL)
+        {
+            // Some engines only take small requests, and some only have
+            // room for so many blocks of a size at once.
+            EngineFree(p1);
+            EngineFree(p2);
+            stats->Refused = samples == 0;
+            break;
+        }
+
+        deltas[samples++] = (int64_t) ((uintptr_t) p2 - (uintptr_t) p1);
+        live[liveCount++] = p1;
+        live[liveCount++] = p2;
+    }
+
+    for (size_t i = 0; i < liveCount; i++)
+    {
+        EngineFree(live[i]);
+    }
+
+    // Engines without a real free (like the arena) would otherwise run out
+    // partway through the sweep. They're never run on more than one thread.
+    if (EngineCurrent()->Reset != NULL)
+    {
+        EngineCurrent()->Reset();
+    }
+
+    stats->Samples = samples;
+    for (unsigned long i = 0; i < samples; i++)
+    {
+        const int64_t gap = deltas[i] - (int64_t) size;
+        enum IntSweepGap bucket;
+        if (deltas[i] < 0)
+        {
+            bucket = INT_GAP_BEFORE;
+        }
+        else if (gap == 0)
+        {
+            bucket = INT_GAP_ADJACENT;
+        }
+        else if (gap < 16)
+        {
+            bucket = INT_GAP_UNDER_16;
+        }
+        else if (gap < 64)
+        {
+            bucket = INT_GAP_UNDER_64;
+        }
+        else if (gap < 256)
+        {
+            bucket = INT_GAP_UNDER_256;
+        }
+        else if (gap < 4096)
+        {
+            bucket = INT_GAP_UNDER_4096;
+        }
+        else
+        {
+            bucket = INT_GAP_FAR;
+        }
+        stats->Gaps[bucket]++;
+    }
+
+    // The most common delta is the longest run once they're sorted.
+    qsort(deltas, samples, sizeof(int64_t), CompareDeltas);
+    for (unsigned long i = 0; i < samples;)
+    {
+        unsigned long run = i + 1;
+        while (run < samples && deltas[run] == deltas[i])
+        {
+            run++;
+        }
+        if (run - i > stats->CommonCount)
+        {
+            stats->CommonCount = run - i;
+            stats->CommonDelta = deltas[i];
+        }
+        stats->DistinctDeltas++;
+        i = run;
+    }
+}
+
+static void PrintIntSweepMode(FILE* stream, const struct IntSweep* sweep, enum IntSweepMode mode)
+{
+    static const size_t sampleSizes[] = { 1, 2, 4, 8, 12, 16, 24, 32, 48, 64, 100, 128, 256, 512, 1000, 1024,
+                                          2048, 4096 };
+
+    const struct IntSizeStats* stats = &sweep->Stats[mode * INT_SWEEP_MAX_SIZE];
+    uint64_t gaps[INT_GAP_BUCKETS] = { 0 };
+    uint64_t total = 0;
+    size_t refused = 0;
+    for (size_t size = 1; size <= INT_SWEEP_MAX_SIZE; size++)
+    {
+        refused += stats[size - 1].Refused;
+        for (size_t b = 0; b < INT_GAP_BUCKETS; b++)
+        {
+            gaps[b] += stats[size - 1].Gaps[b];
+            total += stats[size - 1].Gaps[b];
+        }
+    }
+
+    fprintf(stream, "%s:\n", mode == INT_SWEEP_BACK_TO_BACK ? "p1 and p2 allocated back to back"
+                                                            : "a block freed between p1 and p2");
+    if (refused > 0)
+    {
+        fprintf(stream, "  (the engine refused %zu of the sizes)\n", refused);
+    }
+    for (size_t b = 0; b < INT_GAP_BUCKETS && total > 0; b++)
+    {
+        fprintf(stream, "  %-22s %7.2f%%\n", intGapNames[b], 100.0 * (double) gaps[b] / (double) total);
+    }
+
+    fprintf(stream, "\n  %-8s %14s %8s %10s %8s\n", "size", "usual p2 - p1", "share", "distinct", "pairs");
+    for (size_t i = 0; i < sizeof(sampleSizes) / sizeof(sampleSizes[0]); i++)
+    {
+        const struct IntSizeStats* size = &stats[sampleSizes[i] - 1];
+        if (size->Refused)
+        {
+            fprintf(stream, "  %-8zu %14s\n", sampleSizes[i], "refused");
+            continue;
+        }
+        fprintf(stream, "  %-8zu %14lld %7.2f%% %10llu %8llu\n", sampleSizes[i], (long long) size->CommonDelta,
+                100.0 * (double) size->CommonCount / (double) size->Samples,
+                (unsigned long long) size->DistinctDeltas, (unsigned long long) size->Samples);
+    }
+}
+
+int IntMallocSweep(FILE* stream, unsigned long iterations, size_t threads)
+{
+    // Engines that aren't thread safe get a single thread, and with it a
+    // single heap.
+    struct WorkPool* pool = WorkPoolCreate(EngineCurrent()->ThreadSafe ? threads : 1);
+    if (pool == NULL)
+    {
+        return -1;
+    }
+
+    struct IntSweep sweep;
+    sweep.Iterations = iterations;
+    sweep.Stats = (struct IntSizeStats*) calloc(INT_SWEEP_MODES * INT_SWEEP_MAX_SIZE, sizeof(struct IntSizeStats));
+    sweep.Deltas = (int64_t**) calloc(WorkPoolWorkers(pool), sizeof(int64_t*));
+    sweep.Live = (void***) calloc(WorkPoolWorkers(pool), sizeof(void**));
+    if (sweep.Stats == NULL || sweep.Deltas == NULL || sweep.Live == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(OOM_EXIT_CODE);
+    }
+    for (size_t w = 0; w < WorkPoolWorkers(pool); w++)
+    {
+        sweep.Deltas[w] = (int64_t*) malloc(iterations * sizeof(int64_t));
+        sweep.Live[w] = (void**) malloc(2 * iterations * sizeof(void*));
+        if (sweep.Deltas[w] == NULL || sweep.Live[w] == NULL)
+        {
+            fprintf(stderr, "Out of memory.\n");
+            exit(OOM_EXIT_CODE);
+        }
+    }
+
+    const uint64_t start = NowNs();
+    WorkPoolRun(pool, INT_SWEEP_MODES * INT_SWEEP_MAX_SIZE, IntSweepTask, &sweep);
+    const uint64_t elapsed = NowNs() - start;
+
+    fprintf(stream, "Made the int demo's two allocations %lu times for every size from 1 to %d bytes\n",
+            iterations, INT_SWEEP_MAX_SIZE);
+    fprintf(stream, "on the %s engine, on %zu thread%s, in %.2f s. Every pair stayed allocated until its size\n",
+            EngineCurrent()->Name, WorkPoolWorkers(pool), WorkPoolWorkers(pool) == 1 ? "" : "s",
+            (double) elapsed / 1e9);
+    fprintf(stream, "was done, so each came from fresh heap rather than the blocks the last pair freed; a size\n");
+    fprintf(stream, "stopped early at %u MiB of blocks, or when the engine ran out of room (see \"pairs\").\n\n",
+            INT_SWEEP_MAX_LIVE_BYTES >> 20);
+    PrintIntSweepMode(stream, &sweep, INT_SWEEP_BACK_TO_BACK);
+    fprintf(stream, "\n");
+    PrintIntSweepMode(stream, &sweep, INT_SWEEP_FREE_BETWEEN);
+
+    for (size_t w = 0; w < WorkPoolWorkers(pool); w++)
+    {
+        free(sweep.Deltas[w]);
+        free(sweep.Live[w]);
+    }
+    free(sweep.Deltas);
+    free(sweep.Live);
+    free(sweep.Stats);
+    WorkPoolDestroy(pool);
+    return 0;
+}
@@ -0,0 +1,51 @@
+// Batch experiments built from the demos.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stdio.h>
+
+// The giant object demo as an experiment: for every allocation size from
+// 1 byte up to one short of a whole struct GiantObject, allocate that
+// much on the current engine and write every field in order, rounds
+// times over. Faults are caught in-process (see recover.h), and the
+// sweep prints, for each size, how often a write faulted and at which
+// offset into the object the first fault was.
+//
+// Every byte a trial overwrites is put back before the block is freed,
+// so the engine's own data survives the overflow and the next trial sees
+// a sound heap. Returns 0 on success and -1 if faults can't be caught.
+int GiantObjectSweep(FILE* stream, unsigned long rounds);
+
+// The int demo as an experiment: for every size from 1 to
+// INT_SWEEP_MAX_SIZE bytes, make the demo's two allocations iterations
+// times over and look at where the second one lands relative to the
+// first. It's done twice, once with the two allocations back to back and
+// once with a same-sized block freed between them. Every pair stays
+// allocated until its size is done, so later pairs don't just land in the
+// holes earlier ones left behind. The sizes are spread
+// over threads threads (0 means one per core) if the current engine is
+// thread safe; glibc, tcache and remote then give every thread its own
+// heap. Returns 0 on success and -1 if the threads couldn't be started.
+int IntMallocSweep(FILE* stream, unsigned long iterations, size_t threads);
+
+#define INT_SWEEP_MAX_SIZE 4096
+
+#endif
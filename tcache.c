@@ -0,0 +1,286 @@
+// Thread-local allocation caches over the size-class allocator.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "tcache.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "lfstack.h"
+#include "sizeclass.h"
+
+struct ThreadCacheClass
+{
+    size_t Count;
+    void* Blocks[TCACHE_CAPACITY];
+};
+
+struct ThreadCache
+{
+    int Registered;
+
+    // Set once the thread's exit has flushed the cache. Later calls on the
+    // thread, from other keys' destructors, skip the cache and go straight
+    // to the size-class heap, or their blocks would be stranded in it.
+    int ShutDown;
+    struct ThreadCacheClass Classes[SIZE_CLASS_COUNT];
+};
+
+static __thread struct ThreadCache cache;
+
+// Blocks threads have given back travel between caches in batches, the
+// way TCACHE_BATCH blocks leave and arrive, so a refill or a flush is a
+// couple of CASes instead of one per block. Each class has a lock-free
+// stack of full batches, and there's one stack of empty batch records.
+// Only carving new blocks out of the size-class heap (and large
+// allocations, and calls from a thread that's already exiting) takes
+// centralLock.
+//
+// Batch records come from mappings that are never unmapped, and blocks
+// that reach a batch never go back to the size-class heap, so everything
+// the stacks point to stays mapped, which they need. All zero is an empty
+// stack.
+struct CentralBatch
+{
+    struct LockFreeNode Node;
+    size_t Count;
+    void* Blocks[TCACHE_CAPACITY];
+};
+
+#define BATCH_SLAB_SIZE (64 * 1024)
+
+static struct LockFreeStack centralBatches[SIZE_CLASS_COUNT];
+static struct LockFreeStack spareBatches;
+static pthread_mutex_t centralLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t exitKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t exitKey;
+
+static void FlushOnThreadExit(void* arg)
+{
+    (void) arg;
+    TCacheFlush();
+    cache.Registered = 0;
+    cache.ShutDown = 1;
+}
+
+static void CreateExitKey(void)
+{
+    pthread_key_create(&exitKey, FlushOnThreadExit);
+}
+
+// The key's destructor only runs for threads that set a value, so every
+// thread that caches anything has to register once.
+static void RegisterThread(void)
+{
+    pthread_once(&exitKeyOnce, CreateExitKey);
+    pthread_setspecific(exitKey, &cache);
+    cache.Registered = 1;
+}
+
+// An empty batch record, or NULL if we couldn't map more of them.
+static struct CentralBatch* NewBatch(void)
+{
+    struct CentralBatch* batch = (struct CentralBatch*) LockFreeStackPop(&spareBatches);
+    if (batch != NULL)
+    {
+        return batch;
+    }
+
+    // The lock is only so two threads that run out at once don't both map
+    // a slab; the records themselves are handed out through the stack.
+    pthread_mutex_lock(&centralLock);
+    batch = (struct CentralBatch*) LockFreeStackPop(&spareBatches);
+    if (batch == NULL)
+    {
+        void* slab = mmap(NULL, BATCH_SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (slab != MAP_FAILED)
+        {
+            struct CentralBatch* records = (struct CentralBatch*) slab;
+            const size_t count = BATCH_SLAB_SIZE / sizeof(struct CentralBatch);
+            for (size_t i = 1; i + 1 < count; i++)
+            {
+                records[i].Node.Next = &records[i + 1].Node;
+            }
+            LockFreeStackPushChain(&spareBatches, &records[1].Node, &records[count - 1].Node);
+            batch = &records[0];
+        }
+    }
+    pthread_mutex_unlock(&centralLock);
+    return batch;
+}
+
+// Fills blocks with a batch of the class from the central free list, or
+// with TCACHE_BATCH fresh size-class blocks if there isn't one. Returns
+// how many it got.
+static size_t Refill(size_t index, void** blocks)
+{
+    struct CentralBatch* batch = (struct CentralBatch*) LockFreeStackPop(&centralBatches[index]);
+    if (batch != NULL)
+    {
+        const size_t count = batch->Count;
+        memcpy(blocks, batch->Blocks, count * sizeof(void*));
+        LockFreeStackPush(&spareBatches, &batch->Node);
+        return count;
+    }
+
+    pthread_mutex_lock(&centralLock);
+    const size_t count = SizeClassAllocBatch(index, blocks, TCACHE_BATCH);
+    pthread_mutex_unlock(&centralLock);
+    return count;
+}
+
+// Gives count (at most TCACHE_CAPACITY) blocks of the class back as one
+// batch.
+static void Flush(size_t index, void* const* blocks, size_t count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    struct CentralBatch* batch = NewBatch();
+    if (batch == NULL)
+    {
+        // Out of memory for batch records; the size-class heap takes
+        // them back without needing any.
+        pthread_mutex_lock(&centralLock);
+        SizeClassFreeBatch(index, blocks, count);
+        pthread_mutex_unlock(&centralLock);
+        return;
+    }
+
+    batch->Count = count;
+    memcpy(batch->Blocks, blocks, count * sizeof(void*));
+    LockFreeStackPush(&centralBatches[index], &batch->Node);
+}
+
+void* TCacheMalloc(size_t size)
+{
+    const size_t index = SizeClassIndex(size);
+    if (index == SIZE_CLASS_LARGE || cache.ShutDown)
+    {
+        pthread_mutex_lock(&centralLock);
+        void* p = SizeClassMalloc(size);
+        pthread_mutex_unlock(&centralLock);
+        return p;
+    }
+
+    struct ThreadCacheClass* cacheClass = &cache.Classes[index];
+    if (cacheClass->Count == 0)
+    {
+        if (!cache.Registered)
+        {
+            RegisterThread();
+        }
+
+        cacheClass->Count = Refill(index, cacheClass->Blocks);
+
+        if (cacheClass->Count == 0)
+        {
+            return NULL;
+        }
+    }
+
+    return cacheClass->Blocks[--cacheClass->Count];
+}
+
+void TCacheFree(void* ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    const size_t index = SizeClassIndex(SizeClassUsableSize(ptr));
+    if (index == SIZE_CLASS_LARGE || cache.ShutDown)
+    {
+        pthread_mutex_lock(&centralLock);
+        SizeClassFree(ptr);
+        pthread_mutex_unlock(&centralLock);
+        return;
+    }
+
+    struct ThreadCacheClass* cacheClass = &cache.Classes[index];
+    if (cacheClass->Count == TCACHE_CAPACITY)
+    {
+        if (!cache.Registered)
+        {
+            RegisterThread();
+        }
+
+        // Give back the older half; the newest blocks are the ones most
+        // likely to still be in this core's cache.
+        Flush(index, cacheClass->Blocks, TCACHE_BATCH);
+
+        for (size_t i = 0; i < TCACHE_CAPACITY - TCACHE_BATCH; i++)
+        {
+            cacheClass->Blocks[i] = cacheClass->Blocks[i + TCACHE_BATCH];
+        }
+        cacheClass->Count -= TCACHE_BATCH;
+    }
+
+    cacheClass->Blocks[cacheClass->Count++] = ptr;
+}
+
+void* TCacheMallocAligned(size_t alignment, size_t size)
+{
+    if (alignment <= 8)
+    {
+        return TCacheMalloc(size);
+    }
+    if (alignment == 16)
+    {
+        return TCacheMalloc(size < 16 ? 16 : size);
+    }
+
+    pthread_mutex_lock(&centralLock);
+    void* p = SizeClassMallocAligned(alignment, size);
+    pthread_mutex_unlock(&centralLock);
+    return p;
+}
+
+void TCacheFlush(void)
+{
+    for (size_t index = 0; index < SIZE_CLASS_COUNT; index++)
+    {
+        struct ThreadCacheClass* cacheClass = &cache.Classes[index];
+        Flush(index, cacheClass->Blocks, cacheClass->Count);
+        cacheClass->Count = 0;
+    }
+}
+
+void TCacheLockCentral(void)
+{
+    pthread_mutex_lock(&centralLock);
+}
+
+void TCacheUnlockCentral(void)
+{
+    pthread_mutex_unlock(&centralLock);
+}
+
+const struct AllocEngine TCacheEngine = {
+    .Name = "tcache",
+    .Description = "thread-local caches over the segregated allocator, batched refill/flush",
+    .Malloc = TCacheMalloc,
+    .Free = TCacheFree,
+    .Reset = NULL,
+    .ThreadSafe = 1,
+};
@@ -0,0 +1,65 @@
+// Thread-local allocation caches over the size-class allocator.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef TCACHE_H
+#define TCACHE_H
+
+#include <stddef.h>
+
+#include "engine.h"
+
+// Thread-local caches in front of the size-class allocator. Every thread
+// keeps a small stack of free blocks per size class and only goes to the
+// shared central free lists when a stack runs dry or fills up, and then
+// it moves a batch of TCACHE_BATCH blocks at once. The central lists are
+// lock-free stacks of those batches (see lfstack.h), so refills and
+// flushes never wait on another thread; the lock in front of the
+// size-class heap is only taken to carve out new blocks and for requests
+// too big for a class.
+//
+// Blocks can be freed on any thread; they just land in that thread's
+// cache. When a thread exits, whatever is in its cache goes back to the
+// central free lists, and anything it allocates or frees after that (from
+// a later thread-specific data destructor, say) bypasses the cache.
+
+#define TCACHE_BATCH 32
+
+// Each class holds at most this many blocks. Once it's full, we flush a
+// batch back and keep the other half around for the next allocations.
+#define TCACHE_CAPACITY (2 * TCACHE_BATCH)
+
+void* TCacheMalloc(size_t size);
+void TCacheFree(void* ptr);
+
+// alignment must be a power of two.
+void* TCacheMallocAligned(size_t alignment, size_t size);
+
+// Returns every block cached by the calling thread to the central free
+// lists.
+void TCacheFlush(void);
+
+// Takes and releases the lock in front of the size-class heap, so a fork
+// can happen while nobody is in the middle of using it. The central free
+// lists change with single CASes, so they're consistent at any fork.
+void TCacheLockCentral(void);
+void TCacheUnlockCentral(void);
+
+extern const struct AllocEngine TCacheEngine;
+
+#endif
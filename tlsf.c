@@ -0,0 +1,419 @@
+// A two-level segregated fit (TLSF) allocator.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "tlsf.h"
+
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define TLSF_ENGINE_SIZE ((size_t) 64 * 1024 * 1024)
+
+#define BLOCK_FREE ((size_t) 1)
+#define BLOCK_PREV_FREE ((size_t) 2)
+#define BLOCK_FLAGS (BLOCK_FREE | BLOCK_PREV_FREE)
+
+#define ALIGN_SIZE ((size_t) 1 << TLSF_ALIGN_LOG2)
+#define SMALL_BLOCK_SIZE ((size_t) 1 << TLSF_FL_SHIFT)
+
+struct TlsfBlock
+{
+    // Only valid when the previous block is free. It's stored in the last
+    // word of that block, which is why it comes before our own size.
+    struct TlsfBlock* PrevPhysical;
+
+    // The usable size, with the two flags in the low bits.
+    size_t Size;
+
+    // Only valid while this block is free; they overlap the user's data.
+    struct TlsfBlock* NextFree;
+    struct TlsfBlock* PrevFree;
+};
+
+// The user's pointer starts right after Size. The size header is the only
+// per-block overhead: the next block's PrevPhysical overlaps our last word.
+#define BLOCK_START_OFFSET (offsetof(struct TlsfBlock, Size) + sizeof(size_t))
+#define BLOCK_OVERHEAD sizeof(size_t)
+
+// A free block has to hold its size and free list links.
+#define BLOCK_SIZE_MIN (sizeof(struct TlsfBlock) - sizeof(struct TlsfBlock*))
+#define BLOCK_SIZE_MAX ((size_t) 1 << TLSF_FL_MAX)
+
+static size_t BlockSize(const struct TlsfBlock* block)
+{
+    return block->Size & ~BLOCK_FLAGS;
+}
+
+static void SetBlockSize(struct TlsfBlock* block, size_t size)
+{
+    block->Size = size | (block->Size & BLOCK_FLAGS);
+}
+
+static int IsFree(const struct TlsfBlock* block)
+{
+    return (block->Size & BLOCK_FREE) != 0;
+}
+
+static int IsPrevFree(const struct TlsfBlock* block)
+{
+    return (block->Size & BLOCK_PREV_FREE) != 0;
+}
+
+static void* BlockToPtr(const struct TlsfBlock* block)
+{
+    return (char*) block + BLOCK_START_OFFSET;
+}
+
+static struct TlsfBlock* BlockFromPtr(const void* ptr)
+{
+    return (struct TlsfBlock*) ((char*) ptr - BLOCK_START_OFFSET);
+}
+
+static struct TlsfBlock* BlockNext(const struct TlsfBlock* block)
+{
+    return (struct TlsfBlock*) ((char*) BlockToPtr(block) + BlockSize(block) - BLOCK_OVERHEAD);
+}
+
+// Points the next block back at this one and returns it.
+static struct TlsfBlock* LinkNext(struct TlsfBlock* block)
+{
+    struct TlsfBlock* next = BlockNext(block);
+    next->PrevPhysical = block;
+    return next;
+}
+
+static void MarkFree(struct TlsfBlock* block)
+{
+    struct TlsfBlock* next = LinkNext(block);
+    next->Size |= BLOCK_PREV_FREE;
+    block->Size |= BLOCK_FREE;
+}
+
+static void MarkUsed(struct TlsfBlock* block)
+{
+    struct TlsfBlock* next = BlockNext(block);
+    next->Size &= ~BLOCK_PREV_FREE;
+    block->Size &= ~BLOCK_FREE;
+}
+
+static int FindLastSet(size_t x)
+{
+    return 63 - __builtin_clzll((unsigned long long) x);
+}
+
+// Which list a free block of this size belongs in.
+static void MappingInsert(size_t size, int* fl, int* sl)
+{
+    if (size < SMALL_BLOCK_SIZE)
+    {
+        // Small sizes are spread linearly over the first list.
+        *fl = 0;
+        *sl = (int) (size / (SMALL_BLOCK_SIZE / TLSF_SL_COUNT));
+    }
+    else
+    {
+        const int last = FindLastSet(size);
+        *sl = (int) (size >> (last - TLSF_SL_LOG2)) ^ TLSF_SL_COUNT;
+        *fl = last - (TLSF_FL_SHIFT - 1);
+    }
+}
+
+// Which list to start looking in for a request of this size. We round up
+// to the next list boundary so any block in that list is big enough.
+static void MappingSearch(size_t size, int* fl, int* sl)
+{
+    if (size >= SMALL_BLOCK_SIZE)
+    {
+        size += ((size_t) 1 << (FindLastSet(size) - TLSF_SL_LOG2)) - 1;
+    }
+    MappingInsert(size, fl, sl);
+}
+
+static struct TlsfBlock* SearchSuitableBlock(struct Tlsf* tlsf, int* fl, int* sl)
+{
+    uint32_t slMap = tlsf->SecondLevelMap[*fl] & (~0u << *sl);
+    if (slMap == 0)
+    {
+        // Nothing left at this first level; move up to the next one that
+        // has anything at all.
+        const uint32_t flMap = *fl + 1 < 32 ? tlsf->FirstLevelMap & (~0u << (*fl + 1)) : 0;
+        if (flMap == 0)
+        {
+            return NULL;
+        }
+
+        *fl = __builtin_ctz(flMap);
+        slMap = tlsf->SecondLevelMap[*fl];
+    }
+
+    *sl = __builtin_ctz(slMap);
+    return tlsf->Blocks[*fl][*sl];
+}
+
+static void RemoveFreeBlock(struct Tlsf* tlsf, struct TlsfBlock* block, int fl, int sl)
+{
+    struct TlsfBlock* prev = block->PrevFree;
+    struct TlsfBlock* next = block->NextFree;
+    if (next != NULL)
+    {
+        next->PrevFree = prev;
+    }
+    if (prev != NULL)
+    {
+        prev->NextFree = next;
+    }
+
+    if (tlsf->Blocks[fl][sl] == block)
+    {
+        tlsf->Blocks[fl][sl] = next;
+        if (next == NULL)
+        {
+            tlsf->SecondLevelMap[fl] &= ~(1u << sl);
+            if (tlsf->SecondLevelMap[fl] == 0)
+            {
+                tlsf->FirstLevelMap &= ~(1u << fl);
+            }
+        }
+    }
+}
+
+static void InsertFreeBlock(struct Tlsf* tlsf, struct TlsfBlock* block, int fl, int sl)
+{
+    struct TlsfBlock* current = tlsf->Blocks[fl][sl];
+    block->NextFree = current;
+    block->PrevFree = NULL;
+    if (current != NULL)
+    {
+        current->PrevFree = block;
+    }
+
+    tlsf->Blocks[fl][sl] = block;
+    tlsf->FirstLevelMap |= 1u << fl;
+    tlsf->SecondLevelMap[fl] |= 1u << sl;
+}
+
+static void RemoveBlock(struct Tlsf* tlsf, struct TlsfBlock* block)
+{
+    int fl;
+    int sl;
+    MappingInsert(BlockSize(block), &fl, &sl);
+    RemoveFreeBlock(tlsf, block, fl, sl);
+}
+
+static void InsertBlock(struct Tlsf* tlsf, struct TlsfBlock* block)
+{
+    int fl;
+    int sl;
+    MappingInsert(BlockSize(block), &fl, &sl);
+    InsertFreeBlock(tlsf, block, fl, sl);
+}
+
+// Cuts size bytes off the front of block and returns the rest as a new
+// free block.
+static struct TlsfBlock* Split(struct TlsfBlock* block, size_t size)
+{
+    struct TlsfBlock* remaining = (struct TlsfBlock*) ((char*) BlockToPtr(block) + size - BLOCK_OVERHEAD);
+    const size_t remainingSize = BlockSize(block) - (size + BLOCK_OVERHEAD);
+
+    remaining->Size = remainingSize;
+    SetBlockSize(block, size);
+    MarkFree(remaining);
+    return remaining;
+}
+
+// Swallows next into block. Both must be physically adjacent.
+static struct TlsfBlock* Absorb(struct TlsfBlock* block, struct TlsfBlock* next)
+{
+    block->Size += BlockSize(next) + BLOCK_OVERHEAD;
+    LinkNext(block);
+    return block;
+}
+
+static size_t AdjustRequest(size_t size)
+{
+    if (size == 0 || size >= BLOCK_SIZE_MAX)
+    {
+        return 0;
+    }
+
+    const size_t aligned = (size + ALIGN_SIZE - 1) & ~(ALIGN_SIZE - 1);
+    return aligned < BLOCK_SIZE_MIN ? BLOCK_SIZE_MIN : aligned;
+}
+
+int TlsfInit(struct Tlsf* tlsf, size_t size)
+{
+    const size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    size = (size + pageSize - 1) & ~(pageSize - 1);
+    if (size > BLOCK_SIZE_MAX)
+    {
+        return -1;
+    }
+
+    // Pages are faulted in as they're first touched. A malloc or free
+    // writes headers and links into at most a couple of pages, so that
+    // bounds what an untouched page can add to it; faulting all of them in
+    // here would make whichever call sets the heap up take milliseconds.
+    // TlsfPopulate() does that as a step of its own, for callers that want
+    // no page faults at all.
+    void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    tlsf->Memory = (char*) mem;
+    tlsf->MemorySize = size;
+    tlsf->FirstLevelMap = 0;
+    for (int fl = 0; fl < TLSF_FL_COUNT; fl++)
+    {
+        tlsf->SecondLevelMap[fl] = 0;
+        for (int sl = 0; sl < TLSF_SL_COUNT; sl++)
+        {
+            tlsf->Blocks[fl][sl] = NULL;
+        }
+    }
+
+    // The first block starts one word before the mapping, since its
+    // PrevPhysical field will never be used. The whole mapping minus two
+    // headers is one free block, followed by a zero-sized used block that
+    // stops merges from running off the end.
+    struct TlsfBlock* block = (struct TlsfBlock*) (tlsf->Memory - BLOCK_OVERHEAD);
+    block->Size = 0;
+    SetBlockSize(block, size - 2 * BLOCK_OVERHEAD);
+    block->Size |= BLOCK_FREE;
+    InsertBlock(tlsf, block);
+
+    struct TlsfBlock* sentinel = LinkNext(block);
+    sentinel->Size = BLOCK_PREV_FREE;
+    return 0;
+}
+
+void TlsfPopulate(struct Tlsf* tlsf)
+{
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(tlsf->Memory, tlsf->MemorySize, MADV_POPULATE_WRITE) == 0)
+    {
+        return;
+    }
+#endif
+
+    // Older kernels don't have MADV_POPULATE_WRITE, so touch a byte of
+    // every page instead. Reading and writing it back leaves whatever a
+    // block has already put there alone.
+    const size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    for (size_t offset = 0; offset < tlsf->MemorySize; offset += pageSize)
+    {
+        volatile char* page = tlsf->Memory + offset;
+        *page = *page;
+    }
+}
+
+void* TlsfMalloc(struct Tlsf* tlsf, size_t size)
+{
+    const size_t adjusted = AdjustRequest(size);
+    if (adjusted == 0)
+    {
+        return NULL;
+    }
+
+    int fl;
+    int sl;
+    MappingSearch(adjusted, &fl, &sl);
+    if (fl >= TLSF_FL_COUNT)
+    {
+        return NULL;
+    }
+
+    struct TlsfBlock* block = SearchSuitableBlock(tlsf, &fl, &sl);
+    if (block == NULL)
+    {
+        return NULL;
+    }
+    RemoveFreeBlock(tlsf, block, fl, sl);
+
+    // Give back whatever we don't need if it's big enough to be a block.
+    if (BlockSize(block) >= adjusted + sizeof(struct TlsfBlock))
+    {
+        struct TlsfBlock* remaining = Split(block, adjusted);
+        LinkNext(block);
+        InsertBlock(tlsf, remaining);
+    }
+
+    MarkUsed(block);
+    return BlockToPtr(block);
+}
+
+void TlsfFree(struct Tlsf* tlsf, void* ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    struct TlsfBlock* block = BlockFromPtr(ptr);
+    MarkFree(block);
+
+    if (IsPrevFree(block))
+    {
+        struct TlsfBlock* prev = block->PrevPhysical;
+        RemoveBlock(tlsf, prev);
+        block = Absorb(prev, block);
+    }
+
+    struct TlsfBlock* next = BlockNext(block);
+    if (IsFree(next))
+    {
+        RemoveBlock(tlsf, next);
+        block = Absorb(block, next);
+    }
+
+    InsertBlock(tlsf, block);
+}
+
+void TlsfDestroy(struct Tlsf* tlsf)
+{
+    munmap(tlsf->Memory, tlsf->MemorySize);
+    tlsf->Memory = NULL;
+}
+
+static struct Tlsf engineTlsf;
+
+static void* TlsfEngineMalloc(size_t size)
+{
+    if (engineTlsf.Memory == NULL && TlsfInit(&engineTlsf, TLSF_ENGINE_SIZE) != 0)
+    {
+        return NULL;
+    }
+
+    return TlsfMalloc(&engineTlsf, size);
+}
+
+static void TlsfEngineFree(void* ptr)
+{
+    TlsfFree(&engineTlsf, ptr);
+}
+
+const struct AllocEngine TlsfEngine = {
+    .Name = "tlsf",
+    .Description = "two-level segregated fit over a 64 MiB region, O(1) malloc and free",
+    .Malloc = TlsfEngineMalloc,
+    .Free = TlsfEngineFree,
+    .Reset = NULL,
+    .ThreadSafe = 0,
+};
@@ -0,0 +1,81 @@
+// A two-level segregated fit (TLSF) allocator.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef TLSF_H
+#define TLSF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "engine.h"
+
+// A two-level segregated fit (TLSF) allocator. Free blocks are kept in
+// lists indexed first by the power of two their size falls under and then
+// by which sixteenth of that range it's in. A bitmap per level records
+// which lists are non-empty, so finding a big enough block is a couple of
+// find-first-set instructions no matter how many blocks there are, and
+// merging with free neighbours on free is constant time too. That makes
+// every malloc and free O(1) with a hard bound on the work it does.
+//
+// Blocks are 8 byte aligned and carry an 8 byte size header. Neighbours
+// find each other through a back pointer that lives in the last word of a
+// free block, so allocated blocks don't pay for it.
+
+#define TLSF_SL_LOG2 4
+#define TLSF_SL_COUNT (1 << TLSF_SL_LOG2)
+#define TLSF_ALIGN_LOG2 3
+#define TLSF_FL_SHIFT (TLSF_SL_LOG2 + TLSF_ALIGN_LOG2)
+#define TLSF_FL_MAX 30
+#define TLSF_FL_COUNT (TLSF_FL_MAX - TLSF_FL_SHIFT + 1)
+
+struct TlsfBlock;
+
+struct Tlsf
+{
+    char* Memory;
+    size_t MemorySize;
+
+    uint32_t FirstLevelMap;
+    uint32_t SecondLevelMap[TLSF_FL_COUNT];
+    struct TlsfBlock* Blocks[TLSF_FL_COUNT][TLSF_SL_COUNT];
+};
+
+// Maps size bytes (rounded up to a page) and makes them one free block.
+// The pages are left to fault in as they're used, so this is one mmap no
+// matter the size, and a later malloc or free can take at most a couple
+// of page faults on top of its own work.
+// Returns 0 on success and -1 if the mapping failed.
+int TlsfInit(struct Tlsf* tlsf, size_t size);
+
+// Faults in every page of the heap up front, so no malloc or free ever
+// takes a page fault. That costs time in proportion to the heap's size
+// (milliseconds for tens of MiB), so it's a separate step to run before
+// the latency matters rather than part of TlsfInit.
+void TlsfPopulate(struct Tlsf* tlsf);
+
+// Returns NULL if no free block is big enough.
+void* TlsfMalloc(struct Tlsf* tlsf, size_t size);
+
+void TlsfFree(struct Tlsf* tlsf, void* ptr);
+
+void TlsfDestroy(struct Tlsf* tlsf);
+
+extern const struct AllocEngine TlsfEngine;
+
+#endif
@@ -0,0 +1,610 @@
+// A low-overhead binary allocation tracer.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tracecodec.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Records per thread. At 32 bytes a record that's 2 MiB per ring, of
+// address space mostly: pages only get touched as the ring wraps around
+// to them. The drain process never naps while there's anything to drain,
+// so this only has to cover one nap's worth of events at full speed.
+#define TRACE_RING_SIZE 65536
+
+// Threads that can be traced at once. A ring is handed on once its
+// thread has exited and it's been drained, so this only limits how many
+// are alive together.
+#define TRACE_MAX_RINGS 128
+
+// The file grows this much at a time.
+#define TRACE_WINDOW_SIZE ((size_t) 64 * 1024 * 1024)
+
+// An event as the recording thread leaves it. The drain process fills in
+// the thread id and turns the timestamp into nanoseconds; the op is in
+// the bottom bit of the size.
+struct RingRecord
+{
+    uint64_t Timestamp;
+    uint64_t Ptr;
+    uint64_t CallSite;
+    uint64_t SizeOp;
+};
+
+struct TraceRing
+{
+    // Bumped by the owning thread after it writes a record.
+    _Alignas(64) _Atomic uint64_t Head;
+
+    // Bumped by the drain process after it copies records out.
+    _Alignas(64) _Atomic uint64_t Tail;
+
+    // Owner-only state, on its own line so the drain process reading Head
+    // doesn't fight with it.
+    _Alignas(64) uint64_t CachedTail;
+
+    // The owning thread's id. The drain process fills it into the records,
+    // so recording doesn't have to.
+    uint32_t ThreadId;
+
+    // Set once the owning thread has exited; a new thread may take the
+    // ring over once it's been drained.
+    _Atomic int Retired;
+
+    struct RingRecord Records[TRACE_RING_SIZE];
+};
+
+// Everything the traced process and its drain process both see. It's
+// mapped shared before the drain process is forked and never unmapped,
+// so a ring stays where its thread's threadRing points for good.
+struct TraceShared
+{
+    // Futex words. DrainRequested is set to 1 by whichever thread asks
+    // for a drain first, and back to 0 by the drain process before it
+    // starts draining. Finished is set once the drain process is done
+    // with the file, for good or because it failed.
+    _Atomic uint32_t DrainRequested;
+    _Atomic uint32_t Finished;
+
+    _Atomic int Draining;
+
+    // The errno of the first thing that went wrong, or 0.
+    _Atomic int Error;
+
+    _Atomic uint64_t EventCount;
+
+    // Rings[0] to Rings[RingCount - 1] have been handed out.
+    _Atomic uint32_t RingCount;
+    struct TraceRing Rings[TRACE_MAX_RINGS];
+};
+
+_Atomic int TraceEnabled;
+
+static struct TraceShared* shared;
+
+static __thread struct TraceRing* threadRing;
+
+// What threadRing points to once the thread's ring has been retired, or
+// if there wasn't a ring to be had. A retired ring can be handed to a new
+// thread as soon as it's drained, so anything the exiting thread still
+// frees from a later key destructor is dropped instead of written into a
+// ring that might have a new owner.
+static struct TraceRing* const deadRing = (struct TraceRing*) (uintptr_t) 1;
+
+static pthread_once_t exitKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_once_t forkHandlerOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t exitKey;
+
+// The traced process's side.
+static pid_t tracedPid;
+static pid_t drainPid = -1;
+
+// The drain process's side.
+static int traceFd = -1;
+static char* window;
+static size_t windowOffset;    // where the window starts in the file
+static size_t windowUsed;
+
+// Timestamps are raw TSC ticks on x86 (much cheaper to read than the
+// clock) and get turned into nanoseconds by the drain process. It's a
+// plain rdtsc, with no fence or rdtscp to serialize it: an event's
+// timestamp can be off by the few instructions the CPU runs out of order
+// around it, which is nothing next to the cost of waiting for them.
+static uint64_t startTicks;
+static double nsPerTick;
+
+static uint64_t ReadTicks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+static uint64_t ClockNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+// Measures the TSC rate against the clock from the start of the trace.
+// The drain process does this, so the traced program doesn't wait for it.
+static void CalibrateTicks(uint64_t startNs)
+{
+    // A couple of milliseconds is plenty to get the TSC rate to well
+    // under a percent.
+    uint64_t nowNs;
+    do
+    {
+        nowNs = ClockNs();
+    }
+    while (nowNs - startNs < 2000000);
+
+    nsPerTick = (double) (nowNs - startNs) / (double) (ReadTicks() - startTicks);
+}
+
+// Both processes map the words shared, so these are the plain (not
+// private) futex operations.
+static void FutexWait(_Atomic uint32_t* word, uint32_t value, const struct timespec* timeout)
+{
+    syscall(SYS_futex, word, FUTEX_WAIT, value, timeout, NULL, 0);
+}
+
+static void FutexWake(_Atomic uint32_t* word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+// Records the first error only.
+static void LatchError(int error)
+{
+    int none = 0;
+    atomic_compare_exchange_strong(&shared->Error, &none, error);
+}
+
+static void RetireRing(void* ring)
+{
+    // A forked child still has the key set, but the ring is its parent's.
+    if (getpid() != tracedPid)
+    {
+        return;
+    }
+    threadRing = deadRing;
+    atomic_store_explicit(&((struct TraceRing*) ring)->Retired, 1, memory_order_release);
+}
+
+static void CreateExitKey(void)
+{
+    pthread_key_create(&exitKey, RetireRing);
+}
+
+// Takes over a ring whose thread has exited and that's been drained, or
+// hands out a new one. Returns NULL if every ring is taken.
+static struct TraceRing* AcquireRing(void)
+{
+    struct TraceRing* ring = NULL;
+    uint32_t count = atomic_load(&shared->RingCount);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        int retired = 1;
+        if (atomic_load_explicit(&shared->Rings[i].Retired, memory_order_acquire)
+            && atomic_load(&shared->Rings[i].Head) == atomic_load(&shared->Rings[i].Tail)
+            && atomic_compare_exchange_strong(&shared->Rings[i].Retired, &retired, 0))
+        {
+            ring = &shared->Rings[i];
+            break;
+        }
+    }
+
+    while (ring == NULL)
+    {
+        if (count == TRACE_MAX_RINGS)
+        {
+            return NULL;
+        }
+        if (atomic_compare_exchange_weak(&shared->RingCount, &count, count + 1))
+        {
+            ring = &shared->Rings[count];
+        }
+    }
+
+    ring->CachedTail = atomic_load(&ring->Tail);
+    ring->ThreadId = (uint32_t) syscall(SYS_gettid);
+
+    pthread_once(&exitKeyOnce, CreateExitKey);
+    pthread_setspecific(exitKey, ring);
+    return ring;
+}
+
+static void RequestDrain(void)
+{
+    // Only the first request since the last drain pays for the system call.
+    if (atomic_exchange_explicit(&shared->DrainRequested, 1, memory_order_acq_rel) == 0)
+    {
+        FutexWake(&shared->DrainRequested);
+    }
+}
+
+void TraceRecordEvent(enum TraceOp op, const void* ptr, size_t size, const void* callSite)
+{
+    struct TraceRing* ring = threadRing;
+    if (ring == NULL)
+    {
+        ring = threadRing = AcquireRing();
+        if (ring == NULL)
+        {
+            // More threads at once than there are rings. The trace can't
+            // be complete any more, so say so when it stops.
+            LatchError(ENOBUFS);
+            threadRing = deadRing;
+            return;
+        }
+    }
+    if (ring == deadRing)
+    {
+        return;
+    }
+
+    // The only time recording talks to the drain process is when the ring
+    // looks full, and then only if it really is.
+    const uint64_t head = atomic_load_explicit(&ring->Head, memory_order_relaxed);
+    if (head - ring->CachedTail == TRACE_RING_SIZE
+        && head - (ring->CachedTail = atomic_load_explicit(&ring->Tail, memory_order_acquire)) == TRACE_RING_SIZE)
+    {
+        // Wait for the drain process rather than drop events, so the trace
+        // always has matching mallocs and frees. If it has given up, so
+        // do we.
+        RequestDrain();
+        while (head - (ring->CachedTail = atomic_load_explicit(&ring->Tail, memory_order_acquire))
+               == TRACE_RING_SIZE)
+        {
+            if (atomic_load(&shared->Finished))
+            {
+                atomic_store(&TraceEnabled, 0);
+            }
+            if (!atomic_load_explicit(&TraceEnabled, memory_order_relaxed))
+            {
+                return;
+            }
+            sched_yield();
+        }
+    }
+
+    struct RingRecord* record = &ring->Records[head % TRACE_RING_SIZE];
+    record->Timestamp = ReadTicks();
+    record->Ptr = (uint64_t) (uintptr_t) ptr;
+    record->CallSite = (uint64_t) (uintptr_t) callSite;
+    record->SizeOp = (uint64_t) size << 1 | (op == TRACE_FREE);
+
+    atomic_store_explicit(&ring->Head, head + 1, memory_order_release);
+}
+
+// Makes sure the current window has at least needed bytes left, moving
+// on to the next window of the file if it doesn't.
+static int EnsureWindow(size_t needed)
+{
+    if (window != NULL && TRACE_WINDOW_SIZE - windowUsed >= needed)
+    {
+        return 0;
+    }
+
+    if (window != NULL)
+    {
+        munmap(window, TRACE_WINDOW_SIZE);
+        windowOffset += windowUsed;
+        window = NULL;
+    }
+
+    // Windows have to start on a page boundary, so we back up to the page
+    // we're partway through and carry on from the same spot.
+    const size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    const size_t mapOffset = windowOffset & ~(pageSize - 1);
+    const size_t slack = windowOffset - mapOffset;
+
+    // Reserve the blocks rather than just growing the file, so a full disk
+    // shows up here and not as a SIGBUS when we write through the mapping.
+    const int error = posix_fallocate(traceFd, (off_t) mapOffset, TRACE_WINDOW_SIZE);
+    if (error != 0)
+    {
+        errno = error;
+        return -1;
+    }
+
+    void* mem = mmap(NULL, TRACE_WINDOW_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, traceFd, (off_t) mapOffset);
+    if (mem == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    window = (char*) mem;
+    windowOffset = mapOffset;
+    windowUsed = slack;
+    return 0;
+}
+
+// Only the drain process uses this.
+static struct TraceRecord staging[TRACE_BLOCK_EVENTS];
+
+static uint64_t TicksToNs(uint64_t ticks)
+{
+    // The TSCs of different cores can disagree a little.
+    return ticks > startTicks ? (uint64_t) ((double) (ticks - startTicks) * nsPerTick) : 0;
+}
+
+// Encodes a ring's records straight into the file a block at a time.
+// Returns how many it got into the file; fewer than asked for means the
+// file couldn't grow.
+static uint64_t AppendRecords(const struct TraceRing* ring, uint64_t from, uint64_t to)
+{
+    const uint64_t first = from;
+    while (from < to)
+    {
+        const size_t count = to - from < TRACE_BLOCK_EVENTS ? (size_t) (to - from) : TRACE_BLOCK_EVENTS;
+        for (size_t i = 0; i < count; i++)
+        {
+            const struct RingRecord* record = &ring->Records[(from + i) % TRACE_RING_SIZE];
+            staging[i].Timestamp = TicksToNs(record->Timestamp);
+            staging[i].Ptr = record->Ptr;
+            staging[i].Size = record->SizeOp >> 1;
+            staging[i].CallSite = record->CallSite;
+            staging[i].ThreadId = ring->ThreadId;
+            staging[i].Op = (record->SizeOp & 1) ? TRACE_FREE : TRACE_MALLOC;
+        }
+
+        if (EnsureWindow(TRACE_BLOCK_MAX_BYTES) != 0)
+        {
+            break;
+        }
+        windowUsed += TraceEncodeBlock(staging, count, (uint8_t*) window + windowUsed);
+        from += count;
+    }
+    return from - first;
+}
+
+// Returns how many events it drained, or -1 (with the error latched) if
+// the file couldn't take them.
+static int64_t DrainRings(void)
+{
+    int64_t drained = 0;
+    const uint32_t count = atomic_load(&shared->RingCount);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        struct TraceRing* ring = &shared->Rings[i];
+        const uint64_t tail = atomic_load_explicit(&ring->Tail, memory_order_relaxed);
+        const uint64_t head = atomic_load_explicit(&ring->Head, memory_order_acquire);
+
+        const uint64_t appended = AppendRecords(ring, tail, head);
+        atomic_store_explicit(&ring->Tail, tail + appended, memory_order_release);
+        atomic_fetch_add_explicit(&shared->EventCount, appended, memory_order_relaxed);
+        drained += (int64_t) appended;
+
+        if (tail + appended != head)
+        {
+            LatchError(errno);
+            return -1;
+        }
+    }
+    return drained;
+}
+
+// The drain process: copies the rings into the file until TraceStop says
+// to finish, the file can't take any more, or the traced process dies (so
+// a trace of a demo that crashed still has everything up to the crash).
+static void DrainMain(pid_t parent, uint64_t startNs)
+{
+    CalibrateTicks(startNs);
+
+    struct TraceFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.Magic, TRACE_MAGIC, sizeof(header.Magic));
+    header.Version = TRACE_VERSION;
+    header.RecordSize = sizeof(struct TraceRecord);
+
+    int failed = EnsureWindow(sizeof(header)) != 0;
+    if (failed)
+    {
+        LatchError(errno);
+    }
+    else
+    {
+        memcpy(window + windowUsed, &header, sizeof(header));
+        windowUsed += sizeof(header);
+    }
+
+    while (!failed && atomic_load(&shared->Draining) && getppid() == parent)
+    {
+        atomic_store(&shared->DrainRequested, 0);
+        const int64_t drained = DrainRings();
+        failed = drained < 0;
+        if (drained == 0)
+        {
+            // Nap for a millisecond, or until a thread with a full ring
+            // wakes us.
+            const struct timespec pause = { 0, 1000000 };
+            FutexWait(&shared->DrainRequested, 0, &pause);
+        }
+    }
+
+    // Anything recorded between the last drain and now.
+    if (!failed)
+    {
+        DrainRings();
+    }
+
+    const size_t length = windowOffset + windowUsed;
+    if (window != NULL)
+    {
+        munmap(window, TRACE_WINDOW_SIZE);
+    }
+    // Cut off the unused end of the last window, which leaves whatever
+    // made it in intact even if something went wrong.
+    if (ftruncate(traceFd, (off_t) length) != 0)
+    {
+        LatchError(errno);
+    }
+    close(traceFd);
+
+    atomic_store(&shared->Finished, 1);
+    FutexWake(&shared->Finished);
+}
+
+// A forked child doesn't get its own drain process, so it must not
+// record anything: it would be writing into its parent's rings. Nor may
+// it stop its parent's trace.
+static void StopInChild(void)
+{
+    atomic_store(&TraceEnabled, 0);
+    drainPid = -1;
+}
+
+static void RegisterForkHandler(void)
+{
+    pthread_atfork(NULL, NULL, StopInChild);
+}
+
+int TraceStart(const char* path)
+{
+    pthread_once(&forkHandlerOnce, RegisterForkHandler);
+
+    if (shared == NULL)
+    {
+        void* mem = mmap(NULL, sizeof(struct TraceShared), PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mem == MAP_FAILED)
+        {
+            return -1;
+        }
+        shared = (struct TraceShared*) mem;
+    }
+
+    traceFd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (traceFd < 0)
+    {
+        return -1;
+    }
+
+    // Anything an earlier trace that failed left in the rings is dropped.
+    for (uint32_t i = 0; i < atomic_load(&shared->RingCount); i++)
+    {
+        atomic_store(&shared->Rings[i].Tail, atomic_load(&shared->Rings[i].Head));
+    }
+    atomic_store(&shared->EventCount, 0);
+    atomic_store(&shared->Error, 0);
+    atomic_store(&shared->Finished, 0);
+    atomic_store(&shared->DrainRequested, 0);
+    atomic_store(&shared->Draining, 1);
+
+    const uint64_t startNs = ClockNs();
+    startTicks = ReadTicks();
+
+    // A process rather than a thread: starting a thread would switch
+    // glibc's malloc onto its slower locked paths for the rest of the
+    // program, which would cost the traced program far more than the
+    // tracing itself.
+    tracedPid = getpid();
+    const pid_t pid = fork();
+    if (pid < 0)
+    {
+        const int error = errno;
+        close(traceFd);
+        traceFd = -1;
+        errno = error;
+        return -1;
+    }
+    if (pid == 0)
+    {
+        DrainMain(tracedPid, startNs);
+        _exit(0);
+    }
+
+    // The drain process has the file now.
+    close(traceFd);
+    traceFd = -1;
+    drainPid = pid;
+    atomic_store(&TraceEnabled, 1);
+    return 0;
+}
+
+int TraceStop(void)
+{
+    if (drainPid < 0)
+    {
+        return 0;
+    }
+
+    atomic_store(&TraceEnabled, 0);
+    atomic_store(&shared->Draining, 0);
+    RequestDrain();
+
+    // Finished is what we wait on, since a SIGCHLD handler of the
+    // program's may reap the drain process before we can. Checking that
+    // it's still there now and then keeps us from waiting forever if it
+    // was killed.
+    int reaped = 0;
+    while (!atomic_load(&shared->Finished))
+    {
+        const struct timespec pause = { 0, 10000000 };
+        FutexWait(&shared->Finished, 0, &pause);
+        if (!atomic_load(&shared->Finished)
+            && (waitpid(drainPid, NULL, WNOHANG) == drainPid || kill(drainPid, 0) != 0))
+        {
+            LatchError(ECHILD);
+            reaped = 1;
+            break;
+        }
+    }
+    if (!reaped)
+    {
+        waitpid(drainPid, NULL, 0);
+    }
+    drainPid = -1;
+
+    const int error = atomic_load(&shared->Error);
+    if (error != 0)
+    {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+uint64_t TraceEventCount(void)
+{
+    return shared != NULL ? atomic_load(&shared->EventCount) : 0;
+}
@@ -0,0 +1,117 @@
+// A low-overhead binary allocation tracer.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A low-overhead allocation tracer. Every malloc and free is written as a
+// fixed-size binary record, with its own TSC timestamp, into a lock-free
+// ring owned by the calling thread, and a drain process forked by
+// TraceStart copies all the rings into an mmap'd trace file. The rings
+// live in memory the two processes share. Recording an event is a
+// timestamp read and a handful of stores; nothing on the allocating
+// thread takes a lock, and it only makes a system call if its ring fills
+// up before the drain process gets to it.
+//
+// The drain is a process rather than a thread so that tracing never
+// starts a thread in the traced program: the first pthread_create moves
+// glibc's malloc onto its locked paths for good, which costs more than
+// recording does. It also means a trace survives the traced program
+// crashing, up to the last event it recorded.
+//
+// A trace file is a struct TraceFileHeader followed by the records in
+// the compact block format from tracecodec.h, which takes 4 to 8 bytes
+// an event instead of a struct TraceRecord's 40. Version 1 files were
+// the raw structs one after another; tracereader.h reads both.
+// Records from one thread are in order; records from different threads
+// are only roughly in order, so sort by timestamp if that matters.
+
+#define TRACE_MAGIC "MDTRACE1"
+#define TRACE_VERSION 2
+#define TRACE_VERSION_RAW 1
+
+enum TraceOp
+{
+    TRACE_MALLOC = 1,
+    TRACE_FREE = 2,
+};
+
+struct TraceFileHeader
+{
+    char Magic[8];
+    uint32_t Version;
+    uint32_t RecordSize;
+};
+
+struct TraceRecord
+{
+    // Nanoseconds since the trace started.
+    uint64_t Timestamp;
+    uint64_t Ptr;
+    // Bytes requested. Always 0 for frees.
+    uint64_t Size;
+    // The return address of the malloc or free call.
+    uint64_t CallSite;
+    uint32_t ThreadId;
+    uint8_t Op;
+    uint8_t Reserved[3];
+};
+
+// Starts tracing into path. Returns 0 on success and -1 (with errno set)
+// if the file or the drain process couldn't be created.
+int TraceStart(const char* path);
+
+// Drains everything that's been recorded, finishes the file and stops
+// tracing. Events recorded after this are ignored. Returns 0 on success
+// and -1 (with errno set) if the trace is incomplete: the file couldn't
+// grow or be trimmed (tracing stops as soon as that happens, and the
+// file keeps what made it in), more threads were alive at once than
+// there are rings for (ENOBUFS), or the drain process died (ECHILD).
+int TraceStop(void);
+
+// Set while a trace is running; the hooks below check it first so they
+// cost next to nothing otherwise.
+extern _Atomic int TraceEnabled;
+
+void TraceRecordEvent(enum TraceOp op, const void* ptr, size_t size, const void* callSite);
+
+static inline void TraceMalloc(const void* ptr, size_t size, const void* callSite)
+{
+    if (ptr != NULL && atomic_load_explicit(&TraceEnabled, memory_order_relaxed))
+    {
+        TraceRecordEvent(TRACE_MALLOC, ptr, size, callSite);
+    }
+}
+
+static inline void TraceFree(const void* ptr, const void* callSite)
+{
+    if (ptr != NULL && atomic_load_explicit(&TraceEnabled, memory_order_relaxed))
+    {
+        TraceRecordEvent(TRACE_FREE, ptr, 0, callSite);
+    }
+}
+
+// How many events were recorded by the last (or current) trace.
+uint64_t TraceEventCount(void);
+
+#endif
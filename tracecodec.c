@@ -0,0 +1,258 @@
+// The compact block format for allocation traces.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "tracecodec.h"
+
+#include <string.h>
+
+#include "sizeclass.h"
+
+#define TRACE_CONTEXTS (SIZE_CLASS_COUNT + 1)
+
+#define TAG_FREE 0x01
+#define TAG_SAME_CALL_SITE 0x02
+#define TAG_CONTEXT_SHIFT 2
+
+static inline uint64_t ZigZag(int64_t value)
+{
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+static inline int64_t UnZigZag(uint64_t value)
+{
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+static inline uint8_t* PutVarint(uint8_t* out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        *out++ = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t) value;
+    return out;
+}
+
+// Returns NULL if the varint runs past end or is longer than 10 bytes.
+static inline const uint8_t* GetVarint(const uint8_t* in, const uint8_t* end, uint64_t* value)
+{
+    // Nearly every field fits in a byte or two, so those get a fast path.
+    if (in < end && *in < 0x80)
+    {
+        *value = *in;
+        return in + 1;
+    }
+
+    uint64_t result = 0;
+    for (unsigned shift = 0; shift < 70 && in < end; shift += 7)
+    {
+        const uint8_t byte = *in++;
+        result |= (uint64_t) (byte & 0x7F) << shift;
+        if (byte < 0x80)
+        {
+            *value = result;
+            return in;
+        }
+    }
+    return NULL;
+}
+
+// The context whose last pointer is closest to ptr.
+static size_t NearestContext(const uint64_t* contexts, uint64_t ptr)
+{
+    size_t best = 0;
+    uint64_t bestDistance = UINT64_MAX;
+    for (size_t i = 0; i < TRACE_CONTEXTS; i++)
+    {
+        const uint64_t distance = ptr > contexts[i] ? ptr - contexts[i] : contexts[i] - ptr;
+        if (distance < bestDistance)
+        {
+            best = i;
+            bestDistance = distance;
+        }
+    }
+    return best;
+}
+
+size_t TraceEncodeBlock(const struct TraceRecord* records, size_t count, uint8_t* out)
+{
+    struct TraceBlockHeader header;
+    memset(&header, 0, sizeof(header));
+    header.Count = (uint32_t) count;
+    header.BaseTimestamp = count > 0 ? records[0].Timestamp : 0;
+    header.ThreadId = count > 0 ? records[0].ThreadId : 0;
+
+    uint64_t contexts[TRACE_CONTEXTS] = { 0 };
+    uint64_t timestamp = header.BaseTimestamp;
+    uint64_t callSite = 0;
+
+    uint8_t* p = out + sizeof(header);
+    for (size_t i = 0; i < count; i++)
+    {
+        const struct TraceRecord* record = &records[i];
+        const int isFree = record->Op == TRACE_FREE;
+        const size_t context = isFree ? NearestContext(contexts, record->Ptr) : SizeClassIndex(record->Size);
+
+        uint8_t tag = (uint8_t) (context << TAG_CONTEXT_SHIFT);
+        tag |= isFree ? TAG_FREE : 0;
+        tag |= record->CallSite == callSite ? TAG_SAME_CALL_SITE : 0;
+        *p++ = tag;
+
+        p = PutVarint(p, ZigZag((int64_t) (record->Timestamp - timestamp)));
+        timestamp = record->Timestamp;
+
+        if (!isFree)
+        {
+            p = PutVarint(p, record->Size);
+        }
+
+        p = PutVarint(p, ZigZag((int64_t) (record->Ptr - contexts[context])));
+        contexts[context] = record->Ptr;
+
+        if (record->CallSite != callSite)
+        {
+            p = PutVarint(p, ZigZag((int64_t) (record->CallSite - callSite)));
+            callSite = record->CallSite;
+        }
+    }
+
+    header.Bytes = (uint32_t) (p - out - sizeof(header));
+    memcpy(out, &header, sizeof(header));
+    return (size_t) (p - out);
+}
+
+// Decodes a varint that's known to have 10 readable bytes at in, so it
+// needs no bounds checks.
+static inline const uint8_t* GetVarintUnchecked(const uint8_t* in, uint64_t* value)
+{
+    uint64_t byte = *in++;
+    uint64_t result = byte & 0x7F;
+    for (unsigned shift = 7; byte >= 0x80 && shift < 70; shift += 7)
+    {
+        byte = *in++;
+        result |= (byte & 0x7F) << shift;
+    }
+    *value = result;
+    return in;
+}
+
+// What decoding a block has to carry from one event to the next.
+struct DecodeState
+{
+    uint64_t Contexts[TRACE_CONTEXTS];
+    uint64_t Timestamp;
+    uint64_t CallSite;
+    uint32_t ThreadId;
+};
+
+// Decodes one event at p into record. With checked set every varint is
+// bounds checked against end; without it the caller has to know a whole
+// event's worth of bytes is there. checked is always a constant, so each
+// caller gets its own copy with the other branch compiled out. Returns
+// where the next event starts, or NULL if this one is malformed.
+static inline __attribute__((always_inline)) const uint8_t* DecodeEvent(
+    const uint8_t* p, const uint8_t* end, int checked, struct DecodeState* state, struct TraceRecord* record)
+{
+    const uint8_t tag = *p++;
+    const size_t context = tag >> TAG_CONTEXT_SHIFT;
+    if (context >= TRACE_CONTEXTS)
+    {
+        return NULL;
+    }
+
+    uint64_t value;
+    if ((p = checked ? GetVarint(p, end, &value) : GetVarintUnchecked(p, &value)) == NULL)
+    {
+        return NULL;
+    }
+    state->Timestamp += (uint64_t) UnZigZag(value);
+
+    uint64_t size = 0;
+    if (!(tag & TAG_FREE) && (p = checked ? GetVarint(p, end, &size) : GetVarintUnchecked(p, &size)) == NULL)
+    {
+        return NULL;
+    }
+
+    if ((p = checked ? GetVarint(p, end, &value) : GetVarintUnchecked(p, &value)) == NULL)
+    {
+        return NULL;
+    }
+    state->Contexts[context] += (uint64_t) UnZigZag(value);
+
+    if (!(tag & TAG_SAME_CALL_SITE))
+    {
+        if ((p = checked ? GetVarint(p, end, &value) : GetVarintUnchecked(p, &value)) == NULL)
+        {
+            return NULL;
+        }
+        state->CallSite += (uint64_t) UnZigZag(value);
+    }
+
+    record->Timestamp = state->Timestamp;
+    record->Ptr = state->Contexts[context];
+    record->Size = size;
+    record->CallSite = state->CallSite;
+    record->ThreadId = state->ThreadId;
+    record->Op = (tag & TAG_FREE) ? TRACE_FREE : TRACE_MALLOC;
+    memset(record->Reserved, 0, sizeof(record->Reserved));
+    return p;
+}
+
+size_t TraceDecodeBlock(const uint8_t* block, size_t available, struct TraceRecord* out)
+{
+    struct TraceBlockHeader header;
+    if (available < sizeof(header))
+    {
+        return 0;
+    }
+    memcpy(&header, block, sizeof(header));
+    if (header.Count > TRACE_BLOCK_EVENTS || header.Bytes > available - sizeof(header))
+    {
+        return 0;
+    }
+
+    const uint8_t* p = block + sizeof(header);
+    const uint8_t* end = p + header.Bytes;
+
+    struct DecodeState state = { .Timestamp = header.BaseTimestamp, .ThreadId = header.ThreadId };
+
+    size_t i = 0;
+
+    // Nearly all of a block is far enough from its end that no event can
+    // run past it, and there we skip the bounds checks.
+    const uint8_t* safeEnd = header.Bytes > TRACE_EVENT_MAX_BYTES ? end - TRACE_EVENT_MAX_BYTES : p;
+    for (; i < header.Count && p < safeEnd; i++)
+    {
+        if ((p = DecodeEvent(p, end, 0, &state, &out[i])) == NULL)
+        {
+            return 0;
+        }
+    }
+
+    for (; i < header.Count; i++)
+    {
+        if (p >= end || (p = DecodeEvent(p, end, 1, &state, &out[i])) == NULL)
+        {
+            return 0;
+        }
+    }
+
+    return header.Count;
+}
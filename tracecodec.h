@@ -0,0 +1,77 @@
+// The compact block format for allocation traces.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef TRACECODEC_H
+#define TRACECODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "trace.h"
+
+// The compact on-disk form of trace records. A trace file is a struct
+// TraceFileHeader followed by blocks, each a struct TraceBlockHeader and
+// then its events. Every block holds events from one thread, in order,
+// and can be decoded without looking at any other block.
+//
+// An event is a tag byte and then varints:
+//
+//   tag        bit 0: free; bit 1: same call site as the previous event;
+//              bits 2-6: pointer context
+//   timestamp  zigzag delta from the previous event (the block's base
+//              timestamp for the first)
+//   size       mallocs only
+//   pointer    zigzag delta from the previous pointer in its context
+//   call site  zigzag delta from the previous call site, unless bit 1
+//
+// The pointer contexts are the size classes from sizeclass.h. A malloc
+// goes in the context of its size class, so consecutive blocks of the
+// same size (which allocators tend to put next to each other) differ by
+// a few bytes. A free doesn't know its size, so the encoder just picks
+// whichever context it's closest to and records that in the tag.
+
+struct TraceBlockHeader
+{
+    // Bytes of events after this header.
+    uint32_t Bytes;
+    uint32_t Count;
+    uint64_t BaseTimestamp;
+    uint32_t ThreadId;
+    uint32_t Reserved;
+};
+
+// Most events a block may hold.
+#define TRACE_BLOCK_EVENTS 4096
+
+// A tag and four 10-byte varints.
+#define TRACE_EVENT_MAX_BYTES 41
+
+#define TRACE_BLOCK_MAX_BYTES (sizeof(struct TraceBlockHeader) + TRACE_BLOCK_EVENTS * TRACE_EVENT_MAX_BYTES)
+
+// Encodes up to TRACE_BLOCK_EVENTS records, all from the same thread,
+// into out, which needs TRACE_BLOCK_MAX_BYTES of room. Returns the number
+// of bytes written, header included.
+size_t TraceEncodeBlock(const struct TraceRecord* records, size_t count, uint8_t* out);
+
+// Decodes the block at block into out, which needs room for
+// TRACE_BLOCK_EVENTS records. Returns the number of records, or 0 if the
+// block is cut off or corrupt.
+size_t TraceDecodeBlock(const uint8_t* block, size_t available, struct TraceRecord* out);
+
+#endif
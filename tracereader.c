@@ -0,0 +1,206 @@
+// Reading allocation trace files.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "tracereader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Version 1 files are one long array of records, which we split into
+// blocks of TRACE_BLOCK_EVENTS so they read just like the newer ones.
+static int IndexRawRecords(struct TraceReader* reader)
+{
+    const struct TraceRecord* records = (const struct TraceRecord*) (reader->Map + sizeof(struct TraceFileHeader));
+    const size_t available = (reader->MapSize - sizeof(struct TraceFileHeader)) / sizeof(struct TraceRecord);
+
+    size_t count = 0;
+    while (count < available && records[count].Op != 0)
+    {
+        count++;
+    }
+
+    const size_t blockCount = (count + TRACE_BLOCK_EVENTS - 1) / TRACE_BLOCK_EVENTS;
+    reader->BlockOffsets = (size_t*) malloc((blockCount + 1) * sizeof(size_t));
+    reader->BlockCounts = (uint32_t*) malloc((blockCount + 1) * sizeof(uint32_t));
+    if (reader->BlockOffsets == NULL || reader->BlockCounts == NULL)
+    {
+        return -1;
+    }
+
+    for (size_t i = 0; i < blockCount; i++)
+    {
+        const size_t first = i * TRACE_BLOCK_EVENTS;
+        reader->BlockOffsets[i] = sizeof(struct TraceFileHeader) + first * sizeof(struct TraceRecord);
+        reader->BlockCounts[i] = (uint32_t) (count - first < TRACE_BLOCK_EVENTS ? count - first : TRACE_BLOCK_EVENTS);
+    }
+
+    reader->BlockCount = blockCount;
+    reader->Count = count;
+    return 0;
+}
+
+// Hops from block header to block header; nothing gets decoded.
+static int IndexBlocks(struct TraceReader* reader)
+{
+    size_t capacity = 1024;
+    reader->BlockOffsets = (size_t*) malloc(capacity * sizeof(size_t));
+    reader->BlockCounts = (uint32_t*) malloc(capacity * sizeof(uint32_t));
+    if (reader->BlockOffsets == NULL || reader->BlockCounts == NULL)
+    {
+        return -1;
+    }
+
+    size_t offset = sizeof(struct TraceFileHeader);
+    while (reader->MapSize - offset >= sizeof(struct TraceBlockHeader))
+    {
+        struct TraceBlockHeader header;
+        memcpy(&header, reader->Map + offset, sizeof(header));
+        if (header.Count == 0 || header.Count > TRACE_BLOCK_EVENTS
+            || header.Bytes > reader->MapSize - offset - sizeof(header))
+        {
+            break;
+        }
+
+        if (reader->BlockCount == capacity)
+        {
+            capacity *= 2;
+            size_t* offsets = (size_t*) realloc(reader->BlockOffsets, capacity * sizeof(size_t));
+            if (offsets == NULL)
+            {
+                return -1;
+            }
+            reader->BlockOffsets = offsets;
+
+            uint32_t* counts = (uint32_t*) realloc(reader->BlockCounts, capacity * sizeof(uint32_t));
+            if (counts == NULL)
+            {
+                return -1;
+            }
+            reader->BlockCounts = counts;
+        }
+
+        reader->BlockOffsets[reader->BlockCount] = offset;
+        reader->BlockCounts[reader->BlockCount] = header.Count;
+        reader->BlockCount++;
+        reader->Count += header.Count;
+        offset += sizeof(header) + header.Bytes;
+    }
+    return 0;
+}
+
+int TraceReaderOpen(struct TraceReader* reader, const char* path)
+{
+    memset(reader, 0, sizeof(*reader));
+
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    const size_t size = (size_t) st.st_size;
+    if (size < sizeof(struct TraceFileHeader))
+    {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    const struct TraceFileHeader* header = (const struct TraceFileHeader*) map;
+    if (memcmp(header->Magic, TRACE_MAGIC, sizeof(header->Magic)) != 0
+        || (header->Version != TRACE_VERSION && header->Version != TRACE_VERSION_RAW)
+        || header->RecordSize != sizeof(struct TraceRecord))
+    {
+        munmap(map, size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Readers mostly walk forwards through a trace.
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    reader->Map = (const uint8_t*) map;
+    reader->MapSize = size;
+    reader->Version = header->Version;
+
+    const int result = reader->Version == TRACE_VERSION_RAW ? IndexRawRecords(reader) : IndexBlocks(reader);
+    if (result != 0)
+    {
+        TraceReaderClose(reader);
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+size_t TraceReaderDecodeBlock(const struct TraceReader* reader, size_t index, struct TraceRecord* out)
+{
+    if (index >= reader->BlockCount)
+    {
+        return 0;
+    }
+
+    const uint8_t* block = reader->Map + reader->BlockOffsets[index];
+    if (reader->Version == TRACE_VERSION_RAW)
+    {
+        memcpy(out, block, reader->BlockCounts[index] * sizeof(struct TraceRecord));
+        return reader->BlockCounts[index];
+    }
+
+    return TraceDecodeBlock(block, reader->MapSize - reader->BlockOffsets[index], out);
+}
+
+size_t TraceReaderNext(struct TraceReader* reader, struct TraceRecord* out)
+{
+    if (reader->NextBlock >= reader->BlockCount)
+    {
+        return 0;
+    }
+    return TraceReaderDecodeBlock(reader, reader->NextBlock++, out);
+}
+
+void TraceReaderClose(struct TraceReader* reader)
+{
+    if (reader->Map != NULL)
+    {
+        munmap((void*) reader->Map, reader->MapSize);
+    }
+    free(reader->BlockOffsets);
+    free(reader->BlockCounts);
+    memset(reader, 0, sizeof(*reader));
+}
@@ -0,0 +1,74 @@
+// Reading allocation trace files.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef TRACEREADER_H
+#define TRACEREADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "trace.h"
+#include "tracecodec.h"
+
+// Read access to a trace file written by trace.c. The file is mapped
+// rather than read in, so opening even a huge trace is cheap and the
+// events are only paged in and decoded as they're asked for.
+//
+// Events come out a block at a time (see tracecodec.h). Blocks decode
+// independently, so they can be handed out to several threads; or just
+// call TraceReaderNext until it returns 0 to stream through the file.
+struct TraceReader
+{
+    // Total events in the trace.
+    size_t Count;
+    size_t BlockCount;
+
+    const uint8_t* Map;
+    size_t MapSize;
+    uint32_t Version;
+
+    // Where each block starts in the file, and how many events it holds.
+    size_t* BlockOffsets;
+    uint32_t* BlockCounts;
+
+    // Where TraceReaderNext is up to.
+    size_t NextBlock;
+};
+
+// Maps the trace at path and finds its blocks. Returns 0 on success and
+// -1 with errno set if the file couldn't be opened or mapped, or EINVAL
+// if it isn't a trace.
+//
+// A program that died mid-trace leaves the rest of the file zeroed, so
+// the trace ends at the first empty block (or record, in a version 1
+// file) or the first block that's cut off.
+int TraceReaderOpen(struct TraceReader* reader, const char* path);
+
+// Decodes block index into out, which needs room for TRACE_BLOCK_EVENTS
+// records. Returns how many records it decoded. Safe to call from several
+// threads at once.
+size_t TraceReaderDecodeBlock(const struct TraceReader* reader, size_t index, struct TraceRecord* out);
+
+// Decodes the next block into out, which needs room for TRACE_BLOCK_EVENTS
+// records. Returns how many records it decoded, or 0 at the end.
+size_t TraceReaderNext(struct TraceReader* reader, struct TraceRecord* out);
+
+void TraceReaderClose(struct TraceReader* reader);
+
+#endif
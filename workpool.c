@@ -0,0 +1,263 @@
+// A work-stealing thread pool.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "workpool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// A worker's remaining task numbers, [Begin, End), packed into one word so
+// the owner and thieves can both update it with a single compare-and-swap.
+struct WorkRange
+{
+    _Alignas(64) _Atomic uint64_t Range;
+};
+
+#define RANGE(begin, end) (((uint64_t) (begin) << 32) | (uint64_t) (end))
+#define RANGE_BEGIN(range) ((uint32_t) ((range) >> 32))
+#define RANGE_END(range) ((uint32_t) (range))
+
+struct WorkPool
+{
+    size_t Workers;
+    pthread_t* Threads;
+    struct WorkRange* Ranges;
+
+    // The batch being run. Generation goes up by one for each batch, which
+    // is what wakes the workers.
+    pthread_mutex_t Lock;
+    pthread_cond_t Wake;
+    pthread_cond_t Done;
+    uint64_t Generation;
+    size_t Running;
+    int Stopping;
+
+    void (*Task)(void* context, size_t index, size_t worker);
+    void* Context;
+};
+
+struct WorkerStart
+{
+    struct WorkPool* Pool;
+    size_t Worker;
+};
+
+// Takes the next task number from the front of our own range.
+static int TakeOwn(struct WorkRange* own, uint32_t* index)
+{
+    uint64_t range = atomic_load_explicit(&own->Range, memory_order_acquire);
+    while (RANGE_BEGIN(range) < RANGE_END(range))
+    {
+        if (atomic_compare_exchange_weak_explicit(&own->Range, &range,
+                                                  RANGE(RANGE_BEGIN(range) + 1, RANGE_END(range)),
+                                                  memory_order_acq_rel, memory_order_acquire))
+        {
+            *index = RANGE_BEGIN(range);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Steals the back half of someone else's range into our own (which is
+// empty, so only thieves could be looking at it, and they leave empty
+// ranges alone).
+static int Steal(struct WorkPool* pool, size_t worker)
+{
+    for (size_t i = 1; i < pool->Workers; i++)
+    {
+        struct WorkRange* victim = &pool->Ranges[(worker + i) % pool->Workers];
+        uint64_t range = atomic_load_explicit(&victim->Range, memory_order_acquire);
+        while (RANGE_BEGIN(range) < RANGE_END(range))
+        {
+            const uint32_t begin = RANGE_BEGIN(range);
+            const uint32_t end = RANGE_END(range);
+            const uint32_t split = end - (end - begin + 1) / 2;
+            if (atomic_compare_exchange_weak_explicit(&victim->Range, &range, RANGE(begin, split),
+                                                      memory_order_acq_rel, memory_order_acquire))
+            {
+                atomic_store_explicit(&pool->Ranges[worker].Range, RANGE(split, end), memory_order_release);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void Work(struct WorkPool* pool, size_t worker)
+{
+    struct WorkRange* own = &pool->Ranges[worker];
+    for (;;)
+    {
+        uint32_t index;
+        if (TakeOwn(own, &index))
+        {
+            pool->Task(pool->Context, index, worker);
+        }
+        else if (!Steal(pool, worker))
+        {
+            // Every range is empty. Tasks still running elsewhere can't make
+            // new ones, so we're done.
+            return;
+        }
+    }
+}
+
+static void* WorkerMain(void* arg)
+{
+    struct WorkerStart start = *(struct WorkerStart*) arg;
+    free(arg);
+    struct WorkPool* pool = start.Pool;
+
+    uint64_t seen = 0;
+    pthread_mutex_lock(&pool->Lock);
+    for (;;)
+    {
+        while (pool->Generation == seen && !pool->Stopping)
+        {
+            pthread_cond_wait(&pool->Wake, &pool->Lock);
+        }
+        if (pool->Stopping)
+        {
+            break;
+        }
+        seen = pool->Generation;
+        pthread_mutex_unlock(&pool->Lock);
+
+        Work(pool, start.Worker);
+
+        pthread_mutex_lock(&pool->Lock);
+        if (--pool->Running == 0)
+        {
+            pthread_cond_signal(&pool->Done);
+        }
+    }
+    pthread_mutex_unlock(&pool->Lock);
+    return NULL;
+}
+
+struct WorkPool* WorkPoolCreate(size_t workers)
+{
+    if (workers == 0)
+    {
+        const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cores > 0 ? (size_t) cores : 1;
+    }
+
+    struct WorkPool* pool = (struct WorkPool*) calloc(1, sizeof(struct WorkPool));
+    if (pool == NULL)
+    {
+        return NULL;
+    }
+
+    pool->Workers = workers;
+    pool->Threads = (pthread_t*) calloc(workers, sizeof(pthread_t));
+    pool->Ranges = (struct WorkRange*) aligned_alloc(64, workers * sizeof(struct WorkRange));
+    if (pool->Threads == NULL || pool->Ranges == NULL)
+    {
+        free(pool->Threads);
+        free(pool->Ranges);
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->Lock, NULL);
+    pthread_cond_init(&pool->Wake, NULL);
+    pthread_cond_init(&pool->Done, NULL);
+
+    // Worker 0 is whoever calls WorkPoolRun.
+    for (size_t i = 1; i < workers; i++)
+    {
+        struct WorkerStart* start = (struct WorkerStart*) malloc(sizeof(struct WorkerStart));
+        if (start == NULL)
+        {
+            pool->Workers = i;
+            WorkPoolDestroy(pool);
+            return NULL;
+        }
+
+        start->Pool = pool;
+        start->Worker = i;
+        if (pthread_create(&pool->Threads[i], NULL, WorkerMain, start) != 0)
+        {
+            free(start);
+            pool->Workers = i;
+            WorkPoolDestroy(pool);
+            return NULL;
+        }
+    }
+
+    return pool;
+}
+
+size_t WorkPoolWorkers(const struct WorkPool* pool)
+{
+    return pool->Workers;
+}
+
+void WorkPoolRun(struct WorkPool* pool, size_t count,
+                 void (*task)(void* context, size_t index, size_t worker), void* context)
+{
+    for (size_t i = 0; i < pool->Workers; i++)
+    {
+        const size_t begin = count * i / pool->Workers;
+        const size_t end = count * (i + 1) / pool->Workers;
+        atomic_store_explicit(&pool->Ranges[i].Range, RANGE(begin, end), memory_order_relaxed);
+    }
+
+    pthread_mutex_lock(&pool->Lock);
+    pool->Task = task;
+    pool->Context = context;
+    pool->Running = pool->Workers - 1;
+    pool->Generation++;
+    pthread_cond_broadcast(&pool->Wake);
+    pthread_mutex_unlock(&pool->Lock);
+
+    Work(pool, 0);
+
+    pthread_mutex_lock(&pool->Lock);
+    while (pool->Running > 0)
+    {
+        pthread_cond_wait(&pool->Done, &pool->Lock);
+    }
+    pthread_mutex_unlock(&pool->Lock);
+}
+
+void WorkPoolDestroy(struct WorkPool* pool)
+{
+    pthread_mutex_lock(&pool->Lock);
+    pool->Stopping = 1;
+    pthread_cond_broadcast(&pool->Wake);
+    pthread_mutex_unlock(&pool->Lock);
+
+    for (size_t i = 1; i < pool->Workers; i++)
+    {
+        pthread_join(pool->Threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->Lock);
+    pthread_cond_destroy(&pool->Wake);
+    pthread_cond_destroy(&pool->Done);
+    free(pool->Threads);
+    free(pool->Ranges);
+    free(pool);
+}
@@ -0,0 +1,47 @@
+// A work-stealing thread pool.
+//
+// Copyright 2023  Anthony Webster
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+// associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial
+// portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+// LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <stddef.h>
+
+// A fixed set of worker threads for running a batch of numbered tasks.
+// Each worker starts out with an equal, contiguous share of the task
+// numbers and takes them from the front. A worker that runs out steals
+// the back half of another worker's share, so a few slow tasks don't
+// leave everyone else idle. The thread that calls WorkPoolRun works too.
+struct WorkPool;
+
+// Starts workers threads, counting the caller. 0 means one per core.
+// Returns NULL if the threads couldn't be created.
+struct WorkPool* WorkPoolCreate(size_t workers);
+
+size_t WorkPoolWorkers(const struct WorkPool* pool);
+
+// Calls task(context, index, worker) once for every index in [0, count)
+// and returns once they've all finished. worker is in [0, workers) and no
+// two tasks with the same worker run at once, so tasks can keep per-worker
+// state without locking.
+void WorkPoolRun(struct WorkPool* pool, size_t count,
+                 void (*task)(void* context, size_t index, size_t worker), void* context);
+
+void WorkPoolDestroy(struct WorkPool* pool);
+
+#endif